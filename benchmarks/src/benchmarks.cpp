@@ -0,0 +1,645 @@
+#include <algorithm>   // for max
+#include <atomic>      // for atomic
+#include <chrono>      // for steady_clock, duration
+#include <cstdlib>     // for malloc, free
+#include <filesystem>  // for temp_directory_path
+#include <fstream>     // for ofstream
+#include <iomanip>     // for setw
+#include <iostream>    // for cout, ostream
+#include <new>         // for bad_alloc
+#include <optional>    // for optional
+#include <streambuf>   // for streambuf
+#include <string>      // for string
+#include <string_view> // for string_view
+#include <thread>      // for thread
+#include <vector>      // for vector
+
+#include "ast.hh"    // for Engine
+#include "driver.hh" // for Driver
+#include "input.hh"  // for Input
+#include "ir.hh"     // for opName
+#include "output.hh" // for Output
+#include "simd.hh"   // for kernel, supportedIsa
+
+namespace
+{
+
+std::atomic<size_t> allocations{0};
+
+class NullBuffer final : public std::streambuf
+{
+  protected:
+    int overflow(int ch) override { return ch; }
+
+    std::streamsize xsputn([[maybe_unused]] const char* s,
+                           std::streamsize n) override
+    {
+        return n;
+    }
+};
+
+// Notes when the first output arrives.
+class FirstWriteBuffer final : public std::streambuf
+{
+  public:
+    std::optional<std::chrono::steady_clock::time_point> first;
+
+  protected:
+    int overflow(int ch) override
+    {
+        note();
+        return ch;
+    }
+
+    std::streamsize xsputn([[maybe_unused]] const char* s,
+                           std::streamsize n) override
+    {
+        note();
+        return n;
+    }
+
+  private:
+    void note()
+    {
+        if (!first)
+            first = std::chrono::steady_clock::now();
+    }
+};
+
+struct Case
+{
+    std::string name;
+    AST::Engine engine;
+    int optLevel = 1;
+};
+
+const char* engineName(AST::Engine engine)
+{
+    switch (engine)
+    {
+        case AST::Engine::VM:
+            return "vm";
+        case AST::Engine::FLAT:
+            return "flat";
+        case AST::Engine::IR:
+            return "ir";
+        case AST::Engine::INTERPRETER:
+        default:
+            return "interpreter";
+    }
+}
+
+// Best of a few runs, each on a freshly parsed program.
+void run(const Case& bench, int repeats = 3)
+{
+    NullBuffer buffer;
+    std::ostream out(&buffer);
+
+    double best = 0;
+    size_t allocs = 0;
+
+    for (int id = 0; id < repeats; ++id)
+    {
+        Driver drv(out);
+
+        drv.setOptLevel(bench.optLevel);
+        drv.parse(std::string(BENCH_DATA_DIR) + "data/" + bench.name + ".dat");
+
+        const size_t allocsBefore = allocations.load();
+        const auto start = std::chrono::steady_clock::now();
+
+        drv.eval(bench.engine);
+
+        const auto finish = std::chrono::steady_clock::now();
+        allocs = allocations.load() - allocsBefore;
+
+        const std::chrono::duration<double, std::milli> elapsed = finish - start;
+
+        if (id == 0 || elapsed.count() < best)
+            best = elapsed.count();
+    }
+
+    const std::string engine = std::string(engineName(bench.engine)) + " -O" +
+                               std::to_string(bench.optLevel);
+
+    std::cout << std::left << std::setw(20) << bench.name << std::setw(16)
+              << engine << std::right << std::setw(10)
+              << std::fixed << std::setprecision(1) << best << " ms"
+              << std::setw(12) << allocs << " allocs\n";
+}
+
+// Machine-generated script: many small statements and a few hundred names,
+// each assigned before it is read, so that it runs as well.
+std::string writeParseInput(size_t statements)
+{
+    const auto path =
+        std::filesystem::temp_directory_path() / "paracl_bench_parse.dat";
+
+    std::ofstream os(path);
+
+    os << "v0 = 1;\n";
+
+    for (size_t id = 0; id < statements; ++id)
+    {
+        const size_t var = id % 256;
+
+        os << "v" << var << " = v" << var / 2 << " * " << id % 7 << " + "
+           << id << ";\n";
+
+        if (id % 16 == 0)
+            os << "if (v" << var << " > 3) { print v" << var << "; }\n";
+    }
+
+    return path.string();
+}
+
+// Both front ends on the same script.
+void runParse(size_t statements)
+{
+    const std::string file = writeParseInput(statements);
+
+    NullBuffer buffer;
+    std::ostream out(&buffer);
+
+    for (const AST::Frontend frontend :
+         {AST::Frontend::BISON, AST::Frontend::DESCENT})
+    {
+        const size_t allocsBefore = allocations.load();
+        const auto start = std::chrono::steady_clock::now();
+
+        size_t arenaBytes = 0;
+
+        {
+            Driver drv(out);
+
+            drv.setFrontend(frontend);
+            drv.parse(file);
+            arenaBytes = drv.arena().bytesUsed();
+        }
+
+        const auto finish = std::chrono::steady_clock::now();
+        const size_t allocs = allocations.load() - allocsBefore;
+
+        const std::chrono::duration<double, std::milli> elapsed =
+            finish - start;
+
+        const char* name = frontend == AST::Frontend::BISON ? "parse bison"
+                                                            : "parse descent";
+
+        std::cout << std::left << std::setw(20) << name << std::setw(16)
+                  << statements << std::right << std::setw(10) << std::fixed
+                  << std::setprecision(1) << elapsed.count() << " ms"
+                  << std::setw(12) << allocs << " allocs" << std::setw(12)
+                  << arenaBytes << " arena bytes\n";
+    }
+
+    std::filesystem::remove(file);
+}
+
+// Time to the first output and to the end of a long script, parsed whole
+// and then run, or run as it is parsed.
+void runStream(size_t statements)
+{
+    const std::string file = writeParseInput(statements);
+
+    for (const bool stream : {false, true})
+    {
+        FirstWriteBuffer buffer;
+        std::ostream out(&buffer);
+
+        const auto start = std::chrono::steady_clock::now();
+
+        {
+            Driver drv(out);
+
+            if (stream)
+                drv.stream(file);
+            else
+            {
+                drv.parse(file);
+                drv.eval();
+            }
+        }
+
+        const auto finish = std::chrono::steady_clock::now();
+
+        const std::chrono::duration<double, std::milli> first =
+            buffer.first.value_or(finish) - start;
+        const std::chrono::duration<double, std::milli> total = finish - start;
+
+        std::cout << std::left << std::setw(20)
+                  << (stream ? "stream" : "parse, then run") << std::setw(16)
+                  << statements << std::right << std::setw(10) << std::fixed
+                  << std::setprecision(1) << first.count() << " ms first"
+                  << std::setw(10) << total.count() << " ms total\n";
+    }
+
+    std::filesystem::remove(file);
+}
+
+// A fill of count elements as a pfor loop and as a while loop planned by
+// --auto-parallel, on 1, 2, 4, ... threads up to the hardware threads.
+void runScaling(size_t count, int repeats = 3)
+{
+    const auto path =
+        std::filesystem::temp_directory_path() / "paracl_bench_scaling.dat";
+
+    NullBuffer buffer;
+    std::ostream out(&buffer);
+
+    const unsigned hardware = std::max(1U, std::thread::hardware_concurrency());
+
+    for (const bool pfor : {true, false})
+    {
+        {
+            std::ofstream os(path);
+
+            // The element reads i, so no idiom kernel takes the loop over.
+            os << "n = " << count << ";\na = repeat(0, n);\n";
+
+            if (pfor)
+                os << "pfor (i = 0; i < n) a[i] = i * 3 + 1;\n";
+            else
+                os << "i = 0;\n"
+                   << "while (i < n) { a[i] = i * 3 + 1; i = i + 1; }\n";
+
+            os << "print a[n - 1];\n";
+        }
+
+        double single = 0;
+
+        for (unsigned threads = 1; threads <= hardware; threads *= 2)
+        {
+            double best = 0;
+
+            for (int id = 0; id < repeats; ++id)
+            {
+                Driver drv(out);
+
+                drv.setThreads(threads);
+                drv.setAutoParallel(true);
+                drv.parse(path.string());
+
+                const auto start = std::chrono::steady_clock::now();
+
+                drv.eval();
+
+                const auto finish = std::chrono::steady_clock::now();
+
+                const std::chrono::duration<double, std::milli> elapsed =
+                    finish - start;
+
+                if (id == 0 || elapsed.count() < best)
+                    best = elapsed.count();
+            }
+
+            if (threads == 1)
+                single = best;
+
+            const std::string name = std::string(pfor ? "pfor" : "while") +
+                                     " x" + std::to_string(threads);
+
+            std::cout << std::left << std::setw(20) << name << std::setw(16)
+                      << count << std::right << std::setw(10) << std::fixed
+                      << std::setprecision(1) << best << " ms" << std::setw(8)
+                      << std::setprecision(2) << single / best << "x\n";
+        }
+    }
+
+    std::filesystem::remove(path);
+}
+
+// Startup of a long script: parsing it with no cache, parsing and storing
+// it in an empty one, and loading it from there. At -O0, so that no run
+// folds the tree.
+void runCache(size_t statements, int repeats = 3)
+{
+    const std::string file = writeParseInput(statements);
+    const auto dir =
+        std::filesystem::temp_directory_path() / "paracl_bench_cache";
+
+    std::filesystem::remove_all(dir);
+
+    for (const char* name : {"no cache", "cold cache", "warm cache"})
+    {
+        const std::string_view kind = name;
+
+        double best = 0;
+
+        for (int id = 0; id < repeats; ++id)
+        {
+            if (kind == "cold cache")
+                std::filesystem::remove_all(dir);
+
+            const auto start = std::chrono::steady_clock::now();
+
+            {
+                Driver drv;
+
+                drv.setOptLevel(0);
+
+                if (kind != "no cache")
+                    drv.setCacheDir(dir.string());
+
+                drv.parse(file);
+            }
+
+            const auto finish = std::chrono::steady_clock::now();
+
+            const std::chrono::duration<double, std::milli> elapsed =
+                finish - start;
+
+            if (id == 0 || elapsed.count() < best)
+                best = elapsed.count();
+        }
+
+        std::cout << std::left << std::setw(20) << name << std::setw(16)
+                  << statements << std::right << std::setw(10) << std::fixed
+                  << std::setprecision(1) << best << " ms\n";
+    }
+
+    size_t bytes = 0;
+
+    for (const auto& entry : std::filesystem::directory_iterator(dir))
+        bytes += static_cast<size_t>(entry.file_size());
+
+    std::cout << std::left << std::setw(20) << "cache file" << std::setw(16)
+              << statements << std::right << std::setw(10) << bytes
+              << " bytes, source " << std::filesystem::file_size(file)
+              << " bytes\n";
+
+    std::filesystem::remove_all(dir);
+    std::filesystem::remove(file);
+}
+
+// Scanning alone, in megabytes of source a second.
+void runLex(size_t statements, int repeats = 3)
+{
+    const std::string file = writeParseInput(statements);
+    const double megabytes =
+        static_cast<double>(std::filesystem::file_size(file)) / 1e6;
+
+    double best = 0;
+    size_t allocs = 0;
+    size_t tokens = 0;
+
+    for (int id = 0; id < repeats; ++id)
+    {
+        Driver drv;
+
+        const size_t allocsBefore = allocations.load();
+        const auto start = std::chrono::steady_clock::now();
+
+        tokens = drv.tokenize(file);
+
+        const auto finish = std::chrono::steady_clock::now();
+        allocs = allocations.load() - allocsBefore;
+
+        const std::chrono::duration<double> elapsed = finish - start;
+
+        if (id == 0 || elapsed.count() < best)
+            best = elapsed.count();
+    }
+
+    std::cout << std::left << std::setw(20) << "lex" << std::setw(16)
+              << tokens << std::right << std::setw(10) << std::fixed
+              << std::setprecision(1) << best * 1000 << " ms" << std::setw(12)
+              << megabytes / best << " MB/s" << std::setw(12) << allocs
+              << " allocs\n";
+
+    std::filesystem::remove(file);
+}
+
+// Elementwise kernels over a million elements in every instruction set the
+// processor supports.
+void runKernels(size_t count, int repeats = 20)
+{
+    using AST::detail::Broadcast;
+    using AST::detail::Isa;
+
+    std::vector<int> left(count);
+    std::vector<int> right(count);
+    std::vector<int> out(count);
+
+    for (size_t id = 0; id < count; ++id)
+    {
+        left[id] = static_cast<int>(id % 1000);
+        right[id] = static_cast<int>(id % 7) + 1;
+    }
+
+    for (auto op : {AST::BinaryOp::ADD, AST::BinaryOp::MUL, AST::BinaryOp::LS,
+                    AST::BinaryOp::DIV})
+        for (int isa = 0; isa <= static_cast<int>(AST::detail::supportedIsa());
+             ++isa)
+        {
+            const auto kernel =
+                AST::detail::kernel(op, Broadcast::NONE, static_cast<Isa>(isa));
+            double best = 0;
+
+            for (int id = 0; id < repeats; ++id)
+            {
+                const auto start = std::chrono::steady_clock::now();
+
+                kernel(left.data(), right.data(), out.data(), count);
+
+                const auto finish = std::chrono::steady_clock::now();
+                const std::chrono::duration<double, std::milli> elapsed =
+                    finish - start;
+
+                if (id == 0 || elapsed.count() < best)
+                    best = elapsed.count();
+            }
+
+            const std::string name =
+                std::string("kernel ") + AST::detail::ir::opName(op);
+
+            std::cout << std::left << std::setw(20) << name << std::setw(16)
+                      << AST::detail::isaName(static_cast<Isa>(isa))
+                      << std::right << std::setw(10) << std::fixed
+                      << std::setprecision(2) << best << " ms\n";
+        }
+}
+
+// Output throughput of print: the iostream formatting engines used to do
+// and the buffered sink they write to now, both into a file.
+void runOutput(int count)
+{
+    const auto path =
+        std::filesystem::temp_directory_path() / "paracl_bench_output.txt";
+
+    const auto measure = [&](const char* name, auto&& print)
+    {
+        std::ofstream os(path, std::ios::binary | std::ios::trunc);
+
+        const auto start = std::chrono::steady_clock::now();
+
+        print(os);
+        os.flush();
+
+        const auto finish = std::chrono::steady_clock::now();
+        const std::chrono::duration<double> elapsed = finish - start;
+        const double megabytes =
+            static_cast<double>(std::filesystem::file_size(path)) / 1e6;
+
+        std::cout << std::left << std::setw(20) << "output" << std::setw(16)
+                  << name << std::right << std::setw(10) << std::fixed
+                  << std::setprecision(1) << elapsed.count() * 1000 << " ms"
+                  << std::setw(12) << megabytes / elapsed.count() << " MB/s\n";
+    };
+
+    measure("ostream", [count](std::ostream& os)
+    {
+        for (int id = 0; id < count; ++id)
+            os << id % 1000 * 7919 - id << '\n';
+    });
+
+    measure("buffered", [count](std::ostream& os)
+    {
+        AST::detail::Output out(os);
+
+        for (int id = 0; id < count; ++id)
+            out.print(id % 1000 * 7919 - id);
+    });
+
+    std::filesystem::remove(path);
+}
+
+// Integers a second read through ifstream and through Input.
+void runInput(int count)
+{
+    const auto path =
+        std::filesystem::temp_directory_path() / "paracl_bench_input.txt";
+
+    {
+        std::ofstream os(path);
+
+        for (int id = 0; id < count; ++id)
+            os << id % 1000 * 7919 - id << (id % 8 ? ' ' : '\n');
+    }
+
+    const auto measure = [count](const char* name, auto&& read)
+    {
+        const auto start = std::chrono::steady_clock::now();
+
+        read();
+
+        const auto finish = std::chrono::steady_clock::now();
+        const std::chrono::duration<double> elapsed = finish - start;
+
+        std::cout << std::left << std::setw(20) << "input" << std::setw(16)
+                  << name << std::right << std::setw(10) << std::fixed
+                  << std::setprecision(1) << elapsed.count() * 1000 << " ms"
+                  << std::setw(12) << count / elapsed.count() / 1e6
+                  << " M ints/s\n";
+    };
+
+    measure("ifstream", [&]
+    {
+        std::ifstream is(path);
+        int value = 0;
+
+        while (is >> value)
+            continue;
+    });
+
+    measure("buffered", [&]
+    {
+        NullBuffer buffer;
+        std::ostream os(&buffer);
+        AST::detail::Output out(os);
+
+        const auto input = AST::detail::Input::open(path.string());
+
+        for (int id = 0; id < count; ++id)
+            input->read(out);
+    });
+
+    std::filesystem::remove(path);
+}
+
+} // namespace
+
+void* operator new(std::size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+
+    if (void* ptr = std::malloc(size ? size : 1))
+        return ptr;
+
+    throw std::bad_alloc();
+}
+
+// GCC cannot see through the replaced allocation functions.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+
+void operator delete(void* ptr, [[maybe_unused]] std::size_t size) noexcept
+{
+    std::free(ptr);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+int main(int argc, char** argv)
+{
+    std::string_view filter = argc > 1 ? argv[1] : "";
+
+    const std::vector<std::string> programs = {
+        "scalar_loop",
+        "array_fill_sum",
+        "nested_loops",
+        "matrix_fill_sum",
+        "array_assign",
+        "nested_invariants",
+        "strided_index",
+        "repeated_reads",
+        "elementwise_ops",
+        "elementwise_loop",
+        "loop_idioms",
+        "print_heavy",
+    };
+
+    for (const auto& program : programs)
+    {
+        if (program.find(filter) == std::string::npos)
+            continue;
+
+        for (auto engine :
+             {AST::Engine::INTERPRETER, AST::Engine::FLAT, AST::Engine::VM,
+              AST::Engine::IR})
+            for (int optLevel : {1, 2})
+                run({program, engine, optLevel});
+    }
+
+    if (std::string_view("parse").find(filter) != std::string_view::npos)
+        runParse(200000);
+
+    if (std::string_view("stream").find(filter) != std::string_view::npos)
+        runStream(200000);
+
+    if (std::string_view("scaling").find(filter) != std::string_view::npos)
+        runScaling(100000000);
+
+    if (std::string_view("cache").find(filter) != std::string_view::npos)
+        runCache(200000);
+
+    if (std::string_view("lex").find(filter) != std::string_view::npos)
+        runLex(1000000);
+
+    if (std::string_view("kernel").find(filter) != std::string_view::npos)
+        runKernels(1000000);
+
+    if (std::string_view("output").find(filter) != std::string_view::npos)
+        runOutput(10000000);
+
+    if (std::string_view("input").find(filter) != std::string_view::npos)
+        runInput(10000000);
+
+    return 0;
+}
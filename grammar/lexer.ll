@@ -1,11 +1,11 @@
 
 %{ /* -*- C++ -*- */
 
-# include <cerrno>
-# include <climits>
-# include <cstdlib>
-# include <cstring>
+# include <charconv>
+# include <stdexcept>
 # include <string>
+# include <string_view>
+# include <system_error>
 
 # include "driver.hh"
 # include "parser.hh"
@@ -16,7 +16,7 @@
 
 %{
 	yy::parser::symbol_type
-	make_NUMBER (const std::string &s, const yy::parser::location_type& loc);
+	make_NUMBER (std::string_view s, const yy::parser::location_type& loc);
 %}
 
 ID		[a-zA-Z][a-zA-Z_0-9]*
@@ -55,6 +55,7 @@ BLANK 	[ \t\r]
 "else"		return yy::parser::make_ELSE		(loc);
 "else if"	return yy::parser::make_ELSEIF		(loc);
 "while"		return yy::parser::make_WHILE		(loc);
+"pfor"		return yy::parser::make_PFOR		(loc);
 ">"			return yy::parser::make_GREATER		(loc);
 "<"			return yy::parser::make_LESS		(loc);
 ">="		return yy::parser::make_GREATER_E	(loc);
@@ -73,8 +74,11 @@ BLANK 	[ \t\r]
 ","			return yy::parser::make_COMMA		(loc);
 
 
-{INT}		return make_NUMBER (yytext, loc);
-{ID}		return yy::parser::make_ID (yytext, loc);
+{INT}		return make_NUMBER (std::string_view (yytext, yyleng), loc);
+{ID}		{
+				return yy::parser::make_ID
+				(drv.intern (std::string_view (yytext, yyleng)), loc);
+			}
 
 .			{
 				throw yy::parser::syntax_error
@@ -86,14 +90,55 @@ BLANK 	[ \t\r]
 %%
 
 yy::parser::symbol_type
-make_NUMBER (const std::string &s, const yy::parser::location_type& loc)
+make_NUMBER (std::string_view s, const yy::parser::location_type& loc)
+{
+	int num = 0;
+	const auto [ptr, ec] = std::from_chars (s.data (), s.data () + s.size (), num);
+
+	if (ec != std::errc ())
+		throw yy::parser::syntax_error
+		(loc, "integer is out of range: " + std::string (s));
+
+	return yy::parser::make_NUMBER (num, loc);
+}
+
+void
+Driver::scanBegin ()
 {
-	long num = strtol (s.c_str(), NULL, 10);
+	yy_flex_debug = YY_FLEX_DEBUG;
 
-	if (! (INT_MIN <= num && num <= INT_MAX && errno != ERANGE))
-		throw yy::parser::syntax_error (loc, "integer is out of range: " + s);
+	scanEnd ();
 
-	return yy::parser::make_NUMBER (static_cast<int>(num), loc);
+	if (file_.empty ())
+	{
+		yyin = stdin;
+		yyrestart (yyin);
+
+		// Statements of a streamed script run as their lines come in,
+		// not once a whole block of it is read.
+		if (streaming_)
+			yy_set_interactive (1);
+
+		return;
+	}
+
+	source_.open (file_);
+	buffer_ = yy_scan_buffer (source_.data (), source_.size () + 2);
+
+	// flex would go on reading yyin instead.
+	if (!buffer_)
+	{
+		source_.close ();
+		throw std::runtime_error ("Can't scan input file_\n");
+	}
 }
 
+void
+Driver::scanEnd ()
+{
+	if (buffer_)
+		yy_delete_buffer (buffer_);
 
+	buffer_ = nullptr;
+	source_.close ();
+}
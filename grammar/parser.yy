@@ -51,6 +51,7 @@
 	ELSE		"else"
 	ELSEIF		"else if"
 	WHILE		"while"
+	PFOR		"pfor"
 	GREATER		">"
 	LESS		"<"
 	GREATER_E	">="
@@ -69,7 +70,7 @@
 	COMMA		","
 ;
 
-%token <std::string>	ID		"identifier"
+%token <int>			ID		"identifier"
 %token <int> 			NUMBER 	"number"
 
 // ----- Statement derived -----
@@ -82,6 +83,8 @@
 %nterm <AST::IfElseNode*> 		IfStm
 %nterm <AST::IfElseNode*> 		ElseLike
 %nterm <AST::WhileNode*> 		WhileStm
+%nterm <AST::StatementNode*>	PforStm
+%nterm <std::vector<std::string_view>>	Reductions
 %nterm <AST::VariableNode*> 	Variable
 %nterm <AST::ArrayElemNode*>	ArrayElem
 %nterm <AST::RepeatNode*>		Repeat
@@ -90,6 +93,11 @@
 %nterm <AST::StatementNode*>	Statement
 
 %printer { yyo << $$; } <*>;
+%printer
+{
+	for (std::string_view name : $$)
+		yyo << name << ' ';
+} <std::vector<std::string_view>>;
 
 %nonassoc "if"
 %nonassoc "print"
@@ -129,7 +137,7 @@ Statements: Statement
 					static_cast<const void*>(stm));
 
 
-				drv.curScope().push_back(stm);
+				drv.pushStatement(stm);
 			}
 		|	Statements Statement
 		  	{
@@ -139,7 +147,7 @@ Statements: Statement
 					static_cast<const void*>(stm));
 
 
-				drv.curScope().push_back(stm);
+				drv.pushStatement(stm);
 			}
 		|	";"
 		 	{
@@ -174,6 +182,13 @@ Statement:	Expr ";"
 				LOG("It's WhileStm. Moving from concrete rule: {}\n",
 					static_cast<const void*>($$));
 
+				$$ = $1;
+			}
+		|	PforStm
+			{
+				LOG("It's PforStm. Moving from concrete rule: {}\n",
+					static_cast<const void*>($$));
+
 				$$ = $1;
 			}
 		| 	Print ";"
@@ -249,8 +264,40 @@ WhileStm:	WHILE "(" Expr ")" Statement
 			{
 				MSG("Initialising while statement\n");
 				$$ = drv.construct<AST::WhileNode>($3, $5);
+				$$->setLine(@1.begin.line);
 			};
 
+PforStm:	PFOR "(" Variable "=" Expr ";" Variable "<" Expr ")" Statement
+			{
+				MSG("Initialising pfor statement\n");
+
+				if ($7->getName() != $3->getName())
+					error(@7, "pfor condition must test the loop variable");
+
+				$$ = drv.makePfor($3, $5, $9, $11, {});
+			}
+		|	PFOR "(" Variable "=" Expr ";" Variable "<" Expr ";" Reductions ")" Statement
+			{
+				MSG("Initialising pfor statement with reductions\n");
+
+				if ($7->getName() != $3->getName())
+					error(@7, "pfor condition must test the loop variable");
+
+				$$ = drv.makePfor($3, $5, $9, $13, std::move($11));
+			}
+		;
+
+Reductions:	ID
+			{
+				$$.push_back(drv.symbolName($1));
+			}
+		|	Reductions "," ID
+			{
+				$$ = std::move($1);
+				$$.push_back(drv.symbolName($3));
+			}
+		;
+
 Assign: Variable "=" Expr
 		{
 			MSG("Constructing variable-expression Assign\n");
@@ -474,8 +521,8 @@ UnaryOp	: 	"-" Expr %prec UMINUS
 
 Variable: 	ID
 			{
-				LOG("Initialising AST::VariableNode: {}\n", $1);
-				$$ = drv.construct<AST::VariableNode>(drv.internName($1));
+				LOG("Initialising AST::VariableNode: {}\n", drv.symbolName($1));
+				$$ = drv.construct<AST::VariableNode>(drv.symbolName($1));
 			};
 
 %%
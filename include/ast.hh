@@ -1,61 +1,417 @@
 #pragma once
 
+#include "arena.hh"
+#include "bounds.hh"
+#include "compiler.hh"
+#include "eliminator.hh"
+#include "flat.hh"
+#include "flat_interpreter.hh"
+#include "folder.hh"
+#include "hoister.hh"
+#include "idioms.hh"
+#include "input.hh"
 #include "interpreter.hh"
+#include "ir_builder.hh"
+#include "ir_interpreter.hh"
 #include "log.hh"
 #include "node.hh"
+#include "numbering.hh"
+#include "parallel.hh"
+#include "pass_manager.hh"
+#include "pipeline.hh"
+#include "reducer.hh"
+#include "resolver.hh"
+#include "timing.hh"
+#include "typer.hh"
+#include "vm.hh"
 
+#include <exception>
 #include <memory>
-#include <string>
+#include <optional>
 #include <string_view>
 #include <unordered_map>
-#include <unordered_set>
 #include <vector>
 
 namespace AST
 {
 
+enum class Engine
+{
+    INTERPRETER,
+    VM,
+    FLAT,
+    IR,
+};
+
+// Parser that turns the tokens into the tree.
+enum class Frontend
+{
+    BISON,
+    DESCENT,
+};
+
 class AST final
 {
   public:
     ScopeNode *globalScope;
 
   private:
-    std::vector<std::unique_ptr<INode>> data_;
+    // Owns every node and interned name; must outlive everything below.
+    detail::Arena arena_;
+
+    // Interned names; the symbol of a name is its index in symbols_.
+    std::unordered_map<std::string_view, int> symbolIds_;
+    std::vector<std::string_view> symbols_;
 
-    std::unordered_set<std::string> namePool_;
+    std::ostream &out_;
+
+    detail::FrameLayout layout_;
+    bool resolved_ = false;
+
+    int optLevel_ = 1;
+    bool autoParallel_ = false;
+    detail::Flush flush_ = detail::Flush::BLOCK;
+    std::unique_ptr<detail::Input> input_;
+    bool optimized_ = false;
+    detail::FoldStats foldStats_;
+    detail::ElimStats elimStats_;
+    detail::HoistStats hoistStats_;
+    detail::ReduceStats reduceStats_;
+    detail::NumberStats numberStats_;
+    detail::BoundsStats boundsStats_;
+    detail::TypeStats typeStats_;
+    detail::IdiomStats idiomStats_;
+    detail::ParallelStats parallelStats_;
+    std::vector<detail::LoopReport> parallelReport_;
+    std::vector<detail::PassTiming> timings_;
+
+    std::optional<detail::ir::Function> ir_;
 
     detail::Interpreter interpreter_;
 
+    std::unique_ptr<detail::Pipeline> pipeline_;
+
+  private:
+    // While loops are left in order at -O0 and unless asked for.
+    bool automaticLoops() const { return autoParallel_ && optLevel_ >= 1; }
+
+    // The passes of the optimization level in the order they run: those over
+    // the tree as parsed, or, once the resolver has laid out frame slots,
+    // those over slots. One pipeline serves every engine.
+    detail::PassManager passes(bool resolved)
+    {
+        detail::PassManager manager;
+
+        if (!resolved)
+        {
+            if (optLevel_ >= 1)
+                manager.add("fold", [this]
+                {
+                    foldStats_ = detail::Folder(arena_).run(*globalScope);
+                });
+
+            return manager;
+        }
+
+        // Type errors are reported whatever the optimization level.
+        manager.add("types", [this]
+        {
+            typeStats_ = detail::Typer(layout_).run(*globalScope);
+        });
+        manager.add("pfor", [this]
+        {
+            detail::Parallel(layout_).check(*globalScope);
+        });
+
+        if (optLevel_ >= 2)
+        {
+            manager.add("dce", [this]
+            {
+                elimStats_ = detail::Eliminator(layout_).run(*globalScope);
+            });
+            manager.add("iv", [this]
+            {
+                reduceStats_ =
+                    detail::Reducer(arena_, layout_).run(*globalScope);
+            });
+            manager.add("licm", [this]
+            {
+                hoistStats_ =
+                    detail::Hoister(arena_, layout_).run(*globalScope);
+            });
+            manager.add("cse", [this]
+            {
+                numberStats_ =
+                    detail::Numbering(arena_, layout_).run(*globalScope);
+            });
+
+            // Types the temporaries introduced above.
+            manager.add("types", [this]
+            {
+                typeStats_ = detail::Typer(layout_).run(*globalScope);
+            });
+        }
+
+        if (optLevel_ >= 1)
+        {
+            manager.add("bounds", [this]
+            {
+                boundsStats_ = detail::Bounds(layout_).run(*globalScope);
+            });
+            manager.add("idioms", [this]
+            {
+                idiomStats_ = detail::Idioms(layout_).run(*globalScope);
+            });
+        }
+
+        manager.add("parallel", [this]
+        {
+            detail::Parallel parallel(layout_, automaticLoops());
+
+            parallelStats_ = parallel.plan(*globalScope);
+            parallelReport_ = parallel.report();
+        });
+
+        return manager;
+    }
+
+    void streamStats()
+    {
+        foldStats_ = pipeline_->foldStats();
+        typeStats_ = pipeline_->typeStats();
+        parallelStats_ = pipeline_->parallelStats();
+        parallelReport_ = pipeline_->report();
+    }
+
   public:
     AST(std::ostream &out = std::cout)
-        : interpreter_(out)
+        : out_(out)
+        , interpreter_(out)
     {}
 
-    void eval()
+    void setOptLevel(int level) { optLevel_ = level; }
+
+    int optLevel() const { return optLevel_; }
+
+    void setThreads(unsigned threads) { interpreter_.setThreads(threads); }
+
+    // Lets plain while loops run in parallel from -O1 on; off by default.
+    void setAutoParallel(bool on) { autoParallel_ = on; }
+
+    void setFlush(detail::Flush flush)
+    {
+        flush_ = flush;
+        interpreter_.setFlush(flush);
+    }
+
+    // Source of ?, standard input until set.
+    void setInput(std::unique_ptr<detail::Input> input)
+    {
+        input_ = std::move(input);
+        interpreter_.setInput(this->input());
+    }
+
+    detail::Input& input()
+    {
+        return input_ ? *input_ : detail::Input::standard();
+    }
+
+    // Rewrites the tree in place; runs once, before resolution.
+    void optimize()
+    {
+        if (optimized_)
+            return;
+
+        optimized_ = true;
+
+        passes(false).run(timings_);
+    }
+
+    // The tree was folded before, as a cached program is, with stats.
+    void setFolded(const detail::FoldStats& stats)
+    {
+        optimized_ = true;
+        foldStats_ = stats;
+    }
+
+    const detail::FoldStats& foldStats() const { return foldStats_; }
+
+    const detail::ElimStats& elimStats() const { return elimStats_; }
+
+    const detail::HoistStats& hoistStats() const { return hoistStats_; }
+
+    const detail::ReduceStats& reduceStats() const { return reduceStats_; }
+
+    const detail::NumberStats& numberStats() const { return numberStats_; }
+
+    const detail::BoundsStats& boundsStats() const { return boundsStats_; }
+
+    const detail::TypeStats& typeStats() const { return typeStats_; }
+
+    const detail::IdiomStats& idiomStats() const { return idiomStats_; }
+
+    const detail::ParallelStats& parallelStats() const { return parallelStats_; }
+
+    const std::vector<detail::LoopReport>& parallelReport() const
+    {
+        return parallelReport_;
+    }
+
+    const std::vector<detail::PassTiming>& passTimings() const { return timings_; }
+
+    void resolve()
+    {
+        if (resolved_)
+            return;
+
+        optimize();
+
+        layout_ = detail::timed(timings_, "resolve", [this]
+        {
+            return detail::Resolver().resolve(*globalScope);
+        });
+        resolved_ = true;
+
+        passes(true).run(timings_);
+    }
+
+    // SSA form of the program the passes of the optimization level left.
+    const detail::ir::Function& ir()
     {
+        resolve();
+
+        if (!ir_)
+            ir_ = detail::timed(timings_, "ir-build", [this]
+            {
+                return detail::ir::Builder().build(*globalScope, layout_);
+            });
+
+        return *ir_;
+    }
+
+    void dumpIr(std::ostream& os) { ir().dump(os); }
+
+    void eval(Engine engine = Engine::INTERPRETER)
+    {
+        resolve();
+
         MSG("Evaluating global scope\n");
-        interpreter_.visit(*globalScope);
+
+        switch (engine)
+        {
+            case Engine::VM:
+            {
+                const detail::Program program =
+                    detail::Compiler().compile(*globalScope, layout_);
+
+                detail::VM(out_, flush_, input()).run(program);
+                break;
+            }
+
+            case Engine::FLAT:
+            {
+                const detail::FlatAst flat =
+                    detail::Flattener().flatten(*globalScope, layout_);
+
+                detail::FlatInterpreter(out_, flush_, input()).run(flat);
+                break;
+            }
+
+            case Engine::IR:
+                detail::IrInterpreter(out_, flush_, input()).run(ir());
+                break;
+
+            case Engine::INTERPRETER:
+            default:
+                interpreter_.setLayout(layout_);
+
+                // Output printed before an error goes out ahead of it.
+                try
+                {
+                    interpreter_.visit(*globalScope);
+                }
+                catch (...)
+                {
+                    interpreter_.flushOutput();
+                    throw;
+                }
+
+                interpreter_.flushOutput();
+                break;
+        }
+    }
+
+    // Streaming: the statements of the global scope are pushed as they are
+    // parsed, while runStream() executes them; see detail::Pipeline.
+    void beginStream()
+    {
+        globalScope = construct<ScopeNode>(std::vector<StmtPtr>{});
+        pipeline_ = std::make_unique<detail::Pipeline>(
+            arena_, *globalScope, optLevel_ >= 1, automaticLoops());
+    }
+
+    void stream(StmtPtr stmt) { pipeline_->push(stmt); }
+
+    void endStream(std::exception_ptr error = nullptr)
+    {
+        pipeline_->close(std::move(error));
+    }
+
+    void runStream()
+    {
+        MSG("Evaluating streamed global scope\n");
+
+        interpreter_.setLayout(detail::FrameLayout());
+
+        try
+        {
+            pipeline_->run(interpreter_);
+        }
+        catch (...)
+        {
+            interpreter_.flushOutput();
+            streamStats();
+            throw;
+        }
+
+        interpreter_.flushOutput();
+        streamStats();
     }
 
     template <typename NodeType, typename... Args>
     NodeType *construct(Args &&...args)
     {
-        auto node_ptr = std::make_unique<NodeType>(std::forward<Args>(args)...);
+        return arena_.create<NodeType>(std::forward<Args>(args)...);
+    }
 
-        auto raw_data = node_ptr.get();
+    // Symbol of name, which is copied to the arena the first time it is seen,
+    // so that it may point into the source being scanned.
+    int intern(std::string_view name)
+    {
+        if (const auto it = symbolIds_.find(name); it != symbolIds_.end())
+            return it->second;
 
-        data_.push_back(std::move(node_ptr));
+        const int symbol = static_cast<int>(symbols_.size());
+        const std::string_view copy = arena_.copy(name);
 
-        return raw_data;
+        symbols_.push_back(copy);
+        symbolIds_.emplace(copy, symbol);
+
+        return symbol;
     }
 
-    std::string_view internName(std::string_view name)
+    std::string_view symbolName(int symbol) const
     {
-        const auto it = namePool_.insert(std::string(name)).first;
+        return symbols_[static_cast<size_t>(symbol)];
+    }
 
-        return *it;
+    std::string_view internName(std::string_view name)
+    {
+        return symbolName(intern(name));
     }
 
+    const detail::Arena& arena() const { return arena_; }
+
     int getInterpreterBuf() const { return interpreter_.getBuf(); }
 
     bool varInitialized(std::string_view varName) const
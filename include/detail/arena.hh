@@ -0,0 +1,142 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "log.hh"
+
+namespace AST
+{
+
+namespace detail
+{
+
+// Bump allocator for everything the parser builds. Memory is carved out of
+// large blocks and only given back when the arena dies. Objects with
+// destructors register themselves so the arena can run them.
+class Arena final
+{
+  private:
+    static constexpr size_t BLOCK_SIZE = 64 * 1024;
+
+    struct Block
+    {
+        std::unique_ptr<std::byte[]> data;
+        size_t size = 0;
+    };
+
+    template <typename T>
+    static void destroy(void* ptr)
+    {
+        static_cast<T*>(ptr)->~T();
+    }
+
+    struct Finalizer
+    {
+        void* object;
+        void (*destroy)(void*);
+    };
+
+  private:
+    std::vector<Block> blocks_;
+    std::vector<Finalizer> finalizers_;
+
+    std::byte* cur_ = nullptr;
+    size_t left_ = 0;
+    size_t used_ = 0;
+
+  private:
+    void grow(size_t size)
+    {
+        const size_t blockSize = std::max(size, BLOCK_SIZE);
+
+        LOG("Arena grows by {} bytes\n", blockSize);
+
+        blocks_.push_back(
+            Block{std::make_unique<std::byte[]>(blockSize), blockSize});
+
+        cur_ = blocks_.back().data.get();
+        left_ = blockSize;
+    }
+
+  public:
+    Arena() = default;
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    ~Arena()
+    {
+        for (auto it = finalizers_.rbegin(); it != finalizers_.rend(); ++it)
+            it->destroy(it->object);
+    }
+
+    void* allocate(size_t size, size_t align)
+    {
+        size_t pad = (align - reinterpret_cast<uintptr_t>(cur_) % align) % align;
+
+        if (pad + size > left_)
+        {
+            grow(size + align);
+            pad = (align - reinterpret_cast<uintptr_t>(cur_) % align) % align;
+        }
+
+        std::byte* ptr = cur_ + pad;
+
+        cur_ += pad + size;
+        left_ -= pad + size;
+        used_ += pad + size;
+
+        return ptr;
+    }
+
+    template <typename T, typename... Args>
+    T* create(Args&&... args)
+    {
+        void* mem = allocate(sizeof(T), alignof(T));
+        T* object = new (mem) T(std::forward<Args>(args)...);
+
+        if constexpr (!std::is_trivially_destructible_v<T>)
+            finalizers_.push_back(Finalizer{object, &destroy<T>});
+
+        return object;
+    }
+
+    std::string_view copy(std::string_view str)
+    {
+        if (str.empty())
+            return {};
+
+        char* mem = static_cast<char*>(allocate(str.size(), 1));
+
+        std::memcpy(mem, str.data(), str.size());
+
+        return {mem, str.size()};
+    }
+
+    size_t bytesUsed() const { return used_; }
+
+    size_t bytesReserved() const
+    {
+        size_t reserved = 0;
+
+        for (const auto& block : blocks_)
+            reserved += block.size;
+
+        return reserved;
+    }
+
+    size_t blocks() const { return blocks_.size(); }
+};
+
+} // namespace detail
+
+} // namespace AST
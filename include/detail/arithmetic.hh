@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdexcept>
+
+namespace AST
+{
+
+namespace detail
+{
+
+// Integer arithmetic as every engine, kernel and the folder run it: +, -, *
+// and unary - wrap around in two's complement, so INT_MAX + 1 is INT_MIN.
+inline int wrap(unsigned value) { return static_cast<int>(value); }
+
+inline int add(int left, int right)
+{
+    return wrap(static_cast<unsigned>(left) + static_cast<unsigned>(right));
+}
+
+inline int subtract(int left, int right)
+{
+    return wrap(static_cast<unsigned>(left) - static_cast<unsigned>(right));
+}
+
+inline int multiply(int left, int right)
+{
+    return wrap(static_cast<unsigned>(left) * static_cast<unsigned>(right));
+}
+
+inline int negate(int value) { return wrap(0U - static_cast<unsigned>(value)); }
+
+// / and % by zero fail; by -1 they wrap as well, so INT_MIN / -1 is INT_MIN
+// and INT_MIN % -1 is 0 rather than a trap.
+inline int divide(int left, int right)
+{
+    if (right == 0)
+        throw std::runtime_error("Divide by zero");
+
+    return right == -1 ? negate(left) : left / right;
+}
+
+inline int modulo(int left, int right)
+{
+    if (right == 0)
+        throw std::runtime_error("Divide by zero");
+
+    return right == -1 ? 0 : left % right;
+}
+
+} // namespace detail
+
+} // namespace AST
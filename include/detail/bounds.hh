@@ -0,0 +1,857 @@
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <optional>
+#include <variant>
+#include <vector>
+
+#include "effects.hh"
+#include "frame.hh"
+#include "log.hh"
+#include "loop_pass.hh"
+#include "node.hh"
+#include "slots.hh"
+
+namespace AST
+{
+
+namespace detail
+{
+
+struct BoundsStats
+{
+    size_t accesses = 0; // element reads and stores
+    size_t checked = 0;  // of them still checked at run time
+};
+
+// Bounds-check elimination. A forward walk over the resolved tree keeps
+// facts about frame slots: an interval for integers and the lengths of the
+// leading dimensions for arrays. Facts are stated in constants and in the
+// current values of other slots, so a store to a slot drops everything that
+// mentions it. An element access whose every index provably lies in
+// [0, length) of its dimension is marked unchecked.
+//
+// Facts come from stores of constants, counters stepped by constants,
+// copies such as t = n - 1, conditions such as i < n guarding a loop or
+// branch, and arrays made by repeat() and array(). Loops iterate to a fixed
+// point; a bound that moves between iterations is dropped. Arithmetic that
+// may wrap gives no facts.
+class Bounds final
+{
+  private:
+    // value(slot) + offset, or offset alone when slot < 0.
+    struct Bound
+    {
+        int slot = -1;
+        long long offset = 0;
+
+        bool operator==(const Bound&) const = default;
+    };
+
+    // lo <= value < hi
+    struct Range
+    {
+        std::optional<long long> lo;
+        std::optional<Bound> hi;
+
+        bool operator==(const Range&) const = default;
+    };
+
+    struct Facts
+    {
+        std::vector<Range> ranges;
+        std::vector<std::vector<Bound>> shapes;
+        std::vector<std::optional<Bound>> values; // exact, as in t = n - 1
+
+        bool operator==(const Facts&) const = default;
+    };
+
+  private:
+    const FrameLayout& layout_;
+    BoundsStats stats_;
+
+    Facts facts_;
+    bool final_ = true; // false while a loop iterates to a fixed point
+
+  private:
+    // Index of a slot in the vectors of Facts.
+    static size_t at(int slot) { return static_cast<size_t>(slot); }
+
+    static const VariableNode* local(ExprPtr expr)
+    {
+        auto var = dynamic_cast<const VariableNode*>(expr);
+
+        return var && var->getBinding().resolved() && var->getBinding().chain < 0
+                   ? var
+                   : nullptr;
+    }
+
+    static std::optional<long long> constant(ExprPtr expr)
+    {
+        if (auto value = dynamic_cast<const ConstantNode*>(expr))
+            return value->getVal();
+
+        return std::nullopt;
+    }
+
+    static bool mentions(const std::optional<Bound>& bound, int slot)
+    {
+        return bound && bound->slot == slot;
+    }
+
+    void kill(int slot)
+    {
+        facts_.ranges[at(slot)] = {};
+        facts_.shapes[at(slot)].clear();
+        facts_.values[at(slot)].reset();
+
+        for (Range& range : facts_.ranges)
+            if (mentions(range.hi, slot))
+                range.hi.reset();
+
+        for (std::optional<Bound>& value : facts_.values)
+            if (mentions(value, slot))
+                value.reset();
+
+        for (std::vector<Bound>& shape : facts_.shapes)
+        {
+            auto stale = std::find_if(shape.begin(), shape.end(),
+                                      [slot](const Bound& length)
+                                      { return length.slot == slot; });
+
+            shape.erase(stale, shape.end());
+        }
+    }
+
+    // Upper bound of a slot as a constant, if one is known.
+    std::optional<long long> highest(int slot) const
+    {
+        const std::optional<Bound>& hi = facts_.ranges[at(slot)].hi;
+
+        if (hi && hi->slot < 0)
+            return hi->offset - 1;
+
+        return std::nullopt;
+    }
+
+    // The same bound stated through the slot a copy was taken from.
+    Bound origin(const Bound& bound) const
+    {
+        if (bound.slot < 0 || !facts_.values[at(bound.slot)])
+            return bound;
+
+        const Bound& value = *facts_.values[at(bound.slot)];
+
+        return Bound{value.slot, value.offset + bound.offset};
+    }
+
+    // left <= right for every value of the slots involved.
+    bool atMost(const Bound& left, const Bound& right) const
+    {
+        return compare(left, right) || compare(origin(left), origin(right));
+    }
+
+    bool compare(const Bound& left, const Bound& right) const
+    {
+        if (left.slot == right.slot)
+            return left.offset <= right.offset;
+
+        if (left.slot < 0)
+        {
+            const std::optional<long long>& lo =
+                facts_.ranges[at(right.slot)].lo;
+
+            return lo && left.offset <= *lo + right.offset;
+        }
+
+        if (right.slot < 0)
+        {
+            const std::optional<long long> hi = highest(left.slot);
+
+            return hi && *hi + left.offset <= right.offset;
+        }
+
+        return false;
+    }
+
+    // The value of expr as a bound: a constant or a slot plus a constant,
+    // stated through the original of a copy.
+    std::optional<Bound> bound(ExprPtr expr) const
+    {
+        if (auto value = constant(expr))
+            return Bound{-1, *value};
+
+        if (const VariableNode* var = local(expr))
+            return origin(Bound{var->getBinding().slot, 0});
+
+        auto binary = dynamic_cast<const BinaryOpNode*>(expr);
+
+        if (!binary || !binary->isInteger() ||
+            (binary->getOp() != BinaryOp::ADD && binary->getOp() != BinaryOp::SUB))
+            return std::nullopt;
+
+        ExprPtr counter = binary->getLeft();
+        std::optional<long long> step = constant(binary->getRight());
+
+        if (!local(counter) && binary->getOp() == BinaryOp::ADD)
+        {
+            counter = binary->getRight();
+            step = constant(binary->getLeft());
+        }
+
+        if (!local(counter) || !step)
+            return std::nullopt;
+
+        const long long offset =
+            binary->getOp() == BinaryOp::ADD ? *step : -*step;
+
+        // Exact only when the sum cannot wrap.
+        if (offset != 0 && shifted(range(counter), offset) == Range{})
+            return std::nullopt;
+
+        return origin(Bound{local(counter)->getBinding().slot, offset});
+    }
+
+    Range shifted(const Range& range, long long step) const
+    {
+        if (step == 0)
+            return range;
+
+        Range result;
+
+        // Wrapping is ruled out by the bound on the side the step moves to.
+        if (step > 0)
+        {
+            if (!range.hi)
+                return {};
+
+            if (range.hi->slot < 0 ? range.hi->offset - 1 + step > INT_MAX
+                                   : range.hi->offset + step > 1)
+                return {};
+        }
+        else if (!range.lo || *range.lo + step < INT_MIN)
+            return {};
+
+        if (range.lo)
+            result.lo = *range.lo + step;
+
+        if (range.hi)
+            result.hi = Bound{range.hi->slot, range.hi->offset + step};
+
+        return result;
+    }
+
+    Range range(ExprPtr expr) const
+    {
+        if (auto value = constant(expr))
+            return Range{*value, Bound{-1, *value + 1}};
+
+        // Settled accesses only: the value of a store is its destination's.
+        if (auto assign = dynamic_cast<const AssignNode*>(expr))
+        {
+            auto dest = std::get_if<VariablePtr>(&assign->getDest());
+
+            return dest ? range(*dest) : Range{};
+        }
+
+        if (const VariableNode* var = local(expr))
+        {
+            const int slot = var->getBinding().slot;
+            Range result = facts_.ranges[at(slot)];
+
+            if (!result.hi)
+                result.hi = Bound{slot, 1};
+
+            return result;
+        }
+
+        auto binary = dynamic_cast<const BinaryOpNode*>(expr);
+
+        // Arrays have no range.
+        if (!binary || !binary->isInteger())
+            return {};
+
+        const std::optional<long long> right = constant(binary->getRight());
+
+        switch (binary->getOp())
+        {
+            case BinaryOp::ADD:
+                if (right)
+                    return shifted(range(binary->getLeft()), *right);
+
+                if (auto left = constant(binary->getLeft()))
+                    return shifted(range(binary->getRight()), *left);
+
+                return {};
+
+            case BinaryOp::SUB:
+                return right ? shifted(range(binary->getLeft()), -*right)
+                             : Range{};
+
+            case BinaryOp::MOD:
+            {
+                const Range left = range(binary->getLeft());
+
+                if (!right || *right <= 0 || !left.lo || *left.lo < 0)
+                    return {};
+
+                return Range{0, Bound{-1, *right}};
+            }
+
+            case BinaryOp::MUL:
+            case BinaryOp::DIV:
+            case BinaryOp::GR:
+            case BinaryOp::LS:
+            case BinaryOp::EQ:
+            case BinaryOp::GR_EQ:
+            case BinaryOp::LS_EQ:
+            case BinaryOp::NOT_EQ:
+            case BinaryOp::AND:
+            case BinaryOp::OR:
+            default:
+                return {};
+        }
+    }
+
+    std::vector<Bound> shape(const Rhs& rhs) const
+    {
+        if (auto init = std::get_if<ArrayInitPtr>(&rhs))
+            return {Bound{-1, static_cast<long long>((*init)->arraySize())}};
+
+        if (auto expr = std::get_if<ExprPtr>(&rhs))
+        {
+            if (const VariableNode* var = local(*expr))
+                return facts_.shapes[at(var->getBinding().slot)];
+
+            return {};
+        }
+
+        const RepeatNode& repeat = *std::get<RepeatPtr>(rhs);
+        const std::optional<Bound> size = bound(repeat.getSize());
+
+        if (!size)
+            return {};
+
+        std::vector<Bound> result{*size};
+
+        if (repeat.hasElem())
+        {
+            const std::vector<Bound> inner = shape(repeat.getElem());
+
+            result.insert(result.end(), inner.begin(), inner.end());
+        }
+
+        return result;
+    }
+
+    // Records what holds once cond evaluated to true.
+    void assume(ExprPtr cond)
+    {
+        // A store in cond may have changed what was compared.
+        if (stores(cond))
+            return;
+
+        enter(cond);
+    }
+
+    void enter(ExprPtr cond)
+    {
+        auto binary = dynamic_cast<const BinaryOpNode*>(cond);
+
+        if (!binary)
+            return;
+
+        ExprPtr small = binary->getLeft();
+        ExprPtr big = binary->getRight();
+        bool strict = true;
+
+        switch (binary->getOp())
+        {
+            case BinaryOp::AND:
+                enter(binary->getLeft());
+                enter(binary->getRight());
+                return;
+
+            case BinaryOp::LS:
+                break;
+
+            case BinaryOp::LS_EQ:
+                strict = false;
+                break;
+
+            case BinaryOp::GR:
+                std::swap(small, big);
+                break;
+
+            case BinaryOp::GR_EQ:
+                std::swap(small, big);
+                strict = false;
+                break;
+
+            case BinaryOp::ADD:
+            case BinaryOp::SUB:
+            case BinaryOp::MUL:
+            case BinaryOp::DIV:
+            case BinaryOp::MOD:
+            case BinaryOp::EQ:
+            case BinaryOp::NOT_EQ:
+            case BinaryOp::OR:
+            default:
+                return;
+        }
+
+        // small < big, or small <= big
+        const std::optional<long long> smallest = range(small).lo;
+
+        if (const VariableNode* var = local(big); var && smallest)
+        {
+            std::optional<long long>& lo =
+                facts_.ranges[at(var->getBinding().slot)].lo;
+            const long long least = *smallest + (strict ? 1 : 0);
+
+            lo = lo ? std::max(*lo, least) : least;
+        }
+
+        const VariableNode* var = local(small);
+        std::optional<Bound> limit = bound(big);
+
+        if (!var || !limit || limit->slot == var->getBinding().slot)
+            return;
+
+        limit->offset += strict ? 0 : 1;
+        facts_.ranges[at(var->getBinding().slot)].hi = limit;
+    }
+
+    static size_t depth(const ArrayElemNode& node)
+    {
+        size_t count = 1;
+
+        for (auto elem = &node; elem->holdsArrayElem(); elem = elem->getArrayElem())
+            ++count;
+
+        return count;
+    }
+
+    bool inRange(const ArrayElemNode& node) const
+    {
+        const VariableNode* base = local(node.getBase());
+
+        if (!base)
+            return false;
+
+        const std::vector<Bound>& shape =
+            facts_.shapes[at(base->getBinding().slot)];
+        size_t dim = depth(node);
+
+        if (dim > shape.size())
+            return false;
+
+        for (auto elem = &node;; elem = elem->getArrayElem())
+        {
+            const Range index = range(elem->getIndex());
+
+            if (!index.lo || *index.lo < 0 || !index.hi ||
+                !atMost(*index.hi, shape[--dim]))
+                return false;
+
+            if (elem->holdsVariable())
+                return true;
+        }
+    }
+
+    // expr reads slot through a variable; the destination of a store does
+    // not count.
+    static bool reads(ExprPtr expr, int slot)
+    {
+        if (const VariableNode* var = local(expr))
+            return var->getBinding().slot == slot;
+
+        if (auto unary = dynamic_cast<const UnaryOpNode*>(expr))
+            return reads(unary->getOperand(), slot);
+
+        if (auto binary = dynamic_cast<const BinaryOpNode*>(expr))
+            return reads(binary->getLeft(), slot) ||
+                   reads(binary->getRight(), slot);
+
+        if (auto elem = dynamic_cast<const ArrayElemNode*>(expr))
+        {
+            for (auto node = elem;; node = node->getArrayElem())
+            {
+                if (reads(node->getIndex(), slot))
+                    return true;
+
+                if (node->holdsVariable())
+                    return false;
+            }
+        }
+
+        auto assign = dynamic_cast<const AssignNode*>(expr);
+
+        if (!assign)
+            return false;
+
+        if (auto dest = std::get_if<ArrayElemPtr>(&assign->getDest());
+            dest && reads(*dest, slot))
+            return true;
+
+        auto src = std::get_if<ExprPtr>(&assign->getSrc());
+
+        return !src || reads(*src, slot);
+    }
+
+    // Ranges are looked up once the indices ran. They still describe an
+    // index unless it reads a slot that it or a later index stores to, or
+    // a slot is stored to twice.
+    bool settled(const ArrayElemNode& node) const
+    {
+        if (!stores(&edit(node)))
+            return true;
+
+        std::vector<int> later(static_cast<size_t>(layout_.nslots), 0);
+        std::vector<ExprPtr> order;
+
+        for (auto elem = &node;; elem = elem->getArrayElem())
+        {
+            order.push_back(elem->getIndex());
+
+            if (elem->holdsVariable())
+                break;
+        }
+
+        // Last evaluated first, so later holds what follows each index.
+        for (size_t id = order.size(); id-- > 0;)
+        {
+            const std::vector<int> writes = SlotWrites(layout_).collect(*order[id]);
+
+            for (size_t slot = 0; slot < writes.size(); ++slot)
+            {
+                later[slot] += writes[slot];
+
+                if (later[slot] > 1 ||
+                    (later[slot] && reads(order[id], static_cast<int>(slot))))
+                    return false;
+            }
+        }
+
+        return true;
+    }
+
+    // Evaluating src stores to some slot.
+    static bool stores(const Rhs& src)
+    {
+        if (auto init = std::get_if<ArrayInitPtr>(&src))
+        {
+            for (size_t id = 0; id < (*init)->arraySize(); ++id)
+                if (stores((*init)->getElem(id)))
+                    return true;
+
+            return false;
+        }
+
+        if (auto repeat = std::get_if<RepeatPtr>(&src))
+            return stores((*repeat)->getSize()) ||
+                   ((*repeat)->hasElem() && stores((*repeat)->getElem()));
+
+        const ExprPtr expr = std::get<ExprPtr>(src);
+
+        if (auto unary = dynamic_cast<const UnaryOpNode*>(expr))
+            return stores(unary->getOperand());
+
+        if (auto binary = dynamic_cast<const BinaryOpNode*>(expr))
+            return stores(binary->getLeft()) || stores(binary->getRight());
+
+        if (auto elem = dynamic_cast<const ArrayElemNode*>(expr))
+        {
+            for (auto node = elem;; node = node->getArrayElem())
+            {
+                if (stores(node->getIndex()))
+                    return true;
+
+                if (node->holdsVariable())
+                    return false;
+            }
+        }
+
+        return dynamic_cast<const AssignNode*>(expr) != nullptr;
+    }
+
+    // provable is false when something ran between the indices and the
+    // access that may have changed what they read.
+    void access(const ArrayElemNode& node, bool provable = true)
+    {
+        const bool proven = provable && settled(node) && inRange(node);
+
+        if (!final_)
+            return;
+
+        node.setChecked(!proven);
+
+        ++stats_.accesses;
+
+        if (!proven)
+            ++stats_.checked;
+    }
+
+    // Outermost index first, like the engines.
+    void indices(const ArrayElemNode& node)
+    {
+        for (auto elem = &node;; elem = elem->getArrayElem())
+        {
+            expr(elem->getIndex());
+
+            if (elem->holdsVariable())
+                return;
+        }
+    }
+
+    void expr(ExprPtr node)
+    {
+        if (auto binary = dynamic_cast<const BinaryOpNode*>(node))
+        {
+            expr(binary->getLeft());
+            expr(binary->getRight());
+        }
+        else if (auto unary = dynamic_cast<const UnaryOpNode*>(node))
+            expr(unary->getOperand());
+        else if (auto elem = dynamic_cast<const ArrayElemNode*>(node))
+        {
+            indices(*elem);
+            access(*elem);
+        }
+        else if (auto assign = dynamic_cast<const AssignNode*>(node))
+            store(*assign);
+    }
+
+    void rhs(const Rhs& src)
+    {
+        if (auto value = std::get_if<ExprPtr>(&src))
+            return expr(*value);
+
+        if (auto repeat = std::get_if<RepeatPtr>(&src))
+        {
+            expr((*repeat)->getSize());
+
+            if ((*repeat)->hasElem())
+                rhs((*repeat)->getElem());
+
+            return;
+        }
+
+        // Elements are not walked in evaluation order, so whatever they
+        // store is forgotten before and after.
+        const ArrayInitNode& init = *std::get<ArrayInitPtr>(src);
+        const std::vector<int> writes = SlotWrites(layout_).collect(init);
+
+        forget(writes);
+
+        for (size_t id = 0; id < init.arraySize(); ++id)
+            expr(init.getElem(id));
+
+        forget(writes);
+    }
+
+    void forget(const std::vector<int>& writes)
+    {
+        for (size_t slot = 0; slot < writes.size(); ++slot)
+            if (writes[slot])
+                kill(static_cast<int>(slot));
+    }
+
+    void store(const AssignNode& node)
+    {
+        if (auto elem = std::get_if<ArrayElemPtr>(&node.getDest()))
+        {
+            indices(**elem);
+            rhs(node.getSrc());
+
+            access(**elem, !stores(node.getSrc()));
+
+            // Storing at depth count may reshape every deeper dimension.
+            const size_t count = depth(**elem);
+
+            const Binding& base = (*elem)->getBase()->getBinding();
+
+            for (const int slot : slotsOf(layout_, base))
+                if (facts_.shapes[at(slot)].size() > count)
+                    facts_.shapes[at(slot)].resize(count);
+
+            return;
+        }
+
+        const VariableNode& dest = *std::get<VariablePtr>(node.getDest());
+
+        rhs(node.getSrc());
+
+        if (dest.getBinding().chain >= 0)
+        {
+            for (const int slot : slotsOf(layout_, dest.getBinding()))
+                kill(slot);
+
+            return;
+        }
+
+        const int slot = dest.getBinding().slot;
+        auto value = std::get_if<ExprPtr>(&node.getSrc());
+
+        Range range = value ? this->range(*value) : Range{};
+        std::vector<Bound> shape = this->shape(node.getSrc());
+        std::optional<Bound> copy = value ? bound(*value) : std::nullopt;
+
+        kill(slot);
+
+        if (mentions(range.hi, slot))
+            range.hi.reset();
+
+        if (mentions(copy, slot))
+            copy.reset();
+
+        shape.erase(std::find_if(shape.begin(), shape.end(),
+                                 [slot](const Bound& length)
+                                 { return length.slot == slot; }),
+                    shape.end());
+
+        facts_.ranges[at(slot)] = range;
+        facts_.shapes[at(slot)] = std::move(shape);
+        facts_.values[at(slot)] = copy;
+    }
+
+    // Keeps a fact of head while next agrees with it; a lower bound may
+    // also stay when next only raises it.
+    static void widen(Facts& head, const Facts& next)
+    {
+        for (size_t slot = 0; slot < head.ranges.size(); ++slot)
+        {
+            Range& range = head.ranges[slot];
+            const Range& other = next.ranges[slot];
+
+            if (range.lo && !(other.lo && *other.lo >= *range.lo))
+                range.lo.reset();
+
+            if (range.hi && !(other.hi && other.hi->slot == range.hi->slot &&
+                              other.hi->offset <= range.hi->offset))
+                range.hi.reset();
+
+            std::vector<Bound>& shape = head.shapes[slot];
+            const std::vector<Bound>& lengths = next.shapes[slot];
+
+            const auto common = std::mismatch(shape.begin(), shape.end(),
+                                              lengths.begin(), lengths.end());
+
+            shape.erase(common.first, shape.end());
+
+            if (head.values[slot] != next.values[slot])
+                head.values[slot].reset();
+        }
+    }
+
+    void loop(const WhileNode& node)
+    {
+        const bool wasFinal = final_;
+        Facts head = facts_;
+
+        final_ = false;
+
+        while (true)
+        {
+            facts_ = head;
+            expr(node.getCond());
+            assume(node.getCond());
+            statement(node.getScope());
+
+            Facts next = head;
+            widen(next, facts_);
+
+            if (next == head)
+                break;
+
+            head = std::move(next);
+        }
+
+        final_ = wasFinal;
+
+        facts_ = head;
+        expr(node.getCond());
+
+        const Facts exit = facts_;
+
+        assume(node.getCond());
+        statement(node.getScope());
+
+        facts_ = exit;
+    }
+
+    void branch(const IfElseNode& node)
+    {
+        if (!node.hasCond())
+            return statement(node.getAction());
+
+        expr(node.getCond());
+
+        const Facts before = facts_;
+
+        assume(node.getCond());
+        statement(node.getAction());
+
+        Facts taken = std::move(facts_);
+
+        facts_ = before;
+
+        if (node.hasAltAction())
+            statement(node.getAltAction());
+
+        widen(facts_, taken);
+    }
+
+    void statement(StmtPtr stmt)
+    {
+        if (auto scope = dynamic_cast<const ScopeNode*>(stmt))
+        {
+            for (StmtPtr child : scope->getChildren())
+                statement(child);
+
+            for (int slot = scope->slotBegin(); slot < scope->slotEnd(); ++slot)
+                kill(slot);
+
+            return;
+        }
+
+        if (auto value = dynamic_cast<ExprPtr>(stmt))
+            return expr(value);
+
+        if (auto print = dynamic_cast<const PrintNode*>(stmt))
+            return expr(print->getExpr());
+
+        if (auto ifElse = dynamic_cast<const IfElseNode*>(stmt))
+            return branch(*ifElse);
+
+        if (auto whileNode = dynamic_cast<const WhileNode*>(stmt))
+            return loop(*whileNode);
+    }
+
+  public:
+    explicit Bounds(const FrameLayout& layout)
+        : layout_(layout)
+    {
+        facts_.ranges.resize(static_cast<size_t>(layout.nslots));
+        facts_.shapes.resize(static_cast<size_t>(layout.nslots));
+        facts_.values.resize(static_cast<size_t>(layout.nslots));
+    }
+
+    BoundsStats run(const ScopeNode& global)
+    {
+        MSG("Eliminating bounds checks\n");
+
+        statement(&edit(global));
+
+        LOG("{} of {} element accesses checked\n", stats_.checked,
+            stats_.accesses);
+
+        return stats_;
+    }
+};
+
+} // namespace detail
+
+} // namespace AST
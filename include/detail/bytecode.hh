@@ -0,0 +1,230 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+#include "divisor.hh"
+#include "frame.hh"
+#include "node.hh"
+
+namespace AST
+{
+
+namespace detail
+{
+
+// Three-address register code. Operands are register numbers unless noted.
+enum class OpCode : uint8_t
+{
+    LOAD_CONST,    // r[a] = b (immediate)
+    LOAD_VAR,      // r[a] = slot b (candidate chain c)
+    STORE_VAR,     // slot b (candidate chain c) = r[a]
+    LOAD_ELEM,     // r[a] = slot b[r[a + n - 1]]...[r[a]] (candidate chain c)
+    STORE_ELEM,    // slot b[r[a - 1]]...[r[a - n]] = r[a] (candidate chain c)
+    LOAD_ELEM_UNCHECKED, // LOAD_ELEM with indices proven in range
+    STORE_ELEM_UNCHECKED,
+    LOAD_VAR_INT,  // LOAD_VAR of a slot proven to hold an integer
+    LOAD_ELEM_INT, // LOAD_ELEM of an element proven to be an integer
+    LOAD_ELEM_INT_UNCHECKED,
+    MOVE,          // r[a] = r[b]
+    OWN,           // r[a] keeps its own copy of an array variable it read
+    ADD,           // r[a] = r[b] op r[c]
+    SUB,
+    MUL,
+    DIV,
+    MOD,
+    DIV_CONST,     // r[a] = r[b] / divisors[c]
+    MOD_CONST,     // r[a] = r[b] % divisors[c]
+    GR,
+    LS,
+    EQ,
+    GR_EQ,
+    LS_EQ,
+    NOT_EQ,
+    AND,
+    OR,
+    ELEMENTWISE,   // r[a] = r[b] op r[c] on arrays as well, op in n
+    NEG,           // r[a] = op r[b]
+    NOT,
+    JUMP,          // pc = a
+    JUMP_IF_FALSE, // if (!r[a]) pc = b
+    JUMP_IF_TRUE,  // if (r[a]) pc = b
+    LEAVE_SCOPE,   // undefine slots [a, b)
+    PRINT,         // print r[a]
+    READ,          // r[a] = ?
+    REPEAT,        // r[a] = repeat(r[b], r[c])
+    REPEAT_UNDEF,  // r[a] = repeat(undef, r[c])
+    ARRAY_INIT,    // r[a] = array(r[b], ..., r[b + c - 1])
+    HALT,
+};
+
+struct Instr
+{
+    OpCode op{};
+    uint16_t n = 0; // index count of element chains
+    int32_t a = 0;
+    int32_t b = 0;
+    int32_t c = 0;
+};
+
+inline const char* opName(OpCode op)
+{
+    switch (op)
+    {
+        case OpCode::LOAD_CONST:    return "load_const";
+        case OpCode::LOAD_VAR:      return "load_var";
+        case OpCode::STORE_VAR:     return "store_var";
+        case OpCode::LOAD_ELEM:     return "load_elem";
+        case OpCode::STORE_ELEM:    return "store_elem";
+        case OpCode::LOAD_ELEM_UNCHECKED:  return "load_elem_unchecked";
+        case OpCode::STORE_ELEM_UNCHECKED: return "store_elem_unchecked";
+        case OpCode::LOAD_VAR_INT:  return "load_var_int";
+        case OpCode::LOAD_ELEM_INT: return "load_elem_int";
+        case OpCode::LOAD_ELEM_INT_UNCHECKED: return "load_elem_int_unchecked";
+        case OpCode::MOVE:          return "move";
+        case OpCode::OWN:           return "own";
+        case OpCode::ADD:           return "add";
+        case OpCode::SUB:           return "sub";
+        case OpCode::MUL:           return "mul";
+        case OpCode::DIV:           return "div";
+        case OpCode::MOD:           return "mod";
+        case OpCode::DIV_CONST:     return "div_const";
+        case OpCode::MOD_CONST:     return "mod_const";
+        case OpCode::GR:            return "gr";
+        case OpCode::LS:            return "ls";
+        case OpCode::EQ:            return "eq";
+        case OpCode::GR_EQ:         return "gr_eq";
+        case OpCode::LS_EQ:         return "ls_eq";
+        case OpCode::NOT_EQ:        return "not_eq";
+        case OpCode::AND:           return "and";
+        case OpCode::OR:            return "or";
+        case OpCode::ELEMENTWISE:   return "elementwise";
+        case OpCode::NEG:           return "neg";
+        case OpCode::NOT:           return "not";
+        case OpCode::JUMP:          return "jump";
+        case OpCode::JUMP_IF_FALSE: return "jump_if_false";
+        case OpCode::JUMP_IF_TRUE:  return "jump_if_true";
+        case OpCode::LEAVE_SCOPE:   return "leave_scope";
+        case OpCode::PRINT:         return "print";
+        case OpCode::READ:          return "read";
+        case OpCode::REPEAT:        return "repeat";
+        case OpCode::REPEAT_UNDEF:  return "repeat_undef";
+        case OpCode::ARRAY_INIT:    return "array_init";
+        case OpCode::HALT:          return "halt";
+        default:                    return "unknown";
+    }
+}
+
+inline OpCode toOpCode(BinaryOp op)
+{
+    switch (op)
+    {
+        case BinaryOp::ADD:    return OpCode::ADD;
+        case BinaryOp::SUB:    return OpCode::SUB;
+        case BinaryOp::MUL:    return OpCode::MUL;
+        case BinaryOp::DIV:    return OpCode::DIV;
+        case BinaryOp::MOD:    return OpCode::MOD;
+        case BinaryOp::GR:     return OpCode::GR;
+        case BinaryOp::LS:     return OpCode::LS;
+        case BinaryOp::EQ:     return OpCode::EQ;
+        case BinaryOp::GR_EQ:  return OpCode::GR_EQ;
+        case BinaryOp::LS_EQ:  return OpCode::LS_EQ;
+        case BinaryOp::NOT_EQ: return OpCode::NOT_EQ;
+        case BinaryOp::AND:    return OpCode::AND;
+        case BinaryOp::OR:     return OpCode::OR;
+        default:
+            throw std::runtime_error("Unknown binary operation");
+    }
+}
+
+class Program final
+{
+  public:
+    std::vector<Instr> code;
+    std::vector<Divisor> divisors;
+    FrameLayout layout;
+    int nregs = 0;
+
+  public:
+    void dump(std::ostream& os) const
+    {
+        os << "registers: " << nregs << '\n';
+
+        for (size_t pc = 0; pc < code.size(); ++pc)
+        {
+            const Instr& instr = code[pc];
+
+            os << pc << ":\t" << opName(instr.op) << ' ' << instr.a << ' '
+               << instr.b << ' ' << instr.c;
+
+            switch (instr.op)
+            {
+                case OpCode::LOAD_VAR:
+                case OpCode::STORE_VAR:
+                case OpCode::LOAD_VAR_INT:
+                    os << "\t; " << layout.name(instr.b);
+                    break;
+
+                case OpCode::LOAD_ELEM:
+                case OpCode::STORE_ELEM:
+                case OpCode::LOAD_ELEM_UNCHECKED:
+                case OpCode::STORE_ELEM_UNCHECKED:
+                case OpCode::LOAD_ELEM_INT:
+                case OpCode::LOAD_ELEM_INT_UNCHECKED:
+                    os << "\t; " << layout.name(instr.b) << ", " << instr.n
+                       << " indices";
+                    break;
+
+                case OpCode::DIV_CONST:
+                case OpCode::MOD_CONST:
+                    os << "\t; by "
+                       << divisors[static_cast<size_t>(instr.c)].value();
+                    break;
+
+                case OpCode::ELEMENTWISE:
+                    os << "\t; " << opName(toOpCode(static_cast<BinaryOp>(instr.n)));
+                    break;
+
+                case OpCode::LOAD_CONST:
+                case OpCode::MOVE:
+                case OpCode::OWN:
+                case OpCode::ADD:
+                case OpCode::SUB:
+                case OpCode::MUL:
+                case OpCode::DIV:
+                case OpCode::MOD:
+                case OpCode::GR:
+                case OpCode::LS:
+                case OpCode::EQ:
+                case OpCode::GR_EQ:
+                case OpCode::LS_EQ:
+                case OpCode::NOT_EQ:
+                case OpCode::AND:
+                case OpCode::OR:
+                case OpCode::NEG:
+                case OpCode::NOT:
+                case OpCode::JUMP:
+                case OpCode::JUMP_IF_FALSE:
+                case OpCode::JUMP_IF_TRUE:
+                case OpCode::LEAVE_SCOPE:
+                case OpCode::PRINT:
+                case OpCode::READ:
+                case OpCode::REPEAT:
+                case OpCode::REPEAT_UNDEF:
+                case OpCode::ARRAY_INIT:
+                case OpCode::HALT:
+                default:
+                    break;
+            }
+
+            os << '\n';
+        }
+    }
+};
+
+} // namespace detail
+
+} // namespace AST
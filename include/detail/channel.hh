@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace AST
+{
+
+namespace detail
+{
+
+// Bounded queue from one thread that pushes to one thread that pops. No
+// locks are taken: each side moves its own index of a ring forward with a
+// release store, and waits on the index of the other side with
+// std::atomic::wait only while the ring is full or empty.
+template <typename T>
+class Channel final
+{
+  private:
+    std::vector<T> ring_;
+    const size_t mask_;
+
+    // On lines of their own, as each is written by a different thread.
+    alignas(64) std::atomic<size_t> head_{0}; // next to pop
+    alignas(64) std::atomic<size_t> tail_{0}; // next to push
+
+  private:
+    void take(size_t head, T& item)
+    {
+        item = std::move(ring_[head & mask_]);
+
+        head_.store(head + 1, std::memory_order_release);
+        head_.notify_one();
+    }
+
+  public:
+    // capacity is a power of two.
+    explicit Channel(size_t capacity)
+        : ring_(capacity)
+        , mask_(capacity - 1)
+    {}
+
+    Channel(const Channel&) = delete;
+    Channel& operator=(const Channel&) = delete;
+
+    // Waits while the ring is full.
+    void push(T&& item)
+    {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+
+        for (size_t head = head_.load(std::memory_order_acquire);
+             tail - head == ring_.size();
+             head = head_.load(std::memory_order_acquire))
+            head_.wait(head, std::memory_order_acquire);
+
+        ring_[tail & mask_] = std::move(item);
+
+        tail_.store(tail + 1, std::memory_order_release);
+        tail_.notify_one();
+    }
+
+    // False when the ring is empty.
+    bool tryPop(T& item)
+    {
+        const size_t head = head_.load(std::memory_order_relaxed);
+
+        if (tail_.load(std::memory_order_acquire) == head)
+            return false;
+
+        take(head, item);
+
+        return true;
+    }
+
+    // Waits while the ring is empty.
+    void pop(T& item)
+    {
+        const size_t head = head_.load(std::memory_order_relaxed);
+
+        tail_.wait(head, std::memory_order_acquire);
+
+        take(head, item);
+    }
+};
+
+} // namespace detail
+
+} // namespace AST
@@ -0,0 +1,343 @@
+#pragma once
+
+#include <cstdint>
+#include <variant>
+
+#include "bytecode.hh"
+#include "effects.hh"
+#include "log.hh"
+#include "node.hh"
+#include "visitor.hh"
+
+namespace AST
+{
+
+namespace detail
+{
+
+// Lowers a scope tree to register bytecode. Registers are handed out as a
+// stack: every expression leaves its value in the register that was on top
+// when its visit started, so operands of a node occupy consecutive registers.
+class Compiler final : public Visitor
+{
+  private:
+    Program program_;
+    int top_ = 0;
+    int result_ = 0;
+
+  private:
+    int alloc()
+    {
+        const int reg = top_++;
+
+        if (top_ > program_.nregs)
+            program_.nregs = top_;
+
+        return reg;
+    }
+
+    size_t emit(OpCode op, int a = 0, int b = 0, int c = 0)
+    {
+        program_.code.push_back(Instr{op, 0, a, b, c});
+
+        return program_.code.size() - 1;
+    }
+
+    int here() const { return static_cast<int>(program_.code.size()); }
+
+    size_t emit(OpCode op, int a, const VariableNode& var)
+    {
+        const Binding& binding = var.getBinding();
+
+        return emit(op, a, binding.slot, binding.chain);
+    }
+
+    // Evaluates the indices of an element chain into consecutive registers,
+    // last dimension first, and returns their count.
+    uint16_t indices(const ArrayElemNode& node)
+    {
+        uint16_t count = 0;
+
+        for (auto elem = &node;; elem = elem->getArrayElem())
+        {
+            elem->acceptIndex(*this);
+            ++count;
+
+            if (elem->holdsVariable())
+                return count;
+        }
+    }
+
+    void emit(OpCode op, int a, const ArrayElemNode& elem, uint16_t count)
+    {
+        program_.code[emit(op, a, *elem.getBase())].n = count;
+    }
+
+    void finish(int dst)
+    {
+        top_ = dst + 1;
+        result_ = dst;
+    }
+
+  public:
+    Program compile(const ScopeNode& global, const FrameLayout& layout)
+    {
+        MSG("Compiling global scope\n");
+
+        program_.layout = layout;
+
+        global.accept(*this);
+        emit(OpCode::HALT);
+
+        return std::move(program_);
+    }
+
+    void visit(const ConstantNode& node) override
+    {
+        const int dst = alloc();
+
+        emit(OpCode::LOAD_CONST, dst, node.getVal());
+        finish(dst);
+    }
+
+    void visit(const VariableNode& node) override
+    {
+        const int dst = alloc();
+
+        emit(node.isInteger() ? OpCode::LOAD_VAR_INT : OpCode::LOAD_VAR, dst,
+             node);
+        finish(dst);
+    }
+
+    void visit(const BinaryOpNode& node) override
+    {
+        const int dst = top_;
+
+        node.accept_left(*this);
+        const int left = result_;
+
+        if (!node.isInteger())
+        {
+            // The right operand may store to the variable the left one read.
+            if (!isPure(node.getRight()))
+                emit(OpCode::OWN, left);
+
+            node.accept_right(*this);
+
+            program_.code[emit(OpCode::ELEMENTWISE, dst, left, result_)].n =
+                static_cast<uint16_t>(node.getOp());
+            finish(dst);
+            return;
+        }
+
+        // Division by a constant becomes a multiply and a shift.
+        if (auto divisor = dynamic_cast<const ConstantNode*>(node.getRight());
+            divisor && Divisor::usable(divisor->getVal()) &&
+            (node.getOp() == BinaryOp::DIV || node.getOp() == BinaryOp::MOD))
+        {
+            program_.divisors.emplace_back(divisor->getVal());
+
+            emit(node.getOp() == BinaryOp::DIV ? OpCode::DIV_CONST
+                                               : OpCode::MOD_CONST,
+                 dst, left, static_cast<int>(program_.divisors.size() - 1));
+            finish(dst);
+            return;
+        }
+
+        node.accept_right(*this);
+        const int right = result_;
+
+        emit(toOpCode(node.getOp()), dst, left, right);
+        finish(dst);
+    }
+
+    void visit(const UnaryOpNode& node) override
+    {
+        const int dst = top_;
+
+        node.acceptOperand(*this);
+
+        switch (node.getOp())
+        {
+            case UnaryOp::NEG:
+                emit(OpCode::NEG, dst, result_);
+                break;
+
+            case UnaryOp::NOT:
+                emit(OpCode::NOT, dst, result_);
+                break;
+
+            default:
+                throw std::runtime_error("Unknown unary operation");
+        }
+
+        finish(dst);
+    }
+
+    void visit(const ScopeNode& node) override
+    {
+        if (node.empty())
+            return;
+
+        for (const auto& child : node.getChildren())
+        {
+            const int base = top_;
+
+            child->accept(*this);
+
+            top_ = base;
+        }
+
+        emit(OpCode::LEAVE_SCOPE, node.slotBegin(), node.slotEnd());
+    }
+
+    void visit(const AssignNode& node) override
+    {
+        const int dst = top_;
+
+        if (auto var = std::get_if<VariablePtr>(&node.getDest()))
+        {
+            node.acceptSrc(*this);
+            emit(OpCode::STORE_VAR, dst, **var);
+
+            return finish(dst);
+        }
+
+        const auto elem = std::get<ArrayElemPtr>(node.getDest());
+        const uint16_t count = indices(*elem);
+
+        node.acceptSrc(*this);
+        const int src = result_;
+
+        emit(elem->isChecked() ? OpCode::STORE_ELEM : OpCode::STORE_ELEM_UNCHECKED,
+             src, *elem, count);
+        emit(OpCode::MOVE, dst, src);
+        finish(dst);
+    }
+
+    void visit(const ArrayElemNode& node) override
+    {
+        const int dst = top_;
+        const uint16_t count = indices(node);
+
+        if (node.isInteger())
+            emit(node.isChecked() ? OpCode::LOAD_ELEM_INT
+                                  : OpCode::LOAD_ELEM_INT_UNCHECKED,
+                 dst, node, count);
+        else
+            emit(node.isChecked() ? OpCode::LOAD_ELEM
+                                  : OpCode::LOAD_ELEM_UNCHECKED,
+                 dst, node, count);
+        finish(dst);
+    }
+
+    void visit(const WhileNode& node) override
+    {
+        const int base = top_;
+
+        // Condition is placed after the body so each iteration takes a
+        // single conditional jump.
+        const size_t toCond = emit(OpCode::JUMP);
+        const int body = here();
+
+        node.acceptScope(*this);
+        top_ = base;
+
+        program_.code[toCond].a = here();
+
+        node.acceptCond(*this);
+        emit(OpCode::JUMP_IF_TRUE, result_, body);
+
+        top_ = base;
+    }
+
+    void visit(const PforNode& node) override
+    {
+        visit(static_cast<const WhileNode&>(node));
+    }
+
+    void visit(const IfElseNode& node) override
+    {
+        const int base = top_;
+
+        if (!node.hasCond())
+        {
+            node.acceptAction(*this);
+            top_ = base;
+            return;
+        }
+
+        node.acceptCond(*this);
+        const size_t toAlt = emit(OpCode::JUMP_IF_FALSE, result_);
+        top_ = base;
+
+        node.acceptAction(*this);
+        top_ = base;
+
+        if (!node.hasAltAction())
+        {
+            program_.code[toAlt].b = here();
+            return;
+        }
+
+        const size_t toEnd = emit(OpCode::JUMP);
+        program_.code[toAlt].b = here();
+
+        node.acceptAltAction(*this);
+        top_ = base;
+
+        program_.code[toEnd].a = here();
+    }
+
+    void visit(const PrintNode& node) override
+    {
+        node.acceptExpr(*this);
+        emit(OpCode::PRINT, result_);
+    }
+
+    void visit([[maybe_unused]] const InNode& node) override
+    {
+        const int dst = alloc();
+
+        emit(OpCode::READ, dst);
+        finish(dst);
+    }
+
+    void visit(const RepeatNode& node) override
+    {
+        const int dst = top_;
+
+        node.acceptSize(*this);
+        const int size = result_;
+
+        if (node.hasElem())
+        {
+            node.acceptElem(*this);
+            emit(OpCode::REPEAT, dst, result_, size);
+        }
+        else
+            emit(OpCode::REPEAT_UNDEF, dst, 0, size);
+
+        finish(dst);
+    }
+
+    void visit(const ArrayInitNode& node) override
+    {
+        const int dst = top_;
+        const int size = static_cast<int>(node.arraySize());
+
+        // Initializer list is stored back to front, see ArrayInit rule.
+        for (int id = size - 1; id >= 0; --id)
+            node.acceptElem(static_cast<size_t>(id), *this);
+
+        if (size == 0)
+            alloc();
+
+        emit(OpCode::ARRAY_INIT, dst, dst, size);
+        finish(dst);
+    }
+};
+
+} // namespace detail
+
+} // namespace AST
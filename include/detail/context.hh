@@ -2,12 +2,17 @@
 
 #include <cstdint>
 #include <iostream>
+#include <memory>
 #include <optional>
+#include <stdexcept>
 #include <string>
-#include <unordered_map>
+#include <string_view>
 #include <vector>
 
+#include "frame.hh"
+#include "input.hh"
 #include "log.hh"
+#include "output.hh"
 #include "types.hh"
 
 namespace AST
@@ -19,71 +24,145 @@ namespace detail
 class Context final
 {
   public:
-    using VarTable = std::unordered_map<std::string_view, std::unique_ptr<IType>>;
+    std::vector<Value> frame_;
+    FrameLayout layout_;
+    Output out;
+    Input* in;
+
+  private:
+    // Set in a pfor worker: slots but the private ones are those of the
+    // context that started the loop.
+    std::vector<Value>* shared_ = nullptr;
+    const std::vector<bool>* private_ = nullptr;
+
+  private:
+    Value& at(int slot)
+    {
+        const auto index = static_cast<size_t>(slot);
 
-  public:
-    std::vector<VarTable> varTables_;
-    std::ostream &out;
+        if (shared_ && !(*private_)[index])
+            return (*shared_)[index];
 
-  public:
-    Context(std::ostream &_out = std::cout)
-        : out(_out)
-    {}
+        return frame_[index];
+    }
 
-    IType* getVarValue(std::string_view name) const
+    Value* find(const Binding& binding)
     {
-        auto iter = varTables_.rbegin();
-        auto rend = varTables_.rend();
+        if (binding.chain < 0)
+        {
+            if (!binding.resolved())
+                throw std::runtime_error("Unresolved variable\n");
 
-        for (; iter != rend; ++iter)
+            Value& slot = at(binding.slot);
+
+            return slot.isUndef() ? nullptr : &slot;
+        }
+
+        for (int id : layout_.chain(binding.chain))
         {
-            auto it = iter->find(name);
+            Value& slot = at(id);
 
-            if (it != iter->end())
-            	return it->second.get();
+            if (!slot.isUndef())
+                return &slot;
         }
 
-        throw std::runtime_error("Undeclared variable: " + std::string(name) +
+        return nullptr;
+    }
+
+  public:
+    Context(std::ostream &_out = std::cout, Flush flush = Flush::BLOCK,
+            Input &_in = Input::standard())
+        : out(_out, flush)
+        , in(&_in)
+    {}
+
+    void setLayout(const FrameLayout& layout)
+    {
+        layout_ = layout;
+
+        frame_.clear();
+        frame_.resize(static_cast<size_t>(layout_.nslots));
+    }
+
+    // Adds the slots and chains the next statement of a streamed program
+    // brings; the values of the slots there are kept.
+    void extend(const std::vector<std::string_view>& names,
+                const std::vector<std::vector<int>>& chains)
+    {
+        layout_.nslots += static_cast<int>(names.size());
+        layout_.names.insert(layout_.names.end(), names.begin(), names.end());
+        layout_.chains.insert(layout_.chains.end(), chains.begin(),
+                              chains.end());
+
+        frame_.resize(static_cast<size_t>(layout_.nslots));
+    }
+
+    // Makes this the context of a pfor worker of owner: the slots marked in
+    // privates are its own, the others are read from and written to owner.
+    void share(Context& owner, const std::vector<bool>& privates)
+    {
+        shared_ = &owner.frame_;
+        private_ = &privates;
+    }
+
+    // A slot of this context's own frame, even in a pfor worker.
+    Value& local(int slot) { return frame_[static_cast<size_t>(slot)]; }
+
+    // Slot a binding refers to while its name is bound.
+    int boundSlot(const Binding& binding)
+    {
+        if (binding.chain >= 0)
+            for (int id : layout_.chain(binding.chain))
+                if (!at(id).isUndef())
+                    return id;
+
+        return binding.slot;
+    }
+
+    const Value& getVarValue(const Binding& binding)
+    {
+        if (Value* slot = find(binding))
+            return *slot;
+
+        throw std::runtime_error("Undeclared variable: " +
+                                 std::string(layout_.name(binding.slot)) +
                                  "\n");
     }
 
-	template <typename T>
-	std::unique_ptr<IType>& getVar(std::string_view destName)
+	// Assignment target: the bound slot, or the innermost candidate when
+	// the name is not bound yet.
+	Value& getVar(const Binding& binding)
 	{
-		for (auto iter = varTables_.rbegin(); iter != varTables_.rend(); ++iter)
-		{
-			auto var_iter = iter->find(destName);
-			if (var_iter != iter->end())
-			{
-				return var_iter->second;
-			}
-		}
-
-		if (varTables_.empty())
-			throw std::runtime_error("No active scope\n");
-
-		auto& curScope = varTables_.back();
-		auto [iter, inserted] = curScope.emplace(destName, std::make_unique<T>());
-		if (!inserted)
-			throw std::logic_error("Undeclared variable was supposed to be inserted: Check code logic\n");
-
-		return iter->second;
+		if (Value* slot = find(binding))
+			return *slot;
+
+		return at(binding.slot);
 	}
 
-	std::unique_ptr<IType>& getArray(std::string_view destName)
+	Value& getArray(const Binding& binding)
 	{
-		for (auto iter = varTables_.rbegin(); iter != varTables_.rend(); ++iter)
-		{
-			auto var_iter = iter->find(destName);
-			if (var_iter != iter->end())
-			{
-				return var_iter->second;
-			}
-		}
+		if (Value* slot = find(binding))
+			return *slot;
 
 		throw std::runtime_error("Undefined Array\n");
 	}
 
+    void clearSlots(int begin, int end)
+    {
+        for (int id = begin; id < end; ++id)
+            at(id).reset();
+    }
+
+    bool varInitialized(std::string_view name) const
+    {
+        for (size_t id = 0; id < frame_.size(); ++id)
+        {
+            if (!frame_[id].isUndef() && layout_.names[id] == name)
+                return true;
+        }
+
+        return false;
+    }
 };
 
 } // namespace detail
@@ -0,0 +1,459 @@
+#pragma once
+
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "driver.hh"
+#include "node.hh"
+#include "parser.hh"
+
+namespace AST
+{
+
+namespace detail
+{
+
+// Hand-written front end for grammar/parser.yy: from the tokens yylex gives
+// it builds the tree the Bison parser builds, with the same Driver calls.
+// Statements are parsed by recursive descent and binary operators by
+// precedence climbing, with the precedences the grammar declares. As there,
+// an assignment binds to the variable or element right before "=" and takes
+// everything after it, an else belongs to the nearest if, and a lone ";" may
+// only open a list of statements.
+class DescentParser final
+{
+  private:
+    using Kind = yy::parser::symbol_kind;
+    using KindType = yy::parser::symbol_kind_type;
+
+    struct Token
+    {
+        KindType kind = Kind::S_YYEOF;
+        int value = 0; // of identifiers and numbers
+        yy::location loc;
+    };
+
+    Driver& drv_;
+    Token token_;
+
+  private:
+    [[noreturn]] static void error(const yy::location& loc,
+                                   const std::string& msg)
+    {
+        std::cerr << loc << ": " << msg << '\n';
+        throw std::runtime_error("Semantic error\n");
+    }
+
+    [[noreturn]] void unexpected(const char* expecting = nullptr) const
+    {
+        std::string msg = "syntax error, unexpected ";
+
+        msg += yy::parser::symbol_name(token_.kind);
+
+        if (expecting)
+            msg += std::string(", expecting ") + expecting;
+
+        error(token_.loc, msg);
+    }
+
+    void next()
+    {
+        try
+        {
+            yy::parser::symbol_type symbol = yylex(drv_);
+
+            token_.kind = symbol.kind();
+            token_.loc = symbol.location;
+
+            if (token_.kind == Kind::S_ID || token_.kind == Kind::S_NUMBER)
+                token_.value = symbol.value.as<int>();
+        }
+        catch (const yy::parser::syntax_error& e)
+        {
+            error(e.location, e.what());
+        }
+    }
+
+    bool is(KindType kind) const { return token_.kind == kind; }
+
+    bool accept(KindType kind)
+    {
+        if (!is(kind))
+            return false;
+
+        next();
+        return true;
+    }
+
+    void expect(KindType kind)
+    {
+        if (!accept(kind))
+            unexpected(yy::parser::symbol_name(kind));
+    }
+
+    struct Operator
+    {
+        KindType kind;
+        int precedence;
+        BinaryOp op;
+    };
+
+    // Binary operator tokens with the precedences the grammar declares.
+    static constexpr Operator operators[] = {
+        {Kind::S_OR, 1, BinaryOp::OR},
+        {Kind::S_AND, 2, BinaryOp::AND},
+        {Kind::S_EQUAL, 3, BinaryOp::EQ},
+        {Kind::S_NOT_EQUAL, 3, BinaryOp::NOT_EQ},
+        {Kind::S_GREATER, 4, BinaryOp::GR},
+        {Kind::S_LESS, 4, BinaryOp::LS},
+        {Kind::S_GREATER_E, 4, BinaryOp::GR_EQ},
+        {Kind::S_LESS_E, 4, BinaryOp::LS_EQ},
+        {Kind::S_PLUS, 5, BinaryOp::ADD},
+        {Kind::S_MINUS, 5, BinaryOp::SUB},
+        {Kind::S_STAR, 6, BinaryOp::MUL},
+        {Kind::S_SLASH, 6, BinaryOp::DIV},
+        {Kind::S_MOD, 6, BinaryOp::MOD},
+    };
+
+    // The binary operator a token stands for, null for other tokens.
+    static const Operator* binary(KindType kind)
+    {
+        const auto found = std::find_if(
+            std::begin(operators), std::end(operators),
+            [kind](const Operator& op) { return op.kind == kind; });
+
+        return found == std::end(operators) ? nullptr : found;
+    }
+
+    // Statements up to end.
+    std::vector<StmtPtr> statements(KindType end)
+    {
+        std::vector<StmtPtr> stms;
+
+        accept(Kind::S_SEMIC);
+
+        while (!is(end))
+            stms.push_back(statement());
+
+        return stms;
+    }
+
+    StmtPtr statement()
+    {
+        if (accept(Kind::S_LCPAREN))
+        {
+            std::vector<StmtPtr> stms = statements(Kind::S_RCPAREN);
+
+            next();
+
+            return drv_.construct<ScopeNode>(std::move(stms));
+        }
+
+        if (accept(Kind::S_IF))
+            return ifElse();
+
+        if (is(Kind::S_WHILE))
+            return loop();
+
+        if (is(Kind::S_PFOR))
+            return pfor();
+
+        const bool print = accept(Kind::S_PRINT);
+        ExprPtr expr = expression();
+
+        expect(Kind::S_SEMIC);
+
+        if (print)
+            return drv_.construct<PrintNode>(expr);
+
+        return expr;
+    }
+
+    // The rest of if or else if after the keyword.
+    IfElseNode* ifElse()
+    {
+        expect(Kind::S_LPAREN);
+
+        ExprPtr cond = expression();
+
+        expect(Kind::S_RPAREN);
+
+        StmtPtr action = statement();
+
+        if (accept(Kind::S_ELSE))
+            return drv_.construct<IfElseNode>(
+                cond, action, drv_.construct<IfElseNode>(statement()));
+
+        if (accept(Kind::S_ELSEIF))
+            return drv_.construct<IfElseNode>(cond, action, ifElse());
+
+        return drv_.construct<IfElseNode>(cond, action);
+    }
+
+    WhileNode* loop()
+    {
+        const int line = token_.loc.begin.line;
+
+        next();
+        expect(Kind::S_LPAREN);
+
+        ExprPtr cond = expression();
+
+        expect(Kind::S_RPAREN);
+
+        WhileNode* node = drv_.construct<WhileNode>(cond, statement());
+
+        node->setLine(line);
+
+        return node;
+    }
+
+    StmtPtr pfor()
+    {
+        next();
+        expect(Kind::S_LPAREN);
+
+        VariableNode* var = variable();
+
+        expect(Kind::S_ASSIGN);
+
+        ExprPtr begin = expression();
+
+        expect(Kind::S_SEMIC);
+
+        const yy::location at = token_.loc;
+        VariableNode* tested = variable();
+
+        expect(Kind::S_LESS);
+
+        ExprPtr end = expression();
+
+        std::vector<std::string_view> reductions;
+
+        if (accept(Kind::S_SEMIC))
+        {
+            do
+            {
+                if (!is(Kind::S_ID))
+                    unexpected(yy::parser::symbol_name(Kind::S_ID));
+
+                reductions.push_back(drv_.symbolName(token_.value));
+                next();
+            } while (accept(Kind::S_COMMA));
+        }
+
+        expect(Kind::S_RPAREN);
+
+        StmtPtr body = statement();
+
+        // Checked once the loop is parsed, as the grammar action does.
+        if (tested->getName() != var->getName())
+            error(at, "pfor condition must test the loop variable");
+
+        return drv_.makePfor(var, begin, end, body, std::move(reductions));
+    }
+
+    VariableNode* variable()
+    {
+        if (!is(Kind::S_ID))
+            unexpected(yy::parser::symbol_name(Kind::S_ID));
+
+        VariableNode* var =
+            drv_.construct<VariableNode>(drv_.symbolName(token_.value));
+
+        next();
+
+        return var;
+    }
+
+    ExprPtr expression(int lowest = 1)
+    {
+        ExprPtr left = unary();
+
+        for (const Operator* op = binary(token_.kind);
+             op && op->precedence >= lowest; op = binary(token_.kind))
+        {
+            next();
+
+            // All binary operators associate to the left.
+            ExprPtr right = expression(op->precedence + 1);
+
+            left = drv_.construct<BinaryOpNode>(left, op->op, right);
+        }
+
+        return left;
+    }
+
+    ExprPtr unary()
+    {
+        if (accept(Kind::S_MINUS))
+            return drv_.construct<UnaryOpNode>(unary(), UnaryOp::NEG);
+
+        if (accept(Kind::S_NOT))
+            return drv_.construct<UnaryOpNode>(unary(), UnaryOp::NOT);
+
+        return primary();
+    }
+
+    ExprPtr primary()
+    {
+        if (accept(Kind::S_LPAREN))
+        {
+            ExprPtr expr = expression();
+
+            expect(Kind::S_RPAREN);
+
+            return expr;
+        }
+
+        if (is(Kind::S_NUMBER))
+        {
+            ExprPtr constant = drv_.construct<ConstantNode>(token_.value);
+
+            next();
+
+            return constant;
+        }
+
+        if (accept(Kind::S_READ))
+            return drv_.construct<InNode>();
+
+        if (is(Kind::S_ID))
+            return target();
+
+        unexpected();
+    }
+
+    // A variable or an element, assigned to when "=" follows.
+    ExprPtr target()
+    {
+        VariableNode* var = variable();
+
+        if (!is(Kind::S_LSPAREN))
+        {
+            if (is(Kind::S_ASSIGN))
+                return assign(var, true);
+
+            return var;
+        }
+
+        ArrayElemNode* elem = nullptr;
+
+        while (accept(Kind::S_LSPAREN))
+        {
+            ExprPtr index = expression();
+
+            expect(Kind::S_RSPAREN);
+
+            elem = elem ? drv_.construct<ArrayElemNode>(elem, index)
+                        : drv_.construct<ArrayElemNode>(var, index);
+        }
+
+        if (is(Kind::S_ASSIGN))
+            return assign(elem, false);
+
+        return elem;
+    }
+
+    // dest = ..., where only a variable may be given array(...).
+    AssignNode* assign(Lhs dest, bool arrays)
+    {
+        next();
+
+        if (is(Kind::S_REPEAT))
+            return drv_.construct<AssignNode>(dest, repeat());
+
+        if (arrays && is(Kind::S_ARRAY))
+            return drv_.construct<AssignNode>(dest, arrayInit());
+
+        return drv_.construct<AssignNode>(dest, expression());
+    }
+
+    RepeatNode* repeat()
+    {
+        next();
+        expect(Kind::S_LPAREN);
+
+        Rhs elem = static_cast<ExprPtr>(nullptr);
+        const bool undef = accept(Kind::S_UNDEF);
+
+        if (!undef)
+        {
+            if (is(Kind::S_REPEAT))
+                elem = repeat();
+            else
+                elem = expression();
+        }
+
+        expect(Kind::S_COMMA);
+
+        ExprPtr size = expression();
+
+        expect(Kind::S_RPAREN);
+
+        if (undef)
+            return drv_.construct<RepeatNode>(size);
+
+        return drv_.construct<RepeatNode>(elem, size);
+    }
+
+    ArrayInitNode* arrayInit()
+    {
+        next();
+        expect(Kind::S_LPAREN);
+
+        std::vector<ExprPtr> elems;
+
+        // Elements, of which the last may be followed by a comma.
+        while (!is(Kind::S_RPAREN))
+        {
+            elems.push_back(expression());
+
+            if (!accept(Kind::S_COMMA))
+                break;
+        }
+
+        expect(Kind::S_RPAREN);
+
+        // The grammar collects them from the last one.
+        std::reverse(elems.begin(), elems.end());
+
+        return drv_.construct<ArrayInitNode>(std::move(elems));
+    }
+
+  public:
+    explicit DescentParser(Driver& drv)
+        : drv_(drv)
+    {}
+
+    // Parses the whole input into the global scope of the driver.
+    int parse()
+    {
+        next();
+
+        // Each statement is handed on once complete, as the grammar does.
+        accept(Kind::S_SEMIC);
+
+        while (!is(Kind::S_YYEOF))
+            drv_.pushStatement(statement());
+
+        drv_.formGlobalScope();
+
+        return 0;
+    }
+};
+
+} // namespace detail
+
+} // namespace AST
+
+inline int Driver::parseByDescent()
+{
+    return AST::detail::DescentParser(*this).parse();
+}
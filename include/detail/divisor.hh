@@ -0,0 +1,108 @@
+#pragma once
+
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+
+namespace AST
+{
+
+namespace detail
+{
+
+// Signed division by a constant as a multiply-high and a shift
+// (Hacker's Delight, 10-1). Rounds toward zero like operator/.
+class Divisor final
+{
+  private:
+    int divisor_ = 0;
+    int magic_ = 0;
+    int shift_ = 0;
+
+  public:
+    // 0 and 1 are left to the generic path, and so is -1: INT_MIN / -1
+    // overflows.
+    static bool usable(int divisor)
+    {
+        return divisor != 0 && divisor != 1 && divisor != -1 &&
+               divisor != INT_MIN;
+    }
+
+    explicit Divisor(int divisor)
+        : divisor_(divisor)
+    {
+        constexpr uint32_t two31 = 0x80000000u;
+
+        const uint32_t ad = static_cast<uint32_t>(std::abs(divisor));
+        const uint32_t t = two31 + (static_cast<uint32_t>(divisor) >> 31);
+        const uint32_t anc = t - 1 - t % ad;
+
+        int p = 31;
+
+        uint32_t q1 = two31 / anc;
+        uint32_t r1 = two31 - q1 * anc;
+        uint32_t q2 = two31 / ad;
+        uint32_t r2 = two31 - q2 * ad;
+        uint32_t delta = 0;
+
+        do
+        {
+            ++p;
+
+            q1 *= 2;
+            r1 *= 2;
+
+            if (r1 >= anc)
+            {
+                ++q1;
+                r1 -= anc;
+            }
+
+            q2 *= 2;
+            r2 *= 2;
+
+            if (r2 >= ad)
+            {
+                ++q2;
+                r2 -= ad;
+            }
+
+            delta = ad - r2;
+        } while (q1 < delta || (q1 == delta && r1 == 0));
+
+        const uint32_t magic = q2 + 1;
+
+        magic_ = static_cast<int>(divisor < 0 ? -magic : magic);
+        shift_ = p - 32;
+    }
+
+    int value() const { return divisor_; }
+
+    int divide(int n) const
+    {
+        const int64_t product = static_cast<int64_t>(magic_) * n;
+
+        auto q = static_cast<uint32_t>(product >> 32);
+
+        if (divisor_ > 0 && magic_ < 0)
+            q += static_cast<uint32_t>(n);
+        else if (divisor_ < 0 && magic_ > 0)
+            q -= static_cast<uint32_t>(n);
+
+        const int shifted = static_cast<int>(q) >> shift_;
+
+        return shifted + static_cast<int>(static_cast<uint32_t>(shifted) >> 31);
+    }
+
+    int modulo(int n) const
+    {
+        const uint32_t product = static_cast<uint32_t>(divide(n)) *
+                                 static_cast<uint32_t>(divisor_);
+
+        return static_cast<int>(static_cast<uint32_t>(n) - product);
+    }
+};
+
+} // namespace detail
+
+} // namespace AST
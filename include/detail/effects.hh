@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <variant>
+
+#include "node.hh"
+
+namespace AST
+{
+
+namespace detail
+{
+
+// Evaluates to an integer whenever it evaluates at all. Binary operators
+// on arrays yield arrays.
+inline bool producesInt(ExprPtr expr)
+{
+    if (auto binary = dynamic_cast<const BinaryOpNode*>(expr))
+        return producesInt(binary->getLeft()) && producesInt(binary->getRight());
+
+    return dynamic_cast<const ConstantNode*>(expr) ||
+           dynamic_cast<const UnaryOpNode*>(expr) ||
+           dynamic_cast<const InNode*>(expr);
+}
+
+// True when evaluating expr can neither fail nor have an effect, so it may
+// be dropped or moved. Only holds on a resolved tree: a variable read is
+// pure when the resolver proved the name bound there.
+inline bool isPure(ExprPtr expr)
+{
+    if (dynamic_cast<const ConstantNode*>(expr))
+        return true;
+
+    if (auto var = dynamic_cast<const VariableNode*>(expr))
+        return var->getBinding().sure;
+
+    if (auto unary = dynamic_cast<const UnaryOpNode*>(expr))
+        return isPure(unary->getOperand());
+
+    auto binary = dynamic_cast<const BinaryOpNode*>(expr);
+
+    // Operands of an elementwise operation may differ in size.
+    if (!binary || !binary->isInteger() || !isPure(binary->getLeft()) ||
+        !isPure(binary->getRight()))
+        return false;
+
+    if (binary->getOp() != BinaryOp::DIV && binary->getOp() != BinaryOp::MOD)
+        return true;
+
+    auto divisor = dynamic_cast<const ConstantNode*>(binary->getRight());
+
+    return divisor && divisor->getVal() != 0 && divisor->getVal() != -1;
+}
+
+inline bool isPure(const Rhs& rhs)
+{
+    if (auto expr = std::get_if<ExprPtr>(&rhs))
+        return isPure(*expr);
+
+    if (auto init = std::get_if<ArrayInitPtr>(&rhs))
+    {
+        for (size_t id = 0; id < (*init)->arraySize(); ++id)
+            if (!isPure((*init)->getElem(id)))
+                return false;
+
+        return true;
+    }
+
+    const RepeatNode& repeat = *std::get<RepeatPtr>(rhs);
+    auto size = dynamic_cast<const ConstantNode*>(repeat.getSize());
+
+    return size && size->getVal() >= 0 &&
+           (!repeat.hasElem() || isPure(repeat.getElem()));
+}
+
+} // namespace detail
+
+} // namespace AST
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "log.hh"
+#include "node.hh"
+#include "simd.hh"
+#include "types.hh"
+
+namespace AST
+{
+
+namespace detail
+{
+
+// Applies a binary operator to two integers, or elementwise once either
+// operand is an array: an integer operand stands for every element of the
+// other one, and two arrays must have the same shape. Flat arrays go through
+// the vector kernels, ragged ones element by element.
+inline Value elementwise(BinaryOp op, const Value& left, const Value& right)
+{
+    if (left.isUndef() || right.isUndef())
+        throw std::runtime_error("Undefined array element\n");
+
+    if (left.isInt() && right.isInt())
+    {
+        const int l = left.getInt();
+        const int r = right.getInt();
+        int result = 0;
+
+        kernel(op, Broadcast::NONE, Isa::SCALAR)(&l, &r, &result, 1);
+
+        return result;
+    }
+
+    const Array* l = left.getArray();
+    const Array* r = right.getArray();
+
+    if (l && r && l->size() != r->size())
+        throw std::runtime_error("Array sizes do not match\n");
+
+    if ((!l || l->isFlat()) && (!r || r->isFlat()))
+    {
+        const Array& shaped = l ? *l : *r;
+
+        if (l && r && l->shape() != r->shape())
+            throw std::runtime_error("Array sizes do not match\n");
+
+        const int lone = l ? 0 : left.getInt();
+        const int rone = r ? 0 : right.getInt();
+        const Broadcast mode =
+            !l ? Broadcast::LEFT : (!r ? Broadcast::RIGHT : Broadcast::NONE);
+
+        std::vector<int> shape = shaped.shape();
+        std::vector<int> result(shaped.elements().size());
+
+        kernel(op, mode)(l ? l->elements().data() : &lone,
+                         r ? r->elements().data() : &rone, result.data(),
+                         result.size());
+
+        return Value(Array(std::move(shape), std::move(result)));
+    }
+
+    MSG("Elementwise operation on a ragged array\n");
+
+    const size_t size = l ? l->size() : r->size();
+    std::vector<Value> data;
+    Value lelem;
+    Value relem;
+
+    data.reserve(size);
+
+    for (size_t id = 0; id < size; ++id)
+    {
+        const int index = static_cast<int>(id);
+
+        if (l)
+            l->read(&index, 1, lelem);
+
+        if (r)
+            r->read(&index, 1, relem);
+
+        data.push_back(elementwise(op, l ? lelem : left, r ? relem : right));
+    }
+
+    return Value(Array(std::move(data)));
+}
+
+} // namespace detail
+
+} // namespace AST
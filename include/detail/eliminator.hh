@@ -0,0 +1,349 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <variant>
+#include <vector>
+
+#include "effects.hh"
+#include "frame.hh"
+#include "log.hh"
+#include "node.hh"
+#include "slots.hh"
+#include "visitor.hh"
+
+namespace AST
+{
+
+namespace detail
+{
+
+struct ElimStats
+{
+    size_t branches = 0;   // constant or empty branches and loops removed
+    size_t scopes = 0;     // empty scopes removed
+    size_t statements = 0; // dead stores and effect-free statements removed
+};
+
+// Removes code whose absence cannot be observed. Runs on a resolved tree:
+// liveness is tracked per frame slot, walking each scope backwards.
+//
+// A statement is only dropped when it can neither fail nor have an effect.
+// Reads of variables that may be unbound, element reads, division by a
+// non-constant and input all stay, so every runtime error is preserved.
+class Eliminator final : public Visitor
+{
+  private:
+    const FrameLayout& layout_;
+    ElimStats stats_;
+
+    std::vector<bool> live_;
+    bool final_ = true;     // false while a loop iterates to a fixed point
+    bool removable_ = false; // the parent drops the current statement on request
+    StmtPtr result_ = nullptr;
+
+  private:
+    static const ConstantNode* asConst(ExprPtr expr)
+    {
+        return dynamic_cast<const ConstantNode*>(expr);
+    }
+
+    static bool isEmpty(StmtPtr stmt)
+    {
+        auto scope = dynamic_cast<const ScopeNode*>(stmt);
+
+        return scope && scope->empty();
+    }
+
+    std::vector<bool>::reference live(int slot)
+    {
+        return live_[static_cast<size_t>(slot)];
+    }
+
+    void use(const Binding& binding)
+    {
+        if (binding.chain < 0)
+        {
+            live(binding.slot) = true;
+            return;
+        }
+
+        for (const int slot : layout_.chain(binding.chain))
+            live(slot) = true;
+    }
+
+    void kill(int begin, int end)
+    {
+        std::fill(live_.begin() + begin, live_.begin() + end, false);
+    }
+
+    void merge(const std::vector<bool>& other)
+    {
+        for (size_t slot = 0; slot < live_.size(); ++slot)
+            live_[slot] = live_[slot] || other[slot];
+    }
+
+    // Returns the statement to keep in place of stmt, nullptr once removed.
+    // Without permission to remove, stmt itself is returned.
+    StmtPtr statement(StmtPtr stmt, bool removable)
+    {
+        const bool saved = removable_;
+
+        removable_ = removable && final_;
+        result_ = stmt;
+
+        if (auto assign = dynamic_cast<const AssignNode*>(stmt))
+            store(*assign);
+        else if (auto expr = dynamic_cast<ExprPtr>(stmt);
+                 expr && removable_ && isPure(expr))
+        {
+            ++stats_.statements;
+            result_ = nullptr;
+        }
+        else
+            stmt->accept(*this);
+
+        removable_ = saved;
+
+        return result_;
+    }
+
+    // Assignment whose value is discarded.
+    void store(const AssignNode& node)
+    {
+        auto var = std::get_if<VariablePtr>(&node.getDest());
+
+        if (!var || (*var)->getBinding().chain >= 0)
+        {
+            node.accept(*this);
+            return;
+        }
+
+        const int slot = (*var)->getBinding().slot;
+
+        if (removable_ && !live(slot) && isPure(node.getSrc()))
+        {
+            ++stats_.statements;
+            result_ = nullptr;
+            return;
+        }
+
+        live(slot) = false;
+        node.acceptSrc(*this);
+    }
+
+  public:
+    explicit Eliminator(const FrameLayout& layout)
+        : layout_(layout)
+        , live_(static_cast<size_t>(layout.nslots), false)
+    {}
+
+    ElimStats run(const ScopeNode& global)
+    {
+        MSG("Eliminating dead code\n");
+
+        statement(&edit(global), false);
+
+        LOG("Removed {} branches, {} scopes, {} statements\n", stats_.branches,
+            stats_.scopes, stats_.statements);
+
+        return stats_;
+    }
+
+    void visit([[maybe_unused]] const ConstantNode& node) override {}
+
+    void visit(const VariableNode& node) override { use(node.getBinding()); }
+
+    void visit([[maybe_unused]] const InNode& node) override {}
+
+    void visit(const BinaryOpNode& node) override
+    {
+        node.accept_left(*this);
+        node.accept_right(*this);
+    }
+
+    void visit(const UnaryOpNode& node) override { node.acceptOperand(*this); }
+
+    void visit(const ArrayElemNode& node) override
+    {
+        for (auto elem = &node;; elem = elem->getArrayElem())
+        {
+            elem->acceptIndex(*this);
+
+            if (elem->holdsVariable())
+                return use(elem->getVariable()->getBinding());
+        }
+    }
+
+    // Only reached for assignments used as a value; they stay.
+    void visit(const AssignNode& node) override
+    {
+        if (auto elem = std::get_if<ArrayElemPtr>(&node.getDest()))
+            (*elem)->accept(*this);
+
+        node.acceptSrc(*this);
+    }
+
+    void visit(const ScopeNode& node) override
+    {
+        ScopeNode& self = edit(node);
+        const bool removable = removable_;
+        const std::vector<StmtPtr>& children = node.getChildren();
+
+        kill(node.slotBegin(), node.slotEnd());
+
+        std::vector<StmtPtr> kept;
+        kept.reserve(children.size());
+
+        for (size_t id = children.size(); id-- > 0;)
+            if (StmtPtr stmt = statement(children[id], true))
+                kept.push_back(stmt);
+
+        kill(node.slotBegin(), node.slotEnd());
+
+        if (final_)
+        {
+            std::reverse(kept.begin(), kept.end());
+            self.setChildren(std::move(kept));
+        }
+
+        result_ = &self;
+
+        if (removable && node.empty())
+        {
+            ++stats_.scopes;
+            result_ = nullptr;
+        }
+    }
+
+    void visit(const WhileNode& node) override
+    {
+        const ConstantNode* cond = asConst(node.getCond());
+
+        if (cond && cond->getVal() == 0)
+        {
+            result_ = &edit(node);
+
+            if (removable_)
+            {
+                ++stats_.branches;
+                result_ = nullptr;
+            }
+
+            return;
+        }
+
+        const std::vector<bool> after = live_;
+        const bool wasFinal = final_;
+
+        node.acceptCond(*this);
+
+        std::vector<bool> head = live_;
+
+        final_ = false;
+
+        while (true)
+        {
+            statement(node.getScope(), false);
+            merge(after);
+            node.acceptCond(*this);
+
+            if (live_ == head)
+                break;
+
+            head = live_;
+        }
+
+        final_ = wasFinal;
+
+        statement(node.getScope(), false);
+
+        live_ = head;
+        result_ = &edit(node);
+    }
+
+    void visit(const PforNode& node) override
+    {
+        visit(static_cast<const WhileNode&>(node));
+    }
+
+    void visit(const IfElseNode& node) override
+    {
+        IfElseNode& self = edit(node);
+        const bool removable = removable_;
+
+        if (!node.hasCond())
+        {
+            StmtPtr action = statement(node.getAction(), removable);
+
+            result_ = removable ? action : &self;
+            return;
+        }
+
+        if (const ConstantNode* cond = asConst(node.getCond()))
+        {
+            StmtPtr taken =
+                cond->getVal() ? node.getAction() : node.getAltAction();
+
+            if (!removable)
+            {
+                if (taken)
+                    statement(taken, false);
+
+                result_ = &self;
+                return;
+            }
+
+            ++stats_.branches;
+            result_ = taken ? statement(taken, true) : nullptr;
+            return;
+        }
+
+        const std::vector<bool> after = live_;
+
+        statement(node.getAction(), false);
+
+        if (node.hasAltAction())
+        {
+            std::vector<bool> action = std::move(live_);
+
+            live_ = after;
+            statement(node.getAltAction(), false);
+            merge(action);
+        }
+        else
+            merge(after);
+
+        node.acceptCond(*this);
+
+        result_ = &self;
+
+        if (removable && isEmpty(node.getAction()) &&
+            (!node.hasAltAction() || isEmpty(node.getAltAction())) &&
+            isPure(node.getCond()))
+        {
+            ++stats_.branches;
+            result_ = nullptr;
+        }
+    }
+
+    void visit(const PrintNode& node) override { node.acceptExpr(*this); }
+
+    void visit(const RepeatNode& node) override
+    {
+        node.acceptSize(*this);
+
+        if (node.hasElem())
+            node.acceptElem(*this);
+    }
+
+    void visit(const ArrayInitNode& node) override
+    {
+        for (size_t id = 0; id < node.arraySize(); ++id)
+            node.acceptElem(id, *this);
+    }
+};
+
+} // namespace detail
+
+} // namespace AST
@@ -0,0 +1,307 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <variant>
+#include <vector>
+
+#include "divisor.hh"
+#include "frame.hh"
+#include "log.hh"
+#include "node.hh"
+#include "visitor.hh"
+
+namespace AST
+{
+
+namespace detail
+{
+
+// Fixed-size node of the flattened tree. Children are 32-bit indices into
+// FlatAst::nodes; variable length operand lists live in FlatAst::lists.
+struct FlatNode
+{
+    enum class Kind : uint8_t
+    {
+        CONST,        // a = value
+        VAR,          // a = slot, b = chain
+        BINARY,       // op, a = left, b = right
+        UNARY,        // op, a = operand
+        ASSIGN,       // a = src, b = slot, c = chain
+        ASSIGN_ELEM,  // lists[a, a + count) = indices, lists[a + count] = src,
+                      // op = checked
+        ELEM,         // lists[a, a + count) = indices, b = slot, c = chain,
+                      // op = checked
+        VAR_INT,      // VAR proven to hold an integer
+        ELEM_INT,     // ELEM proven to be an integer
+        SCOPE,        // lists[a], lists[a + 1] = slot range, then b children
+        WHILE,        // a = cond, b = body
+        IF,           // a = cond or NONE, b = action, c = alternative or NONE
+        PRINT,        // a = expr
+        READ,
+        REPEAT,       // a = size, b = elem
+        REPEAT_UNDEF, // a = size
+        ARRAY_INIT,   // lists[a, a + b) = elements
+        DIV_CONST,    // op, a = left, b = index into FlatAst::divisors
+        ELEMENTWISE,  // BINARY on arrays as well
+    };
+
+    static constexpr uint32_t NONE = std::numeric_limits<uint32_t>::max();
+
+    Kind kind{};
+    uint8_t op = 0;
+    uint16_t count = 0; // indices of an element chain, last dimension first
+    uint32_t a = 0;
+    uint32_t b = 0;
+    uint32_t c = 0;
+};
+
+class FlatAst final
+{
+  public:
+    std::vector<FlatNode> nodes;
+    std::vector<uint32_t> lists;
+    std::vector<Divisor> divisors;
+    FrameLayout layout;
+    uint32_t root = FlatNode::NONE;
+
+  public:
+    size_t bytes() const
+    {
+        return nodes.size() * sizeof(FlatNode) + lists.size() * sizeof(uint32_t);
+    }
+};
+
+// Builds a FlatAst from the pointer tree after resolution.
+class Flattener final : public Visitor
+{
+  private:
+    FlatAst ast_;
+    uint32_t result_ = FlatNode::NONE;
+
+  private:
+    uint32_t add(FlatNode node)
+    {
+        ast_.nodes.push_back(node);
+
+        return result_ = static_cast<uint32_t>(ast_.nodes.size() - 1);
+    }
+
+    uint32_t buildNode(const INode& node)
+    {
+        node.accept(*this);
+
+        return result_;
+    }
+
+    template <typename Accept>
+    uint32_t build(Accept&& accept)
+    {
+        accept(*this);
+
+        return result_;
+    }
+
+    uint32_t addList(const std::vector<uint32_t>& ids)
+    {
+        const auto first = static_cast<uint32_t>(ast_.lists.size());
+
+        ast_.lists.insert(ast_.lists.end(), ids.begin(), ids.end());
+
+        return first;
+    }
+
+    static uint32_t slot(const VariableNode& var)
+    {
+        return static_cast<uint32_t>(var.getBinding().slot);
+    }
+
+    static uint32_t chain(const VariableNode& var)
+    {
+        return static_cast<uint32_t>(var.getBinding().chain);
+    }
+
+    std::vector<uint32_t> indices(const ArrayElemNode& node)
+    {
+        std::vector<uint32_t> ids;
+
+        for (auto elem = &node;; elem = elem->getArrayElem())
+        {
+            ids.push_back(build([elem](Visitor& v) { elem->acceptIndex(v); }));
+
+            if (elem->holdsVariable())
+                return ids;
+        }
+    }
+
+  public:
+    FlatAst flatten(const ScopeNode& global, const FrameLayout& layout)
+    {
+        MSG("Flattening global scope\n");
+
+        ast_.layout = layout;
+        ast_.root = buildNode(global);
+
+        return std::move(ast_);
+    }
+
+    void visit(const ConstantNode& node) override
+    {
+        add({FlatNode::Kind::CONST, 0, 0, static_cast<uint32_t>(node.getVal())});
+    }
+
+    void visit(const VariableNode& node) override
+    {
+        add({node.isInteger() ? FlatNode::Kind::VAR_INT : FlatNode::Kind::VAR, 0,
+             0, slot(node), chain(node)});
+    }
+
+    void visit(const BinaryOpNode& node) override
+    {
+        const uint32_t left = build([&](Visitor& v) { node.accept_left(v); });
+
+        if (auto divisor = dynamic_cast<const ConstantNode*>(node.getRight());
+            divisor && Divisor::usable(divisor->getVal()) && node.isInteger() &&
+            (node.getOp() == BinaryOp::DIV || node.getOp() == BinaryOp::MOD))
+        {
+            ast_.divisors.emplace_back(divisor->getVal());
+
+            add({FlatNode::Kind::DIV_CONST, static_cast<uint8_t>(node.getOp()),
+                 0, left, static_cast<uint32_t>(ast_.divisors.size() - 1)});
+            return;
+        }
+        const uint32_t right = build([&](Visitor& v) { node.accept_right(v); });
+
+        add({node.isInteger() ? FlatNode::Kind::BINARY : FlatNode::Kind::ELEMENTWISE,
+             static_cast<uint8_t>(node.getOp()), 0, left, right});
+    }
+
+    void visit(const UnaryOpNode& node) override
+    {
+        const uint32_t operand =
+            build([&](Visitor& v) { node.acceptOperand(v); });
+
+        add({FlatNode::Kind::UNARY, static_cast<uint8_t>(node.getOp()), 0,
+             operand});
+    }
+
+    void visit(const ScopeNode& node) override
+    {
+        std::vector<uint32_t> ids = {static_cast<uint32_t>(node.slotBegin()),
+                                     static_cast<uint32_t>(node.slotEnd())};
+
+        for (const auto& child : node.getChildren())
+            ids.push_back(buildNode(*child));
+
+        add({FlatNode::Kind::SCOPE, 0, 0, addList(ids),
+             static_cast<uint32_t>(node.nstms())});
+    }
+
+    void visit(const AssignNode& node) override
+    {
+        if (auto var = std::get_if<VariablePtr>(&node.getDest()))
+        {
+            const uint32_t src = build([&](Visitor& v) { node.acceptSrc(v); });
+
+            add({FlatNode::Kind::ASSIGN, 0, 0, src, slot(**var), chain(**var)});
+            return;
+        }
+
+        const auto elem = std::get<ArrayElemPtr>(node.getDest());
+
+        std::vector<uint32_t> ids = indices(*elem);
+        const auto count = static_cast<uint16_t>(ids.size());
+
+        ids.push_back(build([&](Visitor& v) { node.acceptSrc(v); }));
+
+        const VariableNode& base = *elem->getBase();
+
+        add({FlatNode::Kind::ASSIGN_ELEM, elem->isChecked(), count,
+             addList(ids), slot(base), chain(base)});
+    }
+
+    void visit(const ArrayElemNode& node) override
+    {
+        const std::vector<uint32_t> ids = indices(node);
+        const VariableNode& base = *node.getBase();
+
+        add({node.isInteger() ? FlatNode::Kind::ELEM_INT : FlatNode::Kind::ELEM,
+             node.isChecked(),
+             static_cast<uint16_t>(ids.size()), addList(ids), slot(base),
+             chain(base)});
+    }
+
+    void visit(const WhileNode& node) override
+    {
+        const uint32_t cond = build([&](Visitor& v) { node.acceptCond(v); });
+        const uint32_t body = build([&](Visitor& v) { node.acceptScope(v); });
+
+        add({FlatNode::Kind::WHILE, 0, 0, cond, body});
+    }
+
+    void visit(const PforNode& node) override
+    {
+        visit(static_cast<const WhileNode&>(node));
+    }
+
+    void visit(const IfElseNode& node) override
+    {
+        uint32_t cond = FlatNode::NONE;
+        uint32_t alt = FlatNode::NONE;
+
+        if (node.hasCond())
+            cond = build([&](Visitor& v) { node.acceptCond(v); });
+
+        const uint32_t action =
+            build([&](Visitor& v) { node.acceptAction(v); });
+
+        if (node.hasAltAction())
+            alt = build([&](Visitor& v) { node.acceptAltAction(v); });
+
+        add({FlatNode::Kind::IF, 0, 0, cond, action, alt});
+    }
+
+    void visit(const PrintNode& node) override
+    {
+        const uint32_t expr = build([&](Visitor& v) { node.acceptExpr(v); });
+
+        add({FlatNode::Kind::PRINT, 0, 0, expr});
+    }
+
+    void visit([[maybe_unused]] const InNode& node) override
+    {
+        add({FlatNode::Kind::READ});
+    }
+
+    void visit(const RepeatNode& node) override
+    {
+        const uint32_t size = build([&](Visitor& v) { node.acceptSize(v); });
+
+        if (!node.hasElem())
+        {
+            add({FlatNode::Kind::REPEAT_UNDEF, 0, 0, size});
+            return;
+        }
+
+        const uint32_t elem = build([&](Visitor& v) { node.acceptElem(v); });
+
+        add({FlatNode::Kind::REPEAT, 0, 0, size, elem});
+    }
+
+    void visit(const ArrayInitNode& node) override
+    {
+        std::vector<uint32_t> ids;
+
+        // Initializer list is stored back to front, see ArrayInit rule.
+        for (size_t id = node.arraySize(); id-- > 0;)
+            ids.push_back(build([&](Visitor& v) { node.acceptElem(id, v); }));
+
+        add({FlatNode::Kind::ARRAY_INIT, 0, 0, addList(ids),
+             static_cast<uint32_t>(ids.size())});
+    }
+};
+
+} // namespace detail
+
+} // namespace AST
@@ -0,0 +1,380 @@
+#pragma once
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+#include "arithmetic.hh"
+#include "context.hh"
+#include "divisor.hh"
+#include "elementwise.hh"
+#include "flat.hh"
+#include "log.hh"
+#include "types.hh"
+
+namespace AST
+{
+
+namespace detail
+{
+
+// Walks a FlatAst with a switch over node kinds. Integer expressions are
+// evaluated straight into ints; anything that may produce an array goes
+// through buf_ the same way the tree interpreter does it.
+class FlatInterpreter final
+{
+  private:
+    using Kind = FlatNode::Kind;
+
+  private:
+    detail::Context ctx_;
+    const FlatNode* nodes_ = nullptr;
+    const uint32_t* lists_ = nullptr;
+    const Divisor* divisors_ = nullptr;
+
+    const Value* buf_{};
+    Value storage_;
+    std::vector<int> indices_;
+
+  private:
+    static Binding binding(uint32_t slot, uint32_t chain)
+    {
+        return Binding{static_cast<int>(slot), static_cast<int>(chain)};
+    }
+
+    void setResult(int value)
+    {
+        storage_ = value;
+        buf_ = &storage_;
+    }
+
+    void setResult(Value&& value)
+    {
+        storage_ = std::move(value);
+        buf_ = &storage_;
+    }
+
+    Value take()
+    {
+        if (buf_ == &storage_)
+            return std::move(storage_);
+
+        return *buf_;
+    }
+
+    // Evaluates the indices of an element chain onto indices_ in dimension
+    // order and returns where they start.
+    size_t pushIndices(const FlatNode& node)
+    {
+        const size_t base = indices_.size();
+
+        for (uint32_t id = 0; id < node.count; ++id)
+            indices_.push_back(evalInt(lists_[node.a + id]));
+
+        std::reverse(indices_.begin() + static_cast<std::ptrdiff_t>(base),
+                     indices_.end());
+
+        return base;
+    }
+
+    void popIndices(const FlatNode& node)
+    {
+        indices_.resize(indices_.size() - node.count);
+    }
+
+    // Kinds that always produce an integer.
+    static bool isIntKind(Kind kind)
+    {
+        return kind == Kind::CONST || kind == Kind::BINARY ||
+               kind == Kind::UNARY || kind == Kind::DIV_CONST ||
+               kind == Kind::VAR_INT || kind == Kind::ELEM_INT;
+    }
+
+    static int binary(BinaryOp op, int left, int right)
+    {
+        switch (op)
+        {
+            case BinaryOp::ADD:    return add(left, right);
+            case BinaryOp::SUB:    return subtract(left, right);
+            case BinaryOp::MUL:    return multiply(left, right);
+            case BinaryOp::DIV:    return divide(left, right);
+            case BinaryOp::MOD:    return modulo(left, right);
+            case BinaryOp::GR:     return left > right;
+            case BinaryOp::LS:     return left < right;
+            case BinaryOp::EQ:     return left == right;
+            case BinaryOp::GR_EQ:  return left >= right;
+            case BinaryOp::LS_EQ:  return left <= right;
+            case BinaryOp::NOT_EQ: return left != right;
+            case BinaryOp::AND:    return left && right;
+            case BinaryOp::OR:     return left || right;
+            default:
+                throw std::runtime_error("Unknown binary operation");
+        }
+    }
+
+    int evalInt(uint32_t id)
+    {
+        const FlatNode& node = nodes_[id];
+
+        switch (node.kind)
+        {
+            case Kind::CONST:
+                return static_cast<int>(node.a);
+
+            case Kind::VAR:
+            case Kind::VAR_INT:
+                return ctx_.getVarValue(binding(node.a, node.b)).getInt();
+
+            case Kind::ELEM_INT:
+            {
+                const size_t indices = pushIndices(node);
+
+                // The base is proven to be an array.
+                const int value =
+                    ctx_.getArray(binding(node.b, node.c))
+                        .getArray()
+                        ->readInt(indices_.data() + indices, node.count, node.op);
+                popIndices(node);
+
+                return value;
+            }
+
+            case Kind::BINARY:
+            {
+                const int left = evalInt(node.a);
+                const int right = evalInt(node.b);
+
+                return binary(static_cast<BinaryOp>(node.op), left, right);
+            }
+
+            case Kind::DIV_CONST:
+            {
+                const Divisor& divisor = divisors_[node.b];
+                const int left = evalInt(node.a);
+
+                return static_cast<BinaryOp>(node.op) == BinaryOp::DIV
+                           ? divisor.divide(left)
+                           : divisor.modulo(left);
+            }
+
+            case Kind::UNARY:
+            {
+                const int operand = evalInt(node.a);
+
+                switch (static_cast<UnaryOp>(node.op))
+                {
+                    case UnaryOp::NEG: return negate(operand);
+                    case UnaryOp::NOT: return !operand;
+                    default:
+                        throw std::runtime_error("Unknown unary operation");
+                }
+            }
+
+            case Kind::ASSIGN:
+            case Kind::ASSIGN_ELEM:
+            case Kind::ELEM:
+            case Kind::SCOPE:
+            case Kind::WHILE:
+            case Kind::IF:
+            case Kind::PRINT:
+            case Kind::READ:
+            case Kind::REPEAT:
+            case Kind::REPEAT_UNDEF:
+            case Kind::ARRAY_INIT:
+            case Kind::ELEMENTWISE:
+            default:
+                eval(id);
+                return buf_->getInt();
+        }
+    }
+
+    void eval(uint32_t id)
+    {
+        const FlatNode& node = nodes_[id];
+
+        switch (node.kind)
+        {
+            case Kind::CONST:
+            case Kind::BINARY:
+            case Kind::UNARY:
+            case Kind::DIV_CONST:
+            case Kind::ELEM_INT:
+                setResult(evalInt(id));
+                break;
+
+            case Kind::VAR:
+            case Kind::VAR_INT:
+                buf_ = &ctx_.getVarValue(binding(node.a, node.b));
+                break;
+
+            case Kind::ELEMENTWISE:
+            {
+                eval(node.a);
+
+                // The right operand may overwrite a temporary left one.
+                const Value left = take();
+
+                eval(node.b);
+                setResult(elementwise(static_cast<BinaryOp>(node.op), left, *buf_));
+                break;
+            }
+
+            case Kind::ASSIGN:
+            {
+                if (isIntKind(nodes_[node.a].kind))
+                {
+                    const int value = evalInt(node.a);
+                    Value& dest = ctx_.getVar(binding(node.b, node.c));
+
+                    dest = value;
+                    buf_ = &dest;
+                    break;
+                }
+
+                eval(node.a);
+
+                Value& dest = ctx_.getVar(binding(node.b, node.c));
+
+                dest = take();
+                buf_ = &dest;
+                break;
+            }
+
+            case Kind::ASSIGN_ELEM:
+            {
+                const size_t indices = pushIndices(node);
+                const uint32_t srcId = lists_[node.a + node.count];
+
+                if (isIntKind(nodes_[srcId].kind))
+                    setResult(evalInt(srcId));
+                else
+                    eval(srcId);
+
+                // The source is taken first: it may share the target.
+                Value src = take();
+
+                Array* array = ctx_.getArray(binding(node.b, node.c)).mutableArray();
+
+                if (!array)
+                    throw std::runtime_error("Indexing non array type\n");
+
+                array->write(indices_.data() + indices, node.count, src, node.op);
+                popIndices(node);
+
+                setResult(std::move(src));
+                break;
+            }
+
+            case Kind::ELEM:
+            {
+                const size_t indices = pushIndices(node);
+                const Array* array = ctx_.getArray(binding(node.b, node.c)).getArray();
+
+                if (!array)
+                {
+                    std::cerr << ctx_.layout_.names[node.b]
+                              << " is not an array type\n";
+                    throw std::runtime_error(
+                        "Can't use [] to non array variables\n");
+                }
+
+                array->read(indices_.data() + indices, node.count, storage_,
+                            node.op);
+                popIndices(node);
+
+                buf_ = &storage_;
+                break;
+            }
+
+            case Kind::SCOPE:
+            {
+                if (node.b == 0)
+                    break;
+
+                const uint32_t* children = lists_ + node.a + 2;
+
+                for (uint32_t child = 0; child < node.b; ++child)
+                    eval(children[child]);
+
+                ctx_.clearSlots(static_cast<int>(lists_[node.a]),
+                                static_cast<int>(lists_[node.a + 1]));
+                break;
+            }
+
+            case Kind::WHILE:
+                while (evalInt(node.a))
+                    eval(node.b);
+                break;
+
+            case Kind::IF:
+                if (node.a == FlatNode::NONE || evalInt(node.a))
+                    eval(node.b);
+                else if (node.c != FlatNode::NONE)
+                    eval(node.c);
+                break;
+
+            case Kind::PRINT:
+                ctx_.out.print(evalInt(node.a));
+                break;
+
+            case Kind::READ:
+                setResult(ctx_.in->read(ctx_.out));
+                break;
+
+            case Kind::REPEAT:
+            {
+                const int size = evalInt(node.a);
+
+                eval(node.b);
+                setResult(Value(Array(*buf_, size)));
+                break;
+            }
+
+            case Kind::REPEAT_UNDEF:
+                setResult(Value(Array(evalInt(node.a))));
+                break;
+
+            case Kind::ARRAY_INIT:
+            {
+                std::vector<Value> data;
+                data.reserve(node.b);
+
+                for (uint32_t elem = 0; elem < node.b; ++elem)
+                {
+                    eval(lists_[node.a + elem]);
+                    data.push_back(*buf_);
+                }
+
+                setResult(Value(Array(std::move(data))));
+                break;
+            }
+
+            default:
+                throw std::runtime_error("Unknown node kind");
+        }
+    }
+
+  public:
+    FlatInterpreter(std::ostream& out = std::cout, Flush flush = Flush::BLOCK,
+                    Input& in = Input::standard())
+        : ctx_(out, flush, in)
+    {}
+
+    void run(const FlatAst& ast)
+    {
+        MSG("Evaluating flat tree\n");
+
+        ctx_.setLayout(ast.layout);
+
+        nodes_ = ast.nodes.data();
+        lists_ = ast.lists.data();
+        divisors_ = ast.divisors.data();
+
+        eval(ast.root);
+    }
+};
+
+} // namespace detail
+
+} // namespace AST
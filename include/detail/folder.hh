@@ -0,0 +1,477 @@
+#pragma once
+
+#include <cstddef>
+#include <variant>
+
+#include "arena.hh"
+#include "arithmetic.hh"
+#include "effects.hh"
+#include "log.hh"
+#include "node.hh"
+#include "slots.hh"
+#include "visitor.hh"
+
+namespace AST
+{
+
+namespace detail
+{
+
+struct FoldStats
+{
+    size_t folded = 0;     // constant subtrees replaced by a ConstantNode
+    size_t simplified = 0; // algebraic identities applied
+};
+
+// Folds constant subtrees and applies identities that neither drop an
+// evaluation nor change its order. Division by a constant zero is left
+// alone so that it still fails at runtime.
+//
+// Replacing x * 1 by x is only exact when x is an integer. Where the result
+// is consumed as an integer (operands, conditions, indices, print) that does
+// not matter; elsewhere the operand must be an integer by construction.
+class Folder final : public Visitor
+{
+  private:
+    Arena& arena_;
+    FoldStats stats_;
+
+    ExprPtr result_ = nullptr; // replacement for the last visited expression
+    bool intContext_ = false;
+
+  private:
+    template <typename Accept>
+    ExprPtr fold(Accept&& accept, bool intContext)
+    {
+        const bool saved = intContext_;
+
+        intContext_ = intContext;
+        result_ = nullptr;
+
+        accept(*this);
+
+        intContext_ = saved;
+
+        return result_;
+    }
+
+    static const ConstantNode* asConst(ExprPtr expr)
+    {
+        return dynamic_cast<const ConstantNode*>(expr);
+    }
+
+    static bool isComparison(BinaryOp op)
+    {
+        switch (op)
+        {
+            case BinaryOp::GR:
+            case BinaryOp::LS:
+            case BinaryOp::EQ:
+            case BinaryOp::GR_EQ:
+            case BinaryOp::LS_EQ:
+            case BinaryOp::NOT_EQ:
+                return true;
+            case BinaryOp::ADD:
+            case BinaryOp::SUB:
+            case BinaryOp::MUL:
+            case BinaryOp::DIV:
+            case BinaryOp::MOD:
+            case BinaryOp::AND:
+            case BinaryOp::OR:
+            default:
+                return false;
+        }
+    }
+
+    static BinaryOp negate(BinaryOp op)
+    {
+        switch (op)
+        {
+            case BinaryOp::GR:     return BinaryOp::LS_EQ;
+            case BinaryOp::LS:     return BinaryOp::GR_EQ;
+            case BinaryOp::EQ:     return BinaryOp::NOT_EQ;
+            case BinaryOp::GR_EQ:  return BinaryOp::LS;
+            case BinaryOp::LS_EQ:  return BinaryOp::GR;
+            case BinaryOp::NOT_EQ: return BinaryOp::EQ;
+            case BinaryOp::ADD:
+            case BinaryOp::SUB:
+            case BinaryOp::MUL:
+            case BinaryOp::DIV:
+            case BinaryOp::MOD:
+            case BinaryOp::AND:
+            case BinaryOp::OR:
+            default:               return op;
+        }
+    }
+
+    // Only yields 0 or 1.
+    static bool isBoolean(ExprPtr expr)
+    {
+        if (auto binary = dynamic_cast<const BinaryOpNode*>(expr))
+            return isComparison(binary->getOp()) ||
+                   binary->getOp() == BinaryOp::AND ||
+                   binary->getOp() == BinaryOp::OR;
+
+        if (auto unary = dynamic_cast<const UnaryOpNode*>(expr))
+            return unary->getOp() == UnaryOp::NOT;
+
+        if (auto constant = asConst(expr))
+            return constant->getVal() == 0 || constant->getVal() == 1;
+
+        return false;
+    }
+
+  public:
+    static bool canFold(BinaryOp op, int right)
+    {
+        if (op != BinaryOp::DIV && op != BinaryOp::MOD)
+            return true;
+
+        // Division by zero is left to fail when it runs.
+        return right != 0;
+    }
+
+    static int compute(BinaryOp op, int left, int right)
+    {
+        switch (op)
+        {
+            case BinaryOp::ADD:    return add(left, right);
+            case BinaryOp::SUB:    return subtract(left, right);
+            case BinaryOp::MUL:    return multiply(left, right);
+            case BinaryOp::DIV:    return divide(left, right);
+            case BinaryOp::MOD:    return modulo(left, right);
+            case BinaryOp::GR:     return left > right;
+            case BinaryOp::LS:     return left < right;
+            case BinaryOp::EQ:     return left == right;
+            case BinaryOp::GR_EQ:  return left >= right;
+            case BinaryOp::LS_EQ:  return left <= right;
+            case BinaryOp::NOT_EQ: return left != right;
+            case BinaryOp::AND:    return left && right;
+            case BinaryOp::OR:     return left || right;
+            default:
+                throw std::runtime_error("Unknown binary operation");
+        }
+    }
+
+  private:
+    ExprPtr constant(int value)
+    {
+        ++stats_.folded;
+
+        return arena_.create<ConstantNode>(value);
+    }
+
+    // The node reduces to one of its operands.
+    bool reduceTo(ExprPtr operand)
+    {
+        if (!intContext_ && !producesInt(operand))
+            return false;
+
+        ++stats_.simplified;
+        result_ = operand;
+
+        return true;
+    }
+
+    bool isConst(ExprPtr expr, int value)
+    {
+        const ConstantNode* constant = asConst(expr);
+
+        return constant && constant->getVal() == value;
+    }
+
+    // (x + c1) + c2 -> x + (c1 + c2), likewise for - and *.
+    bool reassociate(BinaryOp op, ExprPtr left, const ConstantNode& right)
+    {
+        auto inner = dynamic_cast<BinaryOpNode*>(left);
+
+        if (!inner)
+            return false;
+
+        const ConstantNode* innerConst = asConst(inner->getRight());
+
+        if (!innerConst)
+            return false;
+
+        const int c1 = innerConst->getVal();
+        const int c2 = right.getVal();
+
+        const bool additive = (op == BinaryOp::ADD || op == BinaryOp::SUB) &&
+                              (inner->getOp() == BinaryOp::ADD ||
+                               inner->getOp() == BinaryOp::SUB);
+
+        const bool multiplicative =
+            op == BinaryOp::MUL && inner->getOp() == BinaryOp::MUL;
+
+        if (!additive && !multiplicative)
+            return false;
+
+        int value = 0;
+
+        if (multiplicative)
+            value = multiply(c1, c2);
+        else
+            value = add(
+                inner->getOp() == BinaryOp::ADD ? c1 : detail::negate(c1),
+                op == BinaryOp::ADD ? c2 : detail::negate(c2));
+
+        ++stats_.simplified;
+
+        result_ = arena_.create<BinaryOpNode>(
+            inner->getLeft(), multiplicative ? BinaryOp::MUL : BinaryOp::ADD,
+            arena_.create<ConstantNode>(value));
+
+        return true;
+    }
+
+  public:
+    explicit Folder(Arena& arena)
+        : arena_(arena)
+    {}
+
+    FoldStats run(const ScopeNode& global)
+    {
+        MSG("Folding constants\n");
+
+        global.accept(*this);
+
+        LOG("Folded {} subtrees, applied {} identities\n", stats_.folded,
+            stats_.simplified);
+
+        return stats_;
+    }
+
+    void visit(const ConstantNode& node) override { result_ = &edit(node); }
+
+    void visit(const VariableNode& node) override { result_ = &edit(node); }
+
+    void visit(const InNode& node) override { result_ = &edit(node); }
+
+    void visit(const BinaryOpNode& node) override
+    {
+        BinaryOpNode& self = edit(node);
+
+        self.setLeft(fold([&](Visitor& v) { node.accept_left(v); }, true));
+        self.setRight(fold([&](Visitor& v) { node.accept_right(v); }, true));
+
+        result_ = &self;
+
+        const BinaryOp op = node.getOp();
+        const ExprPtr left = node.getLeft();
+        const ExprPtr right = node.getRight();
+
+        const ConstantNode* cl = asConst(left);
+        const ConstantNode* cr = asConst(right);
+
+        if (cl && cr)
+        {
+            if (canFold(op, cr->getVal()))
+                result_ = constant(compute(op, cl->getVal(), cr->getVal()));
+
+            return;
+        }
+
+        switch (op)
+        {
+            case BinaryOp::ADD:
+                if (isConst(right, 0) && reduceTo(left))
+                    return;
+                if (isConst(left, 0) && reduceTo(right))
+                    return;
+                break;
+
+            case BinaryOp::SUB:
+                if (isConst(right, 0) && reduceTo(left))
+                    return;
+                break;
+
+            case BinaryOp::MUL:
+                if (isConst(right, 1) && reduceTo(left))
+                    return;
+                if (isConst(left, 1) && reduceTo(right))
+                    return;
+                break;
+
+            case BinaryOp::DIV:
+                if (isConst(right, 1) && reduceTo(left))
+                    return;
+                break;
+
+            case BinaryOp::MOD:
+            case BinaryOp::GR:
+            case BinaryOp::LS:
+            case BinaryOp::EQ:
+            case BinaryOp::GR_EQ:
+            case BinaryOp::LS_EQ:
+            case BinaryOp::NOT_EQ:
+            case BinaryOp::AND:
+            case BinaryOp::OR:
+            default:
+                break;
+        }
+
+        if (cr)
+            reassociate(op, left, *cr);
+    }
+
+    void visit(const UnaryOpNode& node) override
+    {
+        UnaryOpNode& self = edit(node);
+
+        self.setOperand(
+            fold([&](Visitor& v) { node.acceptOperand(v); }, true));
+
+        result_ = &self;
+
+        const ExprPtr operand = node.getOperand();
+
+        if (const ConstantNode* c = asConst(operand))
+        {
+            const int value = c->getVal();
+
+            result_ = constant(node.getOp() == UnaryOp::NEG
+                                   ? detail::negate(value)
+                                   : !value);
+            return;
+        }
+
+        if (auto inner = dynamic_cast<UnaryOpNode*>(operand))
+        {
+            // - -x -> x, !!c -> c for 0/1 valued c.
+            if (inner->getOp() == node.getOp() &&
+                (node.getOp() == UnaryOp::NEG || isBoolean(inner->getOperand())))
+                reduceTo(inner->getOperand());
+
+            return;
+        }
+
+        auto binary = dynamic_cast<BinaryOpNode*>(operand);
+
+        // !(a < b) -> a >= b
+        if (node.getOp() == UnaryOp::NOT && binary &&
+            isComparison(binary->getOp()))
+        {
+            ++stats_.simplified;
+
+            result_ = arena_.create<BinaryOpNode>(
+                binary->getLeft(), negate(binary->getOp()), binary->getRight());
+        }
+    }
+
+    void visit(const ScopeNode& node) override
+    {
+        ScopeNode& self = edit(node);
+
+        for (size_t id = 0; id < node.nstms(); ++id)
+        {
+            StmtPtr child = node.getChildren()[id];
+
+            const ExprPtr replacement =
+                fold([child](Visitor& v) { child->accept(v); }, false);
+
+            if (replacement && replacement != child)
+                self.setChild(id, replacement);
+        }
+
+        result_ = nullptr;
+    }
+
+    void visit(const AssignNode& node) override
+    {
+        AssignNode& self = edit(node);
+
+        if (auto elem = std::get_if<ArrayElemPtr>(&node.getDest()))
+            (*elem)->accept(*this);
+
+        if (auto src = std::get_if<ExprPtr>(&node.getSrc()))
+        {
+            ExprPtr expr = *src;
+
+            self.setSrc(fold([expr](Visitor& v) { expr->accept(v); }, false));
+        }
+        else
+            node.acceptSrc(*this);
+
+        result_ = &self;
+    }
+
+    void visit(const ArrayElemNode& node) override
+    {
+        ArrayElemNode& self = edit(node);
+
+        self.setIndex(fold([&](Visitor& v) { node.acceptIndex(v); }, true));
+
+        if (node.holdsArrayElem())
+            node.acceptName(*this);
+
+        result_ = &self;
+    }
+
+    void visit(const WhileNode& node) override
+    {
+        edit(node).setCond(fold([&](Visitor& v) { node.acceptCond(v); }, true));
+
+        node.acceptScope(*this);
+
+        result_ = nullptr;
+    }
+
+    void visit(const PforNode& node) override
+    {
+        visit(static_cast<const WhileNode&>(node));
+    }
+
+    void visit(const IfElseNode& node) override
+    {
+        if (node.hasCond())
+            edit(node).setCond(
+                fold([&](Visitor& v) { node.acceptCond(v); }, true));
+
+        node.acceptAction(*this);
+
+        if (node.hasAltAction())
+            node.acceptAltAction(*this);
+
+        result_ = nullptr;
+    }
+
+    void visit(const PrintNode& node) override
+    {
+        edit(node).setExpr(fold([&](Visitor& v) { node.acceptExpr(v); }, true));
+
+        result_ = nullptr;
+    }
+
+    void visit(const RepeatNode& node) override
+    {
+        RepeatNode& self = edit(node);
+
+        self.setSize(fold([&](Visitor& v) { node.acceptSize(v); }, true));
+
+        if (auto elem = std::get_if<ExprPtr>(&node.getElem()); elem && *elem)
+        {
+            ExprPtr expr = *elem;
+
+            self.setElem(fold([expr](Visitor& v) { expr->accept(v); }, false));
+        }
+        else if (node.hasElem())
+            node.acceptElem(*this);
+
+        result_ = nullptr;
+    }
+
+    void visit(const ArrayInitNode& node) override
+    {
+        ArrayInitNode& self = edit(node);
+
+        for (size_t id = 0; id < node.arraySize(); ++id)
+            self.setElem(id, fold([&](Visitor& v) { node.acceptElem(id, v); },
+                                  false));
+
+        result_ = nullptr;
+    }
+};
+
+} // namespace detail
+
+} // namespace AST
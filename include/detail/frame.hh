@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+namespace AST
+{
+
+namespace detail
+{
+
+// Location of a variable in the flat frame. A name that may be bound by
+// several enclosing scopes at run time refers to a chain of candidate slots
+// (innermost first); at most one of them is defined at any moment.
+struct Binding
+{
+    int slot = -1;
+    int chain = -1;
+
+    // Every read through this binding finds the name bound.
+    bool sure = false;
+
+    bool resolved() const { return slot >= 0; }
+};
+
+struct FrameLayout
+{
+    int nslots = 0;
+    std::vector<std::string_view> names;
+    std::vector<std::vector<int>> chains;
+
+    std::string_view name(int slot) const
+    {
+        return names[static_cast<size_t>(slot)];
+    }
+
+    // Candidate slots of a chain, innermost first.
+    const std::vector<int>& chain(int id) const
+    {
+        return chains[static_cast<size_t>(id)];
+    }
+};
+
+} // namespace detail
+
+} // namespace AST
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include "arena.hh"
+#include "effects.hh"
+#include "frame.hh"
+#include "log.hh"
+#include "loop_pass.hh"
+#include "node.hh"
+
+namespace AST
+{
+
+namespace detail
+{
+
+struct HoistStats
+{
+    size_t hoisted = 0; // loop-invariant expressions moved out of loops
+};
+
+// Loop-invariant code motion. An invariant expression is evaluated once
+// into a fresh frame slot right before the loop, and the loop reads that
+// slot instead.
+//
+// Only pure expressions move: evaluating them ahead of time, or when the
+// loop never runs, cannot be observed. Input, element reads and anything
+// reading a slot the loop writes (which covers variables local to the
+// loop body) stay in place. Inner loops are handled first, so their
+// pre-headers are candidates for the enclosing loop.
+class Hoister final : public LoopPass
+{
+  private:
+    HoistStats stats_;
+
+    std::vector<int> writes_;
+    std::vector<StmtPtr> preheader_;
+
+  private:
+    std::vector<StmtPtr> loop(const WhileNode& node,
+                              [[maybe_unused]] const std::vector<StmtPtr>&
+                                  preceding) override
+    {
+        writes_ = writes(node);
+        rewriteLoop(node);
+
+        return std::exchange(preheader_, {});
+    }
+
+    // Moves expr into the pre-header and returns a read of its slot.
+    ExprPtr replace(ExprPtr expr) override
+    {
+        if (!isPure(expr) || !invariant(expr, writes_))
+            return nullptr;
+
+        const Binding slot = newSlot("licm");
+
+        preheader_.push_back(arena_.create<AssignNode>(variable(slot), expr));
+
+        ++stats_.hoisted;
+
+        return variable(slot);
+    }
+
+  public:
+    Hoister(Arena& arena, FrameLayout& layout)
+        : LoopPass(arena, layout)
+    {}
+
+    HoistStats run(const ScopeNode& global)
+    {
+        MSG("Hoisting loop invariants\n");
+
+        global.accept(*this);
+
+        LOG("Hoisted {} expressions\n", stats_.hoisted);
+
+        return stats_;
+    }
+};
+
+} // namespace detail
+
+} // namespace AST
@@ -0,0 +1,423 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <variant>
+#include <vector>
+
+#include "frame.hh"
+#include "log.hh"
+#include "node.hh"
+#include "slots.hh"
+
+namespace AST
+{
+
+namespace detail
+{
+
+struct IdiomStats
+{
+    size_t fills = 0;      // a[i] = e
+    size_t copies = 0;     // a[i] = b[i]
+    size_t reductions = 0; // sums, minimums and maximums of b[i]
+    size_t scans = 0;      // prefix sums
+};
+
+// Recognizes while loops that fill, copy, reduce or scan a row of an array,
+//
+//     while (i < n) { a[i] = e;                       i = i + 1; }
+//     while (i < n) { a[i] = b[i];                    i = i + 1; }
+//     while (i < n) { s = s + b[i];                   i = i + 1; }
+//     while (i < n) { if (b[i] < s) s = b[i];         i = i + 1; }
+//     while (i < n) { a[i] = a[i - 1] + b[i];         i = i + 1; }
+//     while (i < n) { s = s + b[i]; a[i] = s;         i = i + 1; }
+//
+// with n and e reading neither i nor s, nor elements or input, and notes
+// them in WhileNode::Idiom. Whether the variables hold what such a loop
+// expects is only known at run time, where detail::Interpreter checks it.
+class Idioms final
+{
+  private:
+    using Idiom = WhileNode::Idiom;
+
+    const FrameLayout& layout_;
+    IdiomStats stats_;
+
+  private:
+    bool same(const VariableNode* var, const Binding& binding) const
+    {
+        return var &&
+               slotsOf(layout_, var->getBinding()) == slotsOf(layout_, binding);
+    }
+
+    static const VariableNode* variable(ExprPtr expr)
+    {
+        return dynamic_cast<const VariableNode*>(expr);
+    }
+
+    // Row element b[k] of a one-index access.
+    static const ArrayElemNode* element(ExprPtr expr)
+    {
+        auto elem = dynamic_cast<const ArrayElemNode*>(expr);
+
+        return elem && elem->holdsVariable() ? elem : nullptr;
+    }
+
+    // Whether expr is b[i], noting b.
+    bool current(ExprPtr expr, const Binding& loop, Binding& array) const
+    {
+        const ArrayElemNode* elem = element(expr);
+
+        if (!elem || !same(variable(elem->getIndex()), loop))
+            return false;
+
+        array = elem->getVariable()->getBinding();
+
+        return true;
+    }
+
+    // Whether expr is a[i - 1] of the given a.
+    bool previous(ExprPtr expr, const Binding& loop, const Binding& array) const
+    {
+        const ArrayElemNode* elem = element(expr);
+        auto index = elem ? dynamic_cast<const BinaryOpNode*>(elem->getIndex())
+                          : nullptr;
+
+        if (!index || !same(elem->getVariable(), array) ||
+            !same(variable(index->getLeft()), loop))
+            return false;
+
+        auto by = dynamic_cast<const ConstantNode*>(index->getRight());
+
+        return by && ((index->getOp() == BinaryOp::SUB && by->getVal() == 1) ||
+                      (index->getOp() == BinaryOp::ADD && by->getVal() == -1));
+    }
+
+    // Whether expr yields the same value throughout the loop: it reads no
+    // elements, no input and none of the slots the loop assigns.
+    bool invariant(ExprPtr expr, const std::vector<int>& assigned) const
+    {
+        if (dynamic_cast<const ConstantNode*>(expr))
+            return true;
+
+        if (auto var = variable(expr))
+        {
+            const std::vector<int> targets =
+                slotsOf(layout_, var->getBinding());
+
+            return std::find_first_of(targets.begin(), targets.end(),
+                                      assigned.begin(),
+                                      assigned.end()) == targets.end();
+        }
+
+        if (auto unary = dynamic_cast<const UnaryOpNode*>(expr))
+            return invariant(unary->getOperand(), assigned);
+
+        if (auto binary = dynamic_cast<const BinaryOpNode*>(expr))
+            return invariant(binary->getLeft(), assigned) &&
+                   invariant(binary->getRight(), assigned);
+
+        return false;
+    }
+
+    static const AssignNode* assignment(StmtPtr stmt)
+    {
+        // A lone statement may still come in braces.
+        if (auto scope = dynamic_cast<const ScopeNode*>(stmt))
+            if (scope->nstms() == 1 && scope->slotBegin() == scope->slotEnd())
+                stmt = scope->getChildren().front();
+
+        auto assign = dynamic_cast<const AssignNode*>(stmt);
+
+        return assign && std::holds_alternative<ExprPtr>(assign->getSrc())
+                   ? assign
+                   : nullptr;
+    }
+
+    static ExprPtr source(const AssignNode* assign)
+    {
+        return std::get<ExprPtr>(assign->getSrc());
+    }
+
+    static const VariableNode* destVariable(const AssignNode* assign)
+    {
+        auto dest = std::get_if<VariablePtr>(&assign->getDest());
+
+        return dest ? *dest : nullptr;
+    }
+
+    static const ArrayElemNode* destElement(const AssignNode* assign)
+    {
+        auto dest = std::get_if<ArrayElemPtr>(&assign->getDest());
+
+        return dest && (*dest)->holdsVariable() ? *dest : nullptr;
+    }
+
+    // Whether expr is s + b[i] or b[i] + s, noting b.
+    bool accumulates(ExprPtr expr, const Binding& total, const Binding& loop,
+                     Binding& array) const
+    {
+        auto binary = dynamic_cast<const BinaryOpNode*>(expr);
+
+        if (!binary || binary->getOp() != BinaryOp::ADD)
+            return false;
+
+        return (same(variable(binary->getLeft()), total) &&
+                current(binary->getRight(), loop, array)) ||
+               (same(variable(binary->getRight()), total) &&
+                current(binary->getLeft(), loop, array));
+    }
+
+    // a[i] = e, a[i] = b[i] and a[i] = a[i - 1] + b[i].
+    bool store(const AssignNode* assign, Idiom& idiom) const
+    {
+        const ArrayElemNode* dest = destElement(assign);
+
+        if (!dest || !same(variable(dest->getIndex()), idiom.loop))
+            return false;
+
+        const ExprPtr src = source(assign);
+
+        idiom.array = dest->getVariable()->getBinding();
+
+        if (current(src, idiom.loop, idiom.source))
+        {
+            idiom.kind = Idiom::Kind::COPY;
+            return true;
+        }
+
+        auto binary = dynamic_cast<const BinaryOpNode*>(src);
+
+        if (binary && binary->getOp() == BinaryOp::ADD &&
+            ((previous(binary->getLeft(), idiom.loop, idiom.array) &&
+              current(binary->getRight(), idiom.loop, idiom.source)) ||
+             (previous(binary->getRight(), idiom.loop, idiom.array) &&
+              current(binary->getLeft(), idiom.loop, idiom.source))))
+        {
+            idiom.kind = Idiom::Kind::SCAN;
+            return true;
+        }
+
+        if (invariant(src, slotsOf(layout_, idiom.loop)))
+        {
+            idiom.kind = Idiom::Kind::FILL;
+            idiom.value = src;
+            return true;
+        }
+
+        return false;
+    }
+
+    // s = s + b[i].
+    bool sum(const AssignNode* assign, Idiom& idiom) const
+    {
+        const VariableNode* dest = destVariable(assign);
+
+        if (!dest || same(dest, idiom.loop) ||
+            !accumulates(source(assign), dest->getBinding(), idiom.loop,
+                         idiom.source))
+            return false;
+
+        idiom.kind = Idiom::Kind::SUM;
+        idiom.total = dest->getBinding();
+
+        return true;
+    }
+
+    // if (b[i] < s) s = b[i] and the like.
+    bool extremum(StmtPtr stmt, Idiom& idiom) const
+    {
+        auto ifElse = dynamic_cast<const IfElseNode*>(stmt);
+
+        if (!ifElse || !ifElse->hasCond() || ifElse->hasAltAction())
+            return false;
+
+        auto cond = dynamic_cast<const BinaryOpNode*>(ifElse->getCond());
+        const AssignNode* assign = assignment(ifElse->getAction());
+        const VariableNode* dest = assign ? destVariable(assign) : nullptr;
+        Binding array;
+
+        if (!cond || !dest || same(dest, idiom.loop) ||
+            !current(source(assign), idiom.loop, idiom.source))
+            return false;
+
+        const BinaryOp op = cond->getOp();
+
+        if (op != BinaryOp::LS && op != BinaryOp::LS_EQ && op != BinaryOp::GR &&
+            op != BinaryOp::GR_EQ)
+            return false;
+
+        const bool left = current(cond->getLeft(), idiom.loop, array) &&
+                          same(variable(cond->getRight()), dest->getBinding());
+
+        if (!left && !(current(cond->getRight(), idiom.loop, array) &&
+                       same(variable(cond->getLeft()), dest->getBinding())))
+            return false;
+
+        // b[i] < s keeps the minimum, s < b[i] the maximum.
+        const bool less =
+            (op == BinaryOp::LS || op == BinaryOp::LS_EQ) == left;
+
+        if (slotsOf(layout_, array) != slotsOf(layout_, idiom.source))
+            return false;
+
+        idiom.kind = less ? Idiom::Kind::MIN : Idiom::Kind::MAX;
+        idiom.total = dest->getBinding();
+
+        return true;
+    }
+
+    // s = s + b[i]; a[i] = s.
+    bool running(StmtPtr first, StmtPtr second, Idiom& idiom) const
+    {
+        const AssignNode* update = assignment(first);
+        const AssignNode* assign = assignment(second);
+
+        if (!update || !assign || !sum(update, idiom))
+            return false;
+
+        const ArrayElemNode* dest = destElement(assign);
+
+        if (!dest || !same(variable(dest->getIndex()), idiom.loop) ||
+            !same(variable(source(assign)), idiom.total))
+            return false;
+
+        idiom.kind = Idiom::Kind::RUNNING;
+        idiom.array = dest->getVariable()->getBinding();
+
+        return true;
+    }
+
+    // Whether stmt is the statement i = i + 1 of the loop variable.
+    bool step(StmtPtr stmt, const Binding& loop) const
+    {
+        const AssignNode* assign = assignment(stmt);
+        const VariableNode* dest = assign ? destVariable(assign) : nullptr;
+        auto binary =
+            dest ? dynamic_cast<const BinaryOpNode*>(source(assign)) : nullptr;
+
+        if (!binary || binary->getOp() != BinaryOp::ADD || !same(dest, loop))
+            return false;
+
+        auto left = dynamic_cast<const ConstantNode*>(binary->getLeft());
+        auto right = dynamic_cast<const ConstantNode*>(binary->getRight());
+
+        return (right && right->getVal() == 1 &&
+                same(variable(binary->getLeft()), loop)) ||
+               (left && left->getVal() == 1 &&
+                same(variable(binary->getRight()), loop));
+    }
+
+    Idiom recognize(const WhileNode& node) const
+    {
+        auto cond = dynamic_cast<const BinaryOpNode*>(node.getCond());
+        const VariableNode* index = cond ? variable(cond->getLeft()) : nullptr;
+        auto scope = dynamic_cast<const ScopeNode*>(node.getScope());
+
+        if (!index || cond->getOp() != BinaryOp::LS || !scope ||
+            scope->slotBegin() != scope->slotEnd())
+            return {};
+
+        const std::vector<StmtPtr>& children = scope->getChildren();
+        Idiom idiom;
+
+        idiom.loop = index->getBinding();
+        idiom.bound = cond->getRight();
+
+        if (children.size() < 2 || children.size() > 3 ||
+            !step(children.back(), idiom.loop))
+            return {};
+
+        bool found = false;
+
+        if (children.size() == 3)
+            found = running(children[0], children[1], idiom);
+        else if (const AssignNode* assign = assignment(children[0]))
+            found = store(assign, idiom) || sum(assign, idiom);
+        else
+            found = extremum(children[0], idiom);
+
+        std::vector<int> assigned = slotsOf(layout_, idiom.loop);
+
+        if (idiom.kind != Idiom::Kind::FILL && idiom.kind != Idiom::Kind::COPY &&
+            idiom.kind != Idiom::Kind::SCAN)
+        {
+            const std::vector<int> total = slotsOf(layout_, idiom.total);
+
+            assigned.insert(assigned.end(), total.begin(), total.end());
+        }
+
+        if (!found || !invariant(idiom.bound, assigned))
+            return {};
+
+        return idiom;
+    }
+
+    void count(Idiom::Kind kind)
+    {
+        switch (kind)
+        {
+            case Idiom::Kind::FILL:    ++stats_.fills; break;
+            case Idiom::Kind::COPY:    ++stats_.copies; break;
+            case Idiom::Kind::SUM:
+            case Idiom::Kind::MIN:
+            case Idiom::Kind::MAX:     ++stats_.reductions; break;
+            case Idiom::Kind::SCAN:
+            case Idiom::Kind::RUNNING: ++stats_.scans; break;
+            case Idiom::Kind::NONE:
+            default:                   break;
+        }
+    }
+
+    void statement(StmtPtr stmt)
+    {
+        if (auto scope = dynamic_cast<const ScopeNode*>(stmt))
+        {
+            for (StmtPtr child : scope->getChildren())
+                statement(child);
+        }
+        else if (auto ifElse = dynamic_cast<const IfElseNode*>(stmt))
+        {
+            statement(ifElse->getAction());
+
+            if (ifElse->hasAltAction())
+                statement(ifElse->getAltAction());
+        }
+        else if (auto loop = dynamic_cast<const WhileNode*>(stmt))
+        {
+            // pfor loops have plans of their own.
+            if (!dynamic_cast<const PforNode*>(loop))
+            {
+                const Idiom idiom = recognize(*loop);
+
+                count(idiom.kind);
+                loop->setIdiom(idiom);
+            }
+
+            statement(loop->getScope());
+        }
+    }
+
+  public:
+    explicit Idioms(const FrameLayout& layout)
+        : layout_(layout)
+    {}
+
+    IdiomStats run(const ScopeNode& global)
+    {
+        MSG("Recognizing loop idioms\n");
+
+        for (StmtPtr child : global.getChildren())
+            statement(child);
+
+        LOG("{} fills, {} copies, {} reductions and {} scans recognized\n",
+            stats_.fills, stats_.copies, stats_.reductions, stats_.scans);
+
+        return stats_;
+    }
+};
+
+} // namespace detail
+
+} // namespace AST
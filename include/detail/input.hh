@@ -0,0 +1,235 @@
+#pragma once
+
+#include <charconv>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#include "output.hh"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define PARACL_POSIX_INPUT 1
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace AST
+{
+
+namespace detail
+{
+
+// What `?` reads integers from: standard input, a file or text in memory.
+// Files and standard input are read in large blocks; from a terminal or a
+// pipe a block is whatever has arrived, so lines typed in are seen at once.
+// Numbers are parsed with from_chars as operator>> would read them.
+class Input final
+{
+  private:
+    static constexpr size_t capacity = 64 * 1024;
+
+    std::string text_;
+    std::unique_ptr<char[]> buffer_;
+    const char* pos_ = nullptr;
+    const char* end_ = nullptr;
+#ifdef PARACL_POSIX_INPUT
+    int fd_ = -1;
+#else
+    std::FILE* file_ = nullptr;
+#endif
+    bool owned_ = false;
+
+  private:
+    static bool isSpace(char ch)
+    {
+        return ch == ' ' || (ch >= '\t' && ch <= '\r');
+    }
+
+    static bool isDigit(char ch) { return ch >= '0' && ch <= '9'; }
+
+    bool memory() const
+    {
+#ifdef PARACL_POSIX_INPUT
+        return fd_ < 0;
+#else
+        return file_ == nullptr;
+#endif
+    }
+
+    // Reads at most size bytes to data, zero at the end of the source.
+    size_t fill(char* data, size_t size)
+    {
+#ifdef PARACL_POSIX_INPUT
+        for (;;)
+        {
+            const ssize_t got = ::read(fd_, data, size);
+
+            if (got >= 0)
+                return static_cast<size_t>(got);
+
+            if (errno != EINTR)
+                return 0;
+        }
+#else
+        // A line at a time, not to wait for a whole block from a terminal.
+        if (!std::fgets(data, static_cast<int>(size + 1), file_))
+            return 0;
+
+        return std::strlen(data);
+#endif
+    }
+
+    // Appends the next block of the source to what is left unread. Output
+    // goes out first, as the program may be waiting for an answer to it.
+    bool refill(Output& out)
+    {
+        if (memory())
+            return false;
+
+        if (!buffer_)
+        {
+            // One more byte for the terminator fgets writes.
+            buffer_ = std::make_unique<char[]>(capacity + 1);
+            pos_ = end_ = buffer_.get();
+        }
+
+        const size_t left = static_cast<size_t>(end_ - pos_);
+
+        if (left == capacity)
+            return false;
+
+        std::memmove(buffer_.get(), pos_, left);
+        pos_ = buffer_.get();
+        end_ = pos_ + left;
+
+        out.prompt();
+
+        const size_t got = fill(buffer_.get() + left, capacity - left);
+
+        end_ += got;
+
+        return got > 0;
+    }
+
+    // Length of the sign and digits at the read position.
+    size_t number() const
+    {
+        const char* it = pos_;
+
+        if (it != end_ && (*it == '+' || *it == '-'))
+            ++it;
+
+        while (it != end_ && isDigit(*it))
+            ++it;
+
+        return static_cast<size_t>(it - pos_);
+    }
+
+  public:
+    // Standard input.
+    Input()
+    {
+#ifdef PARACL_POSIX_INPUT
+        fd_ = STDIN_FILENO;
+#else
+        file_ = stdin;
+#endif
+    }
+
+    // Reads text, which is copied.
+    explicit Input(std::string_view text)
+        : text_(text)
+        , pos_(text_.data())
+        , end_(text_.data() + text_.size())
+    {}
+
+    Input(const Input&) = delete;
+    Input& operator=(const Input&) = delete;
+
+    ~Input()
+    {
+        if (!owned_)
+            return;
+
+#ifdef PARACL_POSIX_INPUT
+        ::close(fd_);
+#else
+        std::fclose(file_);
+#endif
+    }
+
+    // The file at path.
+    static std::unique_ptr<Input> open(const std::string& path)
+    {
+        auto input = std::make_unique<Input>();
+
+#ifdef PARACL_POSIX_INPUT
+        input->fd_ = ::open(path.c_str(), O_RDONLY);
+
+        if (input->fd_ < 0)
+#else
+        input->file_ = std::fopen(path.c_str(), "r");
+
+        if (!input->file_)
+#endif
+            throw std::runtime_error("Cannot open input file: " + path + "\n");
+
+        input->owned_ = true;
+
+        return input;
+    }
+
+    // What programs read unless given another source.
+    static Input& standard()
+    {
+        static Input input;
+
+        return input;
+    }
+
+    // Next integer: whitespace, an optional sign and decimal digits.
+    int read(Output& out)
+    {
+        while (true)
+        {
+            while (pos_ != end_ && isSpace(*pos_))
+                ++pos_;
+
+            if (pos_ != end_ || !refill(out))
+                break;
+        }
+
+        // The number may go on in the next block.
+        size_t length = number();
+
+        while (pos_ + length == end_ && refill(out))
+            length = number();
+
+        const char* first = pos_;
+        const char* last = pos_ + length;
+
+        // from_chars takes no plus sign.
+        if (first != last && *first == '+')
+            ++first;
+
+        int value = 0;
+        const auto [ptr, ec] = std::from_chars(first, last, value);
+
+        if (ec != std::errc() || ptr != last)
+            throw std::runtime_error("Incorrect input");
+
+        pos_ = last;
+
+        return value;
+    }
+};
+
+} // namespace detail
+
+} // namespace AST
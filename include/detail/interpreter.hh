@@ -1,10 +1,27 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstring>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
 #include <variant>
+#include <vector>
 
+#include "arithmetic.hh"
 #include "context.hh"
+#include "elementwise.hh"
 #include "log.hh"
 #include "node.hh"
+#include "simd.hh"
+#include "thread_pool.hh"
 #include "visitor.hh"
 #include "types.hh"
 
@@ -18,8 +35,20 @@ class Interpreter final : public Visitor
 {
   private:
     detail::Context ctx_;
-    IType* buf_{};
-	std::unique_ptr<IType> storage_;
+    const Value* buf_{};
+	Value storage_;
+	std::vector<int> indices_;
+
+	// Planned pfor loops run on the pool; each worker interprets the body
+	// in a context sharing the frame of this one.
+	unsigned threads_ = std::max(std::thread::hardware_concurrency(), 1u);
+	std::unique_ptr<ThreadPool> pool_;
+	std::vector<std::unique_ptr<Interpreter>> workers_;
+
+	// Output of a worker, held back per range of iterations so that it can
+	// be written in iteration order.
+	std::unique_ptr<std::ostringstream> buffer_;
+	std::vector<std::pair<long long, std::string>> chunks_;
 
   private:
 	class AssignVisitor
@@ -28,93 +57,453 @@ class Interpreter final : public Visitor
 	  	Interpreter& interpreter_;
 		const AssignNode& node_;
 
-	  private:
-	  	class SrcVisitor
-		{
-		  private:
-		  	Interpreter& interpreter_;
-			std::string_view destName_;
-
-		  public:
-			SrcVisitor(Interpreter& interpreter, std::string_view destName)
-			: interpreter_(interpreter)
-			, destName_(destName) {}
-
-		  	void operator()([[maybe_unused]]ExprPtr src)
-			{
-				MSG("It's Var-Expr assignment\n");
-				interpreter_.ctx_.getVar<Integer>(destName_) =
-					interpreter_.buf_->clone();
-			}
-
-			void operator()([[maybe_unused]]RepeatPtr src)
-			{
-				MSG("It's Var-Repeat assignment\n");
-				interpreter_.ctx_.getVar<Array>(destName_) =
-					interpreter_.buf_->clone();
-			}
-
-            void operator()([[maybe_unused]]ArrayInitPtr src)
-            {
-                MSG("It's Var-ArrayInit assignment\n");
-                interpreter_.ctx_.getVar<Array>(destName_) =
-                    interpreter_.buf_->clone();
-            }
-		};
-
 	  public:
 		explicit AssignVisitor(Interpreter& interpreter, const AssignNode& node)
 		: interpreter_(interpreter)
 		, node_(node) {}
 
-	  	void operator()([[maybe_unused]]const VariablePtr dest)
+	  	void operator()(const VariablePtr dest)
 		{
-			std::string_view destName = node_.getDestName();
+			MSG("It's Var assignment\n");
 
 			node_.acceptSrc(interpreter_);
 
-			std::visit(SrcVisitor(interpreter_, destName), node_.getSrc());
+			interpreter_.store(
+				interpreter_.ctx_.getVar(dest->getBinding()));
 		}
 
 		void operator()(const ArrayElemPtr dest)
 		{
-			std::string_view destName = node_.getDestName();
-
-			dest->acceptIndex(interpreter_);
-			const auto index = static_cast<Integer*>(interpreter_.buf_)->value;
+			const size_t count = interpreter_.pushIndices(*dest);
 
 			node_.acceptSrc(interpreter_);
 
-			auto arrayPtr =
-				dynamic_cast<Array*>(interpreter_.ctx_.getArray(destName).get());
+			// The source is taken first: it may share the target.
+			Value src = interpreter_.take();
+
+			Array* arrayPtr =
+				interpreter_.ctx_.getArray(dest->getBase()->getBinding())
+					.mutableArray();
 
 			if (!arrayPtr) throw std::runtime_error("Indexing non array type\n");
 
-			arrayPtr->assignElem(index, interpreter_.buf_);
+			arrayPtr->write(interpreter_.topIndices(count), count, src,
+							dest->isChecked());
+			interpreter_.popIndices(count);
+
+			interpreter_.setResult(std::move(src));
 		}
 
 	};
 
+  private:
+	// Evaluates the indices of an element chain, last dimension first, onto
+	// indices_. Index expressions may push chains of their own meanwhile.
+	size_t pushIndices(const ArrayElemNode& node)
+	{
+		size_t count = 0;
+
+		for (auto elem = &node;; elem = elem->getArrayElem())
+		{
+			elem->acceptIndex(*this);
+			indices_.push_back(buf_->getInt());
+			++count;
+
+			if (elem->holdsVariable())
+				return count;
+		}
+	}
+
+	// Indices of the top chain in dimension order.
+	const int* topIndices(size_t count)
+	{
+		const auto first = indices_.end() - static_cast<std::ptrdiff_t>(count);
+
+		std::reverse(first, indices_.end());
+
+		return &*first;
+	}
+
+	void popIndices(size_t count)
+	{
+		indices_.resize(indices_.size() - count);
+	}
+
+	// Temporaries are moved out, anything else is copied.
+	Value take()
+	{
+		if (buf_ == &storage_)
+			return std::move(storage_);
+
+		return *buf_;
+	}
+
+	void store(Value& dest)
+	{
+		dest = take();
+		buf_ = &dest;
+	}
+
+	void setResult(Value&& value)
+	{
+		storage_ = std::move(value);
+		buf_ = &storage_;
+	}
+
+	void setResult(int value)
+	{
+		storage_ = value;
+		buf_ = &storage_;
+	}
+
+	// Flat row of integers a loop reading or writing [first, last) stays
+	// within, or nullptr.
+	const Array* row(const Binding& binding, long long first, long long last)
+	{
+		const Array* array = ctx_.getVar(binding).getArray();
+
+		if (!array || array->rank() != 1 || first < 0 ||
+			static_cast<size_t>(last) > array->size())
+			return nullptr;
+
+		return array;
+	}
+
+	// Runs a loop detail::Idioms recognized with a kernel; false leaves it
+	// to run as written, as it does when an array is not a flat row of
+	// integers or the loop would step out of one.
+	bool idiom(const WhileNode::Idiom& idiom)
+	{
+		using Kind = WhileNode::Idiom::Kind;
+
+		if (idiom.kind == Kind::NONE || !ctx_.getVar(idiom.loop).isInt())
+			return false;
+
+		const int first = ctx_.getVar(idiom.loop).getInt();
+
+		idiom.bound->accept(*this);
+
+		if (!buf_->isInt())
+			return false;
+
+		const int last = buf_->getInt();
+
+		// The condition fails at once.
+		if (last <= first)
+			return true;
+
+		const size_t count = static_cast<size_t>(static_cast<long long>(last) - first);
+		const bool total = idiom.kind != Kind::FILL && idiom.kind != Kind::COPY &&
+						   idiom.kind != Kind::SCAN;
+		const bool store = idiom.kind != Kind::SUM && idiom.kind != Kind::MIN &&
+						   idiom.kind != Kind::MAX;
+		const long long from = idiom.kind == Kind::SCAN ? first - 1LL : first;
+
+		if ((total && !ctx_.getVar(idiom.total).isInt()) ||
+			(store && !row(idiom.array, from, last)) ||
+			(idiom.kind != Kind::FILL && !row(idiom.source, first, last)))
+			return false;
+
+		int value = 0;
+
+		if (idiom.kind == Kind::FILL)
+		{
+			idiom.value->accept(*this);
+
+			if (!buf_->isInt())
+				return false;
+
+			value = buf_->getInt();
+		}
+
+		// The stored row is detached first: it may share storage with the
+		// one read.
+		int* out = store ? ctx_.getVar(idiom.array).mutableArray()->data() + first
+						 : nullptr;
+		const int* in = idiom.kind == Kind::FILL
+							? nullptr
+							: ctx_.getVar(idiom.source).getArray()->elements().data() +
+								  first;
+		Value* sum = total ? &ctx_.getVar(idiom.total) : nullptr;
+
+		switch (idiom.kind)
+		{
+			case Kind::FILL:
+				if (value == 0)
+					std::memset(out, 0, count * sizeof(int));
+				else
+					std::fill_n(out, count, value);
+				break;
+
+			case Kind::COPY:
+				std::memmove(out, in, count * sizeof(int));
+				break;
+
+			case Kind::SUM:
+				*sum = reduceKernel(Reduce::SUM)(in, count, sum->getInt());
+				break;
+
+			case Kind::MIN:
+				*sum = reduceKernel(Reduce::MIN)(in, count, sum->getInt());
+				break;
+
+			case Kind::MAX:
+				*sum = reduceKernel(Reduce::MAX)(in, count, sum->getInt());
+				break;
+
+			case Kind::SCAN:
+				scanKernel()(in, out, count, out[-1]);
+				break;
+
+			case Kind::RUNNING:
+				*sum = scanKernel()(in, out, count, sum->getInt());
+				break;
+
+			case Kind::NONE:
+			default:
+				return false;
+		}
+
+		ctx_.getVar(idiom.loop) = last;
+
+		return true;
+	}
+
+	// Runs a loop planned parallel on the pool; false leaves it to run
+	// in order.
+	bool parallel(const WhileNode::Plan& plan)
+	{
+		if (!plan.parallel || threads_ < 2)
+			return false;
+
+		const int first = ctx_.getVarValue(plan.loop).getInt();
+
+		plan.bound->accept(*this);
+
+		const int last = buf_->getInt();
+
+		if (static_cast<long long>(last) - first < plan.minimum)
+			return false;
+
+		if (first < last)
+			parallelFor(plan, ctx_.boundSlot(plan.loop), first, last);
+
+		return true;
+	}
+
+	explicit Interpreter(std::unique_ptr<std::ostringstream> buffer)
+		: ctx_(*buffer, Flush::EXIT)
+		, threads_(1)
+		, buffer_(std::move(buffer))
+	{}
+
+	void flush(long long begin)
+	{
+		ctx_.out.flush();
+
+		if (buffer_->tellp() > 0)
+		{
+			chunks_.emplace_back(begin, buffer_->str());
+			buffer_->str("");
+		}
+	}
+
+	// Runs the iterations [first, last) of a planned loop on the pool; the
+	// loop variable lives in slot loop.
+	void parallelFor(const WhileNode::Plan& plan, int loop, int first, int last)
+	{
+		if (!pool_)
+		{
+			pool_ = std::make_unique<ThreadPool>(threads_);
+
+			for (unsigned id = 0; id < threads_; ++id)
+			{
+				workers_.emplace_back(
+					new Interpreter(std::make_unique<std::ostringstream>()));
+				workers_.back()->ctx_.setLayout(ctx_.layout_);
+			}
+		}
+
+		// Stores of the workers must find every array they write unshared.
+		for (const int slot : plan.arrays)
+			if (Array* array = ctx_.local(slot).mutableArray())
+				array->detach();
+
+		for (const auto& worker : workers_)
+		{
+			Context& ctx = worker->ctx_;
+
+			ctx.share(ctx_, plan.privates);
+
+			for (size_t slot = 0; slot < plan.privates.size(); ++slot)
+				if (plan.privates[slot])
+					ctx.frame_[slot].reset();
+
+			for (const auto& [slot, op] : plan.reductions)
+				ctx.local(slot) = op == BinaryOp::MUL ? 1 : 0;
+
+			worker->chunks_.clear();
+		}
+
+		// Variables stepped along with i: where each starts and its step.
+		std::vector<std::pair<int, int>> steps;
+
+		for (const auto& [slot, step] : plan.steps)
+		{
+			step->accept(*this);
+			steps.emplace_back(ctx_.local(slot).getInt(), buf_->getInt());
+		}
+
+		const auto stepped = [&steps](size_t id, long long count)
+		{
+			return add(steps[id].first,
+					   multiply(static_cast<int>(count), steps[id].second));
+		};
+
+		const StmtPtr body = plan.body;
+		std::mutex mutex;
+		std::exception_ptr error;
+		std::atomic<long long> failed{LLONG_MAX}; // first iteration that threw
+
+		const long long count = static_cast<long long>(last) - first;
+
+		pool_->run(first, last, count / (threads_ * 16LL),
+				   [&](unsigned id, long long begin, long long end)
+		{
+			Interpreter& worker = *workers_[id];
+			long long index = begin;
+
+			try
+			{
+				for (; index < end && index < failed.load(std::memory_order_relaxed);
+					 ++index)
+				{
+					worker.ctx_.local(loop) = static_cast<int>(index);
+
+					for (size_t step = 0; step < steps.size(); ++step)
+						worker.ctx_.local(plan.steps[step].first) =
+							stepped(step, index - first);
+
+					body->accept(worker);
+				}
+			}
+			catch (...)
+			{
+				std::lock_guard lock(mutex);
+
+				if (index < failed.load())
+				{
+					failed.store(index);
+					error = std::current_exception();
+				}
+			}
+
+			// Only this worker ran the last iteration, and the slots are
+			// private to every worker.
+			if (index == last)
+				for (const int slot : plan.lasts)
+					ctx_.local(slot) = worker.ctx_.local(slot);
+
+			worker.flush(begin);
+		});
+
+		// Output up to the first failing iteration, as the loop would have
+		// printed it running alone.
+		std::vector<std::pair<long long, std::string>> chunks;
+
+		for (const auto& worker : workers_)
+			std::move(worker->chunks_.begin(), worker->chunks_.end(),
+					  std::back_inserter(chunks));
+
+		std::sort(chunks.begin(), chunks.end());
+
+		for (const auto& [begin, text] : chunks)
+			if (begin <= failed.load())
+				ctx_.out.write(text);
+
+		if (error)
+			std::rethrow_exception(error);
+
+		for (const auto& [slot, op] : plan.reductions)
+		{
+			Value& total = ctx_.getVar(Binding{slot});
+			int value = total.getInt();
+
+			for (const auto& worker : workers_)
+			{
+				const int part = worker->ctx_.local(slot).getInt();
+
+				value = op == BinaryOp::MUL ? multiply(value, part)
+											: add(value, part);
+			}
+
+			total = value;
+		}
+
+		for (size_t id = 0; id < steps.size(); ++id)
+			ctx_.local(plan.steps[id].first) = stepped(id, count);
+
+		ctx_.local(loop) = last;
+	}
+
   public:
     Interpreter(std::ostream &out = std::cout)
         : ctx_(out)
     {}
 
-    int getBuf() const { return static_cast<Integer*>(buf_)->value; }
+    int getBuf() const { return buf_->getInt(); }
+
+    void setLayout(const FrameLayout& layout)
+	{
+		ctx_.setLayout(layout);
+
+		workers_.clear();
+		pool_.reset();
+	}
+
+	// Slots of the next statement of a streamed program, see
+	// Context::extend.
+	void extendLayout(const std::vector<std::string_view>& names,
+					  const std::vector<std::vector<int>>& chains)
+	{
+		ctx_.extend(names, chains);
+
+		for (auto& worker : workers_)
+			worker->ctx_.extend(names, chains);
+	}
+
+	void setFlush(Flush flush) { ctx_.out.setFlush(flush); }
+
+	// Where ? reads from.
+	void setInput(Input& in) { ctx_.in = &in; }
+
+	// Hands on what the program printed so far, as the engine does when it
+	// stops.
+	void flushOutput() { ctx_.out.flush(); }
+
+	// Hands on what was printed unless the policy holds it to the end, as
+	// before the program waits.
+	void promptOutput() { ctx_.out.prompt(); }
+
+	// Threads planned pfor loops run on.
+	void setThreads(unsigned threads)
+	{
+		threads_ = std::max(threads, 1u);
+
+		workers_.clear();
+		pool_.reset();
+	}
 
     void visit(const ConstantNode &node) override
 	{
-		storage_.reset();
-		storage_ = std::make_unique<Integer>(node.getVal());
-		buf_ = storage_.get();
+		setResult(node.getVal());
 	}
 
     void visit(const VariableNode &node) override
     {
-        std::string_view name = node.getName();
-        LOG("Evaluating variable: {}\n", name);
+        LOG("Evaluating variable: {}\n", node.getName());
 
-        buf_ = ctx_.getVarValue(name);
+        buf_ = &ctx_.getVarValue(node.getBinding());
     }
 
     void visit(const BinaryOpNode &node) override
@@ -122,36 +511,44 @@ class Interpreter final : public Visitor
         MSG("Evaluating Binary Operation\n");
 
         node.accept_left(*this);
-        int leftVal = static_cast<Integer*>(buf_)->value;
+
+        if (!node.isInteger())
+        {
+            // The right operand may overwrite a temporary left one.
+            const Value left = take();
+
+            node.accept_right(*this);
+            setResult(elementwise(node.getOp(), left, *buf_));
+            return;
+        }
+
+        int leftVal = buf_->getInt();
 
         node.accept_right(*this);
-        int rightVal = static_cast<Integer*>(buf_)->value;
+        int rightVal = buf_->getInt();
 
         int result{};
 
         switch (node.getOp())
         {
             case BinaryOp::ADD:
-                result = leftVal + rightVal;
+                result = add(leftVal, rightVal);
                 break;
 
             case BinaryOp::SUB:
-                result = leftVal - rightVal;
+                result = subtract(leftVal, rightVal);
                 break;
 
             case BinaryOp::MUL:
-                result = leftVal * rightVal;
+                result = multiply(leftVal, rightVal);
                 break;
 
             case BinaryOp::DIV:
-                if (rightVal == 0)
-					throw std::runtime_error("Divide by zero");
-
-                result = leftVal / rightVal;
+                result = divide(leftVal, rightVal);
                 break;
 
             case BinaryOp::MOD:
-                result = leftVal % rightVal;
+                result = modulo(leftVal, rightVal);
                 break;
 
             case BinaryOp::LS:
@@ -192,10 +589,7 @@ class Interpreter final : public Visitor
 
         LOG("It's {}\n", result);
 
-		storage_.reset();
-		storage_ = std::make_unique<Integer>(result);
-
-        buf_ = storage_.get();
+		setResult(result);
     }
 
     void visit(const ScopeNode &node) override
@@ -205,8 +599,6 @@ class Interpreter final : public Visitor
 
         MSG("Evaluating scope\n");
 
-        ctx_.varTables_.push_back(detail::Context::VarTable());
-
         MSG("Scopes children:\n");
         for ([[maybe_unused]] const auto &child : node.getChildren())
         {
@@ -219,7 +611,7 @@ class Interpreter final : public Visitor
             child->accept(*this);
         }
 
-        ctx_.varTables_.pop_back();
+        ctx_.clearSlots(node.slotBegin(), node.slotEnd());
     }
 
     void visit(const UnaryOpNode &node) override
@@ -227,14 +619,14 @@ class Interpreter final : public Visitor
         MSG("Evaluating Unary Operation\n");
 
         node.acceptOperand(*this);
-        int operandVal = static_cast<Integer*>(buf_)->value;
+        int operandVal = buf_->getInt();
 
 		int result{};
 
         switch (node.getOp())
         {
             case UnaryOp::NEG:
-                result = -operandVal;
+                result = negate(operandVal);
                 break;
 
             case UnaryOp::NOT:
@@ -245,9 +637,7 @@ class Interpreter final : public Visitor
                 throw std::runtime_error("Unknown unary operation");
         }
 
-		storage_.reset();
-		storage_ = std::make_unique<Integer>(result);
-		buf_ = storage_.get();
+		setResult(result);
     }
 
 	void visit(const AssignNode &node) override
@@ -261,46 +651,35 @@ class Interpreter final : public Visitor
 	{
 		MSG("Evaluating ArrayElemNode\n");
 
-        node.acceptIndex(*this);
-        int index = static_cast<Integer*>(buf_)->value;
-		LOG("Index: {}\n", index);
-
-		if (node.holdsVariable())
-		{
-			std::string_view destName = node.getName();
-
-			LOG("Array Name: {}\n", destName);
-
-			auto arrayPtr = dynamic_cast<Array*>(ctx_.getArray(destName).get());
+		const size_t count = pushIndices(node);
+		const VariablePtr base = node.getBase();
 
-			if (!arrayPtr)
-			{
-				std::cerr << destName << " is not an array type\n";
-				throw std::runtime_error("Can't use [] to non array variables\n");
-			}
+		LOG("Array Name: {}\n", base->getName());
 
-			buf_ = arrayPtr->getElem(index);
-		}
-		else if (node.holdsArrayElem())
+		// Typed reads are of arrays for sure.
+		if (node.isInteger())
 		{
-			node.acceptName(*this);
+			const Array& array = *ctx_.getArray(base->getBinding()).getArray();
+			const int value =
+				array.readInt(topIndices(count), count, node.isChecked());
 
-			auto arrayPtr = dynamic_cast<Array*>(buf_);
+			popIndices(count);
+			setResult(value);
+			return;
+		}
 
-			if (!arrayPtr)
-			{
-				throw std::runtime_error(
-					"ArrayElem name acceptance "
-					"did not result in Array\n"
-				);
-			}
+		const Array* arrayPtr = ctx_.getArray(base->getBinding()).getArray();
 
-			buf_ = arrayPtr->getElem(index);
-		}
-		else
+		if (!arrayPtr)
 		{
-			throw std::runtime_error("Array element holds invalid type\n");
+			std::cerr << base->getName() << " is not an array type\n";
+			throw std::runtime_error("Can't use [] to non array variables\n");
 		}
+
+		arrayPtr->read(topIndices(count), count, storage_, node.isChecked());
+		popIndices(count);
+
+		buf_ = &storage_;
 	}
 
     void visit(const WhileNode &node) override
@@ -308,12 +687,20 @@ class Interpreter final : public Visitor
         // node.acceptCond(*this);
         // int cond = buf_;
 
-        while (node.acceptCond(*this), static_cast<Integer*>(buf_)->value)
+        if (idiom(node.idiom()) || parallel(node.plan()))
+            return;
+
+        while (node.acceptCond(*this), buf_->getInt())
         {
             node.acceptScope(*this);
         }
     }
 
+	void visit(const PforNode& node) override
+	{
+		visit(static_cast<const WhileNode&>(node));
+	}
+
     void visit(const IfElseNode &node) override
     {
         if (!node.hasCond())
@@ -324,7 +711,7 @@ class Interpreter final : public Visitor
         }
 
         node.acceptCond(*this);
-        int cond = static_cast<Integer*>(buf_)->value;
+        int cond = buf_->getInt();
 
         if (cond)
         {
@@ -342,25 +729,14 @@ class Interpreter final : public Visitor
         MSG("Evaluation print\n");
 
         node.acceptExpr(*this);
-        int value = static_cast<Integer*>(buf_)->value;
+        int value = buf_->getInt();
 
-        ctx_.out << value << '\n';
+        ctx_.out.print(value);
     }
 
     void visit([[maybe_unused]] const InNode &node) override
     {
-        int value = 0;
-
-        std::cin >> value;
-
-        if (!std::cin.good())
-        {
-            throw std::runtime_error("Incorrect input");
-        }
-
-		storage_.reset();
-		storage_ = std::make_unique<Integer>(value);
-		buf_ = storage_.get();
+		setResult(ctx_.in->read(ctx_.out));
     }
 
 	void visit(const RepeatNode &node) override
@@ -369,7 +745,7 @@ class Interpreter final : public Visitor
 
 		node.acceptSize(*this);
 
-		const auto size = static_cast<Integer*>(buf_)->value;
+		const auto size = buf_->getInt();
 
 		LOG("Size: {}\n", size);
 
@@ -379,19 +755,13 @@ class Interpreter final : public Visitor
 
 			node.acceptElem(*this);
 
-			std::unique_ptr<IType> elem = buf_->clone();
-
-			storage_.reset();
-			storage_ = std::make_unique<Array>(elem.get(), size);
-			buf_ = storage_.get();
+			setResult(Value(Array(*buf_, size)));
 		}
 		else
 		{
 			MSG("Undefined repeat\n");
 
-			storage_.reset();
-			storage_ = std::make_unique<Array>(size);
-			buf_ = storage_.get();
+			setResult(Value(Array(size)));
 		}
 	}
 
@@ -401,29 +771,22 @@ class Interpreter final : public Visitor
 
         size_t array_size = node.arraySize();
 
-        std::vector<std::unique_ptr<IType>> data;
+        std::vector<Value> data;
+        data.reserve(array_size);
 
         for (int id = array_size - 1 ; id >= 0 ; --id)
         {
             node.acceptElem(id, *this);
 
-            data.push_back(std::move(buf_->clone()));
+            data.push_back(*buf_);
         }
 
-        storage_.reset();
-        storage_ = std::make_unique<Array>(std::move(data));
-        buf_ = storage_.get();
+        setResult(Value(Array(std::move(data))));
     }
 
     bool varInitialized(std::string_view varName) const
     {
-        for (const auto &varTable : ctx_.varTables_)
-        {
-            if (varTable.count(varName) > 0)
-                return true;
-        }
-
-        return false;
+        return ctx_.varInitialized(varName);
     }
 };
 
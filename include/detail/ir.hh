@@ -0,0 +1,328 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+#include "frame.hh"
+#include "node.hh"
+
+namespace AST
+{
+
+namespace detail
+{
+
+namespace ir
+{
+
+// An instruction defines the value named by its index in Function::insts.
+// Operands are such indices unless noted.
+enum class Op : uint8_t
+{
+    CONST,      // a
+    UNDEF,      // promoted slot read before any store reached it
+    PHI,        // args[k] when control came from preds[k]
+    LOAD,       // slot binding
+    STORE,      // slot binding = args[0]
+    LOAD_ELEM,  // array[args[1]]...[args[n - 1]], array in args[0] or in
+                // slot binding when frame is set (indices from args[0] then)
+    STORE_ELEM, // slot binding[args[0]]...[args[n - 2]] = args[n - 1]
+    UNARY,      // unary args[0]
+    BINARY,     // args[0] binary args[1]
+    ELEMENTWISE, // BINARY on arrays as well; may fail
+    INPUT,
+    PRINT,      // args[0]
+    REPEAT,     // repeat(args[1], args[0]), undef elements without args[1]
+    ARRAY,      // array(args[0], ...)
+    LEAVE,      // undefine slots [a, b)
+    JUMP,       // to succs[0]
+    BRANCH,     // args[0] ? succs[0] : succs[1]
+    RETURN,
+};
+
+struct Inst
+{
+    Op op{};
+    size_t block = 0;
+    int a = 0;
+    int b = 0;
+    BinaryOp binary{};
+    UnaryOp unary{};
+    Binding binding{}; // also names the array of LOAD_ELEM in messages
+    bool frame = false;
+    bool checked = true;
+    bool dead = false;
+    std::vector<size_t> args;
+};
+
+struct Block
+{
+    std::vector<size_t> insts; // phis first, a terminator last
+    std::vector<size_t> preds;
+    std::vector<size_t> succs;
+};
+
+inline bool isTerminator(Op op)
+{
+    return op == Op::JUMP || op == Op::BRANCH || op == Op::RETURN;
+}
+
+inline const char* opName(Op op)
+{
+    switch (op)
+    {
+        case Op::CONST:      return "const";
+        case Op::UNDEF:      return "undef";
+        case Op::PHI:        return "phi";
+        case Op::LOAD:       return "load";
+        case Op::STORE:      return "store";
+        case Op::LOAD_ELEM:  return "load_elem";
+        case Op::STORE_ELEM: return "store_elem";
+        case Op::UNARY:      return "unary";
+        case Op::BINARY:     return "binary";
+        case Op::ELEMENTWISE: return "elementwise";
+        case Op::INPUT:      return "input";
+        case Op::PRINT:      return "print";
+        case Op::REPEAT:     return "repeat";
+        case Op::ARRAY:      return "array";
+        case Op::LEAVE:      return "leave";
+        case Op::JUMP:       return "jump";
+        case Op::BRANCH:     return "branch";
+        case Op::RETURN:     return "return";
+        default:             return "unknown";
+    }
+}
+
+inline const char* opName(BinaryOp op)
+{
+    switch (op)
+    {
+        case BinaryOp::ADD:    return "add";
+        case BinaryOp::SUB:    return "sub";
+        case BinaryOp::MUL:    return "mul";
+        case BinaryOp::DIV:    return "div";
+        case BinaryOp::MOD:    return "mod";
+        case BinaryOp::GR:     return "gr";
+        case BinaryOp::LS:     return "ls";
+        case BinaryOp::EQ:     return "eq";
+        case BinaryOp::GR_EQ:  return "gr_eq";
+        case BinaryOp::LS_EQ:  return "ls_eq";
+        case BinaryOp::NOT_EQ: return "not_eq";
+        case BinaryOp::AND:    return "and";
+        case BinaryOp::OR:     return "or";
+        default:               return "unknown";
+    }
+}
+
+// A program in SSA form. Frame slots whose every access the resolver could
+// pin down become SSA values; the rest stay in the frame and are accessed
+// with explicit loads and stores, as are array elements. Block 0 is the
+// entry.
+class Function final
+{
+  public:
+    std::vector<Inst> insts;
+    std::vector<Block> blocks;
+    FrameLayout layout;
+
+  public:
+    // Number of leading phis of a block.
+    size_t phis(size_t block) const
+    {
+        const std::vector<size_t>& list = blocks[block].insts;
+
+        return static_cast<size_t>(std::find_if(list.begin(), list.end(),
+                                                [this](size_t id)
+                                                { return insts[id].op != Op::PHI; }) -
+                                   list.begin());
+    }
+
+    // Appends inst before the terminator of block, if there is one.
+    size_t insert(size_t block, Inst inst)
+    {
+        const size_t id = insts.size();
+        std::vector<size_t>& list = blocks[block].insts;
+
+        inst.block = block;
+        insts.push_back(std::move(inst));
+
+        if (!list.empty() && isTerminator(insts[list.back()].op))
+            list.insert(list.end() - 1, id);
+        else
+            list.push_back(id);
+
+        return id;
+    }
+
+    // Replaces every operand v by replacement[v], following chains.
+    void rewrite(std::vector<size_t>& replacement)
+    {
+        const auto find = [&](size_t value)
+        {
+            size_t root = value;
+
+            while (replacement[root] != root)
+                root = replacement[root];
+
+            while (replacement[value] != root)
+                value = std::exchange(replacement[value], root);
+
+            return root;
+        };
+
+        for (Inst& inst : insts)
+            if (!inst.dead)
+                for (size_t& arg : inst.args)
+                    arg = find(arg);
+    }
+
+    // Removes dead instructions from their blocks.
+    void sweep()
+    {
+        for (Block& block : blocks)
+            std::erase_if(block.insts,
+                          [this](size_t id) { return insts[id].dead; });
+    }
+
+    // Reachable blocks, each after all of its predecessors but those along
+    // back edges.
+    std::vector<size_t> order() const
+    {
+        std::vector<size_t> post;
+        std::vector<bool> seen(blocks.size(), false);
+        std::vector<std::pair<size_t, size_t>> stack{{0, 0}};
+
+        seen[0] = true;
+
+        while (!stack.empty())
+        {
+            auto& [block, next] = stack.back();
+            const std::vector<size_t>& succs = blocks[block].succs;
+
+            if (next < succs.size())
+            {
+                const size_t succ = succs[next++];
+
+                if (!seen[succ])
+                {
+                    seen[succ] = true;
+                    stack.emplace_back(succ, 0);
+                }
+
+                continue;
+            }
+
+            post.push_back(block);
+            stack.pop_back();
+        }
+
+        std::reverse(post.begin(), post.end());
+
+        return post;
+    }
+
+    void dump(std::ostream& os) const
+    {
+        const auto name = [this](const Binding& binding)
+        { return layout.name(binding.slot); };
+
+        for (const size_t block : order())
+        {
+            os << 'b' << block << ':';
+
+            if (!blocks[block].preds.empty())
+            {
+                os << "\t; preds";
+
+                for (const size_t pred : blocks[block].preds)
+                    os << " b" << pred;
+            }
+
+            os << '\n';
+
+            for (const size_t id : blocks[block].insts)
+            {
+                const Inst& inst = insts[id];
+
+                os << "  ";
+
+                if (!isTerminator(inst.op) && inst.op != Op::STORE &&
+                    inst.op != Op::STORE_ELEM && inst.op != Op::PRINT &&
+                    inst.op != Op::LEAVE)
+                    os << '%' << id << " = ";
+
+                os << opName(inst.op);
+
+                switch (inst.op)
+                {
+                    case Op::CONST:
+                        os << ' ' << inst.a;
+                        break;
+
+                    case Op::UNARY:
+                        os << (inst.unary == UnaryOp::NEG ? " neg" : " not");
+                        break;
+
+                    case Op::BINARY:
+                    case Op::ELEMENTWISE:
+                        os << ' ' << opName(inst.binary);
+                        break;
+
+                    case Op::LOAD:
+                    case Op::STORE:
+                    case Op::STORE_ELEM:
+                        os << ' ' << name(inst.binding);
+                        break;
+
+                    case Op::LOAD_ELEM:
+                        if (inst.frame)
+                            os << ' ' << name(inst.binding);
+                        break;
+
+                    case Op::LEAVE:
+                        os << ' ' << inst.a << ' ' << inst.b;
+                        break;
+
+                    case Op::UNDEF:
+                    case Op::PHI:
+                    case Op::INPUT:
+                    case Op::PRINT:
+                    case Op::REPEAT:
+                    case Op::ARRAY:
+                    case Op::JUMP:
+                    case Op::BRANCH:
+                    case Op::RETURN:
+                    default:
+                        break;
+                }
+
+                for (size_t arg = 0; arg < inst.args.size(); ++arg)
+                {
+                    os << (arg ? ", %" : " %") << inst.args[arg];
+
+                    if (inst.op == Op::PHI)
+                        os << " b" << blocks[block].preds[arg];
+                }
+
+                if (!inst.checked)
+                    os << " unchecked";
+
+                for (const size_t succ : blocks[block].succs)
+                    if (isTerminator(inst.op))
+                        os << " b" << succ;
+
+                os << '\n';
+            }
+        }
+    }
+};
+
+} // namespace ir
+
+} // namespace detail
+
+} // namespace AST
@@ -0,0 +1,629 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "frame.hh"
+#include "ir.hh"
+#include "log.hh"
+#include "node.hh"
+
+namespace AST
+{
+
+namespace detail
+{
+
+namespace ir
+{
+
+// Lowers a resolved scope tree to SSA form, building phis on the fly while
+// the blocks are emitted (Braun et al., "Simple and Efficient Construction
+// of Static Single Assignment Form").
+//
+// A slot is promoted to SSA values when every read of it is certainly
+// bound, no candidate chain includes it and no element of it is stored to;
+// such a slot is never observed undefined, so its scope exit needs no code.
+// Every other slot stays in the frame.
+class Builder final
+{
+  private:
+    Function fn_;
+    size_t cur_ = 0;
+
+    std::vector<bool> frame_; // slots that stay in the frame
+    std::vector<std::unordered_map<int, size_t>> defs_;
+    std::vector<bool> sealed_;
+    std::vector<std::vector<std::pair<int, size_t>>> incomplete_; // slot, phi
+
+  private:
+    // Whether slot stays in the frame.
+    std::vector<bool>::reference framed(int slot)
+    {
+        return frame_[static_cast<size_t>(slot)];
+    }
+
+    // Marks slots that cannot be promoted.
+    void scan(ExprPtr expr)
+    {
+        if (auto var = dynamic_cast<const VariableNode*>(expr))
+        {
+            if (!var->getBinding().sure)
+                framed(var->getBinding().slot) = true;
+        }
+        else if (auto unary = dynamic_cast<const UnaryOpNode*>(expr))
+            scan(unary->getOperand());
+        else if (auto binary = dynamic_cast<const BinaryOpNode*>(expr))
+        {
+            scan(binary->getLeft());
+            scan(binary->getRight());
+        }
+        else if (auto elem = dynamic_cast<const ArrayElemNode*>(expr))
+            scanChain(*elem);
+        else if (auto assign = dynamic_cast<const AssignNode*>(expr))
+        {
+            if (auto dest = std::get_if<ArrayElemPtr>(&assign->getDest()))
+            {
+                scanChain(**dest);
+                framed((*dest)->getBase()->getBinding().slot) = true;
+            }
+
+            scan(assign->getSrc());
+        }
+    }
+
+    void scanChain(const ArrayElemNode& node)
+    {
+        for (auto elem = &node;; elem = elem->getArrayElem())
+        {
+            scan(elem->getIndex());
+
+            if (elem->holdsVariable())
+                return scan(elem->getVariable());
+        }
+    }
+
+    void scan(const Rhs& rhs)
+    {
+        if (auto expr = std::get_if<ExprPtr>(&rhs))
+            return scan(*expr);
+
+        if (auto init = std::get_if<ArrayInitPtr>(&rhs))
+        {
+            for (size_t id = 0; id < (*init)->arraySize(); ++id)
+                scan((*init)->getElem(id));
+
+            return;
+        }
+
+        const RepeatNode& repeat = *std::get<RepeatPtr>(rhs);
+
+        scan(repeat.getSize());
+
+        if (repeat.hasElem())
+            scan(repeat.getElem());
+    }
+
+    void scan(StmtPtr stmt)
+    {
+        if (auto scope = dynamic_cast<const ScopeNode*>(stmt))
+        {
+            for (StmtPtr child : scope->getChildren())
+                scan(child);
+        }
+        else if (auto expr = dynamic_cast<ExprPtr>(stmt))
+            scan(expr);
+        else if (auto print = dynamic_cast<const PrintNode*>(stmt))
+            scan(print->getExpr());
+        else if (auto ifElse = dynamic_cast<const IfElseNode*>(stmt))
+        {
+            if (ifElse->hasCond())
+                scan(ifElse->getCond());
+
+            scan(ifElse->getAction());
+
+            if (ifElse->hasAltAction())
+                scan(ifElse->getAltAction());
+        }
+        else if (auto loop = dynamic_cast<const WhileNode*>(stmt))
+        {
+            scan(loop->getCond());
+            scan(loop->getScope());
+        }
+    }
+
+    size_t block()
+    {
+        fn_.blocks.emplace_back();
+        defs_.emplace_back();
+        sealed_.push_back(false);
+        incomplete_.emplace_back();
+
+        return fn_.blocks.size() - 1;
+    }
+
+    size_t emit(Inst inst) { return fn_.insert(cur_, std::move(inst)); }
+
+    size_t emit(Op op, std::vector<size_t> args = {})
+    {
+        Inst inst;
+
+        inst.op = op;
+        inst.args = std::move(args);
+
+        return emit(std::move(inst));
+    }
+
+    void link(size_t from, size_t to)
+    {
+        fn_.blocks[from].succs.push_back(to);
+        fn_.blocks[to].preds.push_back(from);
+    }
+
+    void jump(size_t target)
+    {
+        emit(Op::JUMP);
+        link(cur_, target);
+    }
+
+    void branch(size_t cond, size_t then, size_t other)
+    {
+        emit(Op::BRANCH, {cond});
+        link(cur_, then);
+        link(cur_, other);
+    }
+
+    size_t phi(size_t block)
+    {
+        Inst inst;
+
+        inst.op = Op::PHI;
+        inst.block = block;
+
+        const size_t id = fn_.insts.size();
+        std::vector<size_t>& list = fn_.blocks[block].insts;
+
+        fn_.insts.push_back(std::move(inst));
+        list.insert(list.begin() + static_cast<std::ptrdiff_t>(fn_.phis(block)),
+                    id);
+
+        return id;
+    }
+
+    size_t undef()
+    {
+        Inst inst;
+
+        inst.op = Op::UNDEF;
+
+        return fn_.insert(0, std::move(inst));
+    }
+
+    void write(int slot, size_t block, size_t value)
+    {
+        defs_[block][slot] = value;
+    }
+
+    size_t read(int slot, size_t block)
+    {
+        if (auto found = defs_[block].find(slot); found != defs_[block].end())
+            return found->second;
+
+        const std::vector<size_t>& preds = fn_.blocks[block].preds;
+        size_t value = 0;
+
+        if (!sealed_[block])
+        {
+            value = phi(block);
+            incomplete_[block].emplace_back(slot, value);
+        }
+        else if (preds.empty())
+            value = undef();
+        else if (preds.size() == 1)
+            value = read(slot, preds.front());
+        else
+        {
+            // Written first, so that a cycle back to block ends here.
+            value = phi(block);
+            write(slot, block, value);
+            operands(slot, value);
+        }
+
+        write(slot, block, value);
+
+        return value;
+    }
+
+    void operands(int slot, size_t phi)
+    {
+        for (const size_t pred : fn_.blocks[fn_.insts[phi].block].preds)
+        {
+            const size_t value = read(slot, pred);
+
+            fn_.insts[phi].args.push_back(value);
+        }
+    }
+
+    // All predecessors of block are known now.
+    void seal(size_t block)
+    {
+        for (const auto& [slot, phi] : incomplete_[block])
+            operands(slot, phi);
+
+        incomplete_[block].clear();
+        sealed_[block] = true;
+    }
+
+    // A phi whose operands are itself and one other value is that value.
+    void simplify()
+    {
+        std::vector<size_t> replacement(fn_.insts.size());
+
+        for (size_t id = 0; id < replacement.size(); ++id)
+            replacement[id] = id;
+
+        const auto find = [&](size_t value)
+        {
+            while (replacement[value] != value)
+                value = replacement[value];
+
+            return value;
+        };
+
+        for (bool changed = true; changed;)
+        {
+            changed = false;
+
+            for (size_t id = 0; id < fn_.insts.size(); ++id)
+            {
+                Inst& inst = fn_.insts[id];
+
+                if (inst.op != Op::PHI || inst.dead)
+                    continue;
+
+                // The phi itself until another operand turns up.
+                size_t same = id;
+                bool trivial = true;
+
+                for (const size_t arg : inst.args)
+                {
+                    const size_t value = find(arg);
+
+                    if (value == same || value == id)
+                        continue;
+
+                    if (same != id)
+                    {
+                        trivial = false;
+                        break;
+                    }
+
+                    same = value;
+                }
+
+                if (!trivial)
+                    continue;
+
+                // Only reachable from itself.
+                if (same == id)
+                {
+                    same = undef();
+                    replacement.push_back(same);
+                }
+
+                fn_.insts[id].dead = true;
+                replacement[id] = same;
+                changed = true;
+            }
+        }
+
+        fn_.rewrite(replacement);
+        fn_.sweep();
+    }
+
+    size_t load(const Binding& binding)
+    {
+        if (!framed(binding.slot))
+            return read(binding.slot, cur_);
+
+        Inst inst;
+
+        inst.op = Op::LOAD;
+        inst.binding = binding;
+
+        return emit(std::move(inst));
+    }
+
+    // Indices of a chain in dimension order, evaluated last dimension first
+    // like the engines do.
+    std::vector<size_t> indices(const ArrayElemNode& node)
+    {
+        std::vector<size_t> result;
+
+        for (auto elem = &node;; elem = elem->getArrayElem())
+        {
+            result.push_back(value(elem->getIndex()));
+
+            if (elem->holdsVariable())
+                break;
+        }
+
+        std::reverse(result.begin(), result.end());
+
+        return result;
+    }
+
+    size_t element(const ArrayElemNode& node)
+    {
+        std::vector<size_t> args = indices(node);
+        const Binding& base = node.getBase()->getBinding();
+
+        Inst inst;
+
+        inst.op = Op::LOAD_ELEM;
+        inst.binding = base;
+        inst.frame = framed(base.slot);
+        inst.checked = node.isChecked();
+
+        if (!inst.frame)
+            args.insert(args.begin(), read(base.slot, cur_));
+
+        inst.args = std::move(args);
+
+        return emit(std::move(inst));
+    }
+
+    size_t store(const AssignNode& node)
+    {
+        if (auto elem = std::get_if<ArrayElemPtr>(&node.getDest()))
+        {
+            std::vector<size_t> args = indices(**elem);
+            const size_t src = rhs(node.getSrc());
+
+            Inst inst;
+
+            inst.op = Op::STORE_ELEM;
+            inst.binding = (*elem)->getBase()->getBinding();
+            inst.checked = (*elem)->isChecked();
+            inst.args = std::move(args);
+            inst.args.push_back(src);
+
+            emit(std::move(inst));
+
+            return src;
+        }
+
+        const Binding& dest = std::get<VariablePtr>(node.getDest())->getBinding();
+        const size_t src = rhs(node.getSrc());
+
+        if (!framed(dest.slot))
+        {
+            write(dest.slot, cur_, src);
+            return src;
+        }
+
+        Inst inst;
+
+        inst.op = Op::STORE;
+        inst.binding = dest;
+        inst.args = {src};
+
+        emit(std::move(inst));
+
+        return src;
+    }
+
+    size_t value(ExprPtr expr)
+    {
+        if (auto constant = dynamic_cast<const ConstantNode*>(expr))
+        {
+            Inst inst;
+
+            inst.op = Op::CONST;
+            inst.a = constant->getVal();
+
+            return emit(std::move(inst));
+        }
+
+        if (auto var = dynamic_cast<const VariableNode*>(expr))
+            return load(var->getBinding());
+
+        if (auto unary = dynamic_cast<const UnaryOpNode*>(expr))
+        {
+            Inst inst;
+
+            inst.op = Op::UNARY;
+            inst.unary = unary->getOp();
+            inst.args = {value(unary->getOperand())};
+
+            return emit(std::move(inst));
+        }
+
+        if (auto binary = dynamic_cast<const BinaryOpNode*>(expr))
+        {
+            const size_t left = value(binary->getLeft());
+            const size_t right = value(binary->getRight());
+
+            Inst inst;
+
+            inst.op = binary->isInteger() ? Op::BINARY : Op::ELEMENTWISE;
+            inst.binary = binary->getOp();
+            inst.args = {left, right};
+
+            return emit(std::move(inst));
+        }
+
+        if (auto elem = dynamic_cast<const ArrayElemNode*>(expr))
+            return element(*elem);
+
+        if (auto assign = dynamic_cast<const AssignNode*>(expr))
+            return store(*assign);
+
+        return emit(Op::INPUT);
+    }
+
+    size_t rhs(const Rhs& src)
+    {
+        if (auto expr = std::get_if<ExprPtr>(&src))
+            return value(*expr);
+
+        if (auto repeat = std::get_if<RepeatPtr>(&src))
+        {
+            std::vector<size_t> args{value((*repeat)->getSize())};
+
+            if ((*repeat)->hasElem())
+                args.push_back(rhs((*repeat)->getElem()));
+
+            return emit(Op::REPEAT, std::move(args));
+        }
+
+        // Initializer list is stored back to front, see ArrayInit rule.
+        const ArrayInitNode& init = *std::get<ArrayInitPtr>(src);
+        std::vector<size_t> args;
+
+        for (size_t id = init.arraySize(); id-- > 0;)
+            args.push_back(value(init.getElem(id)));
+
+        return emit(Op::ARRAY, std::move(args));
+    }
+
+    void scope(const ScopeNode& node)
+    {
+        if (node.empty())
+            return;
+
+        for (StmtPtr child : node.getChildren())
+            statement(child);
+
+        const auto begin = frame_.begin() + node.slotBegin();
+
+        if (std::find(begin, frame_.begin() + node.slotEnd(), true) ==
+            frame_.begin() + node.slotEnd())
+            return;
+
+        Inst inst;
+
+        inst.op = Op::LEAVE;
+        inst.a = node.slotBegin();
+        inst.b = node.slotEnd();
+
+        emit(std::move(inst));
+    }
+
+    void loop(const WhileNode& node)
+    {
+        const size_t header = block();
+
+        jump(header);
+        cur_ = header;
+
+        const size_t cond = value(node.getCond());
+        const size_t body = block();
+        const size_t exit = block();
+
+        branch(cond, body, exit);
+        seal(body);
+
+        cur_ = body;
+        statement(node.getScope());
+        jump(header);
+
+        seal(header);
+        seal(exit);
+
+        cur_ = exit;
+    }
+
+    void branch(const IfElseNode& node)
+    {
+        if (!node.hasCond())
+            return statement(node.getAction());
+
+        const size_t cond = value(node.getCond());
+        const size_t then = block();
+        const size_t join = block();
+        const size_t other = node.hasAltAction() ? block() : join;
+
+        branch(cond, then, other);
+        seal(then);
+
+        cur_ = then;
+        statement(node.getAction());
+        jump(join);
+
+        if (node.hasAltAction())
+        {
+            seal(other);
+
+            cur_ = other;
+            statement(node.getAltAction());
+            jump(join);
+        }
+
+        seal(join);
+
+        cur_ = join;
+    }
+
+    void statement(StmtPtr stmt)
+    {
+        if (auto node = dynamic_cast<const ScopeNode*>(stmt))
+            return scope(*node);
+
+        if (auto expr = dynamic_cast<ExprPtr>(stmt))
+        {
+            value(expr);
+            return;
+        }
+
+        if (auto print = dynamic_cast<const PrintNode*>(stmt))
+        {
+            emit(Op::PRINT, {value(print->getExpr())});
+            return;
+        }
+
+        if (auto ifElse = dynamic_cast<const IfElseNode*>(stmt))
+            return branch(*ifElse);
+
+        if (auto whileNode = dynamic_cast<const WhileNode*>(stmt))
+            return loop(*whileNode);
+    }
+
+  public:
+    Function build(const ScopeNode& global, const FrameLayout& layout)
+    {
+        MSG("Building SSA form\n");
+
+        fn_.layout = layout;
+        frame_.assign(static_cast<size_t>(layout.nslots), false);
+
+        for (const std::vector<int>& chain : layout.chains)
+            for (const int slot : chain)
+                framed(slot) = true;
+
+        for (StmtPtr child : global.getChildren())
+            scan(child);
+
+        cur_ = block();
+        seal(cur_);
+
+        scope(global);
+        emit(Op::RETURN);
+
+        simplify();
+
+        LOG("{} blocks, {} instructions\n", fn_.blocks.size(), fn_.insts.size());
+
+        return std::move(fn_);
+    }
+};
+
+} // namespace ir
+
+} // namespace detail
+
+} // namespace AST
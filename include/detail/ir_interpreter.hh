@@ -0,0 +1,287 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "arithmetic.hh"
+#include "context.hh"
+#include "elementwise.hh"
+#include "ir.hh"
+#include "log.hh"
+#include "types.hh"
+
+namespace AST
+{
+
+namespace detail
+{
+
+// Executes SSA form directly. Every value has a register of its own; phis
+// of a block are assigned together when control enters it.
+class IrInterpreter final
+{
+  private:
+    detail::Context ctx_;
+    std::vector<Value> regs_;
+    std::vector<Value> incoming_;
+
+    // A value used once, by a later instruction of its own block, is moved
+    // out of its register rather than copied.
+    std::vector<bool> single_;
+
+  private:
+    void prepare(const ir::Function& fn)
+    {
+        std::vector<size_t> uses(fn.insts.size(), 0);
+        std::vector<bool> local(fn.insts.size(), false);
+
+        for (const ir::Block& block : fn.blocks)
+            for (const size_t id : block.insts)
+                for (const size_t arg : fn.insts[id].args)
+                {
+                    ++uses[arg];
+                    local[arg] = fn.insts[arg].block == fn.insts[id].block &&
+                                 fn.insts[id].op != ir::Op::PHI;
+                }
+
+        single_.assign(fn.insts.size(), false);
+
+        for (size_t id = 0; id < fn.insts.size(); ++id)
+            single_[id] = uses[id] == 1 && local[id];
+    }
+
+    Value take(size_t value)
+    {
+        if (single_[value])
+            return std::move(regs_[value]);
+
+        return regs_[value];
+    }
+
+    int integer(size_t value) const { return regs_[value].getInt(); }
+
+    // Indices of an element access in dimension order.
+    const int* gather(const ir::Inst& inst, size_t first, size_t count,
+                      std::vector<int>& out) const
+    {
+        out.resize(count);
+
+        for (size_t id = 0; id < count; ++id)
+            out[id] = integer(inst.args[first + id]);
+
+        return out.data();
+    }
+
+    void enter(const ir::Function& fn, size_t from, size_t to)
+    {
+        const ir::Block& block = fn.blocks[to];
+        const size_t count = fn.phis(to);
+
+        if (count == 0)
+            return;
+
+        const size_t pred = static_cast<size_t>(
+            std::find(block.preds.begin(), block.preds.end(), from) -
+            block.preds.begin());
+
+        // Phis read their operands before any of them is written.
+        incoming_.resize(count);
+
+        for (size_t id = 0; id < count; ++id)
+            incoming_[id] = regs_[fn.insts[block.insts[id]].args[pred]];
+
+        for (size_t id = 0; id < count; ++id)
+            regs_[block.insts[id]] = std::move(incoming_[id]);
+    }
+
+    static int compute(BinaryOp op, int left, int right)
+    {
+        switch (op)
+        {
+            case BinaryOp::ADD:    return add(left, right);
+            case BinaryOp::SUB:    return subtract(left, right);
+            case BinaryOp::MUL:    return multiply(left, right);
+            case BinaryOp::DIV:    return divide(left, right);
+            case BinaryOp::MOD:    return modulo(left, right);
+            case BinaryOp::GR:     return left > right;
+            case BinaryOp::LS:     return left < right;
+            case BinaryOp::EQ:     return left == right;
+            case BinaryOp::GR_EQ:  return left >= right;
+            case BinaryOp::LS_EQ:  return left <= right;
+            case BinaryOp::NOT_EQ: return left != right;
+            case BinaryOp::AND:    return left && right;
+            case BinaryOp::OR:     return left || right;
+            default:
+                throw std::runtime_error("Unknown binary operation");
+        }
+    }
+
+    const Array* array(const ir::Inst& inst)
+    {
+        const Value& base = inst.frame ? ctx_.getArray(inst.binding)
+                                       : regs_[inst.args[0]];
+
+        const Array* result = base.getArray();
+
+        if (!result)
+        {
+            std::cerr << ctx_.layout_.name(inst.binding.slot)
+                      << " is not an array type\n";
+            throw std::runtime_error("Can't use [] to non array variables\n");
+        }
+
+        return result;
+    }
+
+  public:
+    IrInterpreter(std::ostream& out = std::cout, Flush flush = Flush::BLOCK,
+                  Input& in = Input::standard())
+        : ctx_(out, flush, in)
+    {}
+
+    void run(const ir::Function& fn)
+    {
+        MSG("Running SSA form\n");
+
+        ctx_.setLayout(fn.layout);
+        prepare(fn);
+
+        regs_.clear();
+        regs_.resize(fn.insts.size());
+
+        std::vector<int> indices;
+        size_t block = 0;
+
+        for (;;)
+        {
+            const std::vector<size_t>& list = fn.blocks[block].insts;
+            size_t next = 0;
+
+            for (size_t pos = fn.phis(block); pos < list.size(); ++pos)
+            {
+                const size_t id = list[pos];
+                const ir::Inst& inst = fn.insts[id];
+                Value& dst = regs_[id];
+
+                switch (inst.op)
+                {
+                    case ir::Op::CONST:
+                        dst = inst.a;
+                        break;
+
+                    case ir::Op::UNDEF:
+                        dst.reset();
+                        break;
+
+                    case ir::Op::LOAD:
+                        dst = ctx_.getVarValue(inst.binding);
+                        break;
+
+                    case ir::Op::STORE:
+                        ctx_.getVar(inst.binding) = take(inst.args[0]);
+                        break;
+
+                    case ir::Op::LOAD_ELEM:
+                    {
+                        const size_t first = inst.frame ? 0 : 1;
+                        const size_t count = inst.args.size() - first;
+
+                        array(inst)->read(gather(inst, first, count, indices),
+                                          count, dst, inst.checked);
+                        break;
+                    }
+
+                    case ir::Op::STORE_ELEM:
+                    {
+                        const size_t count = inst.args.size() - 1;
+
+                        // The source is taken first: it may share the target.
+                        Value src = take(inst.args.back());
+                        Array* target = ctx_.getArray(inst.binding).mutableArray();
+
+                        if (!target)
+                            throw std::runtime_error("Indexing non array type\n");
+
+                        target->write(gather(inst, 0, count, indices), count, src,
+                                      inst.checked);
+                        break;
+                    }
+
+                    case ir::Op::UNARY:
+                        dst = inst.unary == UnaryOp::NEG
+                                  ? negate(integer(inst.args[0]))
+                                  : !integer(inst.args[0]);
+                        break;
+
+                    case ir::Op::BINARY:
+                        dst = compute(inst.binary, integer(inst.args[0]),
+                                      integer(inst.args[1]));
+                        break;
+
+                    case ir::Op::ELEMENTWISE:
+                        dst = elementwise(inst.binary, regs_[inst.args[0]],
+                                          regs_[inst.args[1]]);
+                        break;
+
+                    case ir::Op::INPUT:
+                        dst = ctx_.in->read(ctx_.out);
+                        break;
+
+                    case ir::Op::PRINT:
+                        ctx_.out.print(integer(inst.args[0]));
+                        break;
+
+                    case ir::Op::REPEAT:
+                        if (inst.args.size() == 1)
+                            dst = Value(Array(integer(inst.args[0])));
+                        else
+                            dst = Value(Array(take(inst.args[1]),
+                                              integer(inst.args[0])));
+                        break;
+
+                    case ir::Op::ARRAY:
+                    {
+                        std::vector<Value> data;
+                        data.reserve(inst.args.size());
+
+                        for (const size_t arg : inst.args)
+                            data.push_back(take(arg));
+
+                        dst = Value(Array(std::move(data)));
+                        break;
+                    }
+
+                    case ir::Op::LEAVE:
+                        ctx_.clearSlots(inst.a, inst.b);
+                        break;
+
+                    case ir::Op::JUMP:
+                        next = fn.blocks[block].succs[0];
+                        break;
+
+                    case ir::Op::BRANCH:
+                        next = fn.blocks[block].succs[integer(inst.args[0]) ? 0 : 1];
+                        break;
+
+                    case ir::Op::RETURN:
+                        return;
+
+                    case ir::Op::PHI:
+                    default:
+                        throw std::runtime_error("Unknown instruction");
+                }
+            }
+
+            enter(fn, block, next);
+            block = next;
+        }
+    }
+};
+
+} // namespace detail
+
+} // namespace AST
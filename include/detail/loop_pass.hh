@@ -0,0 +1,414 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include "arena.hh"
+#include "frame.hh"
+#include "node.hh"
+#include "slots.hh"
+#include "visitor.hh"
+
+namespace AST
+{
+
+namespace detail
+{
+
+// Counts the assignments a subtree makes to each frame slot.
+class SlotWrites final : public Visitor
+{
+  private:
+    const FrameLayout& layout_;
+    std::vector<int> writes_;
+
+  private:
+    void write(const Binding& binding)
+    {
+        if (binding.chain < 0)
+        {
+            ++writes_[static_cast<size_t>(binding.slot)];
+            return;
+        }
+
+        for (const int slot : layout_.chain(binding.chain))
+            ++writes_[static_cast<size_t>(slot)];
+    }
+
+  public:
+    explicit SlotWrites(const FrameLayout& layout)
+        : layout_(layout)
+        , writes_(static_cast<size_t>(layout.nslots), 0)
+    {}
+
+    std::vector<int> collect(const INode& node)
+    {
+        node.accept(*this);
+
+        return std::move(writes_);
+    }
+
+    void visit([[maybe_unused]] const ConstantNode& node) override {}
+
+    void visit([[maybe_unused]] const VariableNode& node) override {}
+
+    void visit([[maybe_unused]] const InNode& node) override {}
+
+    void visit(const BinaryOpNode& node) override
+    {
+        node.accept_left(*this);
+        node.accept_right(*this);
+    }
+
+    void visit(const UnaryOpNode& node) override { node.acceptOperand(*this); }
+
+    void visit(const ScopeNode& node) override
+    {
+        for (const auto& child : node.getChildren())
+            child->accept(*this);
+    }
+
+    void visit(const AssignNode& node) override
+    {
+        if (auto var = std::get_if<VariablePtr>(&node.getDest()))
+            write((*var)->getBinding());
+        else
+        {
+            const auto elem = std::get<ArrayElemPtr>(node.getDest());
+
+            elem->accept(*this);
+            write(elem->getBase()->getBinding());
+        }
+
+        node.acceptSrc(*this);
+    }
+
+    void visit(const ArrayElemNode& node) override
+    {
+        node.acceptIndex(*this);
+
+        if (node.holdsArrayElem())
+            node.acceptName(*this);
+    }
+
+    void visit(const WhileNode& node) override
+    {
+        node.acceptCond(*this);
+        node.acceptScope(*this);
+    }
+
+    void visit(const PforNode& node) override
+    {
+        visit(static_cast<const WhileNode&>(node));
+    }
+
+    void visit(const IfElseNode& node) override
+    {
+        if (node.hasCond())
+            node.acceptCond(*this);
+
+        node.acceptAction(*this);
+
+        if (node.hasAltAction())
+            node.acceptAltAction(*this);
+    }
+
+    void visit(const PrintNode& node) override { node.acceptExpr(*this); }
+
+    void visit(const RepeatNode& node) override
+    {
+        node.acceptSize(*this);
+
+        if (node.hasElem())
+            node.acceptElem(*this);
+    }
+
+    void visit(const ArrayInitNode& node) override
+    {
+        for (size_t id = 0; id < node.arraySize(); ++id)
+            node.acceptElem(id, *this);
+    }
+};
+
+// Base of the passes that transform while loops on a resolved tree. Every
+// loop that sits directly in a scope is handed to loop(), innermost first;
+// the statements it returns are placed right before the loop.
+//
+// rewriteLoop() offers each operator expression of a loop to replace(),
+// outermost first, and substitutes whatever comes back.
+class LoopPass : public Visitor
+{
+  protected:
+    Arena& arena_;
+    FrameLayout& layout_;
+
+  private:
+    bool rewriting_ = false;
+    ExprPtr result_ = nullptr;
+
+  protected:
+    LoopPass(Arena& arena, FrameLayout& layout)
+        : arena_(arena)
+        , layout_(layout)
+    {}
+
+    // preceding holds the statements in front of the loop in its scope.
+    virtual std::vector<StmtPtr> loop(const WhileNode& node,
+                                      const std::vector<StmtPtr>& preceding) = 0;
+
+    // Replacement for expr, or nullptr to look inside it.
+    virtual ExprPtr replace(ExprPtr expr) = 0;
+
+    void rewriteLoop(const WhileNode& node)
+    {
+        rewriting_ = true;
+        node.accept(*this);
+        rewriting_ = false;
+    }
+
+    std::vector<int> writes(const WhileNode& node) const
+    {
+        return SlotWrites(layout_).collect(node);
+    }
+
+    // Assignments to slot among the counted writes.
+    static int writesTo(const std::vector<int>& writes, int slot)
+    {
+        return writes[static_cast<size_t>(slot)];
+    }
+
+    // No variable of expr is assigned where writes were counted.
+    bool invariant(ExprPtr expr, const std::vector<int>& writes) const
+    {
+        if (auto var = dynamic_cast<const VariableNode*>(expr))
+        {
+            const Binding& binding = var->getBinding();
+
+            if (binding.chain < 0)
+                return writesTo(writes, binding.slot) == 0;
+
+            for (const int slot : layout_.chain(binding.chain))
+                if (writesTo(writes, slot) != 0)
+                    return false;
+
+            return true;
+        }
+
+        if (auto unary = dynamic_cast<const UnaryOpNode*>(expr))
+            return invariant(unary->getOperand(), writes);
+
+        if (auto binary = dynamic_cast<const BinaryOpNode*>(expr))
+            return invariant(binary->getLeft(), writes) &&
+                   invariant(binary->getRight(), writes);
+
+        return dynamic_cast<const ConstantNode*>(expr) != nullptr;
+    }
+
+    Binding newSlot(const std::string& prefix)
+    {
+        return detail::newSlot(arena_, layout_, prefix);
+    }
+
+    VariablePtr variable(const Binding& binding)
+    {
+        return slotVariable(arena_, layout_, binding);
+    }
+
+  private:
+    template <typename Accept>
+    ExprPtr rewrite(Accept&& accept)
+    {
+        result_ = nullptr;
+
+        accept(*this);
+
+        return result_;
+    }
+
+  public:
+    void visit(const ConstantNode& node) override { result_ = &edit(node); }
+
+    void visit(const VariableNode& node) override { result_ = &edit(node); }
+
+    void visit(const InNode& node) override { result_ = &edit(node); }
+
+    void visit(const BinaryOpNode& node) override
+    {
+        BinaryOpNode& self = edit(node);
+
+        if (rewriting_)
+            if (ExprPtr replacement = replace(&self))
+            {
+                result_ = replacement;
+                return;
+            }
+
+        self.setLeft(rewrite([&](Visitor& v) { node.accept_left(v); }));
+        self.setRight(rewrite([&](Visitor& v) { node.accept_right(v); }));
+
+        result_ = &self;
+    }
+
+    void visit(const UnaryOpNode& node) override
+    {
+        UnaryOpNode& self = edit(node);
+
+        if (rewriting_)
+            if (ExprPtr replacement = replace(&self))
+            {
+                result_ = replacement;
+                return;
+            }
+
+        self.setOperand(rewrite([&](Visitor& v) { node.acceptOperand(v); }));
+
+        result_ = &self;
+    }
+
+    void visit(const ScopeNode& node) override
+    {
+        ScopeNode& self = edit(node);
+
+        if (rewriting_)
+        {
+            for (size_t id = 0; id < node.nstms(); ++id)
+            {
+                StmtPtr child = node.getChildren()[id];
+
+                const ExprPtr replacement =
+                    rewrite([child](Visitor& v) { child->accept(v); });
+
+                if (replacement && replacement != child)
+                    self.setChild(id, replacement);
+            }
+
+            result_ = nullptr;
+            return;
+        }
+
+        std::vector<StmtPtr> children;
+        children.reserve(node.nstms());
+
+        for (StmtPtr child : node.getChildren())
+        {
+            if (auto loopNode = dynamic_cast<const WhileNode*>(child))
+            {
+                loopNode->acceptScope(*this);
+
+                const std::vector<StmtPtr> preheader = loop(*loopNode, children);
+
+                children.insert(children.end(), preheader.begin(),
+                                preheader.end());
+            }
+            else
+                child->accept(*this);
+
+            children.push_back(child);
+        }
+
+        self.setChildren(std::move(children));
+
+        result_ = nullptr;
+    }
+
+    void visit(const AssignNode& node) override
+    {
+        AssignNode& self = edit(node);
+
+        if (auto elem = std::get_if<ArrayElemPtr>(&node.getDest()))
+            (*elem)->accept(*this);
+
+        if (auto src = std::get_if<ExprPtr>(&node.getSrc()))
+        {
+            ExprPtr expr = *src;
+
+            self.setSrc(rewrite([expr](Visitor& v) { expr->accept(v); }));
+        }
+        else
+            node.acceptSrc(*this);
+
+        result_ = &self;
+    }
+
+    void visit(const ArrayElemNode& node) override
+    {
+        ArrayElemNode& self = edit(node);
+
+        self.setIndex(rewrite([&](Visitor& v) { node.acceptIndex(v); }));
+
+        if (node.holdsArrayElem())
+            node.acceptName(*this);
+
+        result_ = &self;
+    }
+
+    void visit(const WhileNode& node) override
+    {
+        if (rewriting_)
+            edit(node).setCond(rewrite([&](Visitor& v) { node.acceptCond(v); }));
+
+        node.acceptScope(*this);
+
+        result_ = nullptr;
+    }
+
+    void visit(const PforNode& node) override
+    {
+        visit(static_cast<const WhileNode&>(node));
+    }
+
+    void visit(const IfElseNode& node) override
+    {
+        if (rewriting_ && node.hasCond())
+            edit(node).setCond(rewrite([&](Visitor& v) { node.acceptCond(v); }));
+
+        node.acceptAction(*this);
+
+        if (node.hasAltAction())
+            node.acceptAltAction(*this);
+
+        result_ = nullptr;
+    }
+
+    void visit(const PrintNode& node) override
+    {
+        if (rewriting_)
+            edit(node).setExpr(rewrite([&](Visitor& v) { node.acceptExpr(v); }));
+
+        result_ = nullptr;
+    }
+
+    void visit(const RepeatNode& node) override
+    {
+        RepeatNode& self = edit(node);
+
+        self.setSize(rewrite([&](Visitor& v) { node.acceptSize(v); }));
+
+        if (auto elem = std::get_if<ExprPtr>(&node.getElem()); elem && *elem)
+        {
+            ExprPtr expr = *elem;
+
+            self.setElem(rewrite([expr](Visitor& v) { expr->accept(v); }));
+        }
+        else if (node.hasElem())
+            node.acceptElem(*this);
+
+        result_ = nullptr;
+    }
+
+    void visit(const ArrayInitNode& node) override
+    {
+        ArrayInitNode& self = edit(node);
+
+        for (size_t id = 0; id < node.arraySize(); ++id)
+            self.setElem(id, rewrite([&](Visitor& v) { node.acceptElem(id, v); }));
+
+        result_ = nullptr;
+    }
+};
+
+} // namespace detail
+
+} // namespace AST
@@ -0,0 +1,347 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+#include "arena.hh"
+#include "frame.hh"
+#include "log.hh"
+#include "node.hh"
+#include "slots.hh"
+
+namespace AST
+{
+
+namespace detail
+{
+
+struct NumberStats
+{
+    size_t reused = 0; // evaluations replaced by a read of an earlier result
+};
+
+// Local value numbering. Statements that follow each other in a scope, up
+// to the next branch, loop or nested scope, form a block. Within a block
+// an operator expression or element read without effects is computed once:
+// its first evaluation becomes (t = e) for a fresh slot t and later ones
+// read t, until a store to a slot that e reads.
+//
+// Engines read a whole element chain such as m[i][j] with one lookup, so
+// the unit of reuse is the chain; a lone partial path m[i] is a read of its
+// own. Reuse cannot hide an error: anything that may fail in e has failed
+// at its first evaluation already. Nodes are numbered in the order the
+// engines evaluate them.
+class Numbering final
+{
+  private:
+    using Setter = std::function<void(ExprPtr)>;
+
+    struct Value
+    {
+        ExprPtr first;
+        Setter set;             // puts a replacement where first is
+        std::vector<int> slots; // slots first reads
+        Binding temp{};
+    };
+
+  private:
+    Arena& arena_;
+    FrameLayout& layout_;
+    NumberStats stats_;
+
+    std::unordered_map<std::string, Value> values_;
+
+  private:
+    static std::optional<std::string> name(const Binding& binding)
+    {
+        if (!binding.resolved())
+            return std::nullopt;
+
+        if (binding.chain >= 0)
+            return "@" + std::to_string(binding.chain);
+
+        return "$" + std::to_string(binding.slot);
+    }
+
+    // Canonical text of an expression without effects, nothing otherwise.
+    static std::optional<std::string> key(ExprPtr expr)
+    {
+        if (auto constant = dynamic_cast<const ConstantNode*>(expr))
+            return "#" + std::to_string(constant->getVal());
+
+        if (auto var = dynamic_cast<const VariableNode*>(expr))
+            return name(var->getBinding());
+
+        if (auto unary = dynamic_cast<const UnaryOpNode*>(expr))
+        {
+            auto operand = key(unary->getOperand());
+
+            if (!operand)
+                return std::nullopt;
+
+            return "(u" + std::to_string(static_cast<int>(unary->getOp())) +
+                   " " + *operand + ")";
+        }
+
+        if (auto binary = dynamic_cast<const BinaryOpNode*>(expr))
+        {
+            auto left = key(binary->getLeft());
+            auto right = key(binary->getRight());
+
+            if (!left || !right)
+                return std::nullopt;
+
+            return "(" + std::to_string(static_cast<int>(binary->getOp())) +
+                   " " + *left + " " + *right + ")";
+        }
+
+        auto elem = dynamic_cast<const ArrayElemNode*>(expr);
+
+        if (!elem)
+            return std::nullopt;
+
+        auto result = name(elem->getBase()->getBinding());
+
+        if (!result)
+            return std::nullopt;
+
+        for (auto node = elem;; node = node->getArrayElem())
+        {
+            auto index = key(node->getIndex());
+
+            if (!index)
+                return std::nullopt;
+
+            *result += " " + *index;
+
+            if (node->holdsVariable())
+                break;
+        }
+
+        return "[" + *result + "]";
+    }
+
+    void slots(const Binding& binding, std::vector<int>& out) const
+    {
+        if (binding.chain < 0)
+            return out.push_back(binding.slot);
+
+        const std::vector<int>& chain = layout_.chain(binding.chain);
+
+        out.insert(out.end(), chain.begin(), chain.end());
+    }
+
+    void slots(ExprPtr expr, std::vector<int>& out) const
+    {
+        if (auto var = dynamic_cast<const VariableNode*>(expr))
+            return slots(var->getBinding(), out);
+
+        if (auto unary = dynamic_cast<const UnaryOpNode*>(expr))
+            return slots(unary->getOperand(), out);
+
+        if (auto binary = dynamic_cast<const BinaryOpNode*>(expr))
+        {
+            slots(binary->getLeft(), out);
+            return slots(binary->getRight(), out);
+        }
+
+        if (auto elem = dynamic_cast<const ArrayElemNode*>(expr))
+        {
+            slots(elem->getBase()->getBinding(), out);
+
+            for (auto node = elem;; node = node->getArrayElem())
+            {
+                slots(node->getIndex(), out);
+
+                if (node->holdsVariable())
+                    break;
+            }
+        }
+    }
+
+    // Forgets every value that reads a slot binding may store to.
+    void kill(const Binding& binding)
+    {
+        std::vector<int> written;
+        slots(binding, written);
+
+        std::erase_if(values_, [&](const auto& entry)
+        {
+            const std::vector<int>& read = entry.second.slots;
+
+            return std::find_first_of(read.begin(), read.end(), written.begin(),
+                                      written.end()) != read.end();
+        });
+    }
+
+    void reuse(Value& value, const Setter& set)
+    {
+        if (!value.temp.resolved())
+        {
+            value.temp = newSlot(arena_, layout_, "cse");
+            value.set(arena_.create<AssignNode>(
+                slotVariable(arena_, layout_, value.temp), value.first));
+        }
+
+        set(slotVariable(arena_, layout_, value.temp));
+
+        ++stats_.reused;
+    }
+
+    // Without a setter expr is a block of its own and never replaced.
+    void number(ExprPtr expr, const Setter& set)
+    {
+        std::optional<std::string> id;
+        std::vector<int> read;
+
+        if (set && !dynamic_cast<const ConstantNode*>(expr) &&
+            !dynamic_cast<const VariableNode*>(expr) && (id = key(expr)))
+        {
+            if (auto found = values_.find(*id); found != values_.end())
+                return reuse(found->second, set);
+
+            slots(expr, read);
+        }
+
+        if (auto binary = dynamic_cast<const BinaryOpNode*>(expr))
+        {
+            BinaryOpNode& self = edit(*binary);
+
+            number(binary->getLeft(),
+                   [parent = &self](ExprPtr e) { parent->setLeft(e); });
+            number(binary->getRight(),
+                   [parent = &self](ExprPtr e) { parent->setRight(e); });
+        }
+        else if (auto unary = dynamic_cast<const UnaryOpNode*>(expr))
+        {
+            UnaryOpNode& self = edit(*unary);
+
+            number(unary->getOperand(),
+                   [parent = &self](ExprPtr e) { parent->setOperand(e); });
+        }
+        else if (auto elem = dynamic_cast<const ArrayElemNode*>(expr))
+            indices(*elem);
+        else if (auto assign = dynamic_cast<const AssignNode*>(expr))
+            store(*assign);
+
+        if (id)
+            values_.emplace(*id, Value{expr, set, std::move(read)});
+    }
+
+    // Outermost index first, like the engines.
+    void indices(const ArrayElemNode& node)
+    {
+        for (auto elem = &node;; elem = elem->getArrayElem())
+        {
+            ArrayElemNode& self = edit(*elem);
+
+            number(elem->getIndex(),
+                   [parent = &self](ExprPtr e) { parent->setIndex(e); });
+
+            if (elem->holdsVariable())
+                break;
+        }
+    }
+
+    void store(const AssignNode& node)
+    {
+        AssignNode& self = edit(node);
+        auto elem = std::get_if<ArrayElemPtr>(&node.getDest());
+
+        if (elem)
+            indices(**elem);
+
+        if (auto src = std::get_if<ExprPtr>(&node.getSrc()))
+            number(*src, [parent = &self](ExprPtr e) { parent->setSrc(e); });
+        else
+            values_.clear(); // array literals are not numbered
+
+        kill(elem ? (*elem)->getBase()->getBinding()
+                  : std::get<VariablePtr>(node.getDest())->getBinding());
+    }
+
+    void block(const ScopeNode& node)
+    {
+        ScopeNode& self = edit(node);
+
+        values_.clear();
+
+        for (size_t id = 0; id < node.nstms(); ++id)
+            statement(node.getChildren()[id], [parent = &self, id](ExprPtr e)
+            {
+                parent->setChild(id, e);
+            });
+
+        values_.clear();
+    }
+
+    void branch(StmtPtr stmt)
+    {
+        values_.clear();
+        statement(stmt, {});
+        values_.clear();
+    }
+
+    void statement(StmtPtr stmt, const Setter& set)
+    {
+        if (auto scope = dynamic_cast<const ScopeNode*>(stmt))
+            return block(*scope);
+
+        if (auto expr = dynamic_cast<ExprPtr>(stmt))
+            return number(expr, set);
+
+        if (auto print = dynamic_cast<const PrintNode*>(stmt))
+        {
+            PrintNode& self = edit(*print);
+
+            return number(print->getExpr(),
+                          [parent = &self](ExprPtr e) { parent->setExpr(e); });
+        }
+
+        if (auto ifElse = dynamic_cast<const IfElseNode*>(stmt))
+        {
+            IfElseNode& self = edit(*ifElse);
+
+            if (ifElse->hasCond())
+                number(ifElse->getCond(),
+                       [parent = &self](ExprPtr e) { parent->setCond(e); });
+
+            branch(ifElse->getAction());
+
+            if (ifElse->hasAltAction())
+                branch(ifElse->getAltAction());
+
+            return;
+        }
+
+        if (auto loop = dynamic_cast<const WhileNode*>(stmt))
+            branch(loop->getScope());
+    }
+
+  public:
+    Numbering(Arena& arena, FrameLayout& layout)
+        : arena_(arena)
+        , layout_(layout)
+    {}
+
+    NumberStats run(const ScopeNode& global)
+    {
+        MSG("Numbering values\n");
+
+        block(global);
+
+        LOG("Reused {} values\n", stats_.reused);
+
+        return stats_;
+    }
+};
+
+} // namespace detail
+
+} // namespace AST
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <string_view>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define PARACL_POSIX_OUTPUT 1
+#include <unistd.h>
+#endif
+
+namespace AST
+{
+
+namespace detail
+{
+
+// When Output hands what the program printed on to its target.
+enum class Flush : uint8_t
+{
+    LINE,  // after every print
+    BLOCK, // when the buffer fills up
+    EXIT,  // once the program is done
+};
+
+// What print statements write to. Integers are formatted with to_chars into
+// a large buffer, which goes to the target stream in big chunks; standard
+// output is written to with write(2) directly. Whatever is buffered goes out
+// before the program waits for input, unless the policy is EXIT, and when the
+// sink is destroyed or flushed by the engine, error or not.
+class Output final
+{
+  private:
+    static constexpr size_t capacity = 64 * 1024;
+
+    std::ostream& os_;
+    Flush flush_;
+    std::unique_ptr<char[]> buffer_ = std::make_unique<char[]>(capacity);
+    size_t size_ = 0;
+
+  private:
+    // Writes out the whole of data, which write(2) may take in parts.
+    void emit(const char* data, size_t size)
+    {
+#ifdef PARACL_POSIX_OUTPUT
+        if (&os_ == &std::cout)
+        {
+            // Anything printed through the stream before must come first.
+            std::cout.flush();
+            std::fflush(stdout);
+
+            while (size > 0)
+            {
+                const ssize_t written = ::write(STDOUT_FILENO, data, size);
+
+                if (written < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+
+                    std::cout.setstate(std::ios::badbit);
+                    return;
+                }
+
+                data += written;
+                size -= static_cast<size_t>(written);
+            }
+
+            return;
+        }
+#endif
+
+        os_.write(data, static_cast<std::streamsize>(size));
+
+        if (flush_ == Flush::LINE)
+            os_.flush();
+    }
+
+    void reserve(size_t size)
+    {
+        if (size_ + size > capacity)
+            flush();
+    }
+
+  public:
+    explicit Output(std::ostream& os = std::cout, Flush flush = Flush::BLOCK)
+        : os_(os)
+        , flush_(flush)
+    {}
+
+    Output(const Output&) = delete;
+    Output& operator=(const Output&) = delete;
+
+    ~Output() { flush(); }
+
+    void setFlush(Flush flush) { flush_ = flush; }
+
+    Flush policy() const { return flush_; }
+
+    // Prints value on a line of its own.
+    void print(int value)
+    {
+        // Sign, ten digits and the newline.
+        reserve(12);
+
+        char* begin = buffer_.get() + size_;
+        char* end = std::to_chars(begin, begin + 11, value).ptr;
+
+        *end++ = '\n';
+        size_ += static_cast<size_t>(end - begin);
+
+        if (flush_ == Flush::LINE)
+            flush();
+    }
+
+    // Text already formatted, as pfor workers hand it over.
+    void write(std::string_view text)
+    {
+        if (text.size() > capacity)
+        {
+            flush();
+            emit(text.data(), text.size());
+            return;
+        }
+
+        reserve(text.size());
+
+        std::copy(text.begin(), text.end(), buffer_.get() + size_);
+        size_ += text.size();
+
+        if (flush_ == Flush::LINE)
+            flush();
+    }
+
+    // Called before waiting for input, so that prompts show up first.
+    void prompt()
+    {
+        if (flush_ != Flush::EXIT)
+            flush();
+    }
+
+    void flush()
+    {
+        if (size_ == 0)
+            return;
+
+        const size_t size = size_;
+
+        size_ = 0;
+        emit(buffer_.get(), size);
+    }
+};
+
+} // namespace detail
+
+} // namespace AST
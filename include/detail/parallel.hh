@@ -0,0 +1,1258 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "frame.hh"
+#include "log.hh"
+#include "node.hh"
+#include "slots.hh"
+
+namespace AST
+{
+
+namespace detail
+{
+
+struct ParallelStats
+{
+    size_t loops = 0;     // pfor loops
+    size_t parallel = 0;  // of them planned to run in parallel
+    size_t whiles = 0;    // while loops
+    size_t automatic = 0; // of them planned to run in parallel
+};
+
+// What plan() made of a while loop.
+struct LoopReport
+{
+    int line = 0;
+    bool parallel = false;
+    std::string reason; // why it runs in order
+};
+
+// Checks pfor loops and plans how they run.
+//
+// check() rejects bodies whose iterations could not run apart: assignments
+// to variables of the enclosing program other than reductions, and updates
+// of a reduction s other than s = s + e or s = s * e with e not reading s.
+// It runs on the resolved tree whatever the optimization level.
+//
+// plan() looks at the loops once the passes are done. The interpreter may
+// run the iterations of one in parallel when each worker can get copies of
+// the slots the body assigns, the body reads no input and every shared
+// array the body stores to is only accessed by integer elements there: such
+// stores never reshape the array, so iterations storing to distinct
+// elements may run side by side.
+//
+// Unless the program runs as written, plan() also looks at every loop
+// while (i < n) { body; i = i + 1; } with n not assigned in the body, and
+// has to prove its iterations independent on its own: each variable the
+// body assigns is either assigned before it is read in every iteration, and
+// then seen after the loop as the last iteration left it, or a reduction as
+// above; and each shared array the body stores to is only accessed at
+// elements a[k][s * i + c] for the same invariant k and constant s, with
+// the constant parts of the c apart by no multiple of s, so that distinct
+// iterations touch distinct elements.
+class Parallel final
+{
+  private:
+    struct Store
+    {
+        const AssignNode* node = nullptr;
+        bool statement = false; // its value is not used
+    };
+
+    // Everything a loop body accesses.
+    struct Accesses
+    {
+        std::vector<Store> stores; // to whole variables
+        std::vector<const ArrayElemNode*> elemStores;
+        std::vector<const VariableNode*> reads;
+        std::vector<const ArrayElemNode*> elemReads;
+        std::vector<std::pair<int, int>> scopes; // slots bound in the body
+        bool input = false;
+        bool loops = false;
+
+        // Variables stepped after i in every iteration, d = d + s, with s.
+        std::vector<std::pair<int, ExprPtr>> stepped;
+
+        // Variables assigned once, before any read, with their value.
+        std::vector<std::pair<int, ExprPtr>> defined;
+    };
+
+    // Slots a run of a statement assigns, and slots read before the
+    // iteration assigns them, which carry values from one to the next.
+    struct Flow
+    {
+        std::vector<bool> assigned;
+        std::vector<bool> exposed;
+    };
+
+  private:
+    const FrameLayout& layout_;
+    const bool automatic_;
+    ParallelStats stats_;
+    std::vector<LoopReport> report_;
+
+    bool planning_ = false;
+    std::vector<std::string> errors_;
+
+  private:
+    // Index of a slot in vectors over the frame.
+    static size_t at(int slot) { return static_cast<size_t>(slot); }
+
+    void error(std::string msg)
+    {
+        if (!planning_ &&
+            std::find(errors_.begin(), errors_.end(), msg) == errors_.end())
+            errors_.push_back(std::move(msg));
+    }
+
+    void throwErrors() const
+    {
+        if (errors_.empty())
+            return;
+
+        std::string msg;
+
+        for (const std::string& error : errors_)
+            msg += error;
+
+        throw std::runtime_error(msg);
+    }
+
+    static std::string name(std::string_view name) { return std::string(name); }
+
+    void collect(ExprPtr expr, bool statement, Accesses& out) const
+    {
+        if (auto var = dynamic_cast<const VariableNode*>(expr))
+            out.reads.push_back(var);
+        else if (auto elem = dynamic_cast<const ArrayElemNode*>(expr))
+        {
+            indices(*elem, out);
+            out.elemReads.push_back(elem);
+        }
+        else if (auto assignment = dynamic_cast<const AssignNode*>(expr))
+        {
+            if (auto dest = std::get_if<ArrayElemPtr>(&assignment->getDest()))
+            {
+                indices(**dest, out);
+                out.elemStores.push_back(*dest);
+            }
+            else
+                out.stores.push_back({assignment, statement});
+
+            collect(assignment->getSrc(), out);
+        }
+        else if (auto unary = dynamic_cast<const UnaryOpNode*>(expr))
+            collect(unary->getOperand(), false, out);
+        else if (auto binary = dynamic_cast<const BinaryOpNode*>(expr))
+        {
+            collect(binary->getLeft(), false, out);
+            collect(binary->getRight(), false, out);
+        }
+        else if (dynamic_cast<const InNode*>(expr))
+            out.input = true;
+    }
+
+    void collect(const Rhs& src, Accesses& out) const
+    {
+        if (auto expr = std::get_if<ExprPtr>(&src))
+            return collect(*expr, false, out);
+
+        if (auto init = std::get_if<ArrayInitPtr>(&src))
+        {
+            for (size_t id = 0; id < (*init)->arraySize(); ++id)
+                collect((*init)->getElem(id), false, out);
+
+            return;
+        }
+
+        const RepeatNode& repeat = *std::get<RepeatPtr>(src);
+
+        collect(repeat.getSize(), false, out);
+
+        if (repeat.hasElem())
+            collect(repeat.getElem(), out);
+    }
+
+    void indices(const ArrayElemNode& node, Accesses& out) const
+    {
+        for (auto elem = &node;; elem = elem->getArrayElem())
+        {
+            collect(elem->getIndex(), false, out);
+
+            if (elem->holdsVariable())
+                return;
+        }
+    }
+
+    void collect(StmtPtr stmt, Accesses& out) const
+    {
+        if (auto scope = dynamic_cast<const ScopeNode*>(stmt))
+        {
+            out.scopes.emplace_back(scope->slotBegin(), scope->slotEnd());
+
+            for (StmtPtr child : scope->getChildren())
+                collect(child, out);
+        }
+        else if (auto e = dynamic_cast<ExprPtr>(stmt))
+            collect(e, true, out);
+        else if (auto print = dynamic_cast<const PrintNode*>(stmt))
+            collect(print->getExpr(), false, out);
+        else if (auto ifElse = dynamic_cast<const IfElseNode*>(stmt))
+        {
+            if (ifElse->hasCond())
+                collect(ifElse->getCond(), false, out);
+
+            collect(ifElse->getAction(), out);
+
+            if (ifElse->hasAltAction())
+                collect(ifElse->getAltAction(), out);
+        }
+        else if (auto loop = dynamic_cast<const WhileNode*>(stmt))
+        {
+            out.loops = true;
+
+            collect(loop->getCond(), false, out);
+            collect(loop->getScope(), out);
+        }
+    }
+
+    void read(const Binding& binding, Flow& out) const
+    {
+        for (const int slot : slotsOf(layout_, binding))
+            if (!out.assigned[at(slot)])
+                out.exposed[at(slot)] = true;
+    }
+
+    void flow(ExprPtr expr, Flow& out) const
+    {
+        if (auto var = dynamic_cast<const VariableNode*>(expr))
+            read(var->getBinding(), out);
+        else if (auto elem = dynamic_cast<const ArrayElemNode*>(expr))
+            flow(*elem, out);
+        else if (auto assignment = dynamic_cast<const AssignNode*>(expr))
+        {
+            // Indices of the element stored to come first.
+            if (auto dest = std::get_if<ArrayElemPtr>(&assignment->getDest()))
+            {
+                flow(**dest, out);
+                flow(assignment->getSrc(), out);
+                return;
+            }
+
+            flow(assignment->getSrc(), out);
+
+            if (const Binding& binding =
+                    std::get<VariablePtr>(assignment->getDest())->getBinding();
+                binding.chain < 0)
+                out.assigned[at(binding.slot)] = true;
+        }
+        else if (auto unary = dynamic_cast<const UnaryOpNode*>(expr))
+            flow(unary->getOperand(), out);
+        else if (auto binary = dynamic_cast<const BinaryOpNode*>(expr))
+        {
+            flow(binary->getLeft(), out);
+            flow(binary->getRight(), out);
+        }
+    }
+
+    void flow(const Rhs& src, Flow& out) const
+    {
+        if (auto expr = std::get_if<ExprPtr>(&src))
+            return flow(*expr, out);
+
+        if (auto init = std::get_if<ArrayInitPtr>(&src))
+        {
+            for (size_t id = 0; id < (*init)->arraySize(); ++id)
+                flow((*init)->getElem(id), out);
+
+            return;
+        }
+
+        const RepeatNode& repeat = *std::get<RepeatPtr>(src);
+
+        flow(repeat.getSize(), out);
+
+        if (repeat.hasElem())
+            flow(repeat.getElem(), out);
+    }
+
+    void flow(const ArrayElemNode& node, Flow& out) const
+    {
+        for (auto elem = &node;; elem = elem->getArrayElem())
+        {
+            flow(elem->getIndex(), out);
+
+            if (elem->holdsVariable())
+                return read(elem->getVariable()->getBinding(), out);
+        }
+    }
+
+    void flow(StmtPtr stmt, Flow& out) const
+    {
+        if (auto scope = dynamic_cast<const ScopeNode*>(stmt))
+        {
+            for (StmtPtr child : scope->getChildren())
+                flow(child, out);
+        }
+        else if (auto e = dynamic_cast<ExprPtr>(stmt))
+            flow(e, out);
+        else if (auto print = dynamic_cast<const PrintNode*>(stmt))
+            flow(print->getExpr(), out);
+        else if (auto ifElse = dynamic_cast<const IfElseNode*>(stmt))
+        {
+            // The final else of a chain.
+            if (!ifElse->hasCond())
+                return flow(ifElse->getAction(), out);
+
+            flow(ifElse->getCond(), out);
+
+            Flow action = out;
+            flow(ifElse->getAction(), action);
+
+            Flow alt = out;
+
+            if (ifElse->hasAltAction())
+                flow(ifElse->getAltAction(), alt);
+
+            for (size_t slot = 0; slot < out.assigned.size(); ++slot)
+            {
+                out.assigned[slot] = action.assigned[slot] && alt.assigned[slot];
+                out.exposed[slot] = action.exposed[slot] || alt.exposed[slot];
+            }
+        }
+        else if (auto loop = dynamic_cast<const WhileNode*>(stmt))
+        {
+            // The body may not run, and its first run sees what the loop
+            // was entered with.
+            flow(loop->getCond(), out);
+
+            Flow body = out;
+            flow(loop->getScope(), body);
+
+            out.exposed = std::move(body.exposed);
+        }
+    }
+
+    static bool local(const Accesses& body, int slot)
+    {
+        return std::any_of(body.scopes.begin(), body.scopes.end(),
+                           [slot](const std::pair<int, int>& scope)
+                           { return scope.first <= slot && slot < scope.second; });
+    }
+
+    // Operands of a chain of op, such as a, b and c of a + b + c.
+    static void operands(ExprPtr expr, BinaryOp op, std::vector<ExprPtr>& out)
+    {
+        auto binary = dynamic_cast<const BinaryOpNode*>(expr);
+
+        if (!binary || binary->getOp() != op)
+        {
+            out.push_back(expr);
+            return;
+        }
+
+        operands(binary->getLeft(), op, out);
+        operands(binary->getRight(), op, out);
+    }
+
+    // Checks the updates of reduction var and returns its slot, or -1.
+    int reduction(std::string_view var, const Accesses& body, BinaryOp& op)
+    {
+        const std::string form = "pfor reduction variable " + name(var) +
+                                 " is updated other than as " + name(var) +
+                                 " = " + name(var) + " + e or " + name(var) +
+                                 " = " + name(var) + " * e\n";
+        int slot = -1;
+        size_t updates = 0;
+        bool typed = false;
+        bool valid = true;
+
+        for (const Store& store : body.stores)
+        {
+            const auto dest = std::get<VariablePtr>(store.node->getDest());
+
+            if (dest->getName() != var)
+                continue;
+
+            ++updates;
+
+            const Binding& binding = dest->getBinding();
+
+            if (binding.chain >= 0 || local(body, binding.slot))
+            {
+                error("pfor reduction variable " + name(var) +
+                      " is not defined before the loop\n");
+                valid = false;
+                continue;
+            }
+
+            slot = binding.slot;
+
+            auto src = std::get_if<ExprPtr>(&store.node->getSrc());
+
+            if (!store.statement || !src)
+            {
+                error(form);
+                valid = false;
+                continue;
+            }
+
+            // s = s is an update by either operator.
+            if (auto copy = dynamic_cast<const VariableNode*>(*src);
+                copy && copy->getName() == var)
+                continue;
+
+            auto binary = dynamic_cast<const BinaryOpNode*>(*src);
+
+            if (!binary || (binary->getOp() != BinaryOp::ADD &&
+                            binary->getOp() != BinaryOp::MUL) ||
+                (typed && binary->getOp() != op))
+            {
+                error(form);
+                valid = false;
+                continue;
+            }
+
+            op = binary->getOp();
+            typed = true;
+
+            std::vector<ExprPtr> terms;
+            operands(*src, op, terms);
+
+            const auto self = std::find_if(terms.begin(), terms.end(),
+                                           [var](ExprPtr term)
+                                           {
+                                               auto read = dynamic_cast<const VariableNode*>(term);
+
+                                               return read && read->getName() == var;
+                                           });
+
+            if (self == terms.end())
+            {
+                error(form);
+                valid = false;
+            }
+            else if (!static_cast<const VariableNode*>(*self)->getBinding().sure)
+            {
+                error("pfor reduction variable " + name(var) +
+                      " is not defined before the loop\n");
+                valid = false;
+            }
+            // Workers start from integers whatever the variable holds.
+            else if (planning_ &&
+                     !static_cast<const VariableNode*>(*self)->isInteger())
+                valid = false;
+        }
+
+        // Every update reads the variable once; any other read sees a
+        // partial result.
+        const auto reads = std::count_if(body.reads.begin(), body.reads.end(),
+                                         [var](const VariableNode* read)
+                                         { return read->getName() == var; }) +
+                           std::count_if(body.elemReads.begin(),
+                                         body.elemReads.end(),
+                                         [var](const ArrayElemNode* read)
+                                         { return read->getBase()->getName() == var; });
+
+        if (static_cast<size_t>(reads) != updates)
+        {
+            error(form);
+            valid = false;
+        }
+
+        return valid ? slot : -1;
+    }
+
+    // Plan parts every parallel loop has: the loop variable and the slots
+    // of the body's scopes are private.
+    void start(const WhileNode& node, const VariableNode& index, StmtPtr body,
+               const Accesses& accesses, WhileNode::Plan& plan) const
+    {
+        plan.loop = index.getBinding();
+        plan.bound = static_cast<const BinaryOpNode*>(node.getCond())->getRight();
+        plan.body = body;
+        plan.privates.assign(static_cast<size_t>(layout_.nslots), false);
+
+        for (const int slot : slotsOf(layout_, plan.loop))
+            plan.privates[at(slot)] = true;
+
+        for (const auto& [begin, end] : accesses.scopes)
+            std::fill(plan.privates.begin() + begin, plan.privates.begin() + end,
+                      true);
+    }
+
+    // Whether expr reads the loop variable i, bound to slots loop.
+    bool counter(ExprPtr expr, const std::vector<int>& loop) const
+    {
+        auto var = dynamic_cast<const VariableNode*>(expr);
+
+        return var && slotsOf(layout_, var->getBinding()) == loop;
+    }
+
+    // Step of a variable expr may read when the loop steps it after i.
+    ExprPtr stepping(ExprPtr expr, const Accesses& body) const
+    {
+        auto var = dynamic_cast<const VariableNode*>(expr);
+
+        if (!var)
+            return nullptr;
+
+        const std::vector<int> targets = slotsOf(layout_, var->getBinding());
+
+        for (const auto& [slot, step] : body.stepped)
+            if (std::find(targets.begin(), targets.end(), slot) != targets.end())
+                return step;
+
+        return nullptr;
+    }
+
+    // Whether expr has one value throughout the loop: it only reads
+    // variables the body never assigns.
+    bool invariant(ExprPtr expr, const std::vector<int>& loop,
+                   const Accesses& body) const
+    {
+        if (dynamic_cast<const ConstantNode*>(expr))
+            return true;
+
+        if (auto var = dynamic_cast<const VariableNode*>(expr))
+        {
+            if (counter(expr, loop) || stepping(expr, body))
+                return false;
+
+            const std::vector<int> targets =
+                slotsOf(layout_, var->getBinding());
+
+            return std::none_of(body.stores.begin(), body.stores.end(),
+                                [&](const Store& store)
+                                {
+                                    const VariablePtr dest =
+                                        std::get<VariablePtr>(
+                                            store.node->getDest());
+                                    const std::vector<int> stored =
+                                        slotsOf(layout_, dest->getBinding());
+
+                                    return std::find_first_of(
+                                               stored.begin(), stored.end(),
+                                               targets.begin(),
+                                               targets.end()) != stored.end();
+                                });
+        }
+
+        if (auto unary = dynamic_cast<const UnaryOpNode*>(expr))
+            return invariant(unary->getOperand(), loop, body);
+
+        if (auto binary = dynamic_cast<const BinaryOpNode*>(expr))
+            return invariant(binary->getLeft(), loop, body) &&
+                   invariant(binary->getRight(), loop, body);
+
+        return false;
+    }
+
+    // Whether expr only yields integers.
+    static bool integer(ExprPtr expr)
+    {
+        if (dynamic_cast<const ConstantNode*>(expr))
+            return true;
+
+        if (auto var = dynamic_cast<const VariableNode*>(expr))
+            return var->isInteger();
+
+        if (auto unary = dynamic_cast<const UnaryOpNode*>(expr))
+            return integer(unary->getOperand());
+
+        if (auto binary = dynamic_cast<const BinaryOpNode*>(expr))
+            return integer(binary->getLeft()) && integer(binary->getRight());
+
+        return false;
+    }
+
+    // Whether a and b are the same expression of the same variables.
+    bool same(ExprPtr a, ExprPtr b) const
+    {
+        if (auto x = dynamic_cast<const ConstantNode*>(a))
+        {
+            auto y = dynamic_cast<const ConstantNode*>(b);
+
+            return y && x->getVal() == y->getVal();
+        }
+
+        if (auto x = dynamic_cast<const VariableNode*>(a))
+        {
+            auto y = dynamic_cast<const VariableNode*>(b);
+
+            return y && slotsOf(layout_, x->getBinding()) ==
+                            slotsOf(layout_, y->getBinding());
+        }
+
+        if (auto x = dynamic_cast<const UnaryOpNode*>(a))
+        {
+            auto y = dynamic_cast<const UnaryOpNode*>(b);
+
+            return y && x->getOp() == y->getOp() &&
+                   same(x->getOperand(), y->getOperand());
+        }
+
+        if (auto x = dynamic_cast<const BinaryOpNode*>(a))
+        {
+            auto y = dynamic_cast<const BinaryOpNode*>(b);
+
+            return y && x->getOp() == y->getOp() &&
+                   same(x->getLeft(), y->getLeft()) &&
+                   same(x->getRight(), y->getRight());
+        }
+
+        return false;
+    }
+
+    // Whether expr reads i, or a variable stepped after it by a nonzero
+    // constant, which grows by scale every iteration.
+    bool counting(ExprPtr expr, const std::vector<int>& loop,
+                  const Accesses& body, long long& scale) const
+    {
+        if (counter(expr, loop))
+        {
+            scale = 1;
+            return true;
+        }
+
+        auto step = dynamic_cast<const ConstantNode*>(stepping(expr, body));
+
+        if (!step || step->getVal() == 0 ||
+            static_cast<const VariableNode*>(expr)->getBinding().chain >= 0)
+            return false;
+
+        scale = step->getVal();
+
+        return true;
+    }
+
+    // Index of the form scale * i + c + k for a constant c and invariant
+    // terms k.
+    struct Offset
+    {
+        std::vector<int> by; // slots of i
+        long long scale = 0;
+        long long shift = 0;
+        std::vector<std::pair<bool, ExprPtr>> terms; // negated, term
+        int counters = 0;
+    };
+
+    bool split(ExprPtr expr, bool negated, const std::vector<int>& loop,
+               const Accesses& body, Offset& out) const
+    {
+        const auto count = [&](ExprPtr var, long long factor)
+        {
+            long long scale = 0;
+
+            if (!counting(var, loop, body, scale))
+                return false;
+
+            out.by = slotsOf(
+                layout_, static_cast<const VariableNode*>(var)->getBinding());
+            out.scale = (negated ? -scale : scale) * factor;
+            ++out.counters;
+
+            return true;
+        };
+
+        auto binary = dynamic_cast<const BinaryOpNode*>(expr);
+        auto left = binary ? dynamic_cast<const ConstantNode*>(binary->getLeft()) : nullptr;
+        auto right = binary ? dynamic_cast<const ConstantNode*>(binary->getRight()) : nullptr;
+
+        if (count(expr, 1))
+            return true;
+
+        if (auto var = dynamic_cast<const VariableNode*>(expr);
+            var && var->getBinding().chain < 0)
+            for (const auto& [slot, value] : body.defined)
+                if (slot == var->getBinding().slot)
+                    return split(value, negated, loop, body, out);
+
+        // An index may set one of them.
+        if (auto assignment = dynamic_cast<const AssignNode*>(expr);
+            assignment && std::holds_alternative<VariablePtr>(assignment->getDest()))
+            if (auto value = std::get_if<ExprPtr>(&assignment->getSrc()))
+                return split(*value, negated, loop, body, out);
+
+        if (auto constant = dynamic_cast<const ConstantNode*>(expr))
+            out.shift += negated ? -static_cast<long long>(constant->getVal())
+                                 : constant->getVal();
+        else if (binary && (binary->getOp() == BinaryOp::ADD ||
+                            binary->getOp() == BinaryOp::SUB))
+            return split(binary->getLeft(), negated, loop, body, out) &&
+                   split(binary->getRight(),
+                         binary->getOp() == BinaryOp::SUB ? !negated : negated,
+                         loop, body, out);
+        else if (binary && binary->getOp() == BinaryOp::MUL &&
+                 ((right && right->getVal() != 0 &&
+                   count(binary->getLeft(), right->getVal())) ||
+                  (left && left->getVal() != 0 &&
+                   count(binary->getRight(), left->getVal()))))
+            return true;
+        else if (invariant(expr, loop, body))
+            out.terms.emplace_back(negated, expr);
+        else
+            return false;
+
+        return true;
+    }
+
+    bool offset(ExprPtr index, const std::vector<int>& loop,
+                const Accesses& body, Offset& out) const
+    {
+        out = {};
+
+        return split(index, false, loop, body, out) && out.counters == 1;
+    }
+
+    // Whether distinct iterations reach distinct elements through a and b:
+    // scale * i + c never equals scale * j + d for i != j.
+    bool apart(const Offset& a, const Offset& b) const
+    {
+        return a.by == b.by && a.scale == b.scale &&
+               (a.shift == b.shift || (a.shift - b.shift) % a.scale != 0) &&
+               a.terms.size() == b.terms.size() &&
+               std::equal(a.terms.begin(), a.terms.end(), b.terms.begin(),
+                          [this](const auto& x, const auto& y)
+                          { return x.first == y.first && same(x.second, y.second); });
+    }
+
+    // Indices of an element access in the order they apply, i then j of
+    // a[i][j].
+    static std::vector<ExprPtr> path(const ArrayElemNode& node)
+    {
+        std::vector<ExprPtr> out;
+
+        for (auto elem = &node;; elem = elem->getArrayElem())
+        {
+            out.push_back(elem->getIndex());
+
+            if (elem->holdsVariable())
+                break;
+        }
+
+        std::reverse(out.begin(), out.end());
+
+        return out;
+    }
+
+    // Whether step is the statement i = i + 1 of the loop variable index.
+    bool step(StmtPtr stmt, const VariableNode& index) const
+    {
+        auto assignment = dynamic_cast<const AssignNode*>(stmt);
+        auto dest = assignment ? std::get_if<VariablePtr>(&assignment->getDest())
+                               : nullptr;
+        auto src = dest ? std::get_if<ExprPtr>(&assignment->getSrc()) : nullptr;
+        auto binary = src ? dynamic_cast<const BinaryOpNode*>(*src) : nullptr;
+
+        if (!binary || binary->getOp() != BinaryOp::ADD)
+            return false;
+
+        const std::vector<int> loop = slotsOf(layout_, index.getBinding());
+        auto left = dynamic_cast<const ConstantNode*>(binary->getLeft());
+        auto right = dynamic_cast<const ConstantNode*>(binary->getRight());
+
+        return slotsOf(layout_, (*dest)->getBinding()) == loop &&
+               ((right && right->getVal() == 1 && counter(binary->getLeft(), loop)) ||
+                (left && left->getVal() == 1 && counter(binary->getRight(), loop)));
+    }
+
+    // Whether stmt is d = d + s for a variable d defined before the loop and
+    // s a constant or variable, noting d in body.
+    bool stepped(StmtPtr stmt, const std::vector<int>& loop, Accesses& body) const
+    {
+        auto assignment = dynamic_cast<const AssignNode*>(stmt);
+        auto dest = assignment ? std::get_if<VariablePtr>(&assignment->getDest())
+                               : nullptr;
+        auto src = dest ? std::get_if<ExprPtr>(&assignment->getSrc()) : nullptr;
+        auto binary = src ? dynamic_cast<const BinaryOpNode*>(*src) : nullptr;
+
+        if (!binary || binary->getOp() != BinaryOp::ADD)
+            return false;
+
+        auto self = dynamic_cast<const VariableNode*>(binary->getLeft());
+        auto by = binary->getRight();
+        auto var = dynamic_cast<const VariableNode*>(by);
+        const Binding& binding = (*dest)->getBinding();
+
+        if (binding.chain >= 0 || counter(*dest, loop) || stepping(*dest, body) ||
+            !self || !self->isInteger() || !self->getBinding().sure ||
+            slotsOf(layout_, self->getBinding()) !=
+                std::vector<int>{binding.slot} ||
+            !(dynamic_cast<const ConstantNode*>(by) ||
+              (var && var->isInteger() && var->getBinding().sure)))
+            return false;
+
+        body.stepped.emplace_back(binding.slot, by);
+
+        return true;
+    }
+
+    // Plans while (i < n) { body; i = i + 1; } and returns why its
+    // iterations may depend on each other, or nothing when they do not.
+    std::string analyze(const WhileNode& node, WhileNode::Plan& plan)
+    {
+        auto cond = dynamic_cast<const BinaryOpNode*>(node.getCond());
+        auto index = cond ? dynamic_cast<const VariableNode*>(cond->getLeft()) : nullptr;
+
+        if (!index || cond->getOp() != BinaryOp::LS)
+            return "its condition is not of the form i < n";
+
+        const std::string i = name(index->getName());
+        const std::string ending = "its body does not end with " + i + " = " + i + " + 1";
+        auto scope = dynamic_cast<const ScopeNode*>(node.getScope());
+
+        if (!scope)
+            return ending;
+
+        // Variables -O2 steps along with i follow its step.
+        const std::vector<StmtPtr>& children = scope->getChildren();
+        const std::vector<int> loop = slotsOf(layout_, index->getBinding());
+        Accesses body;
+        size_t end = children.size();
+
+        while (end > 0 && !step(children[end - 1], *index))
+            --end;
+
+        if (end < 2)
+            return ending;
+
+        for (size_t id = end; id < children.size(); ++id)
+            if (!stepped(children[id], loop, body))
+                return ending;
+
+        Flow carried{std::vector<bool>(static_cast<size_t>(layout_.nslots), false),
+                     std::vector<bool>(static_cast<size_t>(layout_.nslots), false)};
+
+        for (size_t id = 0; id + 1 < end; ++id)
+        {
+            collect(children[id], body);
+            flow(children[id], carried);
+        }
+
+        body.scopes.emplace_back(scope->slotBegin(), scope->slotEnd());
+
+        if (body.input)
+            return "it reads input";
+
+        if (!index->isInteger() || !integer(cond->getRight()))
+            return "its condition is not proven to compare integers";
+
+        if (!invariant(cond->getRight(), loop, body))
+            return "it may change the bound " + i + " is compared with";
+
+        // Such as the temporaries of -O2, which may stand for their value
+        // in indices.
+        for (const Store& store : body.stores)
+        {
+            const Binding& binding =
+                std::get<VariablePtr>(store.node->getDest())->getBinding();
+            auto value = std::get_if<ExprPtr>(&store.node->getSrc());
+
+            if (binding.chain < 0 && value &&
+                !carried.exposed[at(binding.slot)] &&
+                std::count_if(body.stores.begin(), body.stores.end(),
+                              [&binding](const Store& other)
+                              {
+                                  return std::get<VariablePtr>(other.node->getDest())
+                                             ->getBinding()
+                                             .slot == binding.slot;
+                              }) == 1)
+                body.defined.emplace_back(binding.slot, *value);
+        }
+
+        for (const auto& [slot, by] : body.stepped)
+            if (!invariant(by, loop, body))
+                return "it steps " + name(layout_.name(slot)) +
+                       " by an amount that may change";
+
+        start(node, *index, node.getScope(), body, plan);
+        plan.minimum = body.loops ? 16 : 1024;
+        plan.steps = body.stepped;
+
+        for (const auto& [slot, by] : body.stepped)
+            plan.privates[at(slot)] = true;
+
+        for (const Store& store : body.stores)
+        {
+            const auto dest = std::get<VariablePtr>(store.node->getDest());
+            const std::string var = name(dest->getName());
+            const Binding& binding = dest->getBinding();
+            const std::vector<int> targets = slotsOf(layout_, binding);
+
+            const auto any = [&targets](const std::vector<int>& of)
+            {
+                return std::any_of(targets.begin(), targets.end(), [&of](int slot)
+                                   { return std::find(of.begin(), of.end(), slot) !=
+                                            of.end(); });
+            };
+
+            if (any(loop))
+                return "it assigns " + i + " before its end";
+
+            if (stepping(dest, body))
+                return "it assigns " + var + " besides stepping it";
+
+            if (std::all_of(targets.begin(), targets.end(),
+                            [&](int slot) { return local(body, slot); }))
+                continue;
+
+            if (binding.chain >= 0)
+                return "it assigns " + var +
+                       ", which may name variables of several scopes";
+
+            const int slot = binding.slot;
+
+            if (plan.privates[at(slot)])
+                continue;
+
+            if (!carried.exposed[at(slot)])
+            {
+                // Temporaries of the passes are not read after the loop.
+                if (carried.assigned[at(slot)])
+                    plan.lasts.push_back(slot);
+                else if (var.find('.') == std::string::npos)
+                    return "it assigns " + var + " only in some iterations";
+
+                plan.privates[at(slot)] = true;
+                continue;
+            }
+
+            BinaryOp op = BinaryOp::ADD;
+
+            if (reduction(dest->getName(), body, op) < 0)
+                return "it carries " + var + " from one iteration to the next";
+
+            plan.reductions.emplace_back(slot, op);
+            plan.privates[at(slot)] = true;
+        }
+
+        for (const ArrayElemNode* store : body.elemStores)
+        {
+            const std::string var = name(store->getBase()->getName());
+            const Binding& binding = store->getBase()->getBinding();
+            const std::vector<int> targets = slotsOf(layout_, binding);
+
+            if (std::all_of(targets.begin(), targets.end(),
+                            [&](int slot) { return plan.privates[at(slot)]; }))
+                continue;
+
+            if (binding.chain >= 0)
+                return "it stores to elements of " + var +
+                       ", which may name arrays of several scopes";
+
+            if (!store->isInteger())
+                return "it stores to elements of " + var +
+                       " not proven to hold integers";
+
+            if (std::find(plan.arrays.begin(), plan.arrays.end(),
+                          binding.slot) == plan.arrays.end())
+                plan.arrays.push_back(binding.slot);
+        }
+
+        for (const int array : plan.arrays)
+        {
+            const std::string var = name(layout_.name(array));
+            const auto touches = [&](const Binding& binding)
+            {
+                const std::vector<int> targets = slotsOf(layout_, binding);
+
+                return std::find(targets.begin(), targets.end(), array) !=
+                       targets.end();
+            };
+
+            for (const VariableNode* read : body.reads)
+                if (touches(read->getBinding()))
+                    return "it reads " + var + " as a whole while storing to it";
+
+            std::vector<const ArrayElemNode*> accesses = body.elemStores;
+            accesses.insert(accesses.end(), body.elemReads.begin(),
+                            body.elemReads.end());
+
+            // Every access goes through the same row a[k] and then steps
+            // with i, as a[k][s * i + c] does.
+            const std::string overlap =
+                "different iterations may access the same element of " + var;
+            std::vector<ExprPtr> model;
+            size_t level = 0;
+            std::vector<Offset> rows;
+
+            for (const ArrayElemNode* access : accesses)
+            {
+                const Binding& binding = access->getBase()->getBinding();
+
+                if (!touches(binding))
+                    continue;
+
+                if (binding.chain >= 0 || !access->isInteger())
+                    return "it reads rows of " + var + " while storing to it";
+
+                const std::vector<ExprPtr> indices = path(*access);
+                Offset row;
+
+                if (model.empty())
+                {
+                    while (level < indices.size() &&
+                           !offset(indices[level], loop, body, row))
+                        ++level;
+
+                    model = indices;
+                }
+
+                if (level >= indices.size() ||
+                    !offset(indices[level], loop, body, row) ||
+                    !std::all_of(rows.begin(), rows.end(), [&](const Offset& other)
+                                 { return apart(row, other); }))
+                    return overlap;
+
+                for (size_t id = 0; id < level; ++id)
+                    if (!invariant(indices[id], loop, body) ||
+                        !same(indices[id], model[id]))
+                        return overlap;
+
+                rows.push_back(std::move(row));
+            }
+        }
+
+        return {};
+    }
+
+    bool analyze(const PforNode& node, PforNode::Plan& plan)
+    {
+        auto cond = dynamic_cast<const BinaryOpNode*>(node.getCond());
+        auto index = cond ? dynamic_cast<const VariableNode*>(cond->getLeft()) : nullptr;
+        StmtPtr bodyStmt = node.getBody();
+
+        if (!index || cond->getOp() != BinaryOp::LS || !bodyStmt)
+            return false;
+
+        Accesses body;
+        collect(bodyStmt, body);
+
+        // Names the loop scope binds die with each iteration as well.
+        if (auto scope = dynamic_cast<const ScopeNode*>(node.getScope()))
+            body.scopes.emplace_back(scope->slotBegin(), scope->slotEnd());
+
+        const std::vector<int> loop = slotsOf(layout_, index->getBinding());
+        const std::vector<std::string_view>& names = node.getReductions();
+        bool parallel = !body.input;
+
+        start(node, *index, bodyStmt, body, plan);
+
+        for (std::string_view var : names)
+        {
+            if (var == index->getName())
+            {
+                error("pfor loop variable " + name(var) +
+                      " cannot be a reduction\n");
+                parallel = false;
+                continue;
+            }
+
+            BinaryOp op = BinaryOp::ADD;
+            const int slot = reduction(var, body, op);
+
+            if (slot < 0)
+            {
+                parallel = false;
+                continue;
+            }
+
+            plan.reductions.emplace_back(slot, op);
+            plan.privates[at(slot)] = true;
+        }
+
+        for (const Store& store : body.stores)
+        {
+            const auto dest = std::get<VariablePtr>(store.node->getDest());
+
+            if (std::find(names.begin(), names.end(), dest->getName()) !=
+                names.end())
+                continue;
+
+            const std::vector<int> targets =
+                slotsOf(layout_, dest->getBinding());
+
+            if (std::any_of(targets.begin(), targets.end(), [&](int slot)
+                            { return std::find(loop.begin(), loop.end(), slot) !=
+                                     loop.end(); }))
+            {
+                error("pfor body assigns its loop variable " +
+                      name(index->getName()) + "\n");
+                parallel = false;
+                continue;
+            }
+
+            // Temporaries of the passes belong to no scope, but live within
+            // an iteration.
+            if (!planning_ &&
+                !std::all_of(targets.begin(), targets.end(),
+                             [&](int slot) { return local(body, slot); }))
+                error("pfor body assigns shared variable " +
+                      name(dest->getName()) + "\n");
+
+            for (const int slot : targets)
+                plan.privates[at(slot)] = true;
+        }
+
+        for (const ArrayElemNode* store : body.elemStores)
+        {
+            const Binding& binding = store->getBase()->getBinding();
+
+            if (binding.chain >= 0)
+            {
+                parallel = false;
+                continue;
+            }
+
+            if (plan.privates[at(binding.slot)] || local(body, binding.slot))
+                continue;
+
+            if (!store->isInteger())
+                parallel = false;
+
+            if (std::find(plan.arrays.begin(), plan.arrays.end(),
+                          binding.slot) == plan.arrays.end())
+                plan.arrays.push_back(binding.slot);
+        }
+
+        // Copies or rows of a shared array would make the stores above
+        // detach it.
+        const auto touches = [&](const Binding& binding)
+        {
+            const std::vector<int> targets = slotsOf(layout_, binding);
+
+            return std::any_of(targets.begin(), targets.end(), [&](int slot)
+                               { return std::find(plan.arrays.begin(),
+                                                  plan.arrays.end(),
+                                                  slot) != plan.arrays.end(); });
+        };
+
+        for (const VariableNode* read : body.reads)
+            if (touches(read->getBinding()))
+                parallel = false;
+
+        for (const ArrayElemNode* read : body.elemReads)
+            if (touches(read->getBase()->getBinding()) && !read->isInteger())
+                parallel = false;
+
+        return parallel;
+    }
+
+    void statement(StmtPtr stmt)
+    {
+        if (auto scope = dynamic_cast<const ScopeNode*>(stmt))
+        {
+            for (StmtPtr child : scope->getChildren())
+                statement(child);
+        }
+        else if (auto ifElse = dynamic_cast<const IfElseNode*>(stmt))
+        {
+            statement(ifElse->getAction());
+
+            if (ifElse->hasAltAction())
+                statement(ifElse->getAltAction());
+        }
+        else if (auto loop = dynamic_cast<const WhileNode*>(stmt))
+        {
+            if (auto pfor = dynamic_cast<const PforNode*>(loop))
+            {
+                PforNode::Plan plan;
+
+                plan.parallel = analyze(*pfor, plan);
+
+                if (planning_)
+                {
+                    ++stats_.loops;
+                    stats_.parallel += plan.parallel;
+
+                    pfor->setPlan(std::move(plan));
+                }
+            }
+            else if (planning_)
+            {
+                WhileNode::Plan plan;
+                std::string reason =
+                    automatic_ ? analyze(*loop, plan)
+                               : "loops run as written without --auto-parallel "
+                                 "at -O1 or -O2";
+
+                plan.parallel = reason.empty();
+
+                ++stats_.whiles;
+                stats_.automatic += plan.parallel;
+                report_.push_back({loop->getLine(), plan.parallel, std::move(reason)});
+
+                loop->setPlan(plan.parallel ? std::move(plan) : WhileNode::Plan{});
+            }
+
+            statement(loop->getScope());
+        }
+    }
+
+  public:
+    // automatic lets plan() run while loops in parallel as well.
+    explicit Parallel(const FrameLayout& layout, bool automatic = false)
+        : layout_(layout)
+        , automatic_(automatic)
+    {}
+
+    void check(const ScopeNode& global)
+    {
+        MSG("Checking parallel loops\n");
+
+        for (StmtPtr child : global.getChildren())
+            statement(child);
+
+        throwErrors();
+    }
+
+    // The same for one statement of a streamed global scope; a Parallel
+    // checks or plans, not both.
+    void check(StmtPtr stmt)
+    {
+        statement(stmt);
+        throwErrors();
+    }
+
+    ParallelStats plan(const ScopeNode& global)
+    {
+        MSG("Planning parallel loops\n");
+
+        planning_ = true;
+
+        for (StmtPtr child : global.getChildren())
+            statement(child);
+
+        LOG("{} of {} parallel loops planned to run in parallel\n",
+            stats_.parallel, stats_.loops);
+        LOG("{} of {} while loops planned to run in parallel\n",
+            stats_.automatic, stats_.whiles);
+
+        return stats_;
+    }
+
+    ParallelStats plan(StmtPtr stmt)
+    {
+        planning_ = true;
+        statement(stmt);
+
+        return stats_;
+    }
+
+    // While loops in the order plan() met them.
+    const std::vector<LoopReport>& report() const { return report_; }
+};
+
+} // namespace detail
+
+} // namespace AST
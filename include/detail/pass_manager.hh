@@ -0,0 +1,52 @@
+#pragma once
+
+#include <functional>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "log.hh"
+#include "timing.hh"
+
+namespace AST
+{
+
+namespace detail
+{
+
+// Runs passes over the program in the order they were added, recording how
+// long each took. Every engine runs the tree they leave.
+class PassManager final
+{
+  private:
+    struct Pass
+    {
+        std::string_view name;
+        std::function<void()> run;
+    };
+
+  private:
+    std::vector<Pass> passes_;
+
+  public:
+    PassManager& add(std::string_view name, std::function<void()> run)
+    {
+        passes_.push_back({name, std::move(run)});
+
+        return *this;
+    }
+
+    void run(std::vector<PassTiming>& timings) const
+    {
+        for (const auto& pass : passes_)
+        {
+            LOG("Running pass {}\n", pass.name);
+
+            timed(timings, pass.name, pass.run);
+        }
+    }
+};
+
+} // namespace detail
+
+} // namespace AST
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <atomic>
+#include <exception>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "arena.hh"
+#include "channel.hh"
+#include "folder.hh"
+#include "frame.hh"
+#include "interpreter.hh"
+#include "log.hh"
+#include "node.hh"
+#include "parallel.hh"
+#include "resolver.hh"
+#include "typer.hh"
+
+namespace AST
+{
+
+namespace detail
+{
+
+// Runs a program on the interpreter while the rest of it is parsed. The
+// parsing thread pushes every statement of the global scope once it is
+// complete: the statement is folded, resolved, typed and its pfor loops
+// checked and planned, with what the statements before it left, and it
+// goes through a Channel to the thread that runs them in order. Passes
+// that need the whole program to see what comes later do not run.
+class Pipeline final
+{
+  private:
+    // A statement and what it adds to the layout; none ends the program.
+    struct Item
+    {
+        StmtPtr stmt = nullptr;
+        std::vector<std::string_view> names;
+        std::vector<std::vector<int>> chains;
+    };
+
+    Arena& arena_;
+    ScopeNode& global_;
+    const bool optimize_;
+
+    // Used by the parsing thread only.
+    FrameLayout layout_;
+    Folder folder_{arena_};
+    Resolver resolver_;
+    Typer typer_{layout_};
+    Parallel checker_{layout_};
+    Parallel planner_;
+    FoldStats foldStats_;
+    TypeStats typeStats_;
+    ParallelStats parallelStats_;
+
+    Channel<Item> channel_{1024};
+    std::atomic<bool> stopped_{false};
+    std::exception_ptr error_; // of the parser, set before the last item
+
+  private:
+    Item prepare(StmtPtr stmt)
+    {
+        if (optimize_)
+        {
+            ScopeNode unit({stmt});
+
+            foldStats_ = folder_.run(unit);
+            stmt = unit.getChildren().front();
+        }
+
+        const auto names = static_cast<std::ptrdiff_t>(layout_.names.size());
+        const auto chains = static_cast<std::ptrdiff_t>(layout_.chains.size());
+
+        resolver_.resolve(global_, stmt, layout_);
+        typeStats_ = typer_.run(stmt);
+        checker_.check(stmt);
+        parallelStats_ = planner_.plan(stmt);
+
+        global_.pushChild(stmt);
+
+        return {stmt,
+                {layout_.names.begin() + names, layout_.names.end()},
+                {layout_.chains.begin() + chains, layout_.chains.end()}};
+    }
+
+    // Skips to the end, so that the parsing thread never waits on a full
+    // channel again.
+    void drain()
+    {
+        Item item;
+
+        do
+            channel_.pop(item);
+        while (item.stmt);
+    }
+
+  public:
+    // Statements go to global, which must be empty; optimize folds them,
+    // and automatic lets while loops run in parallel, as in Parallel.
+    Pipeline(Arena& arena, ScopeNode& global, bool optimize, bool automatic)
+        : arena_(arena)
+        , global_(global)
+        , optimize_(optimize)
+        , planner_(layout_, automatic)
+    {}
+
+    Pipeline(const Pipeline&) = delete;
+    Pipeline& operator=(const Pipeline&) = delete;
+
+    // On the parsing thread: the next statement of the global scope. Throws
+    // when it is not valid where it stands, or once the program stopped.
+    void push(StmtPtr stmt)
+    {
+        if (stopped_.load(std::memory_order_relaxed))
+            throw std::runtime_error("Program stopped\n");
+
+        channel_.push(prepare(stmt));
+    }
+
+    // On the parsing thread, once it is done: error is what stopped it.
+    void close(std::exception_ptr error = nullptr)
+    {
+        error_ = std::move(error);
+
+        channel_.push(Item());
+    }
+
+    // Runs the statements as they come, then throws what stopped the
+    // parser, if anything. Output goes out whenever the parser is behind.
+    void run(Interpreter& interpreter)
+    {
+        Item item;
+
+        for (;;)
+        {
+            if (!channel_.tryPop(item))
+            {
+                interpreter.promptOutput();
+                channel_.pop(item);
+            }
+
+            if (!item.stmt)
+                break;
+
+            interpreter.extendLayout(item.names, item.chains);
+
+            try
+            {
+                item.stmt->accept(interpreter);
+            }
+            catch (...)
+            {
+                stopped_.store(true, std::memory_order_relaxed);
+                drain();
+                throw;
+            }
+        }
+
+        MSG("Streamed program done\n");
+
+        if (error_)
+            std::rethrow_exception(error_);
+    }
+
+    // Valid once run() returned.
+    const FoldStats& foldStats() const { return foldStats_; }
+
+    const TypeStats& typeStats() const { return typeStats_; }
+
+    const ParallelStats& parallelStats() const { return parallelStats_; }
+
+    const std::vector<LoopReport>& report() const { return planner_.report(); }
+};
+
+} // namespace detail
+
+} // namespace AST
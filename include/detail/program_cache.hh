@@ -0,0 +1,742 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "driver.hh"
+#include "folder.hh"
+#include "log.hh"
+#include "node.hh"
+#include "source.hh"
+#include "visitor.hh"
+
+namespace AST
+{
+
+namespace detail
+{
+
+// FNV-1a over data, going on from hash: the name of a source in the cache,
+// and the checksum of what is stored for it. Not collision resistant, so a
+// file also holds the source it was made from.
+inline uint64_t contentHash(const char* data, size_t size,
+                            uint64_t hash = 14695981039346656037ULL)
+{
+    for (size_t id = 0; id < size; ++id)
+    {
+        hash ^= static_cast<unsigned char>(data[id]);
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+// Parsed programs kept on disk, one file per source text and level of
+// folding, so that running a script again skips scanning and parsing.
+//
+// A file is a Header, the source text, then the names of the program and
+// its tree in preorder: a tag per node, then its operator, value, name index
+// or count and its children, integers written as LEB128 varints. The header
+// names the build that wrote the file and holds a checksum of all the rest.
+// A file from another build, for other text, that fails its checksum or
+// does not decode to one whole tree, is ignored and written again. Files
+// are in the byte order of the machine that wrote them.
+class ProgramCache final
+{
+  private:
+    static constexpr char signature[8] = {'P', 'A', 'R', 'A',
+                                          'C', 'L', 'T', 'R'};
+    // Changes whenever the layout of a file does.
+    static constexpr uint32_t version = 2;
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t folded;
+        uint64_t build;
+        uint64_t sourceSize;
+        uint64_t payloadSize;
+        // FoldStats of the folding, if any.
+        uint64_t foldedConstants;
+        uint64_t simplified;
+        // Of the header up to here and everything after it.
+        uint64_t checksum;
+    };
+
+    enum Tag : uint8_t
+    {
+        NONE, // no node, as the element of repeat(undef, n)
+        SCOPE,
+        CONSTANT,
+        VARIABLE,
+        BINARY,
+        UNARY,
+        ARRAY_INIT,
+        REPEAT,
+        ARRAY_ELEM,
+        ASSIGN,
+        WHILE,
+        PFOR,
+        IF,
+        PRINT,
+        IN,
+    };
+
+    // Goes through accept(), as a chain of casts per node would cost more
+    // than the parse it saves on a large program.
+    class Writer final : public Visitor
+    {
+      private:
+        std::string out_;
+        std::unordered_map<std::string_view, uint64_t> names_;
+        std::vector<std::string_view> order_;
+
+      private:
+        void put(uint64_t value)
+        {
+            for (; value >= 0x80; value >>= 7)
+                out_.push_back(static_cast<char>((value & 0x7f) | 0x80));
+
+            out_.push_back(static_cast<char>(value));
+        }
+
+        void name(std::string_view name)
+        {
+            const auto [it, inserted] = names_.try_emplace(name, order_.size());
+
+            if (inserted)
+                order_.push_back(name);
+
+            put(it->second);
+        }
+
+        void node(const StatementNode* stmt)
+        {
+            if (stmt)
+                stmt->accept(*this);
+            else
+                put(NONE);
+        }
+
+        void rhs(const Rhs& src)
+        {
+            std::visit([this](auto value) { node(value); }, src);
+        }
+
+      public:
+        void visit(const ScopeNode& scope) override
+        {
+            put(SCOPE);
+            put(scope.nstms());
+
+            for (StmtPtr child : scope.getChildren())
+                node(child);
+        }
+
+        void visit(const ConstantNode& constant) override
+        {
+            const auto value = static_cast<uint32_t>(constant.getVal());
+
+            // Zigzag, so that small negative values stay short.
+            put(CONSTANT);
+            put((value << 1) ^ (value >> 31 ? 0xffffffffU : 0));
+        }
+
+        void visit(const VariableNode& var) override
+        {
+            put(VARIABLE);
+            name(var.getName());
+        }
+
+        void visit(const BinaryOpNode& binary) override
+        {
+            put(BINARY);
+            put(static_cast<uint64_t>(binary.getOp()));
+            node(binary.getLeft());
+            node(binary.getRight());
+        }
+
+        void visit(const UnaryOpNode& unary) override
+        {
+            put(UNARY);
+            put(static_cast<uint64_t>(unary.getOp()));
+            node(unary.getOperand());
+        }
+
+        void visit(const ArrayInitNode& init) override
+        {
+            put(ARRAY_INIT);
+            put(init.arraySize());
+
+            for (size_t id = 0; id < init.arraySize(); ++id)
+                node(init.getElem(id));
+        }
+
+        void visit(const RepeatNode& repeat) override
+        {
+            put(REPEAT);
+            rhs(repeat.getElem());
+            node(repeat.getSize());
+        }
+
+        void visit(const ArrayElemNode& elem) override
+        {
+            put(ARRAY_ELEM);
+
+            if (elem.holdsVariable())
+                node(elem.getVariable());
+            else
+                node(elem.getArrayElem());
+
+            node(elem.getIndex());
+        }
+
+        void visit(const AssignNode& assign) override
+        {
+            put(ASSIGN);
+            std::visit([this](auto dest) { node(dest); }, assign.getDest());
+            rhs(assign.getSrc());
+        }
+
+        void visit(const PforNode& pfor) override
+        {
+            put(PFOR);
+            put(static_cast<uint64_t>(pfor.getLine()));
+            put(pfor.getReductions().size());
+
+            for (std::string_view reduction : pfor.getReductions())
+                name(reduction);
+
+            node(pfor.getCond());
+            node(pfor.getScope());
+        }
+
+        void visit(const WhileNode& loop) override
+        {
+            put(WHILE);
+            put(static_cast<uint64_t>(loop.getLine()));
+            node(loop.getCond());
+            node(loop.getScope());
+        }
+
+        void visit(const IfElseNode& ifElse) override
+        {
+            put(IF);
+            node(ifElse.getCond());
+            node(ifElse.getAction());
+            node(ifElse.getAltAction());
+        }
+
+        void visit(const PrintNode& print) override
+        {
+            put(PRINT);
+            node(print.getExpr());
+        }
+
+        void visit(const InNode&) override { put(IN); }
+
+        // The names, then the tree.
+        std::string write(const ScopeNode& global)
+        {
+            node(&global);
+
+            std::string tree = std::move(out_);
+
+            out_.clear();
+            put(order_.size());
+
+            for (std::string_view name : order_)
+            {
+                put(name.size());
+                out_.append(name);
+            }
+
+            return out_ + tree;
+        }
+    };
+
+    class Reader final
+    {
+      private:
+        Driver& drv_;
+        const char* pos_;
+        const char* end_;
+        std::vector<std::string_view> names_;
+
+      private:
+        [[noreturn]] static void corrupt()
+        {
+            throw std::runtime_error("Corrupted program cache\n");
+        }
+
+        uint64_t get()
+        {
+            uint64_t value = 0;
+
+            for (unsigned shift = 0; shift < 64; shift += 7)
+            {
+                if (pos_ == end_)
+                    corrupt();
+
+                const auto byte = static_cast<unsigned char>(*pos_++);
+
+                value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+
+                if (!(byte & 0x80))
+                    return value;
+            }
+
+            corrupt();
+        }
+
+        // A count of things each taking at least a byte that follow.
+        size_t count()
+        {
+            const uint64_t value = get();
+
+            if (value > static_cast<uint64_t>(end_ - pos_))
+                corrupt();
+
+            return static_cast<size_t>(value);
+        }
+
+        std::string_view name()
+        {
+            const uint64_t id = get();
+
+            if (id >= names_.size())
+                corrupt();
+
+            return names_[id];
+        }
+
+        int line()
+        {
+            const uint64_t value = get();
+
+            if (value > static_cast<uint64_t>(INT32_MAX))
+                corrupt();
+
+            return static_cast<int>(value);
+        }
+
+        template <typename T>
+        static T* as(StmtPtr stmt)
+        {
+            auto node = dynamic_cast<T*>(stmt);
+
+            if (!node)
+                corrupt();
+
+            return node;
+        }
+
+        ExprPtr expr() { return as<ExpressionNode>(node()); }
+
+        Lhs lhs()
+        {
+            StmtPtr dest = node();
+
+            if (auto var = dynamic_cast<VariablePtr>(dest))
+                return var;
+
+            return as<ArrayElemNode>(dest);
+        }
+
+        Rhs rhs()
+        {
+            StmtPtr src = node();
+
+            if (auto repeat = dynamic_cast<RepeatPtr>(src))
+                return repeat;
+
+            if (auto init = dynamic_cast<ArrayInitPtr>(src))
+                return init;
+
+            return expr(src);
+        }
+
+        ExprPtr expr(StmtPtr stmt) { return as<ExpressionNode>(stmt); }
+
+        StmtPtr node()
+        {
+            if (pos_ == end_)
+                corrupt();
+
+            switch (static_cast<unsigned char>(*pos_++))
+            {
+                case NONE:
+                    return nullptr;
+
+                case SCOPE:
+                {
+                    std::vector<StmtPtr> children(count());
+
+                    for (StmtPtr& child : children)
+                        child = as<StatementNode>(node());
+
+                    return drv_.construct<ScopeNode>(std::move(children));
+                }
+
+                case CONSTANT:
+                {
+                    const uint64_t value = get();
+
+                    if (value > UINT32_MAX)
+                        corrupt();
+
+                    const auto bits = static_cast<uint32_t>(value);
+
+                    return drv_.construct<ConstantNode>(static_cast<int>(
+                        (bits >> 1) ^ (bits & 1 ? 0xffffffffU : 0)));
+                }
+
+                case VARIABLE:
+                    return drv_.construct<VariableNode>(name());
+
+                case BINARY:
+                {
+                    const uint64_t op = get();
+
+                    if (op > static_cast<uint64_t>(BinaryOp::OR))
+                        corrupt();
+
+                    ExprPtr left = expr();
+
+                    return drv_.construct<BinaryOpNode>(
+                        left, static_cast<BinaryOp>(op), expr());
+                }
+
+                case UNARY:
+                {
+                    const uint64_t op = get();
+
+                    if (op > static_cast<uint64_t>(UnaryOp::NOT))
+                        corrupt();
+
+                    return drv_.construct<UnaryOpNode>(
+                        expr(), static_cast<UnaryOp>(op));
+                }
+
+                case ARRAY_INIT:
+                {
+                    std::vector<ExprPtr> elems(count());
+
+                    for (ExprPtr& elem : elems)
+                        elem = expr();
+
+                    return drv_.construct<ArrayInitNode>(std::move(elems));
+                }
+
+                case REPEAT:
+                {
+                    StmtPtr elem = node();
+                    ExprPtr size = expr();
+
+                    if (!elem)
+                        return drv_.construct<RepeatNode>(size);
+
+                    if (auto repeat = dynamic_cast<RepeatPtr>(elem))
+                        return drv_.construct<RepeatNode>(repeat, size);
+
+                    return drv_.construct<RepeatNode>(expr(elem), size);
+                }
+
+                case ARRAY_ELEM:
+                {
+                    Lhs name = lhs();
+
+                    return drv_.construct<ArrayElemNode>(name, expr());
+                }
+
+                case ASSIGN:
+                {
+                    Lhs dest = lhs();
+
+                    return drv_.construct<AssignNode>(dest, rhs());
+                }
+
+                case WHILE:
+                {
+                    const int at = line();
+                    ExprPtr cond = expr();
+                    WhileNode* loop = drv_.construct<WhileNode>(
+                        cond, as<StatementNode>(node()));
+
+                    loop->setLine(at);
+
+                    return loop;
+                }
+
+                case PFOR:
+                {
+                    const int at = line();
+                    std::vector<std::string_view> reductions(count());
+
+                    for (std::string_view& reduction : reductions)
+                        reduction = name();
+
+                    ExprPtr cond = expr();
+                    PforNode* loop = drv_.construct<PforNode>(
+                        cond, as<StatementNode>(node()),
+                        std::move(reductions));
+
+                    loop->setLine(at);
+
+                    return loop;
+                }
+
+                case IF:
+                {
+                    StmtPtr cond = node();
+                    StmtPtr action = as<StatementNode>(node());
+                    StmtPtr alt = node();
+
+                    if (!cond)
+                    {
+                        if (alt)
+                            corrupt();
+
+                        return drv_.construct<IfElseNode>(action);
+                    }
+
+                    return drv_.construct<IfElseNode>(expr(cond), action, alt);
+                }
+
+                case PRINT:
+                    return drv_.construct<PrintNode>(expr());
+
+                case IN:
+                    return drv_.construct<InNode>();
+
+                default:
+                    corrupt();
+            }
+        }
+
+      public:
+        Reader(Driver& drv, const char* data, size_t size)
+            : drv_(drv)
+            , pos_(data)
+            , end_(data + size)
+        {}
+
+        ScopeNode* read()
+        {
+            names_.resize(count());
+
+            for (std::string_view& name : names_)
+            {
+                const size_t length = count();
+
+                name = drv_.internName(std::string_view(pos_, length));
+                pos_ += length;
+            }
+
+            ScopeNode* global = as<ScopeNode>(node());
+
+            if (pos_ != end_)
+                corrupt();
+
+            return global;
+        }
+    };
+
+  private:
+    std::filesystem::path dir_;
+
+  private:
+    // Names the build that writes or reads a file. Everything is in headers,
+    // so any change to the nodes, the parser or the folder recompiles the
+    // file that includes this one, and the stamp moves with it.
+    static uint64_t build()
+    {
+        static constexpr char stamp[] = __DATE__ " " __TIME__ " " __VERSION__;
+
+        return contentHash(stamp, sizeof(stamp) - 1, version);
+    }
+
+    static uint64_t checksum(const Header& header, const char* rest,
+                             size_t size)
+    {
+        return contentHash(rest, size,
+                           contentHash(reinterpret_cast<const char*>(&header),
+                                       offsetof(Header, checksum)));
+    }
+
+  public:
+    explicit ProgramCache(std::filesystem::path dir)
+        : dir_(std::move(dir))
+    {}
+
+    // Where the program with source text of hash is kept.
+    std::filesystem::path path(uint64_t hash, bool folded) const
+    {
+        char name[32];
+
+        std::snprintf(name, sizeof(name), "%016llx.O%d.pclc",
+                      static_cast<unsigned long long>(hash), folded ? 1 : 0);
+
+        return dir_ / name;
+    }
+
+    // The tree stored for source, built with drv, and the stats of its
+    // folding; nothing when there is no usable file for it.
+    std::optional<std::pair<ScopeNode*, FoldStats>>
+    load(Driver& drv, std::string_view source, bool folded) const
+    {
+        Source file;
+
+        try
+        {
+            file.open(path(contentHash(source.data(), source.size()), folded)
+                          .string());
+        }
+        catch (std::runtime_error&)
+        {
+            return std::nullopt;
+        }
+
+        Header header;
+
+        if (file.size() < sizeof(header))
+            return std::nullopt;
+
+        std::memcpy(&header, file.data(), sizeof(header));
+
+        const char* rest = file.data() + sizeof(header);
+        const size_t size = file.size() - sizeof(header);
+
+        // The text itself is compared, as names collide.
+        if (std::memcmp(header.magic, signature, sizeof(signature)) != 0 ||
+            header.version != version || header.build != build() ||
+            header.folded != static_cast<uint32_t>(folded) ||
+            header.sourceSize != source.size() || size < source.size() ||
+            header.payloadSize != size - source.size() ||
+            header.checksum != checksum(header, rest, size) ||
+            std::memcmp(rest, source.data(), source.size()) != 0)
+        {
+            MSG("Program cache file is stale or damaged\n");
+            return std::nullopt;
+        }
+
+        try
+        {
+            ScopeNode* global = Reader(drv, rest + source.size(),
+                                       header.payloadSize).read();
+
+            return std::pair{global,
+                             FoldStats{header.foldedConstants,
+                                       header.simplified}};
+        }
+        catch (std::runtime_error&)
+        {
+            MSG("Program cache file does not decode\n");
+            return std::nullopt;
+        }
+    }
+
+    // Keeps global for source; a file for it appears whole or not at all,
+    // so that runs reading it meanwhile never see part of one. Errors only
+    // cost the next run the parsing.
+    void store(const ScopeNode& global, std::string_view source, bool folded,
+               const FoldStats& stats) const
+    {
+        std::string rest(source);
+
+        rest += Writer().write(global);
+
+        Header header{};
+
+        std::memcpy(header.magic, signature, sizeof(signature));
+        header.version = version;
+        header.folded = folded;
+        header.build = build();
+        header.sourceSize = source.size();
+        header.payloadSize = rest.size() - source.size();
+        header.foldedConstants = stats.folded;
+        header.simplified = stats.simplified;
+        header.checksum = checksum(header, rest.data(), rest.size());
+
+        std::error_code ec;
+
+        std::filesystem::create_directories(dir_, ec);
+
+        const std::filesystem::path target =
+            path(contentHash(source.data(), source.size()), folded);
+        std::filesystem::path temp = target;
+
+        temp += ".tmp" + std::to_string(std::random_device()());
+
+        {
+            std::ofstream os(temp, std::ios::binary);
+
+            os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            os.write(rest.data(), static_cast<std::streamsize>(rest.size()));
+
+            if (!os)
+            {
+                os.close();
+                std::filesystem::remove(temp, ec);
+                return;
+            }
+        }
+
+        std::filesystem::rename(temp, target, ec);
+
+        if (ec)
+            std::filesystem::remove(temp, ec);
+    }
+};
+
+} // namespace detail
+
+} // namespace AST
+
+// Parses file_ through the cache: the tree stored for the same source text
+// when there is one, the parsed one, stored for next time, otherwise.
+inline int Driver::parseCached()
+{
+    AST::detail::Source source;
+
+    source.open(file_);
+
+    const std::string_view text(source.data(), source.size());
+    const bool folded = ast_.optLevel() >= 1;
+    const AST::detail::ProgramCache cache(cacheDir_);
+
+    if (auto loaded = cache.load(*this, text, folded))
+    {
+        ast_.globalScope = loaded->first;
+
+        if (folded)
+            ast_.setFolded(loaded->second);
+
+        fromCache_ = true;
+
+        return 0;
+    }
+
+    const int status = parseSource();
+
+    // The tree is stored as it runs, folded or not.
+    ast_.optimize();
+    cache.store(*ast_.globalScope, text, folded, ast_.foldStats());
+
+    return status;
+}
@@ -0,0 +1,315 @@
+#pragma once
+
+#include <cstddef>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "arena.hh"
+#include "arithmetic.hh"
+#include "effects.hh"
+#include "frame.hh"
+#include "log.hh"
+#include "loop_pass.hh"
+#include "node.hh"
+
+namespace AST
+{
+
+namespace detail
+{
+
+struct ReduceStats
+{
+    size_t inductions = 0; // derived induction variables introduced
+    size_t products = 0;   // multiplications replaced by one of them
+};
+
+// Strength reduction of induction variables. A basic induction variable is
+// a counter assigned exactly once in the loop, by `i = i + c` at the top
+// level of the body, and initialized to an integer right before the loop.
+// A product i * k with k constant or invariant becomes a derived variable
+// d: the pre-header sets d = i * k and every increment of i is followed by
+// d = d + c * k, so d equals i * k wherever i is read.
+//
+// Division and modulo by constants are reduced when the engines generate
+// code, see Divisor. pfor loops are left alone: derived variables carry
+// values from one iteration to the next.
+class Reducer final : public LoopPass
+{
+  private:
+    struct Induction
+    {
+        int slot;
+        int step;
+        size_t stmt; // position of the increment in the loop body
+    };
+
+    struct Derived
+    {
+        size_t induction;
+        ExprPtr factor;
+        Binding binding;
+        ExprPtr step;
+    };
+
+  private:
+    ReduceStats stats_;
+
+    std::vector<int> writes_;
+    std::vector<Induction> inductions_;
+    std::vector<Derived> derived_;
+    std::vector<StmtPtr> preheader_;
+
+  private:
+    static const VariableNode* local(ExprPtr expr)
+    {
+        auto var = dynamic_cast<const VariableNode*>(expr);
+
+        return var && var->getBinding().chain < 0 ? var : nullptr;
+    }
+
+    // The last assignment to slot before the loop stores an integer, and
+    // nothing between it and the loop can fail or change it.
+    static bool initialized(int slot, const std::vector<StmtPtr>& preceding)
+    {
+        for (size_t id = preceding.size(); id-- > 0;)
+        {
+            auto assign = dynamic_cast<const AssignNode*>(preceding[id]);
+
+            if (!assign || !std::holds_alternative<VariablePtr>(assign->getDest()))
+                return false;
+
+            const VariableNode* dest = local(std::get<VariablePtr>(assign->getDest()));
+            const Rhs& src = assign->getSrc();
+
+            if (dest && dest->getBinding().slot == slot)
+                return std::holds_alternative<ExprPtr>(src) &&
+                       producesInt(std::get<ExprPtr>(src));
+
+            if (!dest || !isPure(src))
+                return false;
+        }
+
+        return false;
+    }
+
+    // Matches `i = i + c` and `i = i - c` for a counter written only there.
+    bool increment(StmtPtr stmt, Induction& induction) const
+    {
+        auto assign = dynamic_cast<const AssignNode*>(stmt);
+
+        if (!assign || !std::holds_alternative<VariablePtr>(assign->getDest()) ||
+            !std::holds_alternative<ExprPtr>(assign->getSrc()))
+            return false;
+
+        const VariableNode* dest = local(std::get<VariablePtr>(assign->getDest()));
+        auto src = dynamic_cast<const BinaryOpNode*>(std::get<ExprPtr>(assign->getSrc()));
+
+        if (!dest || !src || writesTo(writes_, dest->getBinding().slot) != 1 ||
+            (src->getOp() != BinaryOp::ADD && src->getOp() != BinaryOp::SUB))
+            return false;
+
+        const VariableNode* counter = local(src->getLeft());
+        auto step = dynamic_cast<const ConstantNode*>(src->getRight());
+
+        if (!counter || !step ||
+            counter->getBinding().slot != dest->getBinding().slot)
+            return false;
+
+        const int value = step->getVal();
+
+        induction.slot = dest->getBinding().slot;
+        induction.step = src->getOp() == BinaryOp::ADD ? value : negate(value);
+
+        return true;
+    }
+
+    // A factor the pre-header can evaluate: a constant or an invariant
+    // variable that is certainly bound.
+    bool factor(ExprPtr expr) const
+    {
+        if (dynamic_cast<const ConstantNode*>(expr))
+            return true;
+
+        const VariableNode* var = local(expr);
+
+        return var && var->getBinding().sure && var->isInteger() &&
+               invariant(expr, writes_);
+    }
+
+    static bool sameFactor(ExprPtr left, ExprPtr right)
+    {
+        auto lc = dynamic_cast<const ConstantNode*>(left);
+        auto rc = dynamic_cast<const ConstantNode*>(right);
+
+        if (lc || rc)
+            return lc && rc && lc->getVal() == rc->getVal();
+
+        return local(left)->getBinding().slot == local(right)->getBinding().slot;
+    }
+
+    // Counters and factors are integers, so are their products and sums.
+    ExprPtr binary(ExprPtr left, BinaryOp op, ExprPtr right)
+    {
+        BinaryOpNode* node = arena_.create<BinaryOpNode>(left, op, right);
+
+        node->setInteger(true);
+
+        return node;
+    }
+
+    ExprPtr copy(ExprPtr factor)
+    {
+        if (auto constant = dynamic_cast<const ConstantNode*>(factor))
+            return arena_.create<ConstantNode>(constant->getVal());
+
+        return variable(local(factor)->getBinding());
+    }
+
+    const Derived& derive(size_t id, ExprPtr factor)
+    {
+        for (const Derived& derived : derived_)
+            if (derived.induction == id && sameFactor(derived.factor, factor))
+                return derived;
+
+        const Induction& induction = inductions_[id];
+        const Binding counter{induction.slot, -1, true};
+        const Binding binding = newSlot("iv");
+
+        preheader_.push_back(arena_.create<AssignNode>(
+            variable(binding),
+            binary(variable(counter), BinaryOp::MUL, copy(factor))));
+
+        ExprPtr step = nullptr;
+
+        if (auto constant = dynamic_cast<const ConstantNode*>(factor))
+            step = arena_.create<ConstantNode>(
+                multiply(induction.step, constant->getVal()));
+        else
+        {
+            const Binding stride = newSlot("iv");
+
+            preheader_.push_back(arena_.create<AssignNode>(
+                variable(stride),
+                binary(copy(factor), BinaryOp::MUL,
+                       arena_.create<ConstantNode>(induction.step))));
+
+            step = variable(stride);
+        }
+
+        ++stats_.inductions;
+
+        return derived_.emplace_back(Derived{id, factor, binding, step});
+    }
+
+    std::vector<StmtPtr> loop(const WhileNode& node,
+                              const std::vector<StmtPtr>& preceding) override
+    {
+        auto body = dynamic_cast<ScopeNode*>(node.getScope());
+
+        if (!body || dynamic_cast<const PforNode*>(&node))
+            return {};
+
+        writes_ = writes(node);
+        inductions_.clear();
+        derived_.clear();
+
+        for (size_t id = 0; id < body->nstms(); ++id)
+        {
+            Induction induction{};
+
+            if (increment(body->getChildren()[id], induction) &&
+                initialized(induction.slot, preceding))
+            {
+                induction.stmt = id;
+                inductions_.push_back(induction);
+            }
+        }
+
+        if (inductions_.empty())
+            return {};
+
+        rewriteLoop(node);
+
+        if (derived_.empty())
+            return {};
+
+        std::vector<StmtPtr> children;
+
+        for (size_t id = 0; id < body->nstms(); ++id)
+        {
+            children.push_back(body->getChildren()[id]);
+
+            for (const Derived& derived : derived_)
+            {
+                if (inductions_[derived.induction].stmt != id)
+                    continue;
+
+                children.push_back(arena_.create<AssignNode>(
+                    variable(derived.binding),
+                    binary(variable(derived.binding), BinaryOp::ADD,
+                           derived.step)));
+            }
+        }
+
+        body->setChildren(std::move(children));
+
+        return std::exchange(preheader_, {});
+    }
+
+    // i * k or k * i for a basic induction variable i.
+    ExprPtr replace(ExprPtr expr) override
+    {
+        auto binary = dynamic_cast<const BinaryOpNode*>(expr);
+
+        if (!binary || binary->getOp() != BinaryOp::MUL)
+            return nullptr;
+
+        const std::pair<ExprPtr, ExprPtr> orders[] = {
+            {binary->getLeft(), binary->getRight()},
+            {binary->getRight(), binary->getLeft()},
+        };
+
+        for (const auto& [counter, other] : orders)
+        {
+            const VariableNode* var = local(counter);
+
+            if (!var || !factor(other))
+                continue;
+
+            for (size_t id = 0; id < inductions_.size(); ++id)
+            {
+                if (inductions_[id].slot != var->getBinding().slot)
+                    continue;
+
+                ++stats_.products;
+
+                return variable(derive(id, other).binding);
+            }
+        }
+
+        return nullptr;
+    }
+
+  public:
+    Reducer(Arena& arena, FrameLayout& layout)
+        : LoopPass(arena, layout)
+    {}
+
+    ReduceStats run(const ScopeNode& global)
+    {
+        MSG("Reducing induction variables\n");
+
+        global.accept(*this);
+
+        LOG("Derived {} induction variables for {} products\n",
+            stats_.inductions, stats_.products);
+
+        return stats_;
+    }
+};
+
+} // namespace detail
+
+} // namespace AST
@@ -0,0 +1,387 @@
+#pragma once
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "frame.hh"
+#include "log.hh"
+#include "node.hh"
+#include "visitor.hh"
+
+namespace AST
+{
+
+namespace detail
+{
+
+// Maps every variable occurrence to frame slots before evaluation.
+//
+// A scope binds a name when it contains an assignment to that name executed
+// while the name is not certainly bound by an enclosing scope. Which names
+// are bound at a given point is tracked by a flow analysis over the tree:
+// `maybe` holds names bound on some path, `sure` names bound on all paths.
+// Reading a name that is bound on no path is reported as an error.
+//
+// A streamed program is resolved a statement of the global scope at a time,
+// as the statements before it run: the flow state and the slots of the
+// global scope carry over from one statement to the next.
+class Resolver final : public Visitor
+{
+  private:
+    struct State
+    {
+        std::set<std::string_view> maybe;
+        std::set<std::string_view> sure;
+
+        bool operator==(const State&) const = default;
+
+        void join(const State& other)
+        {
+            maybe.insert(other.maybe.begin(), other.maybe.end());
+
+            std::erase_if(sure, [&](std::string_view name)
+                          { return !other.sure.contains(name); });
+        }
+    };
+
+    struct ScopeInfo
+    {
+        const ScopeNode* node = nullptr;
+        ScopeInfo* parent = nullptr;
+        std::vector<std::string_view> bound;
+        std::vector<int> slots; // of the names in bound given one so far
+    };
+
+    struct Reference
+    {
+        const VariableNode* node;
+        ScopeInfo* scope;
+        bool sure;
+    };
+
+  private:
+    State state_;
+    ScopeInfo* scope_ = nullptr;
+
+    // Only the last walk over a loop body records references and errors,
+    // earlier walks just iterate the flow state to a fixed point.
+    bool final_ = true;
+
+    std::unordered_map<const ScopeNode*, ScopeInfo> scopes_;
+    std::vector<ScopeInfo*> scopeOrder_;
+    size_t placed_ = 0; // scopes of scopeOrder_ given slots
+    std::vector<Reference> refs_;
+    std::vector<std::string_view> errors_;
+    std::map<std::vector<int>, int> chainIds_;
+
+  private:
+    void use(const VariableNode& var)
+    {
+        if (!final_)
+            return;
+
+        std::string_view name = var.getName();
+
+        if (!state_.maybe.contains(name))
+        {
+            if (std::find(errors_.begin(), errors_.end(), name) ==
+                errors_.end())
+                errors_.push_back(name);
+
+            return;
+        }
+
+        refs_.push_back({&var, scope_, state_.sure.contains(name)});
+    }
+
+    void define(const VariableNode& var)
+    {
+        std::string_view name = var.getName();
+
+        if (final_)
+        {
+            if (!state_.sure.contains(name))
+            {
+                auto& bound = scope_->bound;
+
+                if (std::find(bound.begin(), bound.end(), name) == bound.end())
+                    bound.push_back(name);
+            }
+
+            refs_.push_back({&var, scope_, true});
+        }
+
+        state_.maybe.insert(name);
+        state_.sure.insert(name);
+    }
+
+    ScopeInfo& scopeInfo(const ScopeNode& node)
+    {
+        auto [it, inserted] = scopes_.try_emplace(&node);
+
+        if (inserted)
+        {
+            it->second.node = &node;
+            it->second.parent = scope_;
+            scopeOrder_.push_back(&it->second);
+        }
+
+        return it->second;
+    }
+
+    void throwErrors() const
+    {
+        if (errors_.empty())
+            return;
+
+        std::string msg;
+
+        for (std::string_view name : errors_)
+            msg += "Undeclared variable: " + std::string(name) + "\n";
+
+        throw std::runtime_error(msg);
+    }
+
+    static void assign(ScopeInfo& info, FrameLayout& layout)
+    {
+        for (size_t id = info.slots.size(); id < info.bound.size(); ++id)
+        {
+            info.slots.push_back(layout.nslots++);
+            layout.names.push_back(info.bound[id]);
+        }
+    }
+
+    // Gives slots to the names bound since the last call, scope by scope in
+    // the order the scopes were met, and bindings to the references met
+    // since. Of the scopes placed before, only the global one may have
+    // bound more names, as statements are streamed to it.
+    void place(FrameLayout& layout)
+    {
+        if (placed_ > 0)
+            assign(*scopeOrder_.front(), layout);
+
+        for (; placed_ < scopeOrder_.size(); ++placed_)
+        {
+            ScopeInfo* info = scopeOrder_[placed_];
+            const int begin = layout.nslots;
+
+            assign(*info, layout);
+            info->node->setSlots(begin, layout.nslots);
+        }
+
+        for (const auto& [node, scope, sure] : refs_)
+        {
+            std::vector<int> candidates;
+
+            for (ScopeInfo* info = scope; info; info = info->parent)
+            {
+                const auto& bound = info->bound;
+                auto it = std::find(bound.begin(), bound.end(), node->getName());
+
+                if (it != bound.end())
+                    candidates.push_back(info->slots[static_cast<size_t>(
+                        it - bound.begin())]);
+            }
+
+            if (candidates.empty())
+                throw std::logic_error("Reference without binding scope\n");
+
+            Binding binding{candidates.front(), -1, sure};
+
+            if (candidates.size() > 1)
+            {
+                auto [it, inserted] = chainIds_.try_emplace(
+                    candidates, static_cast<int>(layout.chains.size()));
+
+                if (inserted)
+                    layout.chains.push_back(candidates);
+
+                binding.chain = it->second;
+            }
+
+            node->setBinding(binding);
+        }
+
+        refs_.clear();
+    }
+
+  public:
+    FrameLayout resolve(const ScopeNode& global)
+    {
+        MSG("Resolving variables\n");
+
+        global.accept(*this);
+        throwErrors();
+
+        FrameLayout layout;
+
+        place(layout);
+
+        return layout;
+    }
+
+    // Resolves stmt, the next statement of the streamed global scope,
+    // adding the slots it binds to layout.
+    void resolve(const ScopeNode& global, StmtPtr stmt, FrameLayout& layout)
+    {
+        scope_ = &scopeInfo(global);
+        stmt->accept(*this);
+        scope_ = nullptr;
+
+        throwErrors();
+        place(layout);
+    }
+
+    void visit([[maybe_unused]] const ConstantNode& node) override {}
+
+    void visit(const VariableNode& node) override { use(node); }
+
+    void visit(const BinaryOpNode& node) override
+    {
+        node.accept_left(*this);
+        node.accept_right(*this);
+    }
+
+    void visit(const ScopeNode& node) override
+    {
+        if (node.empty())
+            return;
+
+        ScopeInfo* parent = scope_;
+        const State saved = state_;
+
+        scope_ = &scopeInfo(node);
+
+        for (const auto& child : node.getChildren())
+            child->accept(*this);
+
+        // Names bound by this scope die with it, everything else it could
+        // assign was already bound outside.
+        scope_ = parent;
+        state_ = saved;
+    }
+
+    void visit(const UnaryOpNode& node) override
+    {
+        node.acceptOperand(*this);
+    }
+
+    void visit(const AssignNode& node) override
+    {
+        if (auto var = std::get_if<VariablePtr>(&node.getDest()))
+        {
+            node.acceptSrc(*this);
+            define(**var);
+            return;
+        }
+
+        const auto dest = std::get<ArrayElemPtr>(node.getDest());
+
+        for (auto elem = dest;; elem = elem->getArrayElem())
+        {
+            elem->acceptIndex(*this);
+
+            if (elem->holdsVariable())
+                break;
+        }
+
+        node.acceptSrc(*this);
+        use(*dest->getBase());
+    }
+
+    void visit(const ArrayElemNode& node) override
+    {
+        node.acceptIndex(*this);
+
+        if (node.holdsVariable())
+            use(*node.getVariable());
+        else
+            node.acceptName(*this);
+    }
+
+    void visit(const WhileNode& node) override
+    {
+        const bool wasFinal = final_;
+        State head = state_;
+
+        final_ = false;
+
+        for (;;)
+        {
+            state_ = head;
+
+            node.acceptCond(*this);
+            node.acceptScope(*this);
+
+            State next = head;
+            next.join(state_);
+
+            if (next == head)
+                break;
+
+            head = std::move(next);
+        }
+
+        final_ = wasFinal;
+        state_ = head;
+
+        node.acceptCond(*this);
+        const State exit = state_;
+
+        node.acceptScope(*this);
+
+        state_ = exit;
+    }
+
+    void visit(const PforNode& node) override
+    {
+        visit(static_cast<const WhileNode&>(node));
+    }
+
+    void visit(const IfElseNode& node) override
+    {
+        if (!node.hasCond())
+            return node.acceptAction(*this);
+
+        node.acceptCond(*this);
+        const State cond = state_;
+
+        node.acceptAction(*this);
+        State action = std::move(state_);
+
+        state_ = cond;
+
+        if (node.hasAltAction())
+            node.acceptAltAction(*this);
+
+        state_.join(action);
+    }
+
+    void visit(const PrintNode& node) override { node.acceptExpr(*this); }
+
+    void visit([[maybe_unused]] const InNode& node) override {}
+
+    void visit(const RepeatNode& node) override
+    {
+        node.acceptSize(*this);
+
+        if (node.hasElem())
+            node.acceptElem(*this);
+    }
+
+    void visit(const ArrayInitNode& node) override
+    {
+        for (size_t id = node.arraySize(); id-- > 0;)
+            node.acceptElem(id, *this);
+    }
+};
+
+} // namespace detail
+
+} // namespace AST
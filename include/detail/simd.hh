@@ -0,0 +1,469 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+
+#include "arithmetic.hh"
+#include "node.hh"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define PARACL_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+namespace AST
+{
+
+namespace detail
+{
+
+// Instruction sets the elementwise kernels come in, weakest first.
+enum class Isa : uint8_t
+{
+    SCALAR,
+    SSE4, // SSE4.1, for 32-bit multiplication
+    AVX2,
+};
+
+// Which operand of a kernel is a single integer standing for every element.
+enum class Broadcast : uint8_t
+{
+    NONE,
+    LEFT,
+    RIGHT,
+};
+
+// out[k] = left[k] op right[k] for k < count. A broadcast operand points to
+// its one integer instead.
+using Kernel = void (*)(const int* left, const int* right, int* out,
+                        size_t count);
+
+// Reductions of the loop idioms detail::Idioms recognizes.
+enum class Reduce : uint8_t
+{
+    SUM,
+    MIN,
+    MAX,
+};
+
+// init reduced with data[k] for k < count; sums wrap.
+using ReduceKernel = int (*)(const int* data, size_t count, int init);
+
+// out[k] = carry + in[0] + ... + in[k] for k < count, wrapping; returns the
+// last of them, or carry. in may be out.
+using ScanKernel = int (*)(const int* in, int* out, size_t count, int carry);
+
+inline const char* isaName(Isa isa)
+{
+    switch (isa)
+    {
+        case Isa::AVX2: return "avx2";
+        case Isa::SSE4: return "sse4.1";
+        case Isa::SCALAR:
+        default:        return "scalar";
+    }
+}
+
+// The best instruction set this processor runs, detected once.
+inline Isa supportedIsa()
+{
+    static const Isa isa = []
+    {
+#ifdef PARACL_X86_KERNELS
+        __builtin_cpu_init();
+
+        if (__builtin_cpu_supports("avx2"))
+            return Isa::AVX2;
+
+        if (__builtin_cpu_supports("sse4.1"))
+            return Isa::SSE4;
+#endif
+        return Isa::SCALAR;
+    }();
+
+    return isa;
+}
+
+namespace kernels
+{
+
+// One element, with the arithmetic of arithmetic.hh.
+template <BinaryOp op>
+inline int apply(int left, int right)
+{
+    if constexpr (op == BinaryOp::ADD)
+        return add(left, right);
+    else if constexpr (op == BinaryOp::SUB)
+        return subtract(left, right);
+    else if constexpr (op == BinaryOp::MUL)
+        return multiply(left, right);
+    else if constexpr (op == BinaryOp::DIV)
+        return divide(left, right);
+    else if constexpr (op == BinaryOp::MOD)
+        return modulo(left, right);
+    else if constexpr (op == BinaryOp::GR)
+        return left > right;
+    else if constexpr (op == BinaryOp::LS)
+        return left < right;
+    else if constexpr (op == BinaryOp::EQ)
+        return left == right;
+    else if constexpr (op == BinaryOp::GR_EQ)
+        return left >= right;
+    else if constexpr (op == BinaryOp::LS_EQ)
+        return left <= right;
+    else if constexpr (op == BinaryOp::NOT_EQ)
+        return left != right;
+    else if constexpr (op == BinaryOp::AND)
+        return left && right;
+    else
+        return left || right;
+}
+
+template <BinaryOp op, Broadcast mode>
+void scalar(const int* left, const int* right, int* out, size_t count)
+{
+    for (size_t id = 0; id < count; ++id)
+        out[id] = apply<op>(mode == Broadcast::LEFT ? *left : left[id],
+                            mode == Broadcast::RIGHT ? *right : right[id]);
+}
+
+template <Reduce reduce>
+inline int combine(int left, int right)
+{
+    if constexpr (reduce == Reduce::SUM)
+        return add(left, right);
+    else if constexpr (reduce == Reduce::MIN)
+        return std::min(left, right);
+    else
+        return std::max(left, right);
+}
+
+template <Reduce reduce>
+int reduceScalar(const int* data, size_t count, int init)
+{
+    for (size_t id = 0; id < count; ++id)
+        init = combine<reduce>(init, data[id]);
+
+    return init;
+}
+
+inline int scanScalar(const int* in, int* out, size_t count, int carry)
+{
+    for (size_t id = 0; id < count; ++id)
+        out[id] = carry = combine<Reduce::SUM>(carry, in[id]);
+
+    return carry;
+}
+
+#ifdef PARACL_X86_KERNELS
+
+// Comparisons yield all ones per lane; the language wants 1.
+template <BinaryOp op>
+__attribute__((target("sse4.1"))) inline __m128i sse4Op(__m128i l, __m128i r)
+{
+    const __m128i one = _mm_set1_epi32(1);
+    const __m128i zero = _mm_setzero_si128();
+
+    if constexpr (op == BinaryOp::ADD)
+        return _mm_add_epi32(l, r);
+    else if constexpr (op == BinaryOp::SUB)
+        return _mm_sub_epi32(l, r);
+    else if constexpr (op == BinaryOp::MUL)
+        return _mm_mullo_epi32(l, r);
+    else if constexpr (op == BinaryOp::GR)
+        return _mm_and_si128(_mm_cmpgt_epi32(l, r), one);
+    else if constexpr (op == BinaryOp::LS)
+        return _mm_and_si128(_mm_cmpgt_epi32(r, l), one);
+    else if constexpr (op == BinaryOp::EQ)
+        return _mm_and_si128(_mm_cmpeq_epi32(l, r), one);
+    else if constexpr (op == BinaryOp::GR_EQ)
+        return _mm_andnot_si128(_mm_cmpgt_epi32(r, l), one);
+    else if constexpr (op == BinaryOp::LS_EQ)
+        return _mm_andnot_si128(_mm_cmpgt_epi32(l, r), one);
+    else if constexpr (op == BinaryOp::NOT_EQ)
+        return _mm_andnot_si128(_mm_cmpeq_epi32(l, r), one);
+    else if constexpr (op == BinaryOp::AND)
+        return _mm_andnot_si128(_mm_or_si128(_mm_cmpeq_epi32(l, zero),
+                                             _mm_cmpeq_epi32(r, zero)),
+                                one);
+    else
+        return _mm_andnot_si128(_mm_and_si128(_mm_cmpeq_epi32(l, zero),
+                                              _mm_cmpeq_epi32(r, zero)),
+                                one);
+}
+
+template <BinaryOp op>
+__attribute__((target("avx2"))) inline __m256i avx2Op(__m256i l, __m256i r)
+{
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i zero = _mm256_setzero_si256();
+
+    if constexpr (op == BinaryOp::ADD)
+        return _mm256_add_epi32(l, r);
+    else if constexpr (op == BinaryOp::SUB)
+        return _mm256_sub_epi32(l, r);
+    else if constexpr (op == BinaryOp::MUL)
+        return _mm256_mullo_epi32(l, r);
+    else if constexpr (op == BinaryOp::GR)
+        return _mm256_and_si256(_mm256_cmpgt_epi32(l, r), one);
+    else if constexpr (op == BinaryOp::LS)
+        return _mm256_and_si256(_mm256_cmpgt_epi32(r, l), one);
+    else if constexpr (op == BinaryOp::EQ)
+        return _mm256_and_si256(_mm256_cmpeq_epi32(l, r), one);
+    else if constexpr (op == BinaryOp::GR_EQ)
+        return _mm256_andnot_si256(_mm256_cmpgt_epi32(r, l), one);
+    else if constexpr (op == BinaryOp::LS_EQ)
+        return _mm256_andnot_si256(_mm256_cmpgt_epi32(l, r), one);
+    else if constexpr (op == BinaryOp::NOT_EQ)
+        return _mm256_andnot_si256(_mm256_cmpeq_epi32(l, r), one);
+    else if constexpr (op == BinaryOp::AND)
+        return _mm256_andnot_si256(_mm256_or_si256(_mm256_cmpeq_epi32(l, zero),
+                                                   _mm256_cmpeq_epi32(r, zero)),
+                                   one);
+    else
+        return _mm256_andnot_si256(_mm256_and_si256(_mm256_cmpeq_epi32(l, zero),
+                                                    _mm256_cmpeq_epi32(r, zero)),
+                                   one);
+}
+
+template <BinaryOp op, Broadcast mode>
+__attribute__((target("sse4.1"))) void sse4(const int* left, const int* right,
+                                            int* out, size_t count)
+{
+    using Vector = __m128i;
+    size_t id = 0;
+
+    for (; id + 4 <= count; id += 4)
+    {
+        const Vector l =
+            mode == Broadcast::LEFT
+                ? _mm_set1_epi32(*left)
+                : _mm_loadu_si128(reinterpret_cast<const Vector*>(left + id));
+        const Vector r =
+            mode == Broadcast::RIGHT
+                ? _mm_set1_epi32(*right)
+                : _mm_loadu_si128(reinterpret_cast<const Vector*>(right + id));
+
+        _mm_storeu_si128(reinterpret_cast<Vector*>(out + id), sse4Op<op>(l, r));
+    }
+
+    scalar<op, mode>(mode == Broadcast::LEFT ? left : left + id,
+                     mode == Broadcast::RIGHT ? right : right + id, out + id,
+                     count - id);
+}
+
+template <BinaryOp op, Broadcast mode>
+__attribute__((target("avx2"))) void avx2(const int* left, const int* right,
+                                          int* out, size_t count)
+{
+    using Vector = __m256i;
+    size_t id = 0;
+
+    for (; id + 8 <= count; id += 8)
+    {
+        const Vector l =
+            mode == Broadcast::LEFT
+                ? _mm256_set1_epi32(*left)
+                : _mm256_loadu_si256(reinterpret_cast<const Vector*>(left + id));
+        const Vector r =
+            mode == Broadcast::RIGHT
+                ? _mm256_set1_epi32(*right)
+                : _mm256_loadu_si256(reinterpret_cast<const Vector*>(right + id));
+
+        _mm256_storeu_si256(reinterpret_cast<Vector*>(out + id), avx2Op<op>(l, r));
+    }
+
+    scalar<op, mode>(mode == Broadcast::LEFT ? left : left + id,
+                     mode == Broadcast::RIGHT ? right : right + id, out + id,
+                     count - id);
+}
+
+template <Reduce reduce>
+__attribute__((target("sse4.1"))) inline __m128i sse4Reduce(__m128i l, __m128i r)
+{
+    if constexpr (reduce == Reduce::SUM)
+        return _mm_add_epi32(l, r);
+    else if constexpr (reduce == Reduce::MIN)
+        return _mm_min_epi32(l, r);
+    else
+        return _mm_max_epi32(l, r);
+}
+
+template <Reduce reduce>
+__attribute__((target("sse4.1"))) int reduceSse4(const int* data, size_t count,
+                                                 int init)
+{
+    if (count < 4)
+        return reduceScalar<reduce>(data, count, init);
+
+    __m128i acc = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+    size_t id = 4;
+
+    for (; id + 4 <= count; id += 4)
+        acc = sse4Reduce<reduce>(
+            acc, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + id)));
+
+    acc = sse4Reduce<reduce>(acc, _mm_shuffle_epi32(acc, 0x4E));
+    acc = sse4Reduce<reduce>(acc, _mm_shuffle_epi32(acc, 0xB1));
+
+    return reduceScalar<reduce>(data + id, count - id,
+                                combine<reduce>(init, _mm_cvtsi128_si32(acc)));
+}
+
+template <Reduce reduce>
+__attribute__((target("avx2"))) int reduceAvx2(const int* data, size_t count,
+                                               int init)
+{
+    if (count < 8)
+        return reduceScalar<reduce>(data, count, init);
+
+    __m256i acc = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+    size_t id = 8;
+
+    for (; id + 8 <= count; id += 8)
+    {
+        const __m256i next =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + id));
+
+        if constexpr (reduce == Reduce::SUM)
+            acc = _mm256_add_epi32(acc, next);
+        else if constexpr (reduce == Reduce::MIN)
+            acc = _mm256_min_epi32(acc, next);
+        else
+            acc = _mm256_max_epi32(acc, next);
+    }
+
+    __m128i half = sse4Reduce<reduce>(_mm256_castsi256_si128(acc),
+                                      _mm256_extracti128_si256(acc, 1));
+
+    half = sse4Reduce<reduce>(half, _mm_shuffle_epi32(half, 0x4E));
+    half = sse4Reduce<reduce>(half, _mm_shuffle_epi32(half, 0xB1));
+
+    return reduceScalar<reduce>(data + id, count - id,
+                                combine<reduce>(init, _mm_cvtsi128_si32(half)));
+}
+
+// Prefix sums of four lanes at a time in two shifted additions.
+__attribute__((target("sse4.1"))) inline int scanSse4(const int* in, int* out,
+                                                      size_t count, int carry)
+{
+    __m128i last = _mm_set1_epi32(carry);
+    size_t id = 0;
+
+    for (; id + 4 <= count; id += 4)
+    {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + id));
+
+        x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+        x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+        x = _mm_add_epi32(x, last);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + id), x);
+        last = _mm_shuffle_epi32(x, 0xFF);
+    }
+
+    return scanScalar(in + id, out + id, count - id, _mm_cvtsi128_si32(last));
+}
+
+#endif
+
+// There is no vector integer division, so / and % stay scalar.
+template <BinaryOp op, Broadcast mode>
+Kernel pick([[maybe_unused]] Isa isa)
+{
+#ifdef PARACL_X86_KERNELS
+    if constexpr (op != BinaryOp::DIV && op != BinaryOp::MOD)
+    {
+        if (isa == Isa::AVX2)
+            return avx2<op, mode>;
+
+        if (isa == Isa::SSE4)
+            return sse4<op, mode>;
+    }
+#endif
+
+    return scalar<op, mode>;
+}
+
+template <BinaryOp op>
+Kernel pick(Broadcast mode, Isa isa)
+{
+    switch (mode)
+    {
+        case Broadcast::LEFT:  return pick<op, Broadcast::LEFT>(isa);
+        case Broadcast::RIGHT: return pick<op, Broadcast::RIGHT>(isa);
+        case Broadcast::NONE:
+        default:               return pick<op, Broadcast::NONE>(isa);
+    }
+}
+
+template <Reduce reduce>
+ReduceKernel pickReduce([[maybe_unused]] Isa isa)
+{
+#ifdef PARACL_X86_KERNELS
+    if (isa == Isa::AVX2)
+        return reduceAvx2<reduce>;
+
+    if (isa == Isa::SSE4)
+        return reduceSse4<reduce>;
+#endif
+
+    return reduceScalar<reduce>;
+}
+
+} // namespace kernels
+
+// Kernel for op in the given instruction set, which the caller makes sure
+// the processor supports.
+inline Kernel kernel(BinaryOp op, Broadcast mode, Isa isa = supportedIsa())
+{
+    using kernels::pick;
+
+    switch (op)
+    {
+        case BinaryOp::ADD:    return pick<BinaryOp::ADD>(mode, isa);
+        case BinaryOp::SUB:    return pick<BinaryOp::SUB>(mode, isa);
+        case BinaryOp::MUL:    return pick<BinaryOp::MUL>(mode, isa);
+        case BinaryOp::DIV:    return pick<BinaryOp::DIV>(mode, isa);
+        case BinaryOp::MOD:    return pick<BinaryOp::MOD>(mode, isa);
+        case BinaryOp::GR:     return pick<BinaryOp::GR>(mode, isa);
+        case BinaryOp::LS:     return pick<BinaryOp::LS>(mode, isa);
+        case BinaryOp::EQ:     return pick<BinaryOp::EQ>(mode, isa);
+        case BinaryOp::GR_EQ:  return pick<BinaryOp::GR_EQ>(mode, isa);
+        case BinaryOp::LS_EQ:  return pick<BinaryOp::LS_EQ>(mode, isa);
+        case BinaryOp::NOT_EQ: return pick<BinaryOp::NOT_EQ>(mode, isa);
+        case BinaryOp::AND:    return pick<BinaryOp::AND>(mode, isa);
+        case BinaryOp::OR:     return pick<BinaryOp::OR>(mode, isa);
+        default:
+            throw std::runtime_error("Unknown binary operation");
+    }
+}
+
+inline ReduceKernel reduceKernel(Reduce reduce, Isa isa = supportedIsa())
+{
+    switch (reduce)
+    {
+        case Reduce::MIN: return kernels::pickReduce<Reduce::MIN>(isa);
+        case Reduce::MAX: return kernels::pickReduce<Reduce::MAX>(isa);
+        case Reduce::SUM:
+        default:          return kernels::pickReduce<Reduce::SUM>(isa);
+    }
+}
+
+// Lanes do not cross the halves of an AVX2 register cheaply, so a scan
+// stays at SSE4.1 width.
+inline ScanKernel scanKernel([[maybe_unused]] Isa isa = supportedIsa())
+{
+#ifdef PARACL_X86_KERNELS
+    if (isa != Isa::SCALAR)
+        return kernels::scanSse4;
+#endif
+
+    return kernels::scanScalar;
+}
+
+} // namespace detail
+
+} // namespace AST
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "arena.hh"
+#include "frame.hh"
+#include "node.hh"
+
+namespace AST
+{
+
+namespace detail
+{
+
+// Nodes are created mutable in the arena; passes only get const views.
+template <typename T>
+T& edit(const T& node)
+{
+    return const_cast<T&>(node);
+}
+
+// Slots a binding may refer to: its own, or each slot of its chain.
+inline std::vector<int> slotsOf(const FrameLayout& layout,
+                                const Binding& binding)
+{
+    if (binding.chain < 0)
+        return {binding.slot};
+
+    return layout.chain(binding.chain);
+}
+
+// Fresh frame slot that belongs to no scope, named prefix.N.
+inline Binding newSlot(Arena& arena, FrameLayout& layout, std::string_view prefix)
+{
+    const int slot = layout.nslots++;
+
+    layout.names.push_back(
+        arena.copy(std::string(prefix) + "." + std::to_string(slot)));
+
+    return Binding{slot, -1, true};
+}
+
+// Resolved read (or store target) of a slot.
+inline VariablePtr slotVariable(Arena& arena, const FrameLayout& layout,
+                                const Binding& binding)
+{
+    auto var = arena.create<VariableNode>(layout.name(binding.slot));
+
+    var->setBinding(binding);
+
+    return var;
+}
+
+} // namespace detail
+
+} // namespace AST
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define PARACL_POSIX_SOURCE 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace AST
+{
+
+namespace detail
+{
+
+// A source file in memory, followed by the two NUL bytes flex wants after a
+// buffer it scans in place. Regular files are mapped copy-on-write, as flex
+// writes into the buffer while it scans; anything else is read.
+class Source final
+{
+  private:
+    char* data_ = nullptr;
+    size_t size_ = 0;
+    size_t mapped_ = 0;
+    std::vector<char> buffer_;
+
+  private:
+#ifdef PARACL_POSIX_SOURCE
+    bool map(int fd)
+    {
+        struct stat info;
+
+        if (::fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) ||
+            info.st_size == 0)
+            return false;
+
+        const size_t size = static_cast<size_t>(info.st_size);
+        const size_t length = size + 2;
+
+        // The file goes over zero pages, which hold the NULs when it ends on
+        // a page boundary; past its end in the last page it reads as zeros.
+        void* base = ::mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (base == MAP_FAILED)
+            return false;
+
+        if (::mmap(base, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+                   fd, 0) == MAP_FAILED)
+        {
+            ::munmap(base, length);
+            return false;
+        }
+
+        data_ = static_cast<char*>(base);
+        size_ = size;
+        mapped_ = length;
+
+        return true;
+    }
+
+    void read(int fd)
+    {
+        constexpr size_t block = 64 * 1024;
+
+        size_t size = 0;
+
+        for (;;)
+        {
+            buffer_.resize(size + block);
+
+            const ssize_t got = ::read(fd, buffer_.data() + size, block);
+
+            if (got < 0 && errno == EINTR)
+                continue;
+
+            if (got <= 0)
+                break;
+
+            size += static_cast<size_t>(got);
+        }
+
+        buffer_.resize(size);
+    }
+#endif
+
+  public:
+    Source() = default;
+
+    Source(const Source&) = delete;
+    Source& operator=(const Source&) = delete;
+
+    ~Source() { close(); }
+
+    void open(const std::string& path)
+    {
+        close();
+
+#ifdef PARACL_POSIX_SOURCE
+        const int fd = ::open(path.c_str(), O_RDONLY);
+
+        if (fd < 0)
+            throw std::runtime_error("Can't open input file_\n");
+
+        const bool mapped = map(fd);
+
+        if (!mapped)
+            read(fd);
+
+        ::close(fd);
+
+        if (mapped)
+            return;
+#else
+        std::ifstream is(path, std::ios::binary);
+
+        if (!is)
+            throw std::runtime_error("Can't open input file_\n");
+
+        buffer_.assign(std::istreambuf_iterator<char>(is),
+                       std::istreambuf_iterator<char>());
+#endif
+
+        size_ = buffer_.size();
+        buffer_.resize(size_ + 2, '\0');
+        data_ = buffer_.data();
+    }
+
+    void close()
+    {
+#ifdef PARACL_POSIX_SOURCE
+        if (mapped_)
+            ::munmap(data_, mapped_);
+#endif
+
+        data_ = nullptr;
+        size_ = 0;
+        mapped_ = 0;
+        buffer_.clear();
+    }
+
+    // The text, then two NULs.
+    char* data() { return data_; }
+
+    // Length of the text alone.
+    size_t size() const { return size_; }
+};
+
+} // namespace detail
+
+} // namespace AST
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace AST
+{
+
+namespace detail
+{
+
+// Fixed set of threads running loops with work stealing. Every worker keeps
+// a deque of index ranges: it takes the newest range of its own, splitting
+// off upper halves onto the deque until the range fits a grain, and when
+// the deque runs dry steals the oldest, largest range of another worker.
+class ThreadPool final
+{
+  public:
+    // Runs the iterations [begin, end) on the given worker.
+    using Body = std::function<void(unsigned worker, long long begin,
+                                    long long end)>;
+
+  private:
+    struct Range
+    {
+        long long begin = 0;
+        long long end = 0;
+    };
+
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Range> ranges;
+    };
+
+    std::vector<Queue> queues_;
+    std::vector<std::thread> threads_;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    unsigned generation_ = 0;
+    unsigned busy_ = 0; // helper threads still in the current loop
+    bool stop_ = false;
+
+    const Body* body_ = nullptr;
+    long long grain_ = 1;
+    std::atomic<long long> left_{0}; // iterations not run yet
+
+  private:
+    void push(unsigned worker, Range range)
+    {
+        std::lock_guard lock(queues_[worker].mutex);
+
+        queues_[worker].ranges.push_back(range);
+    }
+
+    bool pop(unsigned worker, Range& range)
+    {
+        std::lock_guard lock(queues_[worker].mutex);
+        std::deque<Range>& ranges = queues_[worker].ranges;
+
+        if (ranges.empty())
+            return false;
+
+        range = ranges.back();
+        ranges.pop_back();
+
+        return true;
+    }
+
+    bool steal(unsigned worker, Range& range)
+    {
+        const size_t count = queues_.size();
+
+        for (size_t step = 1; step < count; ++step)
+        {
+            Queue& victim = queues_[(worker + step) % count];
+            std::lock_guard lock(victim.mutex);
+
+            if (victim.ranges.empty())
+                continue;
+
+            range = victim.ranges.front();
+            victim.ranges.pop_front();
+
+            return true;
+        }
+
+        return false;
+    }
+
+    void work(unsigned worker)
+    {
+        Range range;
+
+        while (left_.load(std::memory_order_acquire) > 0)
+        {
+            if (!pop(worker, range) && !steal(worker, range))
+            {
+                std::this_thread::yield();
+                continue;
+            }
+
+            while (range.end - range.begin > grain_)
+            {
+                const long long middle =
+                    range.begin + (range.end - range.begin) / 2;
+
+                push(worker, {middle, range.end});
+                range.end = middle;
+            }
+
+            (*body_)(worker, range.begin, range.end);
+
+            left_.fetch_sub(range.end - range.begin, std::memory_order_acq_rel);
+        }
+    }
+
+    void loop(unsigned worker)
+    {
+        unsigned seen = 0;
+
+        for (;;)
+        {
+            {
+                std::unique_lock lock(mutex_);
+
+                wake_.wait(lock, [&] { return stop_ || generation_ != seen; });
+
+                if (stop_)
+                    return;
+
+                seen = generation_;
+            }
+
+            work(worker);
+
+            std::lock_guard lock(mutex_);
+
+            if (--busy_ == 0)
+                done_.notify_one();
+        }
+    }
+
+  public:
+    // The thread calling run() is worker 0, so threads - 1 are started.
+    explicit ThreadPool(unsigned threads)
+        : queues_(std::max(threads, 1u))
+    {
+        for (unsigned worker = 1; worker < queues_.size(); ++worker)
+            threads_.emplace_back([this, worker] { loop(worker); });
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard lock(mutex_);
+
+            stop_ = true;
+        }
+
+        wake_.notify_all();
+
+        for (std::thread& thread : threads_)
+            thread.join();
+    }
+
+    unsigned size() const { return static_cast<unsigned>(queues_.size()); }
+
+    // Calls body on disjoint ranges of at most grain iterations that cover
+    // [begin, end); returns once all of them are done. body must not throw.
+    void run(long long begin, long long end, long long grain, const Body& body)
+    {
+        if (begin >= end)
+            return;
+
+        body_ = &body;
+        grain_ = std::max(grain, 1LL);
+        left_.store(end - begin, std::memory_order_release);
+
+        // Every worker starts on a share of its own.
+        const long long count = end - begin;
+        const long long workers = size();
+
+        for (long long worker = 0; worker < workers; ++worker)
+        {
+            const long long first = begin + count * worker / workers;
+            const long long last = begin + count * (worker + 1) / workers;
+
+            if (first < last)
+                push(static_cast<unsigned>(worker), {first, last});
+        }
+
+        {
+            std::lock_guard lock(mutex_);
+
+            busy_ = static_cast<unsigned>(threads_.size());
+            ++generation_;
+        }
+
+        wake_.notify_all();
+
+        work(0);
+
+        std::unique_lock lock(mutex_);
+
+        done_.wait(lock, [this] { return busy_ == 0; });
+
+        body_ = nullptr;
+    }
+};
+
+} // namespace detail
+
+} // namespace AST
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <chrono>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace AST
+{
+
+namespace detail
+{
+
+struct PassTiming
+{
+    std::string_view name;
+    std::chrono::steady_clock::duration time{};
+};
+
+// Runs pass and records how long it took.
+template <typename Pass>
+auto timed(std::vector<PassTiming>& timings, std::string_view name, Pass&& pass)
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    if constexpr (std::is_void_v<decltype(pass())>)
+    {
+        pass();
+        timings.push_back({name, std::chrono::steady_clock::now() - start});
+    }
+    else
+    {
+        auto result = pass();
+
+        timings.push_back({name, std::chrono::steady_clock::now() - start});
+
+        return result;
+    }
+}
+
+} // namespace detail
+
+} // namespace AST
@@ -0,0 +1,397 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include "frame.hh"
+#include "log.hh"
+#include "node.hh"
+
+namespace AST
+{
+
+namespace detail
+{
+
+struct TypeStats
+{
+    size_t reads = 0;    // variable and element reads
+    size_t integers = 0; // of them proven to yield an integer
+};
+
+// Static type inference. A value is an integer or an array of some rank
+// whose innermost elements share one type; a frame slot has the join of the
+// types of every value stored to it or to one of its elements. Arrays are
+// never aliased, so that covers whatever the slot holds at run time.
+//
+// Reads proven to yield integers are marked for the engines, as are stores
+// of integers over integer elements and operators on integers only. Element
+// accesses that cannot succeed, such as indexing an integer, are reported
+// before execution.
+class Typer final
+{
+  public:
+    enum class Leaf : uint8_t
+    {
+        NONE, // no value at all, as in an element of repeat(undef, n)
+        INT,
+        ANY,
+    };
+
+    // Leaf values nested rank arrays deep.
+    struct Type
+    {
+        int rank = 0;
+        Leaf leaf = Leaf::NONE;
+
+        bool operator==(const Type&) const = default;
+
+        bool isInt() const { return rank == 0 && leaf == Leaf::INT; }
+    };
+
+  private:
+    // Deeper arrays only come from loops such as a = array(a); give up.
+    static constexpr int MAX_RANK = 32;
+
+    const FrameLayout& layout_;
+    TypeStats stats_;
+
+    std::vector<Type> slots_;
+    bool changed_ = false;
+    bool final_ = false; // the last walk marks nodes and reports errors
+
+    std::vector<std::string> errors_;
+
+  private:
+    static Type join(const Type& left, const Type& right)
+    {
+        if (left.leaf == Leaf::NONE && left.rank <= right.rank)
+            return right;
+
+        if (right.leaf == Leaf::NONE && right.rank <= left.rank)
+            return left;
+
+        if (left.rank == right.rank)
+            return {left.rank, left.leaf == right.leaf ? left.leaf : Leaf::ANY};
+
+        return {std::min(left.rank, right.rank), Leaf::ANY};
+    }
+
+    static Type wrap(const Type& type, int rank)
+    {
+        if (type.rank + rank > MAX_RANK)
+            return {0, Leaf::ANY};
+
+        return {type.rank + rank, type.leaf};
+    }
+
+    Type load(const Binding& binding) const
+    {
+        if (binding.chain < 0)
+            return slotType(binding.slot);
+
+        Type type;
+
+        for (const int slot : layout_.chain(binding.chain))
+            type = join(type, slotType(slot));
+
+        return type;
+    }
+
+    void store(int slot, const Type& type)
+    {
+        Type& current = slots_[static_cast<size_t>(slot)];
+        const Type joined = join(current, type);
+
+        if (joined != current)
+        {
+            current = joined;
+            changed_ = true;
+        }
+    }
+
+    // A store through a chain may bind any of its slots.
+    void store(const Binding& binding, const Type& type)
+    {
+        if (binding.chain < 0)
+            return store(binding.slot, type);
+
+        for (const int slot : layout_.chain(binding.chain))
+            store(slot, type);
+    }
+
+    void error(std::string msg)
+    {
+        if (final_ &&
+            std::find(errors_.begin(), errors_.end(), msg) == errors_.end())
+            errors_.push_back(std::move(msg));
+    }
+
+    void throwErrors() const
+    {
+        if (errors_.empty())
+            return;
+
+        std::string msg;
+
+        for (const std::string& error : errors_)
+            msg += error;
+
+        throw std::runtime_error(msg);
+    }
+
+    static int indices(const ArrayElemNode& node)
+    {
+        int count = 1;
+
+        for (auto elem = &node; !elem->holdsVariable();
+             elem = elem->getArrayElem())
+            ++count;
+
+        return count;
+    }
+
+    // Types the indices and returns the type of the element.
+    Type element(const ArrayElemNode& node)
+    {
+        for (auto elem = &node;; elem = elem->getArrayElem())
+        {
+            expr(elem->getIndex());
+
+            if (elem->holdsVariable())
+                break;
+        }
+
+        const int count = indices(node);
+        const VariablePtr base = node.getBase();
+        const Type array = load(base->getBinding());
+
+        if (array.rank >= count)
+            return {array.rank - count, array.leaf};
+
+        if (array.leaf != Leaf::INT)
+            return {0, array.leaf};
+
+        if (array.rank == 0)
+            error(std::string(base->getName()) + " is not an array type\n");
+        else
+            error(std::string(base->getName()) + ": " + std::to_string(count) +
+                  " indices for an array of rank " +
+                  std::to_string(array.rank) + "\n");
+
+        return {};
+    }
+
+    Type read(const ArrayElemNode& node)
+    {
+        const Type type = element(node);
+
+        if (final_)
+        {
+            node.setInteger(type.isInt());
+
+            ++stats_.reads;
+            stats_.integers += type.isInt();
+        }
+
+        return type;
+    }
+
+    Type read(const VariableNode& node)
+    {
+        const Type type = load(node.getBinding());
+
+        if (final_)
+        {
+            node.setInteger(type.isInt());
+
+            ++stats_.reads;
+            stats_.integers += type.isInt();
+        }
+
+        return type;
+    }
+
+    Type expr(ExprPtr node)
+    {
+        if (auto var = dynamic_cast<const VariableNode*>(node))
+            return read(*var);
+
+        if (auto elem = dynamic_cast<const ArrayElemNode*>(node))
+            return read(*elem);
+
+        if (auto assignment = dynamic_cast<const AssignNode*>(node))
+            return assign(*assignment);
+
+        if (auto binary = dynamic_cast<const BinaryOpNode*>(node))
+            return operation(*binary);
+
+        if (auto unary = dynamic_cast<const UnaryOpNode*>(node))
+            expr(unary->getOperand());
+
+        // Constants, unary operators and input.
+        return {0, Leaf::INT};
+    }
+
+    // Operators apply elementwise to arrays, so the result has the shape of
+    // the array operands with integer elements.
+    Type operation(const BinaryOpNode& node)
+    {
+        const Type left = expr(node.getLeft());
+        const Type right = expr(node.getRight());
+
+        if (final_)
+            node.setInteger(left.isInt() && right.isInt());
+
+        if (left.leaf == Leaf::INT && right.leaf == Leaf::INT &&
+            left.rank > 0 && right.rank > 0 && left.rank != right.rank)
+            error("Operands are arrays of rank " + std::to_string(left.rank) +
+                  " and " + std::to_string(right.rank) + "\n");
+
+        const bool known = left.leaf != Leaf::ANY && right.leaf != Leaf::ANY;
+
+        return {std::max(left.rank, right.rank), known ? Leaf::INT : Leaf::ANY};
+    }
+
+    Type rhs(const Rhs& src)
+    {
+        if (auto value = std::get_if<ExprPtr>(&src))
+            return expr(*value);
+
+        if (auto init = std::get_if<ArrayInitPtr>(&src))
+        {
+            Type type;
+
+            for (size_t id = 0; id < (*init)->arraySize(); ++id)
+                type = join(type, expr((*init)->getElem(id)));
+
+            return wrap(type, 1);
+        }
+
+        const RepeatNode& repeat = *std::get<RepeatPtr>(src);
+
+        expr(repeat.getSize());
+
+        if (!repeat.hasElem())
+            return {1, Leaf::NONE};
+
+        return wrap(rhs(repeat.getElem()), 1);
+    }
+
+    Type assign(const AssignNode& node)
+    {
+        if (auto dest = std::get_if<ArrayElemPtr>(&node.getDest()))
+        {
+            const Type target = element(**dest);
+            const Type src = rhs(node.getSrc());
+
+            if (final_)
+                (*dest)->setInteger(target.isInt() && src.isInt());
+
+            store((*dest)->getBase()->getBinding(), wrap(src, indices(**dest)));
+
+            return src;
+        }
+
+        const Type src = rhs(node.getSrc());
+
+        store(std::get<VariablePtr>(node.getDest())->getBinding(), src);
+
+        return src;
+    }
+
+    void statement(StmtPtr stmt)
+    {
+        if (auto scope = dynamic_cast<const ScopeNode*>(stmt))
+        {
+            for (StmtPtr child : scope->getChildren())
+                statement(child);
+        }
+        else if (auto e = dynamic_cast<ExprPtr>(stmt))
+            expr(e);
+        else if (auto print = dynamic_cast<const PrintNode*>(stmt))
+            expr(print->getExpr());
+        else if (auto ifElse = dynamic_cast<const IfElseNode*>(stmt))
+        {
+            if (ifElse->hasCond())
+                expr(ifElse->getCond());
+
+            statement(ifElse->getAction());
+
+            if (ifElse->hasAltAction())
+                statement(ifElse->getAltAction());
+        }
+        else if (auto loop = dynamic_cast<const WhileNode*>(stmt))
+        {
+            expr(loop->getCond());
+            statement(loop->getScope());
+        }
+    }
+
+  public:
+    explicit Typer(const FrameLayout& layout)
+        : layout_(layout)
+        , slots_(static_cast<size_t>(layout.nslots))
+    {}
+
+    TypeStats run(const ScopeNode& global)
+    {
+        MSG("Inferring types\n");
+
+        // Stores only ever widen slot types, so this terminates.
+        do
+        {
+            changed_ = false;
+
+            for (StmtPtr child : global.getChildren())
+                statement(child);
+        } while (changed_);
+
+        final_ = true;
+
+        for (StmtPtr child : global.getChildren())
+            statement(child);
+
+        throwErrors();
+
+        LOG("{} of {} reads proven integer\n", stats_.integers, stats_.reads);
+
+        return stats_;
+    }
+
+    // Types stmt, the next statement of a streamed global scope, once those
+    // before it are: the slots start out with the types they stored, which
+    // is all stmt may find in them, as the statements run in order.
+    TypeStats run(StmtPtr stmt)
+    {
+        slots_.resize(static_cast<size_t>(layout_.nslots));
+        final_ = false;
+
+        do
+        {
+            changed_ = false;
+            statement(stmt);
+        } while (changed_);
+
+        final_ = true;
+        statement(stmt);
+
+        throwErrors();
+
+        return stats_;
+    }
+
+    const Type& slotType(int slot) const
+    {
+        return slots_[static_cast<size_t>(slot)];
+    }
+};
+
+} // namespace detail
+
+} // namespace AST
@@ -1,6 +1,14 @@
 #pragma once
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
 #include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "log.hh"
 
 namespace AST
 {
@@ -8,85 +16,446 @@ namespace AST
 namespace detail
 {
 
-class IType
+class Array;
+
+// Runtime value: an unboxed integer, an array or nothing at all. UNDEF marks
+// unbound frame slots and elements of repeat(undef, n). Copies share array
+// storage until one of them is written to.
+class Value final
 {
   public:
-	virtual std::unique_ptr<IType> clone() const = 0;
+	enum class Kind : uint8_t
+	{
+		UNDEF,
+		INT,
+		ARRAY,
+	};
 
-	virtual ~IType() = default;
-};
+  private:
+	Kind kind_ = Kind::UNDEF;
+	int int_ = 0;
+	std::shared_ptr<Array> array_;
 
-class Integer final : public IType
-{
   public:
-	int value;
+	Value() = default;
 
-  public:
-	Integer(int _value = 0): value(_value) {}
+	Value(int value)
+		: kind_(Kind::INT)
+		, int_(value)
+	{}
+
+	explicit Value(Array&& array);
+
+	Value(const Value& other);
 
-	std::unique_ptr<IType> clone() const override
+	Value(Value&& other) noexcept
+		: kind_(other.kind_)
+		, int_(other.int_)
+		, array_(std::move(other.array_))
 	{
-		return std::make_unique<Integer>(value);
+		other.kind_ = Kind::UNDEF;
 	}
+
+	// Assignment goes through a temporary: the source may live inside the
+	// array that is being overwritten.
+	Value& operator=(const Value& other)
+	{
+		Value copy(other);
+		swap(copy);
+
+		return *this;
+	}
+
+	Value& operator=(Value&& other) noexcept
+	{
+		Value tmp(std::move(other));
+		swap(tmp);
+
+		return *this;
+	}
+
+	Value& operator=(int value);
+
+	~Value();
+
+	void swap(Value& other) noexcept
+	{
+		std::swap(kind_, other.kind_);
+		std::swap(int_, other.int_);
+		std::swap(array_, other.array_);
+	}
+
+	Kind kind() const { return kind_; }
+
+	bool isUndef() const { return kind_ == Kind::UNDEF; }
+
+	bool isInt() const { return kind_ == Kind::INT; }
+
+	bool isArray() const { return kind_ == Kind::ARRAY; }
+
+	int getInt() const { return int_; }
+
+	const Array* getArray() const { return array_.get(); }
+
+	// Array for writing, detached from any other value sharing it.
+	Array* mutableArray();
+
+	void reset();
 };
 
-class Array final : public IType
+// Arrays are stored flat whenever they are rectangular and hold integers
+// only: one buffer plus shape and strides, so an element chain a[i][j]
+// resolves to a single offset. Ragged arrays and arrays with undef elements
+// keep a vector of values instead.
+class Array final
 {
   private:
-	std::vector<std::unique_ptr<IType>> data_;
+	std::vector<int> flat_;
+	std::vector<int> shape_;
+	std::vector<size_t> strides_;
+
+	std::vector<Value> nested_;
+
+  private:
+	void initStrides()
+	{
+		strides_.assign(shape_.size(), 1);
+
+		for (size_t dim = shape_.size() - 1; dim-- > 0;)
+			strides_[dim] = strides_[dim + 1] * static_cast<size_t>(shape_[dim + 1]);
+	}
+
+	size_t offset(const int* indices, size_t count) const
+	{
+		size_t offset = 0;
+
+		for (size_t dim = 0; dim < count; ++dim)
+			offset += static_cast<size_t>(indices[dim]) * strides_[dim];
+
+		return offset;
+	}
+
+	// Flat sub-array addressed by the first `count` indices.
+	Array block(const int* indices, size_t count) const
+	{
+		const auto begin =
+			static_cast<std::ptrdiff_t>(offset(indices, count));
+		const auto length = static_cast<std::ptrdiff_t>(strides_[count - 1]);
+		const auto dims = static_cast<std::ptrdiff_t>(count);
+
+		return Array(std::vector<int>(shape_.begin() + dims, shape_.end()),
+					 std::vector<int>(flat_.begin() + begin,
+									  flat_.begin() + begin + length));
+	}
+
+	// Throws unless every index that falls on a flat dimension is in range.
+	void checkFlat(const int* indices, size_t count) const
+	{
+		const size_t dims = std::min(count, shape_.size());
+
+		for (size_t dim = 0; dim < dims; ++dim)
+			if (static_cast<unsigned>(indices[dim]) >=
+				static_cast<unsigned>(shape_[dim]))
+				throw std::runtime_error("Array index out of range\n");
+	}
 
-	public:
+	void checkNested(int index) const
+	{
+		if (static_cast<size_t>(static_cast<unsigned>(index)) >= nested_.size())
+			throw std::runtime_error("Array index out of range\n");
+	}
+
+	bool sameShape(const Array& other, size_t from) const
+	{
+		return other.isFlat() &&
+			   std::equal(shape_.begin() + static_cast<std::ptrdiff_t>(from),
+						  shape_.end(),
+						  other.shape_.begin(), other.shape_.end());
+	}
+
+	void makeNested()
+	{
+		MSG("Array becomes ragged, switching to nested storage\n");
+
+		const size_t size = static_cast<size_t>(shape_.front());
+
+		nested_.reserve(size);
+
+		for (size_t id = 0; id < size; ++id)
+		{
+			const int index = static_cast<int>(id);
+
+			if (shape_.size() == 1)
+				nested_.emplace_back(flat_[id]);
+			else
+				nested_.emplace_back(block(&index, 1));
+		}
+
+		flat_ = {};
+		shape_.clear();
+		strides_.clear();
+	}
+
+  public:
 	Array() = default;
 
-	Array(int size)
+	// Flat array of the given shape over its elements in row-major order.
+	Array(std::vector<int>&& shape, std::vector<int>&& flat)
+		: flat_(std::move(flat))
+		, shape_(std::move(shape))
+	{
+		initStrides();
+	}
+
+	explicit Array(int size)
 	{
 		LOG("Constructing undefind array of size {}\n", size);
 
-		data_.resize(size);
+		nested_.resize(static_cast<size_t>(size));
 	}
 
-	Array(const IType* elem, int size)
+	Array(const Value& elem, int size)
 	{
-		data_.reserve(size);
+		const Array* inner = elem.getArray();
 
-		for (size_t id = 0; id < size; ++id)
+		if (elem.isInt())
+		{
+			shape_ = {size};
+			flat_.assign(static_cast<size_t>(size), elem.getInt());
+		}
+		else if (inner && inner->isFlat())
 		{
-			data_.push_back(elem->clone());
+			shape_.push_back(size);
+			shape_.insert(shape_.end(), inner->shape_.begin(),
+						  inner->shape_.end());
+
+			flat_.reserve(static_cast<size_t>(size) * inner->flat_.size());
+
+			for (int id = 0; id < size; ++id)
+				flat_.insert(flat_.end(), inner->flat_.begin(),
+							 inner->flat_.end());
 		}
+		else
+		{
+			nested_.assign(static_cast<size_t>(size), elem);
+			return;
+		}
+
+		initStrides();
 	}
 
-	Array(std::vector<std::unique_ptr<IType>>&& data) 
+	explicit Array(std::vector<Value>&& data)
 	{
-		data_ = std::move(data);
+		const bool ints = std::all_of(data.begin(), data.end(),
+									  [](const Value& v) { return v.isInt(); });
+
+		const Array* first = data.empty() ? nullptr : data.front().getArray();
+
+		const bool blocks =
+			first && first->isFlat() &&
+			std::all_of(data.begin(), data.end(),
+						[&](const Value& v)
+						{ return v.isArray() && first->sameShape(*v.getArray(), 0); });
+
+		if (ints)
+		{
+			shape_ = {static_cast<int>(data.size())};
+
+			for (const auto& value : data)
+				flat_.push_back(value.getInt());
+		}
+		else if (blocks)
+		{
+			shape_.push_back(static_cast<int>(data.size()));
+			shape_.insert(shape_.end(), first->shape_.begin(),
+						  first->shape_.end());
+
+			for (const auto& value : data)
+				flat_.insert(flat_.end(), value.getArray()->flat_.begin(),
+							 value.getArray()->flat_.end());
+		}
+		else
+		{
+			nested_ = std::move(data);
+			return;
+		}
+
+		initStrides();
 	}
 
-	std::unique_ptr<IType> clone() const override
+	bool isFlat() const { return !shape_.empty(); }
+
+	// Dimensions of a flat array, outermost first.
+	const std::vector<int>& shape() const { return shape_; }
+
+	// Elements of a flat array in row-major order.
+	const std::vector<int>& elements() const { return flat_; }
+
+	// Elements of a flat array for writing in place.
+	int* data() { return flat_.data(); }
+
+	size_t rank() const { return shape_.size(); }
+
+	size_t size() const
 	{
-		auto clonedArray = std::make_unique<Array>();
+		return isFlat() ? static_cast<size_t>(shape_.front()) : nested_.size();
+	}
+
+	// Reads the element addressed by indices (outermost dimension first).
+	// Unchecked accesses are for indices proven in range beforehand.
+	void read(const int* indices, size_t count, Value& out,
+			  bool checked = true) const
+	{
+		if (isFlat())
+		{
+			if (checked)
+				checkFlat(indices, count);
+
+			if (count == shape_.size())
+				out = flat_[offset(indices, count)];
+			else if (count < shape_.size())
+				out = Value(block(indices, count));
+			else
+				throw std::runtime_error("ArrayElem name acceptance "
+										 "did not result in Array\n");
+			return;
+		}
+
+		if (checked)
+			checkNested(indices[0]);
+
+		const Value& elem = nested_[static_cast<size_t>(indices[0])];
+
+		if (elem.isUndef())
+			throw std::runtime_error("Undefined array element\n");
+
+		if (count == 1)
+		{
+			out = elem;
+			return;
+		}
 
-		clonedArray->data_.reserve(data_.size());
+		if (!elem.isArray())
+			throw std::runtime_error("ArrayElem name acceptance "
+									 "did not result in Array\n");
 
-		for (const auto& elem : data_)
+		elem.getArray()->read(indices + 1, count - 1, out, checked);
+	}
+
+	// Reads an element the program is proven to hold integers at, without
+	// materializing a value on the flat path.
+	int readInt(const int* indices, size_t count, bool checked = true) const
+	{
+		if (isFlat() && count == shape_.size())
 		{
-			clonedArray->data_.push_back(elem ? elem->clone() : nullptr);
+			if (checked)
+				checkFlat(indices, count);
+
+			return flat_[offset(indices, count)];
 		}
 
-		return clonedArray;
+		Value out;
+		read(indices, count, out, checked);
+
+		return out.getInt();
 	}
 
-	IType* getElem(int index)
+	// Gives every array nested in this one storage of its own, so that
+	// integer elements can then be written in place from several threads.
+	void detach()
 	{
-		return data_[index].get();
+		for (Value& elem : nested_)
+			if (Array* array = elem.mutableArray())
+				array->detach();
 	}
 
-	void assignElem(int index, IType* elem)
+	void write(const int* indices, size_t count, const Value& value,
+			   bool checked = true)
 	{
-		data_[index].reset();
+		if (isFlat())
+		{
+			if (checked)
+				checkFlat(indices, count);
+
+			if (count == shape_.size() && value.isInt())
+			{
+				flat_[offset(indices, count)] = value.getInt();
+				return;
+			}
 
-		data_[index] = elem->clone();
+			if (count < shape_.size() && value.isArray() &&
+				sameShape(*value.getArray(), count))
+			{
+				const auto& src = value.getArray()->flat_;
+
+				std::copy(src.begin(), src.end(),
+						  flat_.begin() +
+							  static_cast<std::ptrdiff_t>(offset(indices, count)));
+				return;
+			}
+
+			if (count > shape_.size())
+				throw std::runtime_error("Indexing non array type\n");
+
+			makeNested();
+		}
+
+		if (checked)
+			checkNested(indices[0]);
+
+		Value& elem = nested_[static_cast<size_t>(indices[0])];
+
+		if (count == 1)
+		{
+			elem = value;
+			return;
+		}
+
+		if (!elem.isArray())
+			throw std::runtime_error("Indexing non array type\n");
+
+		elem.mutableArray()->write(indices + 1, count - 1, value, checked);
 	}
 };
 
+inline Value::Value(Array&& array)
+	: kind_(Kind::ARRAY)
+	, array_(std::make_shared<Array>(std::move(array)))
+{}
+
+inline Value::Value(const Value& other) = default;
+
+inline Array* Value::mutableArray()
+{
+	if (array_ && array_.use_count() > 1)
+	{
+		MSG("Array is shared, copying before write\n");
+
+		array_ = std::make_shared<Array>(*array_);
+	}
+
+	return array_.get();
+}
+
+inline Value::~Value() = default;
+
+inline Value& Value::operator=(int value)
+{
+	if (array_)
+		array_.reset();
+
+	kind_ = Kind::INT;
+	int_ = value;
+
+	return *this;
+}
+
+inline void Value::reset()
+{
+	array_.reset();
+	kind_ = Kind::UNDEF;
+}
+
 }; // detail
 
 }; // AST
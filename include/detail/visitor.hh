@@ -11,6 +11,7 @@ class UnaryOpNode;
 class AssignNode;
 class ArrayElemNode;
 class WhileNode;
+class PforNode;
 class IfElseNode;
 class PrintNode;
 class InNode;
@@ -31,6 +32,7 @@ class Visitor
     virtual void visit(const AssignNode &node) = 0;
 	virtual void visit(const ArrayElemNode &node) = 0;
     virtual void visit(const WhileNode &node) = 0;
+    virtual void visit(const PforNode &node) = 0;
     virtual void visit(const IfElseNode &node) = 0;
     virtual void visit(const PrintNode &node) = 0;
     virtual void visit(const InNode &node) = 0;
@@ -0,0 +1,401 @@
+#pragma once
+
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "arithmetic.hh"
+#include "bytecode.hh"
+#include "context.hh"
+#include "divisor.hh"
+#include "elementwise.hh"
+#include "log.hh"
+#include "types.hh"
+
+namespace AST
+{
+
+namespace detail
+{
+
+class VM final
+{
+  private:
+    // Integers are kept unboxed; array values refer to a variable or to the
+    // register's own temporary.
+    struct Register
+    {
+        int value = 0;
+        const Value* ref = nullptr;
+        Value owned;
+    };
+
+  private:
+    detail::Context ctx_;
+    std::vector<Register> regs_;
+    std::vector<int> indices_;
+
+  private:
+    static void load(Register& reg, const Value& src)
+    {
+        switch (src.kind())
+        {
+            case Value::Kind::INT:
+                reg.value = src.getInt();
+                reg.ref = nullptr;
+                break;
+
+            case Value::Kind::ARRAY:
+                reg.ref = &src;
+                break;
+
+            case Value::Kind::UNDEF:
+            default:
+                throw std::runtime_error("Undefined array element\n");
+        }
+    }
+
+    static void own(Register& reg, Value&& value)
+    {
+        reg.owned = std::move(value);
+        adopt(reg);
+    }
+
+    // Points the register at whatever it owns now.
+    static void adopt(Register& reg)
+    {
+        if (reg.owned.isInt())
+        {
+            reg.value = reg.owned.getInt();
+            reg.ref = nullptr;
+        }
+        else
+            reg.ref = &reg.owned;
+    }
+
+    // Array values are shared, so taking one out of a register is cheap.
+    static Value materialize(Register& reg)
+    {
+        if (!reg.ref)
+            return Value(reg.value);
+
+        if (reg.ref == &reg.owned)
+            return std::move(reg.owned);
+
+        return *reg.ref;
+    }
+
+    // The value a register holds, for operations that take either kind.
+    static Value value(const Register& reg)
+    {
+        return reg.ref ? *reg.ref : Value(reg.value);
+    }
+
+    void storeVar(const Binding& dest, Register& src)
+    {
+        if (!src.ref)
+        {
+            ctx_.getVar(dest) = src.value;
+            return;
+        }
+
+        Value copy = materialize(src);
+        Value& var = ctx_.getVar(dest);
+
+        var = std::move(copy);
+        src.ref = &var;
+    }
+
+    const Array* getArray(const Binding& binding)
+    {
+        const Array* array = ctx_.getArray(binding).getArray();
+
+        if (!array)
+        {
+            std::cerr << ctx_.layout_.name(binding.slot)
+                      << " is not an array type\n";
+            throw std::runtime_error("Can't use [] to non array variables\n");
+        }
+
+        return array;
+    }
+
+    Array* mutableArray(const Binding& binding)
+    {
+        Array* array = ctx_.getArray(binding).mutableArray();
+
+        if (!array)
+            throw std::runtime_error("Indexing non array type\n");
+
+        return array;
+    }
+
+    // Element chain indices in dimension order; registers hold them last
+    // dimension first.
+    const int* indices(const Register* first, uint16_t count)
+    {
+        if (count == 1)
+            return &first->value;
+
+        indices_.resize(count);
+
+        for (size_t id = 0; id < count; ++id)
+            indices_[id] = first[count - 1 - id].value;
+
+        return indices_.data();
+    }
+
+  public:
+    VM(std::ostream& out = std::cout, Flush flush = Flush::BLOCK,
+       Input& in = Input::standard())
+        : ctx_(out, flush, in)
+    {}
+
+    void run(const Program& program)
+    {
+        MSG("Running bytecode\n");
+
+        ctx_.setLayout(program.layout);
+
+        regs_.clear();
+        regs_.resize(static_cast<size_t>(program.nregs));
+
+        Register* r = regs_.data();
+        const Instr* code = program.code.data();
+        const Instr* ip = code;
+        const Divisor* divisors = program.divisors.data();
+
+        for (;;)
+        {
+            const Instr& in = *ip++;
+
+            switch (in.op)
+            {
+                case OpCode::LOAD_CONST:
+                    r[in.a].value = in.b;
+                    r[in.a].ref = nullptr;
+                    break;
+
+                case OpCode::LOAD_VAR:
+                    load(r[in.a], ctx_.getVarValue(Binding{in.b, in.c}));
+                    break;
+
+                case OpCode::LOAD_VAR_INT:
+                    r[in.a].value =
+                        ctx_.getVarValue(Binding{in.b, in.c}).getInt();
+                    r[in.a].ref = nullptr;
+                    break;
+
+                case OpCode::STORE_VAR:
+                    storeVar(Binding{in.b, in.c}, r[in.a]);
+                    break;
+
+                case OpCode::LOAD_ELEM:
+                case OpCode::LOAD_ELEM_UNCHECKED:
+                {
+                    const Array* array = getArray(Binding{in.b, in.c});
+
+                    array->read(indices(r + in.a, in.n), in.n, r[in.a].owned,
+                                in.op == OpCode::LOAD_ELEM);
+                    adopt(r[in.a]);
+                    break;
+                }
+
+                case OpCode::LOAD_ELEM_INT:
+                case OpCode::LOAD_ELEM_INT_UNCHECKED:
+                {
+                    // The base is proven to be an array.
+                    const Array& array =
+                        *ctx_.getArray(Binding{in.b, in.c}).getArray();
+
+                    r[in.a].value = array.readInt(indices(r + in.a, in.n), in.n,
+                                                  in.op == OpCode::LOAD_ELEM_INT);
+                    r[in.a].ref = nullptr;
+                    break;
+                }
+
+                case OpCode::STORE_ELEM:
+                case OpCode::STORE_ELEM_UNCHECKED:
+                {
+                    // The source is taken first: it may share the target.
+                    Register& src = r[in.a];
+                    Value elem = materialize(src);
+
+                    mutableArray(Binding{in.b, in.c})
+                        ->write(indices(r + in.a - in.n, in.n), in.n, elem,
+                                in.op == OpCode::STORE_ELEM);
+
+                    if (src.ref)
+                        own(src, std::move(elem));
+                    break;
+                }
+
+                case OpCode::MOVE:
+                    r[in.a].value = r[in.b].value;
+                    r[in.a].ref = r[in.b].ref;
+                    break;
+
+                case OpCode::ADD:
+                    r[in.a].value = add(r[in.b].value, r[in.c].value);
+                    r[in.a].ref = nullptr;
+                    break;
+
+                case OpCode::SUB:
+                    r[in.a].value = subtract(r[in.b].value, r[in.c].value);
+                    r[in.a].ref = nullptr;
+                    break;
+
+                case OpCode::MUL:
+                    r[in.a].value = multiply(r[in.b].value, r[in.c].value);
+                    r[in.a].ref = nullptr;
+                    break;
+
+                case OpCode::DIV:
+                    r[in.a].value = divide(r[in.b].value, r[in.c].value);
+                    r[in.a].ref = nullptr;
+                    break;
+
+                case OpCode::MOD:
+                    r[in.a].value = modulo(r[in.b].value, r[in.c].value);
+                    r[in.a].ref = nullptr;
+                    break;
+
+                case OpCode::DIV_CONST:
+                    r[in.a].value = divisors[in.c].divide(r[in.b].value);
+                    r[in.a].ref = nullptr;
+                    break;
+
+                case OpCode::MOD_CONST:
+                    r[in.a].value = divisors[in.c].modulo(r[in.b].value);
+                    r[in.a].ref = nullptr;
+                    break;
+
+                case OpCode::GR:
+                    r[in.a].value = r[in.b].value > r[in.c].value;
+                    r[in.a].ref = nullptr;
+                    break;
+
+                case OpCode::LS:
+                    r[in.a].value = r[in.b].value < r[in.c].value;
+                    r[in.a].ref = nullptr;
+                    break;
+
+                case OpCode::EQ:
+                    r[in.a].value = r[in.b].value == r[in.c].value;
+                    r[in.a].ref = nullptr;
+                    break;
+
+                case OpCode::GR_EQ:
+                    r[in.a].value = r[in.b].value >= r[in.c].value;
+                    r[in.a].ref = nullptr;
+                    break;
+
+                case OpCode::LS_EQ:
+                    r[in.a].value = r[in.b].value <= r[in.c].value;
+                    r[in.a].ref = nullptr;
+                    break;
+
+                case OpCode::NOT_EQ:
+                    r[in.a].value = r[in.b].value != r[in.c].value;
+                    r[in.a].ref = nullptr;
+                    break;
+
+                case OpCode::AND:
+                    r[in.a].value = r[in.b].value && r[in.c].value;
+                    r[in.a].ref = nullptr;
+                    break;
+
+                case OpCode::OR:
+                    r[in.a].value = r[in.b].value || r[in.c].value;
+                    r[in.a].ref = nullptr;
+                    break;
+
+                case OpCode::OWN:
+                    if (r[in.a].ref && r[in.a].ref != &r[in.a].owned)
+                        own(r[in.a], Value(*r[in.a].ref));
+                    break;
+
+                case OpCode::ELEMENTWISE:
+                    own(r[in.a], elementwise(static_cast<BinaryOp>(in.n),
+                                             value(r[in.b]), value(r[in.c])));
+                    break;
+
+                case OpCode::NEG:
+                    r[in.a].value = negate(r[in.b].value);
+                    r[in.a].ref = nullptr;
+                    break;
+
+                case OpCode::NOT:
+                    r[in.a].value = !r[in.b].value;
+                    r[in.a].ref = nullptr;
+                    break;
+
+                case OpCode::JUMP:
+                    ip = code + in.a;
+                    break;
+
+                case OpCode::JUMP_IF_FALSE:
+                    if (!r[in.a].value)
+                        ip = code + in.b;
+                    break;
+
+                case OpCode::JUMP_IF_TRUE:
+                    if (r[in.a].value)
+                        ip = code + in.b;
+                    break;
+
+                case OpCode::LEAVE_SCOPE:
+                    ctx_.clearSlots(in.a, in.b);
+                    break;
+
+                case OpCode::PRINT:
+                    ctx_.out.print(r[in.a].value);
+                    break;
+
+                case OpCode::READ:
+                {
+                    const int value = ctx_.in->read(ctx_.out);
+
+                    r[in.a].value = value;
+                    r[in.a].ref = nullptr;
+                    break;
+                }
+
+                case OpCode::REPEAT:
+                {
+                    Value elem = materialize(r[in.b]);
+
+                    own(r[in.a], Value(Array(elem, r[in.c].value)));
+                    break;
+                }
+
+                case OpCode::REPEAT_UNDEF:
+                    own(r[in.a], Value(Array(r[in.c].value)));
+                    break;
+
+                case OpCode::ARRAY_INIT:
+                {
+                    std::vector<Value> data;
+                    data.reserve(static_cast<size_t>(in.c));
+
+                    for (int id = 0; id < in.c; ++id)
+                        data.push_back(materialize(r[in.b + id]));
+
+                    own(r[in.a], Value(Array(std::move(data))));
+                    break;
+                }
+
+                case OpCode::HALT:
+                    return;
+
+                default:
+                    throw std::runtime_error("Unknown opcode");
+            }
+        }
+    }
+};
+
+} // namespace detail
+
+} // namespace AST
@@ -1,16 +1,23 @@
 #pragma once
 
+#include <memory>
 #include <ostream>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 #include "ast.hh"
 #include "parser.hh"
+#include "source.hh"
 
 extern int yy_flex_debug;
 extern int yydebug;
 extern FILE *yyin;
 
+struct yy_buffer_state;
+
 #define YY_DECL yy::parser::symbol_type yylex(Driver &drv)
 
 YY_DECL;
@@ -25,9 +32,18 @@ class Driver final
 
   private:
     std::string file_;
+    // The file being scanned and the flex buffer over it.
+    AST::detail::Source source_;
+    yy_buffer_state* buffer_ = nullptr;
     AST::AST ast_;
+    AST::Frontend frontend_ = AST::Frontend::BISON;
     std::vector<Scope> stmTable_;
     std::vector<AST::ExprPtr> init_list_;
+    int pfors_ = 0;
+    bool streaming_ = false;
+    // Parsed programs are kept there when set.
+    std::string cacheDir_;
+    bool fromCache_ = false;
 
 
   public:
@@ -39,7 +55,88 @@ class Driver final
 
     const AST::ScopeNode *getGlobalScope() const { return ast_.globalScope; }
 
-    void eval() { ast_.eval(); }
+    const AST::detail::Arena& arena() const { return ast_.arena(); }
+
+    const AST::detail::FoldStats& foldStats() const { return ast_.foldStats(); }
+
+    const AST::detail::ElimStats& elimStats() const { return ast_.elimStats(); }
+
+    const AST::detail::HoistStats& hoistStats() const { return ast_.hoistStats(); }
+
+    const AST::detail::ReduceStats& reduceStats() const
+    {
+        return ast_.reduceStats();
+    }
+
+    const AST::detail::NumberStats& numberStats() const
+    {
+        return ast_.numberStats();
+    }
+
+    const AST::detail::BoundsStats& boundsStats() const
+    {
+        return ast_.boundsStats();
+    }
+
+    const AST::detail::TypeStats& typeStats() const
+    {
+        return ast_.typeStats();
+    }
+
+    const AST::detail::IdiomStats& idiomStats() const
+    {
+        return ast_.idiomStats();
+    }
+
+    const AST::detail::ParallelStats& parallelStats() const
+    {
+        return ast_.parallelStats();
+    }
+
+    const std::vector<AST::detail::LoopReport>& parallelReport() const
+    {
+        return ast_.parallelReport();
+    }
+
+    const std::vector<AST::detail::PassTiming>& passTimings() const
+    {
+        return ast_.passTimings();
+    }
+
+    void dumpIr(std::ostream& os) { ast_.dumpIr(os); }
+
+    void setOptLevel(int level) { ast_.setOptLevel(level); }
+
+    void setFlush(AST::detail::Flush flush) { ast_.setFlush(flush); }
+
+    void setThreads(unsigned threads) { ast_.setThreads(threads); }
+
+    void setAutoParallel(bool on) { ast_.setAutoParallel(on); }
+
+    void setFrontend(AST::Frontend frontend) { frontend_ = frontend; }
+
+    // Keeps parsed programs in dir, see AST::detail::ProgramCache.
+    void setCacheDir(std::string dir) { cacheDir_ = std::move(dir); }
+
+    // Whether the last parse took the program from the cache.
+    bool fromCache() const { return fromCache_; }
+
+    // Makes ? read text instead of standard input.
+    void setInput(std::string_view text)
+    {
+        ast_.setInput(std::make_unique<AST::detail::Input>(text));
+    }
+
+    // Makes ? read the file at path; throws if it cannot be opened.
+    void setInputFile(const std::string& path)
+    {
+        ast_.setInput(AST::detail::Input::open(path));
+    }
+
+    void eval(AST::Engine engine = AST::Engine::INTERPRETER)
+    {
+        ast_.eval(engine);
+    }
 
     template <typename NodeType, typename... Args>
     NodeType *construct(Args &&...args)
@@ -59,7 +156,22 @@ class Driver final
 
     void initScope() { stmTable_.emplace_back(); }
 
-    void formGlobalScope() { ast_.globalScope = formScope(); }
+    // A streamed program has its global scope from the start.
+    void formGlobalScope()
+    {
+        if (!streaming_)
+            ast_.globalScope = formScope();
+    }
+
+    // Adds a parsed statement to the current scope; one of the global scope
+    // of a streamed program goes to run at once.
+    void pushStatement(AST::StmtPtr stmt)
+    {
+        if (streaming_ && stmTable_.size() == 1)
+            ast_.stream(stmt);
+        else
+            curScope().push_back(stmt);
+    }
 
     int getInterpreterBuf() const { return ast_.getInterpreterBuf(); }
 
@@ -73,6 +185,42 @@ class Driver final
         return ast_.internName(name);
     }
 
+    int intern(std::string_view name) { return ast_.intern(name); }
+
+    std::string_view symbolName(int symbol) const
+    {
+        return ast_.symbolName(symbol);
+    }
+
+    // pfor (var = begin; var < end; reductions) body in the form described
+    // at AST::PforNode.
+    AST::StmtPtr makePfor(AST::VariableNode* var, AST::ExprPtr begin,
+                          AST::ExprPtr end, AST::StmtPtr body,
+                          std::vector<std::string_view>&& reductions)
+    {
+        const std::string_view index = var->getName();
+        const std::string_view bound =
+            internName("pfor." + std::to_string(pfors_++));
+
+        auto step = construct<AST::AssignNode>(
+            construct<AST::VariableNode>(index),
+            construct<AST::BinaryOpNode>(construct<AST::VariableNode>(index),
+                                         AST::BinaryOp::ADD,
+                                         construct<AST::ConstantNode>(1)));
+
+        auto loop = construct<AST::PforNode>(
+            construct<AST::BinaryOpNode>(construct<AST::VariableNode>(index),
+                                         AST::BinaryOp::LS,
+                                         construct<AST::VariableNode>(bound)),
+            construct<AST::ScopeNode>(std::vector<AST::StmtPtr>{body, step}),
+            std::move(reductions));
+
+        return construct<AST::ScopeNode>(std::vector<AST::StmtPtr>{
+            construct<AST::AssignNode>(var, begin),
+            construct<AST::AssignNode>(construct<AST::VariableNode>(bound), end),
+            loop});
+    }
+
     void pushToInitList(AST::ExprPtr expr)
     {
         init_list_.push_back(expr);
@@ -86,33 +234,133 @@ class Driver final
     int parse(const std::string &f)
     {
         file_ = f;
+        fromCache_ = false;
 
         location.initialize(&file_);
 
+        // Scripts on standard input and streamed ones are parsed as usual.
+        if (!cacheDir_.empty() && !f.empty() && !streaming_)
+            return parseCached();
+
+        return parseSource();
+    }
+
+    int parseSource()
+    {
         scanBegin();
 
-        yy::parser parse(*this);
+        int status = 0;
+
+        try
+        {
+            if (frontend_ == AST::Frontend::DESCENT)
+                status = parseByDescent();
+            else
+            {
+                yy::parser parse(*this);
 
 #if YYDEBUG
-        parse.set_debug_level(YYDEBUG);
+                parse.set_debug_level(YYDEBUG);
 #endif
 
-        int status = parse();
+                status = parse();
+            }
+        }
+        catch (...)
+        {
+            scanEnd();
+            throw;
+        }
 
         scanEnd();
 
         return status;
     }
 
-    void scanBegin()
+    // Runs the program in f on the interpreter while it is parsed: a thread
+    // parses it and hands on every statement of the global scope as soon as
+    // it is complete. Errors in a statement stop the program when it is
+    // reached, after the statements before it ran.
+    int stream(const std::string &f)
     {
-        yy_flex_debug = YY_FLEX_DEBUG;
+        // ? would read the script otherwise; it finds nothing left, as it
+        // does once the whole script is parsed.
+        if (f.empty() && &ast_.input() == &AST::detail::Input::standard())
+            setInput(std::string_view());
+
+        ast_.beginStream();
+        streaming_ = true;
+
+        int status = 0;
+
+        std::thread parser([this, &f, &status]
+        {
+            try
+            {
+                status = parse(f);
+                ast_.endStream();
+            }
+            catch (...)
+            {
+                ast_.endStream(std::current_exception());
+            }
+        });
+
+        try
+        {
+            ast_.runStream();
+        }
+        catch (...)
+        {
+            parser.join();
+            streaming_ = false;
+            throw;
+        }
+
+        parser.join();
+        streaming_ = false;
 
-        if (file_.empty())
-            yyin = stdin;
-        else if (!(yyin = fopen(file_.c_str(), "r")))
-            throw std::runtime_error("Can't open input file_\n");
+        return status;
     }
 
-    void scanEnd() { fclose(yyin); }
+    // Splits f into tokens without parsing them; returns how many there are.
+    size_t tokenize(const std::string &f)
+    {
+        file_ = f;
+
+        location.initialize(&file_);
+
+        scanBegin();
+
+        size_t tokens = 0;
+
+        try
+        {
+            while (yylex(*this).kind() != yy::parser::symbol_kind::S_YYEOF)
+                ++tokens;
+        }
+        catch (...)
+        {
+            scanEnd();
+            throw;
+        }
+
+        scanEnd();
+
+        return tokens;
+    }
+
+    // Defined with the scanner: a file is scanned in place from memory,
+    // standard input through yyin.
+    void scanBegin();
+    void scanEnd();
+
+    // Defined with AST::detail::DescentParser.
+    int parseByDescent();
+
+    // Defined with AST::detail::ProgramCache.
+    int parseCached();
 };
+
+#include "descent_parser.hh"
+#include "program_cache.hh"
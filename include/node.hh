@@ -1,6 +1,7 @@
 #pragma once
 
 #include "context.hh"
+#include "frame.hh"
 #include "log.hh"
 #include "visitor.hh"
 
@@ -11,6 +12,8 @@
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <unordered_map>
+#include <utility>
 #include <variant>
 #include <vector>
 
@@ -73,6 +76,10 @@ class ScopeNode final : public StatementNode
   private:
     std::vector<StmtPtr> children_;
 
+    // Frame slots owned by this scope, assigned by detail::Resolver.
+    mutable int slotBegin_ = 0;
+    mutable int slotEnd_ = 0;
+
   public:
     ScopeNode(std::vector<StmtPtr>&& stms)
         : children_(std::move(stms))
@@ -84,8 +91,25 @@ class ScopeNode final : public StatementNode
 
     void pushChild(StmtPtr stmt) { children_.push_back(stmt); }
 
+    void setChild(size_t index, StmtPtr stmt) { children_[index] = stmt; }
+
+    void setChildren(std::vector<StmtPtr>&& children)
+    {
+        children_ = std::move(children);
+    }
+
     size_t nstms() const { return children_.size(); }
 
+    int slotBegin() const { return slotBegin_; }
+
+    int slotEnd() const { return slotEnd_; }
+
+    void setSlots(int begin, int end) const
+    {
+        slotBegin_ = begin;
+        slotEnd_ = end;
+    }
+
     void accept(detail::Visitor& visitor) const override
     {
         visitor.visit(*this);
@@ -117,6 +141,12 @@ class VariableNode final : public ExpressionNode
   private:
     std::string_view name_;
 
+    // Assigned by detail::Resolver before evaluation.
+    mutable detail::Binding binding_;
+
+    // Set by detail::Typer when the variable can only hold an integer here.
+    mutable bool integer_ = false;
+
   public:
     VariableNode(std::string_view name)
         : name_(name)
@@ -124,6 +154,17 @@ class VariableNode final : public ExpressionNode
 
     std::string_view getName() const { return name_; }
 
+    const detail::Binding& getBinding() const { return binding_; }
+
+    void setBinding(const detail::Binding& binding) const
+    {
+        binding_ = binding;
+    }
+
+    bool isInteger() const { return integer_; }
+
+    void setInteger(bool integer) const { integer_ = integer; }
+
     void accept(detail::Visitor& visitor) const override
     {
         visitor.visit(*this);
@@ -139,6 +180,10 @@ class BinaryOpNode final : public ExpressionNode
     ExprPtr right_{};
     BinaryOp op_{};
 
+    // Set by detail::Typer when both operands can only be integers here;
+    // otherwise the operator may apply elementwise to arrays.
+    mutable bool integer_ = false;
+
   public:
     void accept_left(detail::Visitor& visitor) const { left_->accept(visitor); }
 
@@ -149,6 +194,18 @@ class BinaryOpNode final : public ExpressionNode
 
     BinaryOp getOp() const { return op_; }
 
+    ExprPtr getLeft() const { return left_; }
+
+    ExprPtr getRight() const { return right_; }
+
+    void setLeft(ExprPtr left) { left_ = left; }
+
+    void setRight(ExprPtr right) { right_ = right; }
+
+    bool isInteger() const { return integer_; }
+
+    void setInteger(bool integer) const { integer_ = integer; }
+
     BinaryOpNode(ExprPtr left, BinaryOp op, ExprPtr right)
         : left_(left)
         , right_(right)
@@ -180,6 +237,10 @@ class UnaryOpNode final : public ExpressionNode
 
     UnaryOp getOp() const { return op_; }
 
+    ExprPtr getOperand() const { return operand_; }
+
+    void setOperand(ExprPtr operand) { operand_ = operand; }
+
     void accept(detail::Visitor& visitor) const override
     {
         visitor.visit(*this);
@@ -213,6 +274,10 @@ class ArrayInitNode : public StatementNode
     {
         init_list_[index]->accept(visitor);
     }
+
+    ExprPtr getElem(size_t index) const { return init_list_[index]; }
+
+    void setElem(size_t index, ExprPtr elem) { init_list_[index] = elem; }
 };
 
 using ArrayInitPtr = ArrayInitNode*;
@@ -260,6 +325,14 @@ class RepeatNode final : public StatementNode
     {
         return std::visit([&](auto&& elem) { return elem != nullptr; }, elem_);
     }
+
+    const Rhs& getElem() const { return elem_; }
+
+    void setElem(Rhs elem) { elem_ = elem; }
+
+    ExprPtr getSize() const { return size_; }
+
+    void setSize(ExprPtr size) { size_ = size; }
 };
 
 class ArrayElemNode;
@@ -274,12 +347,27 @@ class ArrayElemNode final : public ExpressionNode
     Lhs name_{};
     ExprPtr index_{};
 
+    // Cleared by detail::Bounds when every index is proven in range.
+    mutable bool checked_ = true;
+
+    // Set by detail::Typer when the element read can only yield an integer,
+    // or the element stored to can only hold one.
+    mutable bool integer_ = false;
+
   public:
     ArrayElemNode(Lhs name, ExprPtr index)
         : name_(name)
         , index_(index)
     {}
 
+    bool isChecked() const { return checked_; }
+
+    void setChecked(bool checked) const { checked_ = checked; }
+
+    bool isInteger() const { return integer_; }
+
+    void setInteger(bool integer) const { integer_ = integer; }
+
     void accept(detail::Visitor& visitor) const override
     {
         visitor.visit(*this);
@@ -291,6 +379,10 @@ class ArrayElemNode final : public ExpressionNode
         index_->accept(visitor);
     }
 
+    ExprPtr getIndex() const { return index_; }
+
+    void setIndex(ExprPtr index) { index_ = index; }
+
     void acceptName(detail::Visitor& visitor) const
     {
         MSG("Accepting ArrayElem name\n");
@@ -302,13 +394,37 @@ class ArrayElemNode final : public ExpressionNode
     }
 
     std::string_view getName() const
+    {
+        return getVariable()->getName();
+    }
+
+    VariablePtr getVariable() const
     {
         if (auto var = std::get_if<VariablePtr>(&name_))
-            return (*var)->getName();
+            return *var;
 
         throw std::runtime_error("Can't get name of arrayElem\n");
     }
 
+    ArrayElemPtr getArrayElem() const
+    {
+        if (auto elem = std::get_if<ArrayElemPtr>(&name_))
+            return *elem;
+
+        throw std::runtime_error("ArrayElem doesn't hold arrayElem\n");
+    }
+
+    // Array variable at the bottom of an element chain like a[i][j].
+    VariablePtr getBase() const
+    {
+        const ArrayElemNode* elem = this;
+
+        while (elem->holdsArrayElem())
+            elem = elem->getArrayElem();
+
+        return elem->getVariable();
+    }
+
     bool holdsVariable() const
     {
         return std::holds_alternative<VariablePtr>(name_);
@@ -360,14 +476,77 @@ class AssignNode final : public ExpressionNode
 
     const Rhs& getSrc() const { return src_; }
 
+    void setSrc(Rhs src) { src_ = src; }
+
     const Lhs& getDest() const { return dest_; }
 };
 
-class WhileNode final : public ConditionalStatementNode
+class WhileNode : public ConditionalStatementNode
 {
+  public:
+    // How detail::Interpreter may run the iterations of a counted loop
+    // while (i < n) in parallel; set by detail::Parallel.
+    struct Plan
+    {
+        bool parallel = false;
+        detail::Binding loop; // of i
+        ExprPtr bound = nullptr; // n, the same in every iteration
+        StmtPtr body = nullptr;  // run once per iteration with i set
+
+        // Fewest iterations worth handing to the threads.
+        long long minimum = 0;
+
+        // Slots every worker keeps a copy of: the loop variable, the
+        // reductions and whatever the body assigns as a whole.
+        std::vector<bool> privates;
+
+        // Of them, slots the enclosing program sees the last iteration's
+        // value of.
+        std::vector<int> lasts;
+
+        std::vector<std::pair<int, BinaryOp>> reductions;
+
+        // Slots stepped by an invariant amount after i in every iteration.
+        std::vector<std::pair<int, ExprPtr>> steps;
+
+        // Shared arrays the body writes elements of.
+        std::vector<int> arrays;
+    };
+
+    // A loop while (i < n) { body; i = i + 1; } detail::Idioms found to
+    // fill, copy, reduce or scan a row of an array; detail::Interpreter runs
+    // it with a native kernel when the arrays turn out to be flat rows of
+    // integers the loop stays within.
+    struct Idiom
+    {
+        enum class Kind : uint8_t
+        {
+            NONE,
+            FILL,    // a[i] = e
+            COPY,    // a[i] = b[i]
+            SUM,     // s = s + b[i]
+            MIN,     // if (b[i] < s) s = b[i]
+            MAX,     // if (b[i] > s) s = b[i]
+            SCAN,    // a[i] = a[i - 1] + b[i]
+            RUNNING, // s = s + b[i]; a[i] = s
+        };
+
+        Kind kind = Kind::NONE;
+        detail::Binding loop;    // of i
+        ExprPtr bound = nullptr; // n, the same in every iteration
+        detail::Binding array;   // a
+        detail::Binding source;  // b
+        detail::Binding total;   // s
+        ExprPtr value = nullptr; // e, the same in every iteration
+    };
+
   private:
     ExprPtr cond_{};
     StmtPtr scope_{};
+    int line_ = 0;
+
+    mutable Plan plan_;
+    mutable Idiom idiom_;
 
   public:
     WhileNode(ExprPtr cond, StmtPtr scope)
@@ -377,6 +556,25 @@ class WhileNode final : public ConditionalStatementNode
 
     void acceptCond(detail::Visitor& visitor) const { cond_->accept(visitor); }
 
+    ExprPtr getCond() const { return cond_; }
+
+    void setCond(ExprPtr cond) { cond_ = cond; }
+
+    StmtPtr getScope() const { return scope_; }
+
+    // Source line of the loop, or 0 when it was not parsed.
+    int getLine() const { return line_; }
+
+    void setLine(int line) { line_ = line; }
+
+    const Plan& plan() const { return plan_; }
+
+    void setPlan(Plan&& plan) const { plan_ = std::move(plan); }
+
+    const Idiom& idiom() const { return idiom_; }
+
+    void setIdiom(const Idiom& idiom) const { idiom_ = idiom; }
+
     void acceptScope(detail::Visitor& visitor) const
     {
         scope_->accept(visitor);
@@ -388,6 +586,49 @@ class WhileNode final : public ConditionalStatementNode
     }
 };
 
+// pfor (i = a; i < b; s, ...) body is parsed into
+//
+//     { i = a; pfor.N = b; pfor (i < pfor.N) { body; i = i + 1; } }
+//
+// so every pass and engine may treat it as the while loop that runs its
+// iterations in order. detail::Interpreter runs them in parallel instead
+// when detail::Parallel has planned the loop that way; the variables listed
+// after the condition are reductions, updated as s = s + e or s = s * e.
+class PforNode final : public WhileNode
+{
+  private:
+    std::vector<std::string_view> reductions_;
+
+  public:
+    PforNode(ExprPtr cond, StmtPtr scope,
+             std::vector<std::string_view>&& reductions)
+        : WhileNode(cond, scope)
+        , reductions_(std::move(reductions))
+    {}
+
+    const std::vector<std::string_view>& getReductions() const
+    {
+        return reductions_;
+    }
+
+    // The body as parsed, or nullptr once the passes have reshaped the
+    // loop scope around it.
+    StmtPtr getBody() const
+    {
+        auto scope = dynamic_cast<const ScopeNode*>(getScope());
+
+        if (!scope || scope->nstms() != 2)
+            return nullptr;
+
+        return scope->getChildren().front();
+    }
+
+    void accept(detail::Visitor& visitor) const override
+    {
+        visitor.visit(*this);
+    }
+};
+
 class IfElseNode final : public StatementNode
 {
   private:
@@ -417,6 +658,14 @@ class IfElseNode final : public StatementNode
 
     void acceptCond(detail::Visitor& visitor) const { cond_->accept(visitor); }
 
+    ExprPtr getCond() const { return cond_; }
+
+    void setCond(ExprPtr cond) { cond_ = cond; }
+
+    StmtPtr getAction() const { return action_; }
+
+    StmtPtr getAltAction() const { return alt_action_; }
+
     void acceptAction(detail::Visitor& visitor) const
     {
         action_->accept(visitor);
@@ -445,6 +694,10 @@ class PrintNode final : public StatementNode
 
     void acceptExpr(detail::Visitor& visitor) const { expr_->accept(visitor); }
 
+    ExprPtr getExpr() const { return expr_; }
+
+    void setExpr(ExprPtr expr) { expr_ = expr; }
+
     void accept(detail::Visitor& visitor) const override
     {
         visitor.visit(*this);
@@ -1,10 +1,17 @@
+#include <chrono>
 #include <exception>
-#include <string> // for basic_string
+#include <optional>    // for optional
+#include <string>      // for basic_string
+#include <string_view> // for string_view
 
 #include "ast.hh"    // for AST
 #include "driver.hh" // for Driver
 #include "log.hh"    // for LOG, MSG
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h> // for isatty
+#endif
+
 int main(int argc, char** argv)
 {
     MSG("MACROSES:\n");
@@ -13,35 +20,242 @@ int main(int argc, char** argv)
 
     int status = 0;
 
-    Driver drv;
+    std::string file;
+    std::string input;
+    std::string cache;
+    AST::Engine engine = AST::Engine::INTERPRETER;
+    AST::Frontend frontend = AST::Frontend::BISON;
+    bool stats = false;
+    bool dumpIr = false;
+    bool timePasses = false;
+    bool parallelReport = false;
+    bool autoParallel = false;
+    bool stream = false;
+    int optLevel = 1;
+    int threads = 0;
+    std::optional<AST::detail::Flush> flush;
 
-    try
+    for (int id = 1; id < argc; ++id)
     {
-        if (argc <= 1)
+        std::string_view arg = argv[id];
+
+        if (arg == "--engine=vm")
+            engine = AST::Engine::VM;
+        else if (arg == "--engine=flat")
+            engine = AST::Engine::FLAT;
+        else if (arg == "--engine=interpreter")
+            engine = AST::Engine::INTERPRETER;
+        else if (arg == "--engine=ir")
+            engine = AST::Engine::IR;
+        else if (arg == "--parser=bison")
+            frontend = AST::Frontend::BISON;
+        else if (arg == "--parser=descent")
+            frontend = AST::Frontend::DESCENT;
+        else if (arg == "--stats")
+            stats = true;
+        else if (arg == "--dump-ir")
+            dumpIr = true;
+        else if (arg == "--time-passes")
+            timePasses = true;
+        else if (arg == "--parallel-report")
+            parallelReport = true;
+        else if (arg == "--auto-parallel")
+            autoParallel = true;
+        else if (arg == "--stream")
+            stream = true;
+        else if (arg.starts_with("--threads="))
         {
-            MSG("Reading from standard input.\n");
-            status = drv.parse("");
+            try
+            {
+                threads = std::stoi(std::string(arg.substr(10)));
+            }
+            catch (std::exception&)
+            {
+                threads = 0;
+            }
+
+            if (threads < 1)
+            {
+                std::cerr << "Invalid thread count: " << arg << '\n';
+                return 1;
+            }
+        }
+        else if (arg == "--flush=line")
+            flush = AST::detail::Flush::LINE;
+        else if (arg == "--flush=block")
+            flush = AST::detail::Flush::BLOCK;
+        else if (arg == "--flush=exit")
+            flush = AST::detail::Flush::EXIT;
+        else if (arg.starts_with("--input="))
+            input = arg.substr(8);
+        else if (arg.starts_with("--cache="))
+            cache = arg.substr(8);
+        else if (arg == "-O0" || arg == "-O1" || arg == "-O2")
+            optLevel = arg.back() - '0';
+        else if (arg.starts_with("--"))
+        {
+            std::cerr << "Unknown option: " << arg << '\n';
+            return 1;
         }
         else
-            status = drv.parse(argv[1]);
+            file = arg;
+    }
+
+    // Statements run as they are parsed only on the tree interpreter.
+    if (stream && (engine != AST::Engine::INTERPRETER || dumpIr))
+    {
+        std::cerr << "--stream runs on the interpreter only\n";
+        return 1;
+    }
+
+    Driver drv;
+
+    drv.setOptLevel(optLevel);
+    drv.setFrontend(frontend);
+    drv.setAutoParallel(autoParallel);
+    drv.setCacheDir(cache);
+
+    if (threads > 0)
+        drv.setThreads(static_cast<unsigned>(threads));
+
+    // A terminal sees every line as it is printed, as stdio would have it.
+#if defined(__unix__) || defined(__APPLE__)
+    if (!flush && isatty(STDOUT_FILENO))
+        flush = AST::detail::Flush::LINE;
+#endif
+
+    drv.setFlush(flush.value_or(AST::detail::Flush::BLOCK));
+
+    if (!input.empty())
+    {
+        try
+        {
+            drv.setInputFile(input);
+        }
+        catch (std::exception& e)
+        {
+            std::cerr << e.what();
+            return 1;
+        }
+    }
+
+    const auto printStats = [&drv]
+    {
+        const auto& fold = drv.foldStats();
+        const auto& elim = drv.elimStats();
+        const auto& hoist = drv.hoistStats();
+        const auto& reduce = drv.reduceStats();
+        const auto& number = drv.numberStats();
+        const auto& bounds = drv.boundsStats();
+        const auto& types = drv.typeStats();
+        const auto& idioms = drv.idiomStats();
+        const auto& parallel = drv.parallelStats();
+
+        std::cerr << "ast arena: " << drv.arena().bytesUsed() << " bytes used, "
+                  << drv.arena().bytesReserved() << " bytes in "
+                  << drv.arena().blocks() << " blocks\n"
+                  << "fold: " << fold.folded << " constants folded, "
+                  << fold.simplified << " identities applied\n"
+                  << "dce: " << elim.branches << " branches, " << elim.scopes
+                  << " scopes, " << elim.statements << " statements removed\n"
+                  << "licm: " << hoist.hoisted << " expressions hoisted\n"
+                  << "iv: " << reduce.inductions << " induction variables for "
+                  << reduce.products << " products\n"
+                  << "cse: " << number.reused << " evaluations saved\n"
+                  << "bounds: " << bounds.checked << " of " << bounds.accesses
+                  << " element accesses checked\n"
+                  << "types: " << types.integers << " of " << types.reads
+                  << " reads proven integer\n"
+                  << "idioms: " << idioms.fills << " fills, " << idioms.copies
+                  << " copies, " << idioms.reductions << " reductions, "
+                  << idioms.scans << " scans\n"
+                  << "pfor: " << parallel.parallel << " of " << parallel.loops
+                  << " loops run in parallel\n"
+                  << "while: " << parallel.automatic << " of " << parallel.whiles
+                  << " loops run in parallel\n";
+    };
+
+    const auto printTimings = [&drv]
+    {
+        for (const auto& pass : drv.passTimings())
+        {
+            const std::chrono::duration<double, std::milli> time = pass.time;
+
+            std::cerr << "time: " << pass.name << ' ' << time.count()
+                      << " ms\n";
+        }
+    };
+
+    const auto printReport = [&drv]
+    {
+        for (const auto& loop : drv.parallelReport())
+        {
+            std::cerr << "while loop at line " << loop.line << ": ";
+
+            if (loop.parallel)
+                std::cerr << "parallel\n";
+            else
+                std::cerr << "sequential, " << loop.reason << '\n';
+        }
+    };
+
+    // Every exit past this point reports what the flags ask for.
+    const auto finish = [&](int code)
+    {
+        if (stats)
+            printStats();
+
+        if (timePasses)
+            printTimings();
+
+        if (parallelReport)
+            printReport();
+
+        return code;
+    };
+
+    if (stream)
+    {
+        try
+        {
+            status = drv.stream(file);
+        }
+        catch (std::exception& e)
+        {
+            std::cerr << e.what();
+            status = 0;
+        }
+
+        return finish(status);
+    }
+
+    try
+    {
+        if (file.empty())
+            MSG("Reading from standard input.\n");
+
+        status = drv.parse(file);
     }
     catch (std::exception& e)
     {
         std::cerr << e.what();
-        return 0;
+        return finish(0);
     }
 
     LOG("global statements amount: {}\n", drv.getGlobalScope()->nstms());
 
     try
     {
-        drv.eval();
+        if (dumpIr)
+            drv.dumpIr(std::cerr);
+
+        drv.eval(engine);
     }
     catch (std::exception& e)
     {
         std::cerr << e.what();
-        return 0;
+        return finish(0);
     }
 
-    return status;
+    return finish(status);
 }
@@ -1,15 +1,27 @@
 #include <gtest/gtest.h>   // for Test, Message, TestInfo (ptr only), CmpHel...
+#include <algorithm>       // for find
+#include <climits>         // for INT_MAX, INT_MIN
+#include <filesystem>      // for remove, file_size
+#include <fstream>         // for ofstream
 #include <sstream>         // for basic_stringstream, basic_iostream, basic_...
 #include <stdexcept>       // for runtime_error
 #include <string>          // for basic_string, allocator, char_traits
 #include <string_view>     // for basic_string_view
+#include <tuple>           // for tuple
+#include <utility>         // for pair
 #include <vector>          // for vector
 
 #include "ast.hh"          // for AST
+#include "divisor.hh"      // for Divisor
 #include "driver.hh"       // for Driver
+#include "elementwise.hh"  // for elementwise
+#include "input.hh"        // for Input
 #include "interpreter.hh"  // for Interpreter
 #include "node.hh"         // for ConstantNode, BinaryOpNode, AssignNode
+#include "simd.hh"         // for kernel, Isa, Broadcast
+#include "source.hh"       // for Source
 #include "test_utils.hh"   // for run_test
+#include "thread_pool.hh"  // for ThreadPool
 
 TEST(common, basic_1) { test_utils::run_test("/common/basic_1"); }
 
@@ -96,6 +108,1344 @@ TEST(common, array_repeat_in_repeat) { test_utils::run_test("/common/array_repea
 
 TEST(common, array_super_multi_dim) { test_utils::run_test("/common/array_super_multi_dim"); }
 
+TEST(common, scope_chain) { test_utils::run_test("/common/scope_chain"); }
+
+TEST(common, array_copy) { test_utils::run_test("/common/array_copy"); }
+
+TEST(common, array_element_store) { test_utils::run_test("/common/array_element_store"); }
+
+TEST(common, constant_folding) { test_utils::run_test("/common/constant_folding"); }
+
+TEST(common, loop_invariants) { test_utils::run_test("/common/loop_invariants"); }
+
+TEST(common, strength_reduction) { test_utils::run_test("/common/strength_reduction"); }
+
+TEST(common, value_numbering) { test_utils::run_test("/common/value_numbering"); }
+
+TEST(common, bounds_checks) { test_utils::run_test("/common/bounds_checks"); }
+
+TEST(common, static_types) { test_utils::run_test("/common/static_types"); }
+
+TEST(common, pfor) { test_utils::run_test("/common/pfor"); }
+
+TEST(common, auto_parallel) { test_utils::run_test("/common/auto_parallel"); }
+
+TEST(common, elementwise) { test_utils::run_test("/common/elementwise"); }
+
+TEST(common, idioms) { test_utils::run_test("/common/idioms"); }
+
+// Every program of the corpus, on every engine at every level.
+class corpus
+    : public testing::TestWithParam<std::tuple<std::string, AST::Engine, int>>
+{};
+
+TEST_P(corpus, MatchesTheAnswer)
+{
+    const auto& [name, engine, optLevel] = GetParam();
+
+    test_utils::run_test("/common/" + name, engine, optLevel);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    engines, corpus,
+    testing::Combine(testing::ValuesIn(test_utils::corpus("/common")),
+                     testing::Values(AST::Engine::INTERPRETER, AST::Engine::VM,
+                                     AST::Engine::FLAT, AST::Engine::IR),
+                     testing::Values(0, 1, 2)),
+    [](const testing::TestParamInfo<corpus::ParamType>& param)
+    {
+        return std::get<0>(param.param) + "_" +
+               test_utils::engineName(std::get<1>(param.param)) + "_O" +
+               std::to_string(std::get<2>(param.param));
+    });
+
+TEST(resolver, UndeclaredBeforeExecution)
+{
+    std::stringstream out;
+
+    Driver drv(out);
+
+    drv.curScope().push_back(
+        drv.construct<AST::PrintNode>(drv.construct<AST::ConstantNode>(1)));
+    drv.curScope().push_back(
+        drv.construct<AST::PrintNode>(drv.construct<AST::VariableNode>("y")));
+    drv.formGlobalScope();
+
+    EXPECT_THROW(drv.eval(), std::runtime_error);
+    EXPECT_EQ(out.str(), "");
+}
+
+TEST(typer, ProvesIntegerReads)
+{
+    std::stringstream out;
+
+    Driver drv(out);
+
+    drv.parse(std::string(TEST_DATA_DIR) + "data/common/static_types.dat");
+    drv.eval(AST::Engine::VM);
+
+    // All but the read of the row m[1] and of x, which may be an array.
+    EXPECT_EQ(out.str(), test_utils::detail::getAnswer(
+                             std::string(TEST_DATA_DIR) +
+                             "data/common/static_types.ans"));
+    EXPECT_EQ(drv.typeStats().reads, 16U);
+    EXPECT_EQ(drv.typeStats().integers, 14U);
+}
+
+TEST(typer, ReportsIndexingIntegers)
+{
+    std::stringstream out;
+
+    Driver drv(out);
+
+    // print 1; x = 5; print x[0];
+    const auto x = drv.construct<AST::VariableNode>("x");
+
+    drv.curScope().push_back(
+        drv.construct<AST::PrintNode>(drv.construct<AST::ConstantNode>(1)));
+    drv.curScope().push_back(
+        drv.construct<AST::AssignNode>(x, drv.construct<AST::ConstantNode>(5)));
+    drv.curScope().push_back(drv.construct<AST::PrintNode>(
+        drv.construct<AST::ArrayElemNode>(x, drv.construct<AST::ConstantNode>(0))));
+    drv.formGlobalScope();
+
+    EXPECT_THROW(drv.eval(), std::runtime_error);
+    EXPECT_EQ(out.str(), "");
+}
+
+TEST(typer, ReportsMismatchedRanks)
+{
+    std::stringstream out;
+
+    Driver drv(out);
+
+    // print 1; v = repeat(0, 3); m = repeat(v, 2); print m + v;
+    const auto v = [&drv] { return drv.construct<AST::VariableNode>("v"); };
+    const auto m = [&drv] { return drv.construct<AST::VariableNode>("m"); };
+
+    drv.curScope().push_back(
+        drv.construct<AST::PrintNode>(drv.construct<AST::ConstantNode>(1)));
+    drv.curScope().push_back(drv.construct<AST::AssignNode>(
+        v(), drv.construct<AST::RepeatNode>(drv.construct<AST::ConstantNode>(0),
+                                            drv.construct<AST::ConstantNode>(3))));
+    drv.curScope().push_back(drv.construct<AST::AssignNode>(
+        m(), drv.construct<AST::RepeatNode>(v(),
+                                            drv.construct<AST::ConstantNode>(2))));
+    drv.curScope().push_back(drv.construct<AST::PrintNode>(
+        drv.construct<AST::BinaryOpNode>(m(), AST::BinaryOp::ADD, v())));
+    drv.formGlobalScope();
+
+    EXPECT_THROW(drv.eval(), std::runtime_error);
+    EXPECT_EQ(out.str(), "");
+}
+
+TEST(idioms, RecognizesLoops)
+{
+    std::stringstream out;
+
+    Driver drv(out);
+
+    drv.parse(std::string(TEST_DATA_DIR) + "data/common/idioms.dat");
+    drv.eval();
+
+    // All but the loop filling b with i * i.
+    EXPECT_EQ(out.str(), test_utils::detail::getAnswer(
+                             std::string(TEST_DATA_DIR) + "data/common/idioms.ans"));
+    EXPECT_EQ(drv.idiomStats().fills, 3U);
+    EXPECT_EQ(drv.idiomStats().copies, 1U);
+    EXPECT_EQ(drv.idiomStats().reductions, 3U);
+    EXPECT_EQ(drv.idiomStats().scans, 3U);
+}
+
+TEST(idioms, KeepsLoopsAtO0)
+{
+    std::stringstream out;
+
+    Driver drv(out);
+
+    drv.setOptLevel(0);
+    drv.parse(std::string(TEST_DATA_DIR) + "data/common/idioms.dat");
+    drv.eval();
+
+    EXPECT_EQ(drv.idiomStats().fills, 0U);
+    EXPECT_EQ(drv.idiomStats().scans, 0U);
+}
+
+TEST(idioms, FailsLikeTheLoop)
+{
+    std::stringstream out;
+
+    Driver drv(out);
+
+    // a = repeat(0, 3); i = 0; while (i < 5) { a[i] = 1; i = i + 1; }
+    const auto a = [&drv] { return drv.construct<AST::VariableNode>("a"); };
+    const auto i = [&drv] { return drv.construct<AST::VariableNode>("i"); };
+
+    drv.curScope().push_back(drv.construct<AST::AssignNode>(
+        a(), drv.construct<AST::RepeatNode>(drv.construct<AST::ConstantNode>(0),
+                                            drv.construct<AST::ConstantNode>(3))));
+    drv.curScope().push_back(
+        drv.construct<AST::AssignNode>(i(), drv.construct<AST::ConstantNode>(0)));
+    drv.curScope().push_back(drv.construct<AST::WhileNode>(
+        drv.construct<AST::BinaryOpNode>(i(), AST::BinaryOp::LS,
+                                         drv.construct<AST::ConstantNode>(5)),
+        drv.construct<AST::ScopeNode>(std::vector<AST::StmtPtr>{
+            drv.construct<AST::AssignNode>(
+                drv.construct<AST::ArrayElemNode>(a(), i()),
+                drv.construct<AST::ConstantNode>(1)),
+            drv.construct<AST::AssignNode>(
+                i(), drv.construct<AST::BinaryOpNode>(
+                         i(), AST::BinaryOp::ADD,
+                         drv.construct<AST::ConstantNode>(1)))})));
+    drv.curScope().push_back(drv.construct<AST::PrintNode>(i()));
+    drv.formGlobalScope();
+
+    EXPECT_THROW(drv.eval(), std::runtime_error);
+    EXPECT_EQ(drv.idiomStats().fills, 1U);
+}
+
+TEST(output, FormatsIntegers)
+{
+    std::stringstream out;
+
+    {
+        AST::detail::Output sink(out);
+
+        for (const int value : {0, -7, 42, INT_MIN, INT_MAX})
+            sink.print(value);
+    }
+
+    EXPECT_EQ(out.str(), "0\n-7\n42\n-2147483648\n2147483647\n");
+}
+
+TEST(output, KeepsTextLongerThanTheBuffer)
+{
+    std::stringstream out;
+
+    const std::string text(200000, 'x');
+
+    {
+        AST::detail::Output sink(out);
+
+        sink.print(1);
+        sink.write(text);
+        sink.print(2);
+    }
+
+    EXPECT_EQ(out.str(), "1\n" + text + "2\n");
+}
+
+TEST(output, FollowsThePolicy)
+{
+    std::stringstream out;
+
+    AST::detail::Output sink(out, AST::detail::Flush::EXIT);
+
+    sink.print(1);
+    sink.prompt();
+    EXPECT_EQ(out.str(), "");
+
+    sink.setFlush(AST::detail::Flush::BLOCK);
+    sink.print(2);
+    EXPECT_EQ(out.str(), "");
+    sink.prompt();
+    EXPECT_EQ(out.str(), "1\n2\n");
+
+    sink.setFlush(AST::detail::Flush::LINE);
+    sink.print(3);
+    EXPECT_EQ(out.str(), "1\n2\n3\n");
+}
+
+TEST(output, FlushedOnErrors)
+{
+    for (const auto engine : {AST::Engine::INTERPRETER, AST::Engine::VM,
+                              AST::Engine::FLAT, AST::Engine::IR})
+    {
+        std::stringstream out;
+
+        Driver drv(out);
+
+        // print 1; a = repeat(0, 3); print a[5];
+        const auto a = [&drv] { return drv.construct<AST::VariableNode>("a"); };
+
+        drv.curScope().push_back(
+            drv.construct<AST::PrintNode>(drv.construct<AST::ConstantNode>(1)));
+        drv.curScope().push_back(drv.construct<AST::AssignNode>(
+            a(), drv.construct<AST::RepeatNode>(drv.construct<AST::ConstantNode>(0),
+                                                drv.construct<AST::ConstantNode>(3))));
+        drv.curScope().push_back(drv.construct<AST::PrintNode>(
+            drv.construct<AST::ArrayElemNode>(a(), drv.construct<AST::ConstantNode>(5))));
+        drv.formGlobalScope();
+
+        EXPECT_THROW(drv.eval(engine), std::runtime_error);
+        EXPECT_EQ(out.str(), "1\n");
+    }
+}
+
+TEST(input, ReadsLikeTheStream)
+{
+    std::stringstream out;
+
+    AST::detail::Output sink(out);
+    AST::detail::Input input("  12 -3\n+7\t007\r\n2147483647 -2147483648 5x");
+
+    for (const int value : {12, -3, 7, 7, INT_MAX, INT_MIN, 5})
+        EXPECT_EQ(input.read(sink), value);
+
+    EXPECT_THROW(input.read(sink), std::runtime_error);
+}
+
+TEST(input, RejectsMalformedNumbers)
+{
+    std::stringstream out;
+
+    AST::detail::Output sink(out);
+
+    for (const char* text : {"", "  \n", "abc", "- 1", "+-1", "2147483648",
+                             "-2147483649", "99999999999"})
+    {
+        AST::detail::Input input(text);
+
+        EXPECT_THROW(input.read(sink), std::runtime_error) << text;
+    }
+}
+
+TEST(input, ReadsFilesInBlocks)
+{
+    const test_utils::detail::TempPath temp(".txt");
+    const auto& path = temp.path();
+
+    long long expected = 0;
+
+    {
+        std::ofstream os(path);
+
+        // Numbers of every length cross the block boundaries.
+        for (int id = 0; id < 100000; ++id)
+        {
+            const int value = (id % 2 ? -1 : 1) * (id * 7919 % 1000003);
+
+            os << value << (id % 5 ? " " : "\n");
+            expected += value;
+        }
+    }
+
+    std::stringstream out;
+
+    AST::detail::Output sink(out);
+    const auto input = AST::detail::Input::open(path.string());
+
+    long long sum = 0;
+
+    for (int id = 0; id < 100000; ++id)
+        sum += input->read(sink);
+
+    EXPECT_EQ(sum, expected);
+    EXPECT_THROW(input->read(sink), std::runtime_error);
+
+    std::filesystem::remove(path);
+
+    EXPECT_THROW(AST::detail::Input::open(path.string()), std::runtime_error);
+}
+
+TEST(input, InjectedIntoEveryEngine)
+{
+    for (const auto engine : {AST::Engine::INTERPRETER, AST::Engine::VM,
+                              AST::Engine::FLAT, AST::Engine::IR})
+    {
+        std::stringstream out;
+
+        Driver drv(out);
+
+        drv.setInput("7\n");
+        drv.parse(std::string(TEST_DATA_DIR) + "data/common/user_input_1.dat");
+        drv.eval(engine);
+
+        EXPECT_EQ(out.str(), "35\n");
+    }
+}
+
+TEST(source, EndsWithTwoNuls)
+{
+    const test_utils::detail::TempPath temp;
+    const auto& path = temp.path();
+
+    // Around page boundaries, where the NULs are not in the file's pages.
+    for (const size_t size : {0U, 1U, 4094U, 4095U, 4096U, 4097U, 8192U})
+    {
+        std::ofstream(path, std::ios::binary) << std::string(size, 'a');
+
+        AST::detail::Source source;
+
+        source.open(path.string());
+
+        ASSERT_EQ(source.size(), size);
+        EXPECT_EQ(std::string_view(source.data(), size), std::string(size, 'a'));
+        EXPECT_EQ(source.data()[size], '\0');
+        EXPECT_EQ(source.data()[size + 1], '\0');
+
+        // What the scanner writes stays in memory.
+        source.data()[size] = 'b';
+    }
+
+    EXPECT_EQ(std::filesystem::file_size(path), 8192U);
+
+    std::filesystem::remove(path);
+
+    AST::detail::Source source;
+
+    EXPECT_THROW(source.open(path.string()), std::runtime_error);
+}
+
+TEST(source, TokensNameInternedSymbols)
+{
+    const test_utils::detail::TempPath path;
+
+    std::ofstream(path.path()) << "abc = b + 12;\nprint abc; // b\n";
+
+    Driver drv;
+
+    EXPECT_EQ(drv.tokenize(path.string()), 9U);
+
+    const int abc = drv.intern("abc");
+    const int b = drv.intern("b");
+
+    EXPECT_NE(abc, b);
+    EXPECT_EQ(drv.intern(std::string("abc")), abc);
+    EXPECT_EQ(drv.symbolName(abc), "abc");
+    EXPECT_EQ(drv.internName("b"), drv.symbolName(b));
+}
+
+TEST(descent, MatchesBisonOnTestData)
+{
+    size_t programs = 0;
+
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(
+             std::string(TEST_DATA_DIR) + "data"))
+    {
+        if (entry.path().extension() != ".dat")
+            continue;
+
+        const std::string file = entry.path().string();
+
+        EXPECT_EQ(test_utils::detail::getTree(file, AST::Frontend::DESCENT),
+                  test_utils::detail::getTree(file, AST::Frontend::BISON))
+            << file;
+
+        ++programs;
+    }
+
+    EXPECT_GT(programs, 40U);
+}
+
+TEST(descent, MatchesBisonOnCornerCases)
+{
+    const test_utils::detail::TempPath path;
+
+    const std::vector<std::string> programs = {
+        "b + a = 3 * 2 || x;",
+        "-a = b + c; !a[1] = 2; - -a;",
+        "a = b = c = 4;",
+        "a = repeat(0, 3) + 1;",
+        "x * a = repeat(repeat(undef, 2), 3) + 1;",
+        "a = array(1, 2, 3); b = array(); c = array(4, );",
+        "d = array(x = array(5), 6 + y, z = repeat(1, 2));",
+        "a[1][2] = a[0][x = 1] = 3;",
+        "if (a) if (b) print 1; else print 2;",
+        "if (a) print 1; else if (b) print 2; else if (c) print 3; else print 4;",
+        "if (a) print 1; else  if (b) print 2;",
+        "; x = 1; { ; } { } { ; x = 2; }",
+        "while (i < 10) {\n i = i + 1; }\n\n while (j) j = j - 1;",
+        "pfor (i = 0; i < n) a[i] = i;",
+        "pfor (k = j = 0; k < n + 1 < 3; s, t) { s = s + k; }",
+        "print a < b < c == d != e && f || g % h / i * j - k + -l;",
+        "print a || b && c == d < e + f * !g;",
+        "x = (a = 3) * 2; y = ?; print (?);",
+        "if (a) print 1; else\tif (b) print 2; else\nif (c) print 3;",
+        "x = 007;\r\nprint x; // no newline after this",
+        "//",
+        "",
+        ";",
+        // Rejected by both.
+        "x = 1; ;",
+        "a[0] = array(1);",
+        "(a) = 1;",
+        "pfor (i = 0; j < n) print i;",
+        "pfor (i = 0; i < n; ) print i;",
+        "pfor (i = 0; i < n; s,) print i;",
+        "x = 2147483648;",
+        "x = 1 $ 2;",
+        "if (a) print 1; else ifx = 2; elseif = 3;",
+        "{ x = 1;",
+        "x = 1; }",
+        "array(1);",
+        "print repeat(1, 2);",
+        "x = array(, 1);",
+        "x = repeat(undef);",
+        "if (x) else print 1;",
+        "while (x);",
+        "x = 1",
+        "print;",
+        std::string("x = 1;\0 print x;", 16),
+    };
+
+    for (const auto& program : programs)
+    {
+        std::ofstream(path.path()) << program;
+
+        const std::string file = path.string();
+
+        EXPECT_EQ(test_utils::detail::getTree(file, AST::Frontend::DESCENT),
+                  test_utils::detail::getTree(file, AST::Frontend::BISON))
+            << program;
+    }
+}
+
+TEST(stream, MatchesTheWholeProgram)
+{
+    size_t programs = 0;
+
+    for (const auto& entry : std::filesystem::directory_iterator(
+             std::string(TEST_DATA_DIR) + "data/common"))
+    {
+        std::filesystem::path answer = entry.path();
+
+        answer.replace_extension(".ans");
+
+        if (entry.path().extension() != ".dat" ||
+            !std::filesystem::exists(answer))
+            continue;
+
+        const std::string file = entry.path().string();
+        const std::string expected =
+            test_utils::detail::getAnswer(answer.string());
+
+        for (int optLevel : {0, 1, 2})
+            EXPECT_EQ(test_utils::detail::getStreamedResult(file, optLevel),
+                      expected)
+                << file << " -O" << optLevel;
+
+        EXPECT_EQ(test_utils::detail::getStreamedResult(
+                      file, 1, AST::Frontend::DESCENT),
+                  expected)
+            << file;
+
+        ++programs;
+    }
+
+    EXPECT_GT(programs, 30U);
+}
+
+TEST(stream, RunsStatementsBeforeAnError)
+{
+    const test_utils::detail::TempPath path;
+
+    const std::vector<std::pair<std::string, std::string>> programs = {
+        {"a = 2; print a; print c; print 5;",
+         "2\nUndeclared variable: c\n"},
+        {"a = 2; print a; print a +; print 5;", "2\nSemantic error\n"},
+        {"a = 2; print a; print a / 0; print 5 +;", "2\nDivide by zero"},
+        {"x = 1; print x; x = array(1, 2); print x[1]; print x[5];",
+         "1\n2\nArray index out of range\n"},
+        {"{ a = 1; } a = 2; { print a; b = a; } print b;",
+         "2\nUndeclared variable: b\n"},
+    };
+
+    for (const auto& [program, expected] : programs)
+    {
+        std::ofstream(path.path()) << program;
+
+        EXPECT_EQ(test_utils::detail::getStreamedResult(path.string()),
+                  expected)
+            << program;
+    }
+}
+
+TEST(cache, LoadsTheTreeItStored)
+{
+    const test_utils::detail::TempPath dir("");
+
+    size_t programs = 0;
+
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(
+             std::string(TEST_DATA_DIR) + "data"))
+    {
+        if (entry.path().extension() != ".dat")
+            continue;
+
+        const std::string file = entry.path().string();
+
+        std::filesystem::path answer = entry.path();
+
+        answer.replace_extension(".ans");
+
+        for (int optLevel : {0, 1})
+        {
+            std::string trees[2];
+
+            for (bool warm : {false, true})
+            {
+                std::stringstream out;
+                std::stringstream tree;
+
+                Driver drv(out);
+
+                drv.setOptLevel(optLevel);
+                drv.setCacheDir(dir.string());
+
+                try
+                {
+                    drv.parse(file);
+                }
+                catch (std::runtime_error&)
+                {
+                    break;
+                }
+
+                EXPECT_EQ(drv.fromCache(), warm) << file;
+
+                test_utils::detail::dumpTree(tree, drv.getGlobalScope());
+                trees[warm] = tree.str();
+
+                if (!warm || !std::filesystem::exists(answer))
+                    continue;
+
+                drv.eval();
+
+                EXPECT_EQ(out.str(),
+                          test_utils::detail::getAnswer(answer.string()))
+                    << file << " -O" << optLevel;
+            }
+
+            EXPECT_EQ(trees[1], trees[0]) << file << " -O" << optLevel;
+        }
+
+        ++programs;
+    }
+
+    EXPECT_GT(programs, 40U);
+}
+
+TEST(cache, RejectsStaleAndDamagedFiles)
+{
+    const test_utils::detail::TempPath temp("");
+    const test_utils::detail::TempPath source;
+    const auto& dir = temp.path();
+    const auto& path = source.path();
+
+    const auto run = [&](bool cached)
+    {
+        std::stringstream out;
+
+        Driver drv(out);
+
+        drv.setCacheDir(dir.string());
+        drv.parse(path.string());
+
+        EXPECT_EQ(drv.fromCache(), cached);
+
+        drv.eval();
+
+        return out.str();
+    };
+
+    std::ofstream(path) << "a = array(1, -2, 3); x = 0; i = 0;\n"
+                           "while (i < 3) { x = x + a[i] * 2; i = i + 1; }\n"
+                           "print x;";
+
+    EXPECT_EQ(run(false), "4\n");
+    EXPECT_EQ(run(true), "4\n");
+
+    const auto file = std::filesystem::directory_iterator(dir)->path();
+    const auto size = std::filesystem::file_size(file);
+
+    // The signature, the version, the build, the fold stats, the checksum,
+    // the source text, the tree.
+    for (const auto offset :
+         {size_t{0}, size_t{8}, size_t{16}, size_t{40}, size_t{56}, size_t{70},
+          static_cast<size_t>(size - 1)})
+    {
+        std::fstream fs(file, std::ios::in | std::ios::out | std::ios::binary);
+
+        fs.seekg(static_cast<std::streamoff>(offset));
+
+        const char byte = static_cast<char>(fs.get() ^ 0x20);
+
+        fs.seekp(static_cast<std::streamoff>(offset));
+        fs.put(byte);
+        fs.close();
+
+        EXPECT_EQ(run(false), "4\n") << offset;
+        EXPECT_EQ(run(true), "4\n") << offset;
+    }
+
+    std::filesystem::resize_file(file, size / 2);
+
+    EXPECT_EQ(run(false), "4\n");
+    EXPECT_EQ(run(true), "4\n");
+
+    // Another source is another file.
+    std::ofstream(path) << "print 5;";
+
+    EXPECT_EQ(run(false), "5\n");
+    EXPECT_EQ(run(true), "5\n");
+
+    // The file of a source of the same length under the name of this one,
+    // as on a hash collision, is told apart by its text.
+    std::vector<std::filesystem::path> before;
+
+    for (const auto& entry : std::filesystem::directory_iterator(dir))
+        before.push_back(entry.path());
+
+    std::ofstream(path) << "print 6;";
+
+    EXPECT_EQ(run(false), "6\n");
+
+    for (const auto& entry : std::filesystem::directory_iterator(dir))
+        if (std::find(before.begin(), before.end(), entry.path()) ==
+            before.end())
+            for (const auto& other : before)
+                if (other != file)
+                    std::filesystem::copy_file(
+                        other, entry.path(),
+                        std::filesystem::copy_options::overwrite_existing);
+
+    EXPECT_EQ(run(false), "6\n");
+    EXPECT_EQ(run(true), "6\n");
+
+    size_t files = 0;
+
+    for ([[maybe_unused]] const auto& entry :
+         std::filesystem::directory_iterator(dir))
+        ++files;
+
+    EXPECT_EQ(files, 3U);
+}
+
+TEST(pfor, RunsIterationsInParallel)
+{
+    std::stringstream out;
+
+    Driver drv(out);
+
+    drv.setThreads(4);
+    drv.parse(std::string(TEST_DATA_DIR) + "data/common/pfor.dat");
+    drv.eval();
+
+    EXPECT_EQ(out.str(), test_utils::detail::getAnswer(
+                             std::string(TEST_DATA_DIR) + "data/common/pfor.ans"));
+    EXPECT_EQ(drv.parallelStats().loops, 6U);
+    EXPECT_EQ(drv.parallelStats().parallel, 6U);
+}
+
+TEST(pfor, PrintsUpToFailingIteration)
+{
+    std::stringstream out;
+
+    Driver drv(out);
+
+    // a = repeat(0, 4); pfor (i = 0; i < 100) { print i; a[i] = 1; }
+    const auto a = drv.construct<AST::VariableNode>("a");
+    const auto i = [&drv] { return drv.construct<AST::VariableNode>("i"); };
+
+    drv.curScope().push_back(drv.construct<AST::AssignNode>(
+        a, drv.construct<AST::RepeatNode>(drv.construct<AST::ConstantNode>(0),
+                                          drv.construct<AST::ConstantNode>(4))));
+    drv.curScope().push_back(drv.makePfor(
+        i(), drv.construct<AST::ConstantNode>(0),
+        drv.construct<AST::ConstantNode>(100),
+        drv.construct<AST::ScopeNode>(std::vector<AST::StmtPtr>{
+            drv.construct<AST::PrintNode>(i()),
+            drv.construct<AST::AssignNode>(
+                drv.construct<AST::ArrayElemNode>(
+                    drv.construct<AST::VariableNode>("a"), i()),
+                drv.construct<AST::ConstantNode>(1))}),
+        {}));
+    drv.formGlobalScope();
+    drv.setThreads(4);
+
+    EXPECT_THROW(drv.eval(), std::runtime_error);
+    EXPECT_EQ(out.str(), "0\n1\n2\n3\n4\n");
+    EXPECT_EQ(drv.parallelStats().parallel, 1U);
+}
+
+TEST(pfor, ReportsSharedAssignments)
+{
+    std::stringstream out;
+
+    Driver drv(out);
+
+    // x = 0; pfor (i = 0; i < 10) x = i;
+    drv.curScope().push_back(drv.construct<AST::AssignNode>(
+        drv.construct<AST::VariableNode>("x"),
+        drv.construct<AST::ConstantNode>(0)));
+    drv.curScope().push_back(drv.makePfor(
+        drv.construct<AST::VariableNode>("i"),
+        drv.construct<AST::ConstantNode>(0),
+        drv.construct<AST::ConstantNode>(10),
+        drv.construct<AST::AssignNode>(drv.construct<AST::VariableNode>("x"),
+                                       drv.construct<AST::VariableNode>("i")),
+        {}));
+    drv.formGlobalScope();
+
+    EXPECT_THROW(drv.eval(AST::Engine::VM), std::runtime_error);
+    EXPECT_EQ(out.str(), "");
+}
+
+TEST(parallel, RunsIndependentWhileLoops)
+{
+    std::stringstream out;
+
+    Driver drv(out);
+
+    drv.setThreads(4);
+    drv.setOptLevel(2);
+    drv.setAutoParallel(true);
+    drv.parse(std::string(TEST_DATA_DIR) + "data/common/auto_parallel.dat");
+    drv.eval();
+
+    EXPECT_EQ(out.str(), test_utils::detail::getAnswer(
+                             std::string(TEST_DATA_DIR) +
+                             "data/common/auto_parallel.ans"));
+    EXPECT_EQ(drv.parallelStats().whiles, 7U);
+    EXPECT_EQ(drv.parallelStats().automatic, 5U);
+
+    const std::vector<AST::detail::LoopReport>& report = drv.parallelReport();
+
+    ASSERT_EQ(report.size(), 7U);
+    EXPECT_EQ(report[0].line, 6);
+    EXPECT_TRUE(report[0].parallel);
+    EXPECT_EQ(report[5].line, 65);
+    EXPECT_FALSE(report[5].parallel);
+    EXPECT_EQ(report[5].reason, "it carries s from one iteration to the next");
+    EXPECT_EQ(report[6].reason,
+              "different iterations may access the same element of a");
+}
+
+TEST(parallel, KeepsWhileLoopsInOrderAtO0)
+{
+    std::stringstream out;
+
+    Driver drv(out);
+
+    drv.setThreads(4);
+    drv.setOptLevel(0);
+    drv.setAutoParallel(true);
+    drv.parse(std::string(TEST_DATA_DIR) + "data/common/auto_parallel.dat");
+    drv.eval();
+
+    EXPECT_EQ(out.str(), test_utils::detail::getAnswer(
+                             std::string(TEST_DATA_DIR) +
+                             "data/common/auto_parallel.ans"));
+    EXPECT_EQ(drv.parallelStats().automatic, 0U);
+    EXPECT_EQ(drv.parallelReport().front().reason,
+              "loops run as written without --auto-parallel at -O1 or -O2");
+}
+
+TEST(parallel, KeepsWhileLoopsInOrderByDefault)
+{
+    std::stringstream out;
+
+    Driver drv(out);
+
+    drv.setThreads(4);
+    drv.setOptLevel(2);
+    drv.parse(std::string(TEST_DATA_DIR) + "data/common/auto_parallel.dat");
+    drv.eval();
+
+    EXPECT_EQ(out.str(), test_utils::detail::getAnswer(
+                             std::string(TEST_DATA_DIR) +
+                             "data/common/auto_parallel.ans"));
+    EXPECT_EQ(drv.parallelStats().whiles, 7U);
+    EXPECT_EQ(drv.parallelStats().automatic, 0U);
+}
+
+TEST(parallel, PrintsUpToFailingIteration)
+{
+    std::stringstream out;
+
+    Driver drv(out);
+
+    // a = repeat(0, 4); i = 0;
+    // while (i < 2000) { a[i] = 1; i = i + 1; } print 5;
+    const auto var = [&drv](const char* name)
+    { return drv.construct<AST::VariableNode>(name); };
+    const auto num = [&drv](int value)
+    { return drv.construct<AST::ConstantNode>(value); };
+
+    drv.curScope().push_back(drv.construct<AST::AssignNode>(
+        var("a"), drv.construct<AST::RepeatNode>(num(0), num(4))));
+    drv.curScope().push_back(drv.construct<AST::AssignNode>(var("i"), num(0)));
+    drv.curScope().push_back(drv.construct<AST::WhileNode>(
+        drv.construct<AST::BinaryOpNode>(var("i"), AST::BinaryOp::LS, num(2000)),
+        drv.construct<AST::ScopeNode>(std::vector<AST::StmtPtr>{
+            drv.construct<AST::AssignNode>(
+                drv.construct<AST::ArrayElemNode>(var("a"), var("i")), num(1)),
+            drv.construct<AST::AssignNode>(
+                var("i"), drv.construct<AST::BinaryOpNode>(
+                              var("i"), AST::BinaryOp::ADD, num(1)))})));
+    drv.curScope().push_back(drv.construct<AST::PrintNode>(num(5)));
+    drv.formGlobalScope();
+    drv.setThreads(4);
+    drv.setAutoParallel(true);
+
+    EXPECT_THROW(drv.eval(), std::runtime_error);
+    EXPECT_EQ(out.str(), "");
+    EXPECT_EQ(drv.parallelStats().automatic, 1U);
+}
+
+TEST(thread_pool, RunsEveryIterationOnce)
+{
+    AST::detail::ThreadPool pool(4);
+    std::vector<int> runs(10000, 0);
+
+    pool.run(0, 10000, 7, [&runs](unsigned, long long begin, long long end)
+    {
+        EXPECT_LE(end - begin, 7);
+
+        for (long long id = begin; id < end; ++id)
+            ++runs[static_cast<size_t>(id)];
+    });
+
+    EXPECT_EQ(std::count(runs.begin(), runs.end(), 1), 10000);
+}
+
+TEST(folder, FoldsConstantSubtrees)
+{
+    std::stringstream out;
+
+    Driver drv(out);
+
+    // print (3 * 4) - x * 1;
+    const auto x = drv.construct<AST::VariableNode>("x");
+    const auto expr = drv.construct<AST::BinaryOpNode>(
+        drv.construct<AST::BinaryOpNode>(drv.construct<AST::ConstantNode>(3),
+                                         AST::BinaryOp::MUL,
+                                         drv.construct<AST::ConstantNode>(4)),
+        AST::BinaryOp::SUB,
+        drv.construct<AST::BinaryOpNode>(x, AST::BinaryOp::MUL,
+                                         drv.construct<AST::ConstantNode>(1)));
+
+    drv.curScope().push_back(drv.construct<AST::AssignNode>(
+        x, drv.construct<AST::ConstantNode>(2)));
+    drv.curScope().push_back(drv.construct<AST::PrintNode>(expr));
+    drv.formGlobalScope();
+
+    drv.eval();
+
+    EXPECT_EQ(out.str(), "10\n");
+    EXPECT_EQ(drv.foldStats().folded, 1);
+    EXPECT_EQ(drv.foldStats().simplified, 1);
+    EXPECT_EQ(expr->getRight(), x);
+}
+
+TEST(folder, KeepsDivisionByZero)
+{
+    Driver drv;
+
+    const auto div = drv.construct<AST::BinaryOpNode>(
+        drv.construct<AST::ConstantNode>(42), AST::BinaryOp::DIV,
+        drv.construct<AST::BinaryOpNode>(drv.construct<AST::ConstantNode>(1),
+                                         AST::BinaryOp::SUB,
+                                         drv.construct<AST::ConstantNode>(1)));
+
+    drv.curScope().push_back(drv.construct<AST::PrintNode>(div));
+    drv.formGlobalScope();
+
+    EXPECT_THROW(drv.eval(), std::runtime_error);
+    EXPECT_EQ(drv.foldStats().folded, 1);
+}
+
+TEST(eliminator, RemovesDeadCode)
+{
+    std::stringstream out;
+
+    Driver drv(out);
+
+    drv.setOptLevel(2);
+
+    // x = 1; x = 2; if (0) print 5; {} while (0) print 6; print x;
+    const auto x = drv.construct<AST::VariableNode>("x");
+
+    drv.curScope().push_back(drv.construct<AST::AssignNode>(
+        x, drv.construct<AST::ConstantNode>(1)));
+    drv.curScope().push_back(drv.construct<AST::AssignNode>(
+        x, drv.construct<AST::ConstantNode>(2)));
+    drv.curScope().push_back(drv.construct<AST::IfElseNode>(
+        drv.construct<AST::ConstantNode>(0),
+        drv.construct<AST::PrintNode>(drv.construct<AST::ConstantNode>(5))));
+    drv.curScope().push_back(
+        drv.construct<AST::ScopeNode>(std::vector<AST::StmtPtr>{}));
+    drv.curScope().push_back(drv.construct<AST::WhileNode>(
+        drv.construct<AST::ConstantNode>(0),
+        drv.construct<AST::PrintNode>(drv.construct<AST::ConstantNode>(6))));
+    drv.curScope().push_back(drv.construct<AST::PrintNode>(x));
+    drv.formGlobalScope();
+
+    drv.eval();
+
+    EXPECT_EQ(out.str(), "2\n");
+    EXPECT_EQ(drv.elimStats().statements, 1);
+    EXPECT_EQ(drv.elimStats().branches, 2);
+    EXPECT_EQ(drv.elimStats().scopes, 1);
+    EXPECT_EQ(drv.getGlobalScope()->nstms(), 2);
+}
+
+TEST(eliminator, KeepsStoresThatMayFail)
+{
+    Driver drv;
+
+    drv.setOptLevel(2);
+
+    // y = 0; x = 1 / y;
+    const auto y = drv.construct<AST::VariableNode>("y");
+
+    drv.curScope().push_back(drv.construct<AST::AssignNode>(
+        y, drv.construct<AST::ConstantNode>(0)));
+    drv.curScope().push_back(drv.construct<AST::AssignNode>(
+        drv.construct<AST::VariableNode>("x"),
+        drv.construct<AST::BinaryOpNode>(drv.construct<AST::ConstantNode>(1),
+                                         AST::BinaryOp::DIV, y)));
+    drv.formGlobalScope();
+
+    EXPECT_THROW(drv.eval(), std::runtime_error);
+    EXPECT_EQ(drv.elimStats().statements, 0);
+}
+
+TEST(hoister, HoistsInvariantExpressions)
+{
+    std::stringstream out;
+
+    Driver drv(out);
+
+    drv.setOptLevel(2);
+    drv.parse(std::string(TEST_DATA_DIR) + "data/common/loop_invariants.dat");
+    drv.eval(AST::Engine::VM);
+
+    // k * k + i * m out of the inner loop, then k * k out of the outer one;
+    // k - 1; n * m and k - 4. local * 3 stays in its scope, and i * m is an
+    // induction variable of the outer loop by now.
+    EXPECT_EQ(out.str(), "21\n22\n0\n23\n4\n366\n");
+    EXPECT_EQ(drv.hoistStats().hoisted, 5);
+    EXPECT_EQ(drv.reduceStats().inductions, 1);
+    EXPECT_EQ(drv.reduceStats().products, 2);
+}
+
+TEST(reducer, DerivesInductionVariables)
+{
+    std::stringstream out;
+
+    Driver drv(out);
+
+    drv.setOptLevel(2);
+    drv.parse(std::string(TEST_DATA_DIR) + "data/common/strength_reduction.dat");
+    drv.eval(AST::Engine::FLAT);
+
+    // y * w, x * 10, y * 100, n * 5 and k * 3 (three times).
+    EXPECT_EQ(out.str(), test_utils::detail::getAnswer(
+                             std::string(TEST_DATA_DIR) +
+                             "data/common/strength_reduction.ans"));
+    EXPECT_EQ(drv.reduceStats().inductions, 5);
+    EXPECT_EQ(drv.reduceStats().products, 7);
+}
+
+TEST(numbering, ReusesValues)
+{
+    std::stringstream out;
+
+    Driver drv(out);
+
+    drv.setOptLevel(2);
+    drv.parse(std::string(TEST_DATA_DIR) + "data/common/value_numbering.dat");
+    drv.eval(AST::Engine::VM);
+
+    // m[i - 1][j] and j - 1 in the loop; two a[k] and a[k] + 1 in x; one
+    // a[k] each in y and z, and x / y; a[0] in the condition and in the
+    // branch, which is a block of its own; a[0] and b[0] in the last print.
+    EXPECT_EQ(out.str(), test_utils::detail::getAnswer(
+                             std::string(TEST_DATA_DIR) +
+                             "data/common/value_numbering.ans"));
+    EXPECT_EQ(drv.numberStats().reused, 12);
+}
+
+TEST(bounds, EliminatesProvenChecks)
+{
+    std::stringstream out;
+
+    Driver drv(out);
+
+    drv.parse(std::string(TEST_DATA_DIR) + "data/common/bounds_checks.dat");
+    drv.eval(AST::Engine::VM);
+
+    // a[j / 2] and b[a[1]] keep their checks.
+    EXPECT_EQ(out.str(), test_utils::detail::getAnswer(
+                             std::string(TEST_DATA_DIR) +
+                             "data/common/bounds_checks.ans"));
+    EXPECT_EQ(drv.boundsStats().accesses, 13);
+    EXPECT_EQ(drv.boundsStats().checked, 2);
+}
+
+TEST(bounds, ThrowsOutOfRange)
+{
+    for (const AST::Engine engine :
+         {AST::Engine::INTERPRETER, AST::Engine::VM, AST::Engine::FLAT,
+          AST::Engine::IR})
+    {
+        std::stringstream out;
+
+        Driver drv(out);
+
+        // a = repeat(0, 3); i = 0; while (i < 4) { a[i] = i; i = i + 1; }
+        const auto a = drv.construct<AST::VariableNode>("a");
+        const auto i = drv.construct<AST::VariableNode>("i");
+
+        drv.curScope().push_back(drv.construct<AST::AssignNode>(
+            a, drv.construct<AST::RepeatNode>(
+                   drv.construct<AST::ConstantNode>(0),
+                   drv.construct<AST::ConstantNode>(3))));
+        drv.curScope().push_back(drv.construct<AST::AssignNode>(
+            i, drv.construct<AST::ConstantNode>(0)));
+        drv.curScope().push_back(drv.construct<AST::WhileNode>(
+            drv.construct<AST::BinaryOpNode>(i, AST::BinaryOp::LS,
+                                             drv.construct<AST::ConstantNode>(4)),
+            drv.construct<AST::ScopeNode>(std::vector<AST::StmtPtr>{
+                drv.construct<AST::AssignNode>(
+                    drv.construct<AST::ArrayElemNode>(a, i), i),
+                drv.construct<AST::AssignNode>(
+                    i, drv.construct<AST::BinaryOpNode>(
+                           i, AST::BinaryOp::ADD,
+                           drv.construct<AST::ConstantNode>(1)))})));
+        drv.formGlobalScope();
+
+        EXPECT_THROW(drv.eval(engine), std::runtime_error);
+        EXPECT_EQ(drv.boundsStats().checked, 1);
+    }
+}
+
+TEST(ssa, BuildsPhis)
+{
+    std::stringstream out;
+    std::stringstream dump;
+
+    Driver drv(out);
+
+    drv.setOptLevel(0);
+    drv.parse(std::string(TEST_DATA_DIR) + "data/common/while_1.dat");
+    drv.dumpIr(dump);
+
+    // The loop counter lives in a phi of the loop header.
+    EXPECT_NE(dump.str().find("phi"), std::string::npos);
+    EXPECT_EQ(dump.str().find("load"), std::string::npos);
+}
+
+TEST(ssa, RunsThePassesOfTheLevel)
+{
+    const std::string file =
+        std::string(TEST_DATA_DIR) + "data/common/strength_reduction.dat";
+    const std::string answer = test_utils::detail::getAnswer(
+        std::string(TEST_DATA_DIR) + "data/common/strength_reduction.ans");
+
+    const std::vector<std::vector<std::string>> pipelines = {
+        {"resolve", "types", "pfor", "parallel", "ir-build"},
+        {"fold", "resolve", "types", "pfor", "bounds", "idioms", "parallel",
+         "ir-build"},
+        {"fold", "resolve", "types", "pfor", "dce", "iv", "licm", "cse",
+         "types", "bounds", "idioms", "parallel", "ir-build"},
+    };
+
+    for (int level : {0, 1, 2})
+    {
+        std::stringstream out;
+
+        Driver drv(out);
+
+        drv.setOptLevel(level);
+        drv.parse(file);
+        drv.eval(AST::Engine::IR);
+
+        EXPECT_EQ(out.str(), answer) << "-O" << level;
+
+        std::vector<std::string> names;
+
+        for (const auto& pass : drv.passTimings())
+            names.emplace_back(pass.name);
+
+        EXPECT_EQ(names, pipelines[static_cast<size_t>(level)])
+            << "-O" << level;
+    }
+}
+
+TEST(divisor, DividesAlikeOnEveryEngine)
+{
+    // x is proven an integer in the first program of each pair; in the
+    // second it may hold an array, so / and % go the elementwise way.
+    const std::vector<std::pair<std::string, std::string>> programs = {
+        {"print 42 / 0;", "Divide by zero"},
+        {"x = 5; print x % 0;", "Divide by zero"},
+        {"x = 5; if (x > 9) x = array(1); print x % 0;", "Divide by zero"},
+        {"x = 5; print x / 0;", "Divide by zero"},
+        {"x = 5; if (x > 9) x = array(1); print x / 0;", "Divide by zero"},
+        {"x = -2147483647 - 1; y = -1; print x / y; print x % y;",
+         "-2147483648\n0\n"},
+        {"x = -2147483647 - 1; y = -1; if (y > 9) x = array(1);"
+         " print x / y; print x % y;",
+         "-2147483648\n0\n"},
+    };
+
+    for (const auto& [program, answer] : programs)
+        for (auto engine : {AST::Engine::INTERPRETER, AST::Engine::VM,
+                            AST::Engine::FLAT, AST::Engine::IR})
+            for (int optLevel : {0, 1, 2})
+                EXPECT_EQ(test_utils::runProgram(program, engine, optLevel),
+                          answer)
+                    << program << " on " << test_utils::engineName(engine)
+                    << " at -O" << optLevel;
+}
+
+TEST(divisor, MatchesDivision)
+{
+    using AST::detail::Divisor;
+
+    const std::vector<int> values = {0,         1,       -1,          7,
+                                     -7,        65536,   -98765,      123456789,
+                                     INT_MAX,   INT_MIN, INT_MIN + 1, 1000000007};
+
+    for (int divisor = -300; divisor <= 300; ++divisor)
+    {
+        if (!Divisor::usable(divisor))
+            continue;
+
+        const Divisor magic(divisor);
+
+        for (int value : values)
+        {
+            EXPECT_EQ(magic.divide(value), value / divisor);
+            EXPECT_EQ(magic.modulo(value), value % divisor);
+        }
+    }
+}
+
+TEST(simd, KernelsMatchScalar)
+{
+    using AST::detail::Broadcast;
+    using AST::detail::Isa;
+
+    const AST::BinaryOp ops[] = {
+        AST::BinaryOp::ADD,   AST::BinaryOp::SUB,   AST::BinaryOp::MUL,
+        AST::BinaryOp::GR,    AST::BinaryOp::LS,    AST::BinaryOp::EQ,
+        AST::BinaryOp::GR_EQ, AST::BinaryOp::LS_EQ, AST::BinaryOp::NOT_EQ,
+        AST::BinaryOp::AND,   AST::BinaryOp::OR,    AST::BinaryOp::DIV,
+        AST::BinaryOp::MOD};
+    const Broadcast modes[] = {Broadcast::NONE, Broadcast::LEFT,
+                               Broadcast::RIGHT};
+    const std::vector<int> values = {0,  1,       -1,      7,       -7,
+                                     3,  INT_MAX, INT_MIN, 65536,   -98765,
+                                     0,  5,       -3,      INT_MAX, 2};
+
+    std::vector<int> left;
+    std::vector<int> right;
+
+    for (size_t id = 0; id < 37; ++id)
+    {
+        left.push_back(values[id % values.size()]);
+        right.push_back(values[(id * 7 + 3) % values.size()] | 1);
+    }
+
+    for (auto isa = static_cast<int>(Isa::SSE4);
+         isa <= static_cast<int>(AST::detail::supportedIsa()); ++isa)
+        for (const auto op : ops)
+            for (const auto mode : modes)
+                for (size_t count = 0; count <= left.size(); ++count)
+                {
+                    std::vector<int> expected(count);
+                    std::vector<int> actual(count);
+
+                    AST::detail::kernel(op, mode, Isa::SCALAR)(
+                        left.data(), right.data(), expected.data(), count);
+                    AST::detail::kernel(op, mode, static_cast<Isa>(isa))(
+                        left.data(), right.data(), actual.data(), count);
+
+                    EXPECT_EQ(actual, expected);
+                }
+}
+
+TEST(simd, ReductionsMatchScalar)
+{
+    using AST::detail::Isa;
+    using AST::detail::Reduce;
+
+    std::vector<int> data;
+
+    for (int id = 0; id < 37; ++id)
+        data.push_back(id % 5 == 0 ? INT_MAX - id : id * 7919 % 1000 - 500);
+
+    for (auto isa = static_cast<int>(Isa::SSE4);
+         isa <= static_cast<int>(AST::detail::supportedIsa()); ++isa)
+        for (size_t count = 0; count <= data.size(); ++count)
+        {
+            for (const auto reduce : {Reduce::SUM, Reduce::MIN, Reduce::MAX})
+                EXPECT_EQ(AST::detail::reduceKernel(reduce, static_cast<Isa>(isa))(
+                              data.data(), count, 3),
+                          AST::detail::reduceKernel(reduce, Isa::SCALAR)(
+                              data.data(), count, 3));
+
+            std::vector<int> expected(count);
+            std::vector<int> actual(
+                data.begin(), data.begin() + static_cast<std::ptrdiff_t>(count));
+
+            EXPECT_EQ(AST::detail::scanKernel(static_cast<Isa>(isa))(
+                          actual.data(), actual.data(), count, -4),
+                      AST::detail::scanKernel(Isa::SCALAR)(
+                          data.data(), expected.data(), count, -4));
+            EXPECT_EQ(actual, expected);
+        }
+}
+
+TEST(elementwise, ReportsMismatchedSizes)
+{
+    using AST::detail::Array;
+    using AST::detail::Value;
+
+    const Value left(Array(std::vector<int>{3}, std::vector<int>{1, 2, 3}));
+    const Value right(Array(std::vector<int>{2}, std::vector<int>{1, 2}));
+    const Value rows(Array(std::vector<int>{2, 3}, std::vector<int>(6, 1)));
+    const Value columns(Array(std::vector<int>{2, 3}, std::vector<int>(6, 0)));
+
+    EXPECT_THROW(AST::detail::elementwise(AST::BinaryOp::ADD, left, right),
+                 std::runtime_error);
+    EXPECT_THROW(AST::detail::elementwise(AST::BinaryOp::DIV, rows, columns),
+                 std::runtime_error);
+    EXPECT_EQ(AST::detail::elementwise(AST::BinaryOp::MUL, left, Value(2))
+                  .getArray()
+                  ->elements(),
+              (std::vector<int>{2, 4, 6}));
+}
+
+TEST(value, CopyOnWrite)
+{
+    using AST::detail::Array;
+    using AST::detail::Value;
+
+    const int index = 1;
+
+    Value a(Array(Value(7), 3));
+    Value b = a;
+
+    EXPECT_EQ(a.getArray(), b.getArray());
+
+    b.mutableArray()->write(&index, 1, Value(5));
+
+    EXPECT_NE(a.getArray(), b.getArray());
+
+    Value elem;
+
+    a.getArray()->read(&index, 1, elem);
+    EXPECT_EQ(elem.getInt(), 7);
+
+    b.getArray()->read(&index, 1, elem);
+    EXPECT_EQ(elem.getInt(), 5);
+}
+
 TEST(ASTTest, CreateConstant)
 {
     AST::AST ast;
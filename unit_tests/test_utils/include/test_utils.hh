@@ -2,23 +2,97 @@
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
 #include "log.hh"
 #include "test_utils_detail.hh"
 
 namespace test_utils
 {
 
-void run_test(const std::string &test_name)
+void run_test(const std::string &test_name,
+              AST::Engine engine = AST::Engine::INTERPRETER, int optLevel = 1)
 {
     std::string test_folder = "data";
 
     std::string test_path =
         std::string(TEST_DATA_DIR) + test_folder + test_name;
 
-    std::string result = detail::getResult(test_path + ".dat");
+    std::string result = detail::getResult(test_path + ".dat", engine, optLevel);
     std::string answer = detail::getAnswer(test_path + ".ans");
 
     EXPECT_EQ(result, answer);
 }
 
+// Output of a program run on engine, followed by the error that stopped
+// it, if any.
+inline std::string runProgram(const std::string &text,
+                              AST::Engine engine = AST::Engine::INTERPRETER,
+                              int optLevel = 1)
+{
+    const detail::TempPath file;
+
+    std::ofstream(file.path()) << text;
+
+    std::stringstream result;
+
+    Driver drv(result);
+
+    drv.setOptLevel(optLevel);
+
+    try
+    {
+        drv.parse(file.string());
+        drv.eval(engine);
+    }
+    catch (std::runtime_error &e)
+    {
+        result << e.what();
+    }
+
+    return result.str();
+}
+
+// Names of the programs in a data folder that come with an answer.
+inline std::vector<std::string> corpus(const std::string &test_folder)
+{
+    std::vector<std::string> names;
+
+    for (const auto &entry : std::filesystem::directory_iterator(
+             std::string(TEST_DATA_DIR) + "data" + test_folder))
+    {
+        std::filesystem::path answer = entry.path();
+
+        if (entry.path().extension() == ".dat" &&
+            std::filesystem::exists(answer.replace_extension(".ans")))
+            names.push_back(entry.path().stem().string());
+    }
+
+    std::sort(names.begin(), names.end());
+
+    return names;
+}
+
+inline std::string engineName(AST::Engine engine)
+{
+    switch (engine)
+    {
+        case AST::Engine::VM:
+            return "vm";
+        case AST::Engine::FLAT:
+            return "flat";
+        case AST::Engine::IR:
+            return "ir";
+        case AST::Engine::INTERPRETER:
+        default:
+            return "interpreter";
+    }
+}
+
 } // namespace test_utils
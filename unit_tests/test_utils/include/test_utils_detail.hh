@@ -2,8 +2,13 @@
 
 #include "driver.hh"
 
+#include <filesystem>
 #include <fstream>
+#include <random>
 #include <sstream>
+#include <string>
+#include <system_error>
+#include <variant>
 
 #include <gtest/gtest.h>
 
@@ -13,7 +18,9 @@ namespace test_utils
 namespace detail
 {
 
-std::string getResult(std::string_view file_name)
+std::string getResult(std::string_view file_name,
+                      AST::Engine engine = AST::Engine::INTERPRETER,
+                      int optLevel = 1)
 {
     int status = 0;
 
@@ -21,15 +28,55 @@ std::string getResult(std::string_view file_name)
 
     Driver drv(result);
 
+    drv.setOptLevel(optLevel);
+
     status = drv.parse(std::string(file_name));
 
-    drv.eval();
+    drv.eval(engine);
 
     EXPECT_EQ(status, 0);
 
     return result.str();
 }
 
+// A path under the temporary directory named after the running test, with
+// a random part so that parallel runs never share it. Whatever is there is
+// removed with the object.
+class TempPath final
+{
+  private:
+    std::filesystem::path path_;
+
+  public:
+    explicit TempPath(const std::string& suffix = ".dat")
+    {
+        const testing::TestInfo* test =
+            testing::UnitTest::GetInstance()->current_test_info();
+
+        std::string name = "paracl";
+
+        if (test)
+            name = name + "_" + test->test_suite_name() + "_" + test->name();
+
+        path_ = std::filesystem::temp_directory_path() /
+                (name + "_" + std::to_string(std::random_device()()) + suffix);
+    }
+
+    TempPath(const TempPath&) = delete;
+    TempPath& operator=(const TempPath&) = delete;
+
+    ~TempPath()
+    {
+        std::error_code error;
+
+        std::filesystem::remove_all(path_, error);
+    }
+
+    const std::filesystem::path& path() const { return path_; }
+
+    std::string string() const { return path_.string(); }
+};
+
 inline std::string getAnswer(std::string_view file_name)
 {
     std::ifstream answer_file{std::string(file_name)};
@@ -46,6 +93,179 @@ inline std::string getAnswer(std::string_view file_name)
     return answer;
 }
 
+// Shape of the tree under node, to compare what two front ends built.
+inline void dumpTree(std::ostream& os, const AST::INode* node)
+{
+    using namespace AST;
+
+    const auto rhs = [&os](const Rhs& src)
+    {
+        std::visit([&os](auto elem) { dumpTree(os, elem); }, src);
+    };
+
+    const auto lhs = [&os](const Lhs& dest)
+    {
+        std::visit([&os](auto elem) { dumpTree(os, elem); }, dest);
+    };
+
+    if (!node)
+        os << "_";
+    else if (auto scope = dynamic_cast<const ScopeNode*>(node))
+    {
+        os << "{ ";
+
+        for (const auto stm : scope->getChildren())
+        {
+            dumpTree(os, stm);
+            os << "; ";
+        }
+
+        os << "}";
+    }
+    else if (auto constant = dynamic_cast<const ConstantNode*>(node))
+        os << constant->getVal();
+    else if (auto var = dynamic_cast<const VariableNode*>(node))
+        os << var->getName();
+    else if (auto binary = dynamic_cast<const BinaryOpNode*>(node))
+    {
+        os << "(";
+        dumpTree(os, binary->getLeft());
+        os << " op" << static_cast<int>(binary->getOp()) << " ";
+        dumpTree(os, binary->getRight());
+        os << ")";
+    }
+    else if (auto unary = dynamic_cast<const UnaryOpNode*>(node))
+    {
+        os << "(op" << static_cast<int>(unary->getOp()) << " ";
+        dumpTree(os, unary->getOperand());
+        os << ")";
+    }
+    else if (auto init = dynamic_cast<const ArrayInitNode*>(node))
+    {
+        os << "array(";
+
+        for (size_t id = 0; id < init->arraySize(); ++id)
+        {
+            dumpTree(os, init->getElem(id));
+            os << ", ";
+        }
+
+        os << ")";
+    }
+    else if (auto repeat = dynamic_cast<const RepeatNode*>(node))
+    {
+        os << "repeat(";
+        rhs(repeat->getElem());
+        os << ", ";
+        dumpTree(os, repeat->getSize());
+        os << ")";
+    }
+    else if (auto elem = dynamic_cast<const ArrayElemNode*>(node))
+    {
+        if (elem->holdsVariable())
+            dumpTree(os, elem->getVariable());
+        else
+            dumpTree(os, elem->getArrayElem());
+
+        os << "[";
+        dumpTree(os, elem->getIndex());
+        os << "]";
+    }
+    else if (auto assign = dynamic_cast<const AssignNode*>(node))
+    {
+        os << "(";
+        lhs(assign->getDest());
+        os << " = ";
+        rhs(assign->getSrc());
+        os << ")";
+    }
+    else if (auto loop = dynamic_cast<const WhileNode*>(node))
+    {
+        if (auto pfor = dynamic_cast<const PforNode*>(node))
+        {
+            os << "pfor";
+
+            for (const auto name : pfor->getReductions())
+                os << " " << name;
+        }
+        else
+            os << "while";
+
+        os << "@" << loop->getLine() << " (";
+        dumpTree(os, loop->getCond());
+        os << ") ";
+        dumpTree(os, loop->getScope());
+    }
+    else if (auto branch = dynamic_cast<const IfElseNode*>(node))
+    {
+        os << "if (";
+        dumpTree(os, branch->getCond());
+        os << ") ";
+        dumpTree(os, branch->getAction());
+        os << " else ";
+        dumpTree(os, branch->getAltAction());
+    }
+    else if (auto print = dynamic_cast<const PrintNode*>(node))
+    {
+        os << "print ";
+        dumpTree(os, print->getExpr());
+    }
+    else if (dynamic_cast<const InNode*>(node))
+        os << "?";
+    else
+        os << "unknown";
+}
+
+// Tree the front end builds from a file, or "error" when it rejects it.
+inline std::string getTree(const std::string& file_name,
+                           AST::Frontend frontend)
+{
+    Driver drv;
+
+    drv.setFrontend(frontend);
+
+    try
+    {
+        drv.parse(file_name);
+    }
+    catch (std::runtime_error&)
+    {
+        return "error";
+    }
+
+    std::stringstream tree;
+
+    dumpTree(tree, drv.getGlobalScope());
+
+    return tree.str();
+}
+
+// Output of the file run as it is parsed, followed by the error that
+// stopped it, if any.
+inline std::string getStreamedResult(const std::string& file_name,
+                                     int optLevel = 1,
+                                     AST::Frontend frontend =
+                                         AST::Frontend::BISON)
+{
+    std::stringstream result;
+
+    Driver drv(result);
+
+    drv.setOptLevel(optLevel);
+    drv.setFrontend(frontend);
+
+    try
+    {
+        EXPECT_EQ(drv.stream(file_name), 0);
+    }
+    catch (std::runtime_error& e)
+    {
+        result << e.what();
+    }
+
+    return result.str();
+}
+
 }; // namespace detail
 
 }; // namespace test_utils